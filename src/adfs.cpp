@@ -190,7 +190,7 @@ int adfs::lib(const char *objspec) {
 
 int adfs::mount(const char *objspec, const char *discname) {
 	int i, handle;
-	FSDirectory adfsdir;
+	ADFSDirectory adfsdir;
 
 	/* Temporary code to prevent -Wunused-parameter for now */
 	printf("%s\n", discname);
@@ -199,7 +199,7 @@ int adfs::mount(const char *objspec, const char *discname) {
 		return (0x000000D6);
 	}
 
-	if ((adfsdisc.dir[0] = (FSDirectory *) malloc(1 * sizeof(adfsdir))) == NULL) {
+	if ((adfsdisc.dir[0] = (ADFSDirectory *) malloc(1 * sizeof(adfsdir))) == NULL) {
 		fclose(adfsdisc.fp);
 //		errorHandler(0xFFFFFFFF, "adfs::mount: allocation error");
 		return (0xFFFFFFFF);
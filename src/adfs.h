@@ -13,6 +13,12 @@
 
 #include "netfs.h"			// FSAttributes, FSObject
 
+#define ADFS_MAX_DIRENTRIES	47	// An ADFS directory has room for 47 objects
+
+typedef struct {
+	FSObject	fsp[ADFS_MAX_DIRENTRIES];
+} ADFSDirectory;
+
 typedef struct {
 	FILE *fp;
 	struct {
@@ -22,7 +28,7 @@ typedef struct {
 	uint32_t		totalsectors;	/* Total number of sectors on disc (3 bytes) */
 	uint16_t		discidentifier;	/* Disc identifier (2 bytes) */
 	uint8_t			bootoption;	/* Boot option (1 byte) */
-	FSDirectory		**dir;		/* Pointer to directory's (0 = root dir) */
+	ADFSDirectory		**dir;		/* Pointer to directory's (0 = root dir) */
 	uint8_t			msn;			/* Master sequence number (1 byte) */
 	unsigned char		dirtitle[19];		/* Directory title (19 bytes) */
 	unsigned char		dirname[10];		/* TODO: find out if this is really part of the ADFS directory structure */
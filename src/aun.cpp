@@ -6,16 +6,26 @@
 
 #include <cstdlib>		// strtol()
 #include <cstring>		// memset() and memcpy()
+#include <atomic>		// std::atomic
+#include <mutex>		// std::once_flag, std::call_once(), std::mutex
 #include <unistd.h>		// close()
+#include <sys/uio.h>		// struct iovec
+#include <net/if.h>		// if_nametoindex()
+#include <netinet/in.h>		// struct ip_mreqn, struct ipv6_mreq, IN_MULTICAST()
 
 #include "aun.h"		// Header file for this code
+#include "bridge.h"		// bridge::acquire(), bridge::submit(), bridge::drop()
 #include "cli.h"		// netmonPrintFrame()
 #include "econet.h"		// econet::Frame
 #include "errorhandler.h"	// errorHandler::errorMessages[]
 #include "main.h"		// Included for bye variable
 #include "netfs.h"
+#include "peers.h"		// peers::learn(), peers::find(), peers::lookup(), peers::visit()
+#include "ratelimit.h"		// ratelimit::allow(), ratelimit::allowUnknown()
+#include "routes.h"		// routes::forward(), routes::trusted()
 #include "settings.h"		// Global configuration variables are defined here
 #include "stations.h"		// stations::stations[][]
+#include "workers.h"		// workers::dispatch(), workers::call(), workers::current
 #if (FILESTORE_WITHOPENSSL == 1)
 #include "dtls/dtls.h"		// All functions for DTLS (Datagram TLS)
 #endif
@@ -25,58 +35,415 @@ using namespace std;
 
 
 namespace aun {
+	/* A broadcast which is sent to every learned station */
+	typedef struct {
+		econet::Frame	*frame;
+		unsigned int	length;
+	} Broadcast;
+
 	char straddr[INET6_ADDRSTRLEN];
 
-	int transmitFrame(econet::Frame *frame, unsigned int tx_length) {
-		char ipstr[256];
-		int n, s;
+	std::atomic<uint32_t>	tx_sequence(0);			// Sequence number of the last frame we've sent to an AUN station
+	int			tx_sock[2] = {-1, -1};		// Transmit sockets for IPv4 and IPv6, shared by all threads
+	std::once_flag		tx_sock_once[2];
+	std::mutex		multicast_lock;			// Protects mc_sock and mc_addr
+	int			mc_sock = -1;			// Transmit socket for broadcasts to the multicast group, or -1 if not used
+	struct sockaddr_storage	mc_addr;			// Multicast group and port
+	socklen_t		mc_addrlen;
+	std::mutex		bridged_lock;			// Makes the workers take turns as the single producer of the AUN-RX pipe
+
+	/* Open the transmit socket for IPv4 (0) or IPv6 (1) */
+	void openTransmitSocket(int i) {
+		if ((tx_sock[i] = socket((i == 0) ? AF_INET : AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) == -1)
+			fprintf(stderr, "aun::openTransmitSocket: socket() failed.\n");
+	}
+
+	/* Get the transmit socket for an address family; it's only opened once */
+	int transmitSocket(int family) {
+		int i = (family == AF_INET6) ? 1 : 0;
+
+		std::call_once(tx_sock_once[i], openTransmitSocket, i);
+		return tx_sock[i];
+	}
+
+	/* Transmit one datagram which is gathered from several buffers on a socket */
+	int sendVector(int sock, const struct sockaddr *addr, socklen_t addrlen, struct iovec *iov, int iovcnt) {
+		struct msghdr msg;
+
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name	= (void *) addr;
+		msg.msg_namelen	= addrlen;
+		msg.msg_iov	= iov;
+		msg.msg_iovlen	= iovcnt;
+
+		if (sendmsg(sock, &msg, 0) == -1) {
+			fprintf(stderr, "aun::sendVector: sendmsg() failed.\n");
+			return(-3);
+		}
+		return(0);
+	}
+
+	/* Transmit one datagram which is gathered from several buffers on the shared transmit socket */
+	int transmitVector(const struct sockaddr *addr, socklen_t addrlen, struct iovec *iov, int iovcnt) {
+		int sock;
+
+		if ((sock = transmitSocket(addr->sa_family)) == -1)
+			return(-1);
+
+		return sendVector(sock, addr, addrlen, iov, iovcnt);
+	}
+
+	/* Send broadcasts to a multicast group instead of to every station; group is NULL to switch it off */
+	int setMulticast(const char *group, const char *interface) {
+		struct sockaddr_in *addr4 = (struct sockaddr_in *) &mc_addr;
+		struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *) &mc_addr;
+		struct ip_mreqn mreq;
+		unsigned int ifindex;
+		int loop, hops;
+
+		std::lock_guard<std::mutex> lock(multicast_lock);
+
+		if (mc_sock != -1) {
+			close(mc_sock);
+			mc_sock = -1;
+		}
+		if (group == NULL)
+			return(0);
+
+		ifindex = 0;
+		if ((interface != NULL) && ((ifindex = if_nametoindex(interface)) == 0)) {
+			fprintf(stderr, "aun::setMulticast: unknown interface %s\n", interface);
+			return(-2);
+		}
+
+		memset(&mc_addr, 0, sizeof(mc_addr));
+		if ((inet_pton(AF_INET, group, &addr4->sin_addr) == 1) && (IN_MULTICAST(ntohl(addr4->sin_addr.s_addr)))) {
+			addr4->sin_family = AF_INET;
+			addr4->sin_port = htons(settings::aun_port);
+			mc_addrlen = sizeof(struct sockaddr_in);
+		} else if ((inet_pton(AF_INET6, group, &addr6->sin6_addr) == 1) && (IN6_IS_ADDR_MULTICAST(&addr6->sin6_addr))) {
+			addr6->sin6_family = AF_INET6;
+			addr6->sin6_port = htons(settings::aun_port);
+			mc_addrlen = sizeof(struct sockaddr_in6);
+		} else {
+			fprintf(stderr, "aun::setMulticast: %s is not a multicast group\n", group);
+			return(-2);
+		}
+
+		if ((mc_sock = socket(mc_addr.ss_family, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
+			fprintf(stderr, "aun::setMulticast: socket() failed.\n");
+			return(-1);
+		}
+
+		/* Send on the configured interface, don't receive our own broadcasts back and keep them on the local network */
+		loop = 0;
+		hops = settings::multicast_ttl;
+		if (mc_addr.ss_family == AF_INET6) {
+			if ((setsockopt(mc_sock, IPPROTO_IPV6, IPV6_MULTICAST_IF, &ifindex, sizeof(ifindex)) == -1) ||
+			    (setsockopt(mc_sock, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop)) == -1) ||
+			    (setsockopt(mc_sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops)) == -1)) {
+				fprintf(stderr, "aun::setMulticast: setsockopt() failed.\n");
+				close(mc_sock);
+				mc_sock = -1;
+				return(-1);
+			}
+		} else {
+			memset(&mreq, 0, sizeof(mreq));
+			mreq.imr_ifindex = ifindex;
+			if ((setsockopt(mc_sock, IPPROTO_IP, IP_MULTICAST_IF, &mreq, sizeof(mreq)) == -1) ||
+			    (setsockopt(mc_sock, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) == -1) ||
+			    (setsockopt(mc_sock, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof(hops)) == -1)) {
+				fprintf(stderr, "aun::setMulticast: setsockopt() failed.\n");
+				close(mc_sock);
+				mc_sock = -1;
+				return(-1);
+			}
+		}
+
+		printf("- Sending broadcasts to multicast group %s:%i\n", group, settings::aun_port);
+		return(0);
+	}
+
+	/* Join the multicast group on a listener socket, so we receive the broadcasts of stations which use it */
+	void joinMulticast(int sock, int family) {
+		struct ip_mreqn mreq;
+		struct ipv6_mreq mreq6;
+		unsigned int ifindex;
+
+		std::lock_guard<std::mutex> lock(multicast_lock);
+
+		if ((mc_sock == -1) || (mc_addr.ss_family != family))
+			return;
+
+		ifindex = (settings::multicast_interface != NULL) ? if_nametoindex((const char *) settings::multicast_interface) : 0;
+		if (family == AF_INET6) {
+			mreq6.ipv6mr_multiaddr = ((struct sockaddr_in6 *) &mc_addr)->sin6_addr;
+			mreq6.ipv6mr_interface = ifindex;
+			if (setsockopt(sock, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, &mreq6, sizeof(mreq6)) == -1)
+				fprintf(stderr, "aun::joinMulticast: setsockopt(IPV6_ADD_MEMBERSHIP) failed.\n");
+		} else {
+			memset(&mreq, 0, sizeof(mreq));
+			mreq.imr_multiaddr = ((struct sockaddr_in *) &mc_addr)->sin_addr;
+			mreq.imr_ifindex = ifindex;
+			if (setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+				fprintf(stderr, "aun::joinMulticast: setsockopt(IP_ADD_MEMBERSHIP) failed.\n");
+		}
+	}
+
+	/* Get the address of a station in !Stations or a learned station */
+	bool stationAddress(int n, int s, struct sockaddr_storage *addr, socklen_t *addrlen) {
+		struct sockaddr_in *addr4 = (struct sockaddr_in *) addr;
+		struct sockaddr_in6 *addr6 = (struct sockaddr_in6 *) addr;
+
+		memset(addr, 0, sizeof(struct sockaddr_storage));
+		switch (stations::stations[n][s].type) {
+			case STATION_IPV4 :
+				addr4->sin_family	= AF_INET;
+				addr4->sin_port		= htons(stations::stations[n][s].port);
+				addr4->sin_addr		= stations::stations[n][s].ipv4;
+				*addrlen = sizeof(struct sockaddr_in);
+				return true;
+
+			case STATION_IPV6 :
+				addr6->sin6_family	= AF_INET6;
+				addr6->sin6_port	= htons(stations::stations[n][s].port);
+				addr6->sin6_addr	= stations::stations[n][s].ipv6;
+				*addrlen = sizeof(struct sockaddr_in6);
+				return true;
+
+			case STATION_UNUSED :
+				if (peers::lookup(n, s, addr) == false)
+					return false;
+				*addrlen = (addr->ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+				return true;
+
+			default :
+				return false;
+		}
+	}
+
+	/* Build the AUN header of an Econet frame in header, and point iov at the header and the payload */
+	void buildHeader(econet::Frame *frame, unsigned int tx_length, uint8_t *header, struct iovec *iov) {
+		uint32_t sequence;
+
+		if ((frame->econet.dst_network == 0xFF) && (frame->econet.dst_station == 0xFF))
+			header[0] = AUN_BROADCAST;
+		else if (frame->rawdata[5] == 0x00)
+			header[0] = AUN_IMMEDIATE;
+		else
+			header[0] = AUN_UNICAST;
+		header[1] = frame->rawdata[5];			// Port
+		header[2] = frame->rawdata[4] & 0x7F;		// Control byte; AUN doesn't transmit the top bit
+		header[3] = 0;					// Retry
+		sequence = (tx_sequence += 4);
+		header[4] = (sequence & 0x000000FF);		// Sequence number LSB
+		header[5] = (sequence & 0x0000FF00) >> 8;
+		header[6] = (sequence & 0x00FF0000) >> 16;
+		header[7] = (sequence & 0xFF000000) >> 24;	// Sequence number MSB
+
+		iov[0].iov_base	= header;
+		iov[0].iov_len	= AUN_HEADER_LENGTH;
+		iov[1].iov_base	= &frame->rawdata[6];
+		iov[1].iov_len	= tx_length - 6;
+
+		if (econet::netmon)
+			netmonPrintFrame("eth", true, frame, tx_length);
+	}
+
+	/* Transmit an Econet frame to an AUN station. The AUN header is built in a separate buffer and the
+	 * payload is sent straight out of the frame, so the frame itself is never copied. */
+	int transmitAUN(const struct sockaddr_storage *addr, socklen_t addrlen, econet::Frame *frame, unsigned int tx_length) {
+		uint8_t header[AUN_HEADER_LENGTH];
+		struct iovec iov[2];
+
+		/* Acks and scouts only exist on the Econet itself */
+		if (tx_length < 6)
+			return(0);
+
+		buildHeader(frame, tx_length, header, iov);
+		return transmitVector((const struct sockaddr *) addr, addrlen, iov, 2);
+	}
+
+	/* Transmit a broadcast once to the multicast group; returns false if multicast isn't used */
+	bool transmitMulticast(econet::Frame *frame, unsigned int tx_length) {
+		uint8_t header[AUN_HEADER_LENGTH];
+		struct iovec iov[2];
+
+		std::lock_guard<std::mutex> lock(multicast_lock);
+
+		if (mc_sock == -1)
+			return false;
+
+		if (tx_length >= 6) {
+			buildHeader(frame, tx_length, header, iov);
+			sendVector(mc_sock, (const struct sockaddr *) &mc_addr, mc_addrlen, iov, 2);
+		}
+		return true;
+	}
 
-		for (n = 1; n < 127; n++) {
-			for (s = 1; s < 255; s++) {
-				switch (stations::stations[n][s].type) {
-					case STATION_IPV4 :
-						inet_ntop(AF_INET, &stations::stations[n][s].ipv4, ipstr, sizeof(ipstr));
-						if (strlen(stations::stations[n][s].fingerprint) == 0) {
-							aun::ipv4_aun_Transmit(ipstr, stations::stations[n][s].port, frame, tx_length);
 #if (FILESTORE_WITHOPENSSL == 1)
-						} else {
-							aun::ipv4_dtls_Transmit(ipstr, stations::stations[n][s].port, frame, tx_length);
-#endif
-						}
-						break;
+	/* Transmit a frame to a station in !Stations which uses DTLS */
+	void transmitDTLS(int n, int s, econet::Frame *frame, unsigned int tx_length) {
+		char ipstr[256];
+
+		switch (stations::stations[n][s].type) {
+			case STATION_IPV4 :
+				inet_ntop(AF_INET, &stations::stations[n][s].ipv4, ipstr, sizeof(ipstr));
+				aun::ipv4_dtls_Transmit(ipstr, stations::stations[n][s].port, frame, tx_length);
+				break;
 
 #if (FILESTORE_WITHIPV6 == 1)
-					case STATION_IPV6 :
-						inet_ntop(AF_INET6, &stations::stations[n][s].ipv6, ipstr, sizeof(ipstr));
-						if (strlen(stations::stations[n][s].fingerprint) == 0) {
-							aun::ipv6_aun_Transmit(ipstr, stations::stations[n][s].port, frame, tx_length);
-#if (FILESTORE_WITHOPENSSL == 1)
-						} else {
-							aun::ipv6_dtls_Transmit(ipstr, stations::stations[n][s].port, frame, tx_length);
+			case STATION_IPV6 :
+				inet_ntop(AF_INET6, &stations::stations[n][s].ipv6, ipstr, sizeof(ipstr));
+				aun::ipv6_dtls_Transmit(ipstr, stations::stations[n][s].port, frame, tx_length);
+				break;
 #endif
-						}
-						break;
+			default :
+				break;
+		}
+	}
 #endif
-					default :
-						break;
-				}
+
+	/* Transmit a frame to one station, which is either in !Stations or learned */
+	int transmitTo(int n, int s, econet::Frame *frame, unsigned int tx_length) {
+		struct sockaddr_storage addr;
+		socklen_t addrlen;
+
+		if (n == 0)
+			n = settings::aun_network;
+		if ((n > 126) || (s > 254))
+			return -1;
+
+#if (FILESTORE_WITHOPENSSL == 1)
+		if ((stations::stations[n][s].type != STATION_UNUSED) && (strlen(stations::stations[n][s].fingerprint) != 0)) {
+			transmitDTLS(n, s, frame, tx_length);
+			return 0;
+		}
+#endif
+		if (stationAddress(n, s, &addr, &addrlen) == false)
+			return -1;
+		return transmitAUN(&addr, addrlen, frame, tx_length);
+	}
+
+	/* Transmit a frame for another network to the bridge at n:s, with its Econet addresses in front of the payload */
+	int transmitBridged(int n, int s, econet::Frame *frame, unsigned int tx_length) {
+		struct sockaddr_storage addr;
+		socklen_t addrlen;
+		uint8_t header[AUN_HEADER_LENGTH];
+		uint8_t addresses[4];
+		struct iovec iov[3];
+
+		if (tx_length < 6)
+			return(0);
+		if (n == 0)
+			n = settings::aun_network;
+		if ((n > 126) || (s > 254))
+			return -1;
+		if (stationAddress(n, s, &addr, &addrlen) == false)
+			return -1;
+
+		/* A frame from the local Econet has source network 0, which the receiving bridge can't check */
+		memcpy(addresses, frame->rawdata, 4);
+		if (addresses[2] == 0)
+			addresses[2] = settings::econet_network;
+
+		buildHeader(frame, tx_length, header, iov);
+		header[0] = AUN_BRIDGED;
+		iov[2] = iov[1];
+		iov[1].iov_base	= addresses;
+		iov[1].iov_len	= 4;
+		return transmitVector((const struct sockaddr *) &addr, addrlen, iov, 3);
+	}
+
+	/* Send a broadcast to a learned station; called by peers::visit() */
+	void transmitLearned(const peers::Peer *peer, void *context) {
+		const Broadcast *broadcast = (const Broadcast *) context;
+		socklen_t addrlen;
+
+		addrlen = (peer->addr.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+		transmitAUN(&peer->addr, addrlen, broadcast->frame, broadcast->length);
+	}
+
+	int transmitFrame(econet::Frame *frame, unsigned int tx_length) {
+		Broadcast broadcast;
+		int n, s;
+		bool multicast;
+
+		n = frame->econet.dst_network;
+		s = frame->econet.dst_station;
+
+		/* Unicast frame: look up the destination station directly */
+		if ((n != 0xFF) || (s != 0xFF))
+			return transmitTo(n, s, frame, tx_length);
+
+		/* Broadcast frame: send it to the multicast group once if that's configured. Stations which can't receive
+		 * it (marked UNICAST in !Stations, or using DTLS) and learned stations still get their own copy. */
+		multicast = transmitMulticast(frame, tx_length);
+		for (n = 1; n < 127; n++) {
+			for (s = 1; s < 255; s++) {
+				if ((stations::stations[n][s].type != STATION_IPV4) && (stations::stations[n][s].type != STATION_IPV6))
+					continue;
+				if ((multicast == true) && (stations::stations[n][s].unicast == false) && (strlen(stations::stations[n][s].fingerprint) == 0))
+					continue;
+				transmitTo(n, s, frame, tx_length);
 			}
 		}
 
+		/* Straight from the cache of learned stations, instead of copying all of it onto the stack */
+		broadcast.frame = frame;
+		broadcast.length = tx_length;
+		peers::visit(transmitLearned, &broadcast);
+
 		return 0;
 	}
 
-	/* Periodically check if we've received an Econet network package */
+	/* Only learn stations from frames which carry a valid AUN header */
+	bool learnable(const econet::Frame *frame, int length) {
+		if (length < 8)
+			return false;
+		if ((frame->aun.type < AUN_BROADCAST) || (frame->aun.type > AUN_IMMEDIATE_REPLY))
+			return false;
+		return true;
+	}
+
+	/* Find the station which sent a received frame and check its rate limit; returns false if the frame must be dropped */
+	bool admit(Job *job, const econet::Frame *frame, int length) {
+		const struct sockaddr *addr = (const struct sockaddr *) &job->addr;
+
+		if (stations::findStation(addr, &job->network, &job->station) == true)
+			return ratelimit::allow(job->network, job->station, length);
+
+		if (peers::find(addr, &job->network, &job->station) == true) {
+			if (ratelimit::allow(job->network, job->station, length) == false)
+				return false;
+			/* Keep the learned station from being aged out */
+			peers::learn(addr, &job->network, &job->station);
+			return true;
+		}
+
+		/* Unknown source: rate limit it before spending any work (or a peer entry) on learning it */
+		job->network = 0;
+		job->station = 0;
+		if (ratelimit::allowUnknown(addr, length) == false)
+			return false;
+
+		/* Learn the station from this frame if autolearning is on */
+		if ((settings::autolearn == 0) || (learnable(frame, length) == false) || (peers::learn(addr, &job->network, &job->station) == false)) {
+			job->network = 0;
+			job->station = 0;
+		}
+		return true;
+	}
+
 	int ipv4_aun_Listener(void) {
-		econet::Frame rx_data, tx_data, ack;
-		int rx_length, tx_length;
+		econet::Frame *rx_data;
+		int rx_length;
 		int reuseconn;
 		int rx_sock;
-		bool sendAck;
+		Job job;
 
-		struct sockaddr_in addr_me, addr_incoming;
+		struct sockaddr_in addr_me;
 		struct timeval timeout;
-		socklen_t slen = sizeof(addr_incoming);
 
 		if ((rx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
 			fprintf(stderr, "aun::ipv4_aun_Listener: socket() failed.\n");
@@ -110,50 +477,45 @@ namespace aun {
 			fprintf(stderr, "aun::ipv4_aun_Listener: Error on bind.\n");
 			return -1;
 		}
+		joinMulticast(rx_sock, AF_INET);
 
 		printf("- Listening for UDP4 connections on %s:%i\n", inet_ntoa(addr_me.sin_addr), settings::aun_port);
 		fflush(stdout);
+		rx_data = new econet::Frame;
 		while (bye == false) {
-			if ((rx_length = recvfrom(rx_sock, (econet::Frame *) &rx_data, sizeof(rx_data), 0, (struct sockaddr *) &addr_incoming, &slen)) > 0) {
+			job.addrlen = sizeof(job.addr);
+			if ((rx_length = recvfrom(rx_sock, (econet::Frame *) rx_data, sizeof(econet::Frame), 0, (struct sockaddr *) &job.addr, &job.addrlen)) > 0) {
+				/* Drop frames from sources which exceed their rate limit before doing any work on them */
+				if (admit(&job, rx_data, rx_length) == false)
+					continue;
+
 				if (econet::netmon == true) {
-					netmonPrintFrame("eth", false, &rx_data, rx_length);
+					netmonPrintFrame("eth", false, rx_data, rx_length);
 				}
-				tx_length = rxHandler(&rx_data, rx_length, &tx_data, sizeof(tx_data), &sendAck);
-				if (sendAck) {
-					if ((prepareAckPackage(&rx_data, rx_length, &ack, sizeof(ack))) > 0) {
-						if (sendto(rx_sock, (char *) &ack, 8, 0, (struct sockaddr *) &addr_incoming, slen) == -1) {
-							fprintf(stderr, "aun::ipv4_aun_Listener: sendto() ACK failed.\n");
-						}
-					} else {
-						fprintf(stderr, "aun::ipv4_aun_Listener: prepareAckPackage() failed.\n");
-					}
-				}
-				if (tx_length > 0) {
-					if (econet::netmon == true) {
-						netmonPrintFrame("eth", true, &tx_data, tx_length);
-					}
-					if (sendto(rx_sock, (char *) &tx_data, tx_length, 0, (struct sockaddr *) &addr_incoming, slen) == -1) {
-						fprintf(stderr, "aun::ipv4_aun_Listener: sendto() data failed.\n");
-					} // TODO: Wait for receive ack, or open session which closes on receive ack
+
+				/* Hand the frame over to the worker which owns the sending station */
+				job.frame = rx_data;
+				job.length = rx_length;
+				job.sock = rx_sock;
+				job.reply = NULL;
+				if (workers::dispatch(&job) == true) {
+					/* The worker owns the frame now, so receive the next frame into a new buffer */
+					rx_data = new econet::Frame;
 				}
 			} else {
 				/* Ease down on the CPU when polling the network */
 //				usleep(10000);
 			}
 		}
+		delete rx_data;
 		printf("- Listener stopped on %s:%i\n", inet_ntoa(addr_me.sin_addr), settings::aun_port);
 		return 0;
 	}
 
 	int ipv4_aun_Transmit(const char *address, unsigned short port, econet::Frame *frame, size_t tx_length) {
 		struct sockaddr_in addr_outgoing;
-		int tx_sock, slen = sizeof(addr_outgoing);
- 
-		if ((tx_sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
-			fprintf(stderr, "aun::ipv4_aun_Transmit: socket() failed.\n");
-			return(-1);
-		}
- 
+		struct iovec iov;
+
 		bzero(&addr_outgoing, sizeof(addr_outgoing));
 //		memset((char *) &addr_outgoing, 0, sizeof(addr_outgoing));
 		addr_outgoing.sin_family	= AF_INET;
@@ -167,12 +529,10 @@ namespace aun {
 		if (econet::netmon)
 			netmonPrintFrame("eth", true, frame, tx_length);
 
-		if (sendto(tx_sock, (char *) &frame, sizeof(frame), 0, (struct sockaddr *) &addr_outgoing, slen) == -1) {
-			fprintf(stderr, "aun::ipv4_aun_Transmit: sendto() failed.\n");
-			return(-3);
-		}
-//		close(tx_sock);
-		return(0);
+		/* Only send the bytes of the frame which are in use */
+		iov.iov_base	= frame->rawdata;
+		iov.iov_len	= tx_length;
+		return transmitVector((struct sockaddr *) &addr_outgoing, sizeof(addr_outgoing), &iov, 1);
 	}
 
 #if (FILESTORE_WITHOPENSSL == 1)
@@ -190,7 +550,7 @@ namespace aun {
 		server.ca		= NULL;
 		server.cert		= "./server-cert.pem";
 		server.privkey		= "./server-key.pem";
-		server.rxhandler	= aun::rxHandler;		/* Handler for received data */
+		server.rxhandler	= aun::dtlsHandler;		/* Handler for received data */
 
 		if (dtls::ssl_initialize(&server) != 0) {
 			fprintf(stderr, "aun::ipv4_dtls_Listener: dtls::ssl_initialize() failed\n");
@@ -270,18 +630,38 @@ namespace aun {
 		return(rx_length);
 	}
 #endif
+
+	/* Forwarding stage of the bridge: handle one frame which was received from an AUN station, or forwarded to us by another bridge */
+	void handleFrame(econet::Frame *frame, int size) {
+		if (econet::validateFrame(frame, size)) {
+			if (frame->flags & ECONET_FRAME_TOLOCAL) {
+				/* Frame is addressed to a station on our local network */
+				if (frame->flags & ECONET_FRAME_TOME) {
+					/* Frame is addressed to us */
+					econet::processFrame(frame, size);
+				} else {
+					/* Frame is addressed to a station on our local network */
+//					frame->data[0] = 0x00; // Set destination network to local network
+					econet::transmitFrame(frame, size);
+				}
+			} else {
+				/* Frame is addressed to a station on another network: forward it to the next hop */
+				routes::forward(frame, size, ROUTE_AUN);
+			}
+		}
+	}
+
 #if (FILESTORE_WITHIPV6 == 1)
 	/* Periodically check if we've received an Econet network package */
 	int ipv6_aun_Listener(void) {
 		int reuseconn;
 		int rx_sock;
 		int rx_length;
-		econet::Frame frame;
-		bool valid;
+		econet::Frame *rx_data;
+		Job job;
 
-		struct sockaddr_in6 addr_me, addr_incoming;
+		struct sockaddr_in6 addr_me;
 		struct timeval timeout;
-		socklen_t slen = sizeof(addr_incoming);
 
 		if ((rx_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
 			fprintf(stderr, "aun::ipv6_aun_Listener: socket() failed.\n");
@@ -315,55 +695,45 @@ namespace aun {
 			fprintf(stderr, "aun::ipv6_aun_Listener: Error on bind.\n");
 			return -1;
 		}
+		joinMulticast(rx_sock, AF_INET6);
 
 		printf("- Listening for UDP6 connections on [%s]:%i\n", inet_ntop(AF_INET6, &addr_me.sin6_addr, straddr, sizeof(straddr)), settings::aun_port); 
 		fflush(stdout);
+		rx_data = new econet::Frame;
 		while (bye == false) {
-			if ((rx_length = recvfrom(rx_sock, (econet::Frame *) &frame, sizeof(frame), 0, (struct sockaddr *) &addr_incoming, &slen)) > 0) {
-				valid = econet::validateFrame(&frame, rx_length);
+			job.addrlen = sizeof(job.addr);
+			if ((rx_length = recvfrom(rx_sock, (econet::Frame *) rx_data, sizeof(econet::Frame), 0, (struct sockaddr *) &job.addr, &job.addrlen)) > 0) {
+				/* Drop frames from sources which exceed their rate limit before doing any work on them */
+				if (admit(&job, rx_data, rx_length) == false)
+					continue;
+
 				if (econet::netmon == true) {
-					netmonPrintFrame("eth", false, &frame, rx_length);
+					netmonPrintFrame("eth", false, rx_data, rx_length);
 				}
-				if (valid) {
-					if (frame.flags || ECONET_FRAME_TOLOCAL) {
-						/* Frame is addressed to a station on our local network */
-						if (frame.flags || ECONET_FRAME_TOME) {
-							/* Frame is addressed to us */
-							econet::processFrame(&frame, rx_length);
-						} else {
-							/* Frame is addressed to a station on our local network */
-//							frame.data[0] = 0x00; // Set destination network to local network
-							econet::transmitFrame((econet::Frame *) &frame, rx_length);
-						}
-					} else {
-						/* Frame is addressed to a station on another network */
-//						if ((configuration::relay_only_known_networks) && (econet::known_networks[frame.dst_network].network == 0)) {
-							/* Don't relay the frame, but reply with ICMP 3.0: Destination network unknown */
-//							ethernet::send ICMP 3.0: Destination network unknown
-//						} else {
-							/* Relay frame to other known network(s) */
-							econet::transmitFrame((econet::Frame *) &frame, rx_length);
-//						}
-					}
+
+				/* Hand the frame over to the worker which owns the sending station */
+				job.frame = rx_data;
+				job.length = rx_length;
+				job.sock = rx_sock;
+				job.reply = NULL;
+				if (workers::dispatch(&job) == true) {
+					/* The worker owns the frame now, so receive the next frame into a new buffer */
+					rx_data = new econet::Frame;
 				}
 			} else {
 				/* Ease down on the CPU when polling the network */
 //				usleep(10000);
 			}
 		}
+		delete rx_data;
 		printf("- Listener stopped on [%s]:%i\n", inet_ntop(AF_INET6, &addr_me.sin6_addr, straddr, sizeof(straddr)), settings::aun_port);
 		return 0;
 	}
 
 	int ipv6_aun_Transmit(const char *address, unsigned short port, econet::Frame *frame, size_t tx_length) {
 		struct sockaddr_in6 addr_outgoing;
-		int tx_sock, slen = sizeof(addr_outgoing);
- 
-		if ((tx_sock = socket(AF_INET6, SOCK_DGRAM, IPPROTO_UDP)) == -1) {
-			fprintf(stderr, "aun::ipv6_aun_Transmit: socket() failed.\n");
-			return(-1);
-		}
- 
+		struct iovec iov;
+
 		bzero(&addr_outgoing, sizeof(addr_outgoing));
 //		memset((char *) &addr_outgoing, 0, sizeof(addr_outgoing));
 		addr_outgoing.sin6_family	= AF_INET6;
@@ -377,12 +747,10 @@ namespace aun {
 		if (econet::netmon)
 			netmonPrintFrame("eth", true, frame, tx_length);
 
-		if (sendto(tx_sock, (char *) &frame, sizeof(frame), 0, (struct sockaddr *) &addr_outgoing, slen) == -1) {
-			fprintf(stderr, "aun::ipv6_aun_Transmit: sendto() failed.\n");
-			return(-3);
-		}
-//		close(tx_sock);
-		return(0);
+		/* Only send the bytes of the frame which are in use */
+		iov.iov_base	= frame->rawdata;
+		iov.iov_len	= tx_length;
+		return transmitVector((struct sockaddr *) &addr_outgoing, sizeof(addr_outgoing), &iov, 1);
 	}
 
 #if (FILESTORE_WITHOPENSSL == 1)
@@ -400,7 +768,7 @@ namespace aun {
 		server.ca		= NULL;
 		server.cert		= "./server-cert.pem";
 		server.privkey		= "./server-key.pem";
-		server.rxhandler	= aun::rxHandler;		/* Handler for received data */
+		server.rxhandler	= aun::dtlsHandler;		/* Handler for received data */
 
 		if (dtls::ssl_initialize(&server) != 0) {
 			fprintf(stderr, "aun::ipv6_dtls_Listener: dtls::ssl_initialize() failed\n");
@@ -444,8 +812,23 @@ namespace aun {
 		return 8;
 	}
 
+	/* Hand a bridged frame over to the forwarding stage; returns false if the AUN-RX pipe had no free buffer */
+	bool submitBridged(const econet::Frame *frame, unsigned int length) {
+		std::lock_guard<std::mutex> lock(bridged_lock);
+		econet::Frame *copy;
+
+		if ((copy = bridge::acquire(BRIDGE_AUN_RX)) == NULL) {
+			bridge::drop(BRIDGE_AUN_RX);
+			return false;
+		}
+		memcpy(copy->rawdata, frame->rawdata, length);
+		bridge::submit(BRIDGE_AUN_RX, copy, length);
+		return true;
+	}
+
 	int rxHandler(econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length, bool *sendAck) {
 		int result, datalen;
+		uint8_t port, control, addresses[4];
 
 		/* temp stuff to prevent unintialized variables in netmon */
 		rx_data->control = 0;
@@ -453,15 +836,6 @@ namespace aun {
 		tx_data->control = 0;
 		tx_data->port = 0;
 
-econet::protohandlers[0x00] = econet::port00handler;
-econet::protohandlers[0x90] = econet::port90handler;
-econet::protohandlers[0x91] = econet::port91handler;
-econet::protohandlers[0x99] = econet::port99handler;
-econet::protohandlers[0x9F] = econet::port9Fhandler;
-econet::protohandlers[0xB0] = econet::portB0handler;
-econet::protohandlers[0xD0] = econet::portD0handler;
-econet::protohandlers[0xD1] = econet::portD1handler;
-
 		result = 0;
 		*sendAck = false;
 		if (aun::validateFrame(rx_data, rx_length)) {
@@ -500,6 +874,27 @@ econet::protohandlers[0xD1] = econet::portD1handler;
 				case AUN_IMMEDIATE_REPLY :
 					break;
 
+				case AUN_BRIDGED :
+					/* Turn it back into the Econet frame which another bridge forwarded to us, and pass it on */
+					if (rx_length < 12)
+						break;
+					/* Only the bridge to the frame's source network may vouch for its Econet source address */
+					if (routes::trusted(rx_data->aun.data[2], ROUTE_AUN, workers::current.network, workers::current.station) == false)
+						break;
+					port = rx_data->aun.port;
+					control = rx_data->aun.control | 0x80;
+					memcpy(addresses, rx_data->aun.data, 4);
+					memmove(&rx_data->rawdata[6], &rx_data->rawdata[12], rx_length - 12);
+					memcpy(rx_data->rawdata, addresses, 4);
+					rx_data->rawdata[4] = control;
+					rx_data->rawdata[5] = port;
+					/* A frame for us is processed by this worker, anything else goes to the forwarding stage of the bridge */
+					if (((addresses[0] == 0) || (addresses[0] == settings::econet_network)) && (addresses[1] == settings::econet_station))
+						aun::handleFrame(rx_data, (int) rx_length - 6);
+					else
+						submitBridged(rx_data, rx_length - 6);
+					break;
+
 				default :
 					fprintf(stderr, "aun::rxHandler: Unknown transaction type 0x%02X in AUN frame\n", rx_data->aun.type);
 					break;
@@ -509,6 +904,34 @@ econet::protohandlers[0xD1] = econet::portD1handler;
 		return result;
 	}
 
+#if (FILESTORE_WITHOPENSSL == 1)
+	/* Handler for frames received by the DTLS listeners: the DTLS server sends the reply, but the worker which owns the station builds it */
+	int dtlsHandler(econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length, bool *sendAck) {
+		Job job;
+		Reply reply;
+
+		(void) tx_length;
+
+		/* The DTLS server doesn't pass on the peer's address, so these frames are sharded as an unknown station */
+		bzero(&job.addr, sizeof(job.addr));
+		job.addrlen = 0;
+		job.network = 0;
+		job.station = 0;
+		job.frame = rx_data;
+		job.length = rx_length;
+		job.sock = -1;
+		reply.tx_data = tx_data;
+
+		if (workers::call(&job, &reply) == false) {
+			*sendAck = false;
+			return 0;
+		}
+
+		*sendAck = reply.sendAck;
+		return reply.tx_length;
+	}
+#endif
+
 	/* Check if a frame is a valid Econet frame */
 	bool validateFrame(econet::Frame *data, size_t length) {
 		data->flags = 0;
@@ -519,7 +942,7 @@ econet::protohandlers[0xD1] = econet::portD1handler;
 			return false;
 		}
 		/* Check if the transaction type is valid */
-		if ((data->aun.type < AUN_BROADCAST) || (data->aun.type > AUN_IMMEDIATE_REPLY)) {
+		if (((data->aun.type < AUN_BROADCAST) || (data->aun.type > AUN_IMMEDIATE_REPLY)) && (data->aun.type != AUN_BRIDGED)) {
 			data->flags |= ECONET_FRAME_INVALID;
 			return false;
 		}
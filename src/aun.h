@@ -13,10 +13,16 @@
 #include <openssl/ssl.h>	/* SSL* */
 #endif
 
+#define AUN_HEADER_LENGTH	8	// Type, port, control, retry and a 32-bit sequence number
+
 enum {AUN_BROADCAST = 0x01, AUN_UNICAST, AUN_ACK, AUN_NAK, AUN_IMMEDIATE, AUN_IMMEDIATE_REPLY};
+#define AUN_BRIDGED		0x10	// Not part of AUN: a frame forwarded by a bridge, with the Econet addresses in front of the payload
 
 namespace aun {
+	int	transmitTo(int n, int s, econet::Frame *frame, unsigned int tx_length);
+	int	transmitBridged(int n, int s, econet::Frame *frame, unsigned int tx_length);
 	int	transmitFrame(econet::Frame *frame, unsigned int tx_length);
+	int	setMulticast(const char *group, const char *interface);
 	int	ipv4_aun_Listener(void);
 	int	ipv4_aun_Transmit(const char *address, unsigned short port, econet::Frame *frame, size_t tx_length);
 #if (FILESTORE_WITHOPENSSL == 1)
@@ -32,7 +38,12 @@ namespace aun {
 #endif
 #endif
 	int	prepareAckPackage(econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length);
+	void	handleFrame(econet::Frame *frame, int size);
+	bool	submitBridged(const econet::Frame *frame, unsigned int length);
 	int	rxHandler(econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length, bool *sendAck);
+#if (FILESTORE_WITHOPENSSL == 1)
+	int	dtlsHandler(econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length, bool *sendAck);
+#endif
 	bool	validateFrame(econet::Frame *data, size_t length);
 }
 #endif
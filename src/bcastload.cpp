@@ -0,0 +1,397 @@
+/* bcastload.cpp
+ * Broadcast loader: sends one file to many stations at once on ports &D6 BroadcastControl and &D7 BroadcastData
+ *
+ * Loading the same program on a whole room of stations one LOAD at a time
+ * takes as long as all those loads together. The broadcast loader reads the
+ * file into memory once and sends it to all stations at the same time:
+ * - the transfer is announced FILESTORE_BCASTLOAD_ANNOUNCE times on &D6
+ * - every block of the file is broadcast once on &D7, with its block number
+ * - the end of the transfer is announced on &D6
+ * - every station which missed blocks reports them on &D6 as ranges of block
+ *   numbers; the reports are collected for FILESTORE_BCASTLOAD_WINDOW and the
+ *   missing blocks are sent to just the stations which asked for them, or
+ *   broadcast again when more than FILESTORE_BCASTLOAD_REBROADCAST stations
+ *   missed the same block
+ * - the end is announced again after every repair round, until no station
+ *   reports missing blocks for FILESTORE_BCASTLOAD_END_ROUNDS announcements
+ *
+ * Real Econet can't carry large broadcasts, so the data blocks are only
+ * broadcast to the AUN stations. Stations on the Econet see the announcements
+ * and get all blocks they report as missing sent to them directly.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <chrono>		// std::chrono::microseconds
+#include <condition_variable>	// std::condition_variable
+#include <cstdio>		// FILE*, fopen(), fread(), fclose(), fprintf()
+#include <cstring>		// memcpy(), memset(), strncpy(), strrchr()
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::lock_guard, std::unique_lock
+#include <thread>		// std::thread
+#include <unistd.h>		// usleep()
+
+#include "bcastload.h"		// Header file for this code
+#include "aun.h"		// aun::transmitFrame(), aun::transmitTo()
+#include "main.h"		// bye
+#include "settings.h"		// settings::econet_network, settings::aun_network, settings::bcastload_delay
+#include "workers.h"		// workers::current
+
+using namespace std;
+
+
+
+namespace bcastload {
+	/* Blocks which a station reported as missing */
+	typedef struct {
+		uint8_t		network;
+		uint8_t		station;
+		uint16_t	first;
+		uint16_t	last;
+	} Request;
+
+	Status			status;
+	Request			requests[FILESTORE_BCASTLOAD_REQUESTS];
+	int			numrequests;
+	std::mutex		transfer_lock;			// Protects status, requests[] and numrequests
+	std::condition_variable	transfer_cv;			// Signalled when a station reports missing blocks, or the transfer is stopped
+	std::thread		thread_transfer;
+	std::atomic<bool>	aborted(false);
+	uint8_t			last_id = 0;
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	bool stopped(void) {
+		return ((aborted == true) || (bye == true));
+	}
+
+	/* Broadcast a frame to all AUN stations, and to the Econet if it isn't too large for it */
+	void broadcast(econet::Frame *frame, unsigned int size, bool to_econet) {
+		frame->rawdata[0x00] = 0xFF;
+		frame->rawdata[0x01] = 0xFF;
+
+		if (to_econet == true) {
+			frame->rawdata[0x02] = settings::econet_network;
+			frame->rawdata[0x03] = settings::econet_station;
+			econet::transmitFrame(frame, size);
+		}
+
+		frame->rawdata[0x02] = settings::aun_network;
+		frame->rawdata[0x03] = settings::aun_station;
+		aun::transmitFrame(frame, size);
+	}
+
+	/* Send a frame to one station, on the Econet or over AUN */
+	void sendTo(uint8_t network, uint8_t station, econet::Frame *frame, unsigned int size) {
+		frame->rawdata[0x00] = network;
+		frame->rawdata[0x01] = station;
+
+		if (network == settings::econet_network) {
+			frame->rawdata[0x02] = settings::econet_network;
+			frame->rawdata[0x03] = settings::econet_station;
+			econet::transmitFrame(frame, size);
+		} else {
+			frame->rawdata[0x02] = settings::aun_network;
+			frame->rawdata[0x03] = settings::aun_station;
+			aun::transmitTo(network, station, frame, size);
+		}
+	}
+
+	/* Build a control frame on &D6; returns the size of the frame */
+	unsigned int buildControl(econet::Frame *frame, uint8_t control, const Status *transfer, uint32_t loadaddr, uint32_t execaddr) {
+		unsigned int size;
+
+		frame->rawdata[0x04] = control;
+		frame->rawdata[0x05] = 0xD6;
+		frame->rawdata[0x06] = transfer->id;
+		if (control != BCASTLOAD_CONTROL_ANNOUNCE)
+			return 7;
+
+		frame->rawdata[0x07] = (transfer->length & 0x000000FF);
+		frame->rawdata[0x08] = (transfer->length & 0x0000FF00) >> 8;
+		frame->rawdata[0x09] = (transfer->length & 0x00FF0000) >> 16;
+		frame->rawdata[0x0A] = (transfer->length & 0xFF000000) >> 24;
+		frame->rawdata[0x0B] = (loadaddr & 0x000000FF);
+		frame->rawdata[0x0C] = (loadaddr & 0x0000FF00) >> 8;
+		frame->rawdata[0x0D] = (loadaddr & 0x00FF0000) >> 16;
+		frame->rawdata[0x0E] = (loadaddr & 0xFF000000) >> 24;
+		frame->rawdata[0x0F] = (execaddr & 0x000000FF);
+		frame->rawdata[0x10] = (execaddr & 0x0000FF00) >> 8;
+		frame->rawdata[0x11] = (execaddr & 0x00FF0000) >> 16;
+		frame->rawdata[0x12] = (execaddr & 0xFF000000) >> 24;
+		frame->rawdata[0x13] = (FILESTORE_BCASTLOAD_BLOCK & 0x00FF);
+		frame->rawdata[0x14] = (FILESTORE_BCASTLOAD_BLOCK & 0xFF00) >> 8;
+		frame->rawdata[0x15] = (transfer->blocks & 0x00FF);
+		frame->rawdata[0x16] = (transfer->blocks & 0xFF00) >> 8;
+		size = strlen(transfer->name);
+		memcpy(&frame->rawdata[0x17], transfer->name, size);
+		frame->rawdata[0x17 + size] = 0x0D;
+		return 0x18 + size;
+	}
+
+	/* Build a data frame with one block of the file on &D7; returns the size of the frame */
+	unsigned int buildBlock(econet::Frame *frame, uint8_t id, const uint8_t *buffer, uint32_t length, uint16_t block) {
+		uint32_t offset, size;
+
+		offset = (uint32_t) block * FILESTORE_BCASTLOAD_BLOCK;
+		size = ((length - offset) > FILESTORE_BCASTLOAD_BLOCK) ? FILESTORE_BCASTLOAD_BLOCK : (length - offset);
+
+		frame->rawdata[0x04] = BCASTLOAD_CONTROL_DATA;
+		frame->rawdata[0x05] = 0xD7;
+		frame->rawdata[0x06] = id;
+		frame->rawdata[0x07] = (block & 0x00FF);
+		frame->rawdata[0x08] = (block & 0xFF00) >> 8;
+		memcpy(&frame->rawdata[0x09], &buffer[offset], size);
+		return 0x09 + size;
+	}
+
+	/* Send the blocks which stations reported as missing: to each of those stations, or to all of them at once */
+	void repair(econet::Frame *frame, const Status *transfer, const uint8_t *buffer, const Request *pending, int total, uint16_t *count) {
+		uint32_t repaired, rebroadcast;
+		unsigned int b;
+		int i;
+
+		repaired = 0;
+		rebroadcast = 0;
+
+		/* Count the number of stations which miss every block */
+		memset(count, 0, transfer->blocks * sizeof(uint16_t));
+		for (i = 0; i < total; i++) {
+			for (b = pending[i].first; b <= pending[i].last; b++) {
+				if (count[b] < 0xFFFF)
+					count[b]++;
+			}
+		}
+
+		/* A block which many stations miss is broadcast again once */
+		for (b = 0; (b < transfer->blocks) && (stopped() == false); b++) {
+			if (count[b] <= FILESTORE_BCASTLOAD_REBROADCAST)
+				continue;
+			broadcast(frame, buildBlock(frame, transfer->id, buffer, transfer->length, b), false);
+			count[b] = 0;
+			rebroadcast++;
+			if (settings::bcastload_delay > 0)
+				usleep(settings::bcastload_delay);
+		}
+
+		/* All other blocks are sent only to the stations which miss them */
+		for (i = 0; (i < total) && (stopped() == false); i++) {
+			for (b = pending[i].first; (b <= pending[i].last) && (stopped() == false); b++) {
+				if (count[b] == 0)
+					continue;
+				sendTo(pending[i].network, pending[i].station, frame, buildBlock(frame, transfer->id, buffer, transfer->length, b));
+				repaired++;
+				if (settings::bcastload_delay > 0)
+					usleep(settings::bcastload_delay);
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(transfer_lock);
+		status.repaired += repaired;
+		status.rebroadcast += rebroadcast;
+		status.rounds++;
+	}
+
+	/* Main loop of the transfer thread: send the whole file, then repair the blocks which stations missed */
+	void run(uint8_t *buffer, uint32_t loadaddr, uint32_t execaddr) {
+		econet::Frame *frame = new econet::Frame;
+		Request *pending = new Request[FILESTORE_BCASTLOAD_REQUESTS];
+		uint16_t *count;
+		Status transfer;
+		uint64_t started;
+		unsigned int b, quiet, rounds;
+		int i, total;
+
+		started = now();
+		{
+			std::lock_guard<std::mutex> lock(transfer_lock);
+			transfer = status;
+		}
+		count = new uint16_t[transfer.blocks];
+
+		for (i = 0; (i < FILESTORE_BCASTLOAD_ANNOUNCE) && (stopped() == false); i++) {
+			broadcast(frame, buildControl(frame, BCASTLOAD_CONTROL_ANNOUNCE, &transfer, loadaddr, execaddr), true);
+			usleep(FILESTORE_BCASTLOAD_WINDOW);
+		}
+
+		for (b = 0; (b < transfer.blocks) && (stopped() == false); b++) {
+			broadcast(frame, buildBlock(frame, transfer.id, buffer, transfer.length, b), false);
+			{
+				std::lock_guard<std::mutex> lock(transfer_lock);
+				status.sent = b + 1;
+			}
+			if (settings::bcastload_delay > 0)
+				usleep(settings::bcastload_delay);
+		}
+
+		/* Announce the end and repair until the stations don't report missing blocks anymore */
+		quiet = 0;
+		rounds = 0;
+		while ((stopped() == false) && (quiet < FILESTORE_BCASTLOAD_END_ROUNDS) && (rounds < FILESTORE_BCASTLOAD_MAX_ROUNDS)) {
+			broadcast(frame, buildControl(frame, BCASTLOAD_CONTROL_END, &transfer, loadaddr, execaddr), true);
+
+			{
+				std::unique_lock<std::mutex> lock(transfer_lock);
+				transfer_cv.wait_for(lock, std::chrono::microseconds(FILESTORE_BCASTLOAD_QUIET), [] { return ((numrequests > 0) || (stopped() == true)); });
+				if (numrequests == 0) {
+					quiet++;
+					continue;
+				}
+			}
+
+			/* Give the other stations a moment to report too, so blocks which many of them missed are sent only once */
+			usleep(FILESTORE_BCASTLOAD_WINDOW);
+			{
+				std::lock_guard<std::mutex> lock(transfer_lock);
+				total = numrequests;
+				memcpy(pending, requests, total * sizeof(Request));
+				numrequests = 0;
+			}
+
+			repair(frame, &transfer, buffer, pending, total, count);
+			quiet = 0;
+			rounds++;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(transfer_lock);
+			status.active = false;
+			status.elapsed = now() - started;
+			numrequests = 0;
+		}
+
+		delete[] count;
+		delete[] pending;
+		delete frame;
+		delete[] buffer;
+	}
+
+	/* Read a file into memory and start broadcasting it */
+	int load(const char *filename, uint32_t loadaddr, uint32_t execaddr) {
+		uint8_t *buffer;
+		const char *name;
+		long length;
+		FILE *fp;
+
+		{
+			std::lock_guard<std::mutex> lock(transfer_lock);
+			if (status.active == true) {
+				fprintf(stderr, "bcastload::load: Transfer of %s is still running.\n", status.name);
+				return -1;
+			}
+		}
+		if (thread_transfer.joinable())
+			thread_transfer.join();
+
+		if ((fp = fopen(filename, "rb")) == NULL) {
+			fprintf(stderr, "bcastload::load: Can't open %s.\n", filename);
+			return -1;
+		}
+		fseek(fp, 0, SEEK_END);
+		length = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		if ((length <= 0) || (length > FILESTORE_BCASTLOAD_MAX_SIZE)) {
+			fprintf(stderr, "bcastload::load: %s is empty or too large.\n", filename);
+			fclose(fp);
+			return -1;
+		}
+		buffer = new uint8_t[length];
+		if (fread(buffer, 1, length, fp) != (size_t) length) {
+			fprintf(stderr, "bcastload::load: Can't read %s.\n", filename);
+			fclose(fp);
+			delete[] buffer;
+			return -1;
+		}
+		fclose(fp);
+
+		name = strrchr(filename, '/');
+		name = (name == NULL) ? filename : name + 1;
+
+		{
+			std::lock_guard<std::mutex> lock(transfer_lock);
+			memset(&status, 0, sizeof(status));
+			status.active = true;
+			status.id = ++last_id;
+			strncpy(status.name, name, FILESTORE_BCASTLOAD_MAX_NAME);
+			status.length = length;
+			status.blocks = (length + FILESTORE_BCASTLOAD_BLOCK - 1) / FILESTORE_BCASTLOAD_BLOCK;
+			numrequests = 0;
+		}
+
+		aborted = false;
+		thread_transfer = std::thread(run, buffer, loadaddr, execaddr);
+		return 0;
+	}
+
+	/* Stop the running transfer, if any, and wait for the transfer thread to finish */
+	void stop(void) {
+		aborted = true;
+		transfer_cv.notify_all();
+		if (thread_transfer.joinable())
+			thread_transfer.join();
+	}
+
+	/* Handle a report from a station about the running transfer */
+	void report(uint8_t network, uint8_t station, uint8_t control, const uint8_t *data, size_t length) {
+		uint16_t first, last;
+		unsigned int i;
+
+		std::lock_guard<std::mutex> lock(transfer_lock);
+
+		if ((status.active == false) || (length < 1) || (data[0] != status.id))
+			return;
+
+		/* AUN doesn't transmit the top bit of the control byte */
+		switch (control | 0x80) {
+			case BCASTLOAD_CONTROL_MISSING :
+				if (length < 2)
+					break;
+				status.reports++;
+				for (i = 0; (i < data[1]) && (2 + (i * 4) + 4 <= length); i++) {
+					first = data[2 + (i * 4)] | (data[3 + (i * 4)] << 8);
+					last = data[4 + (i * 4)] | (data[5 + (i * 4)] << 8);
+					if (last >= status.blocks)
+						last = status.blocks - 1;
+					if ((first > last) || (numrequests >= FILESTORE_BCASTLOAD_REQUESTS))
+						continue;
+					requests[numrequests].network = network;
+					requests[numrequests].station = station;
+					requests[numrequests].first = first;
+					requests[numrequests].last = last;
+					numrequests++;
+				}
+				transfer_cv.notify_one();
+				break;
+
+			case BCASTLOAD_CONTROL_COMPLETE :
+				status.completed++;
+				break;
+
+			default :
+				break;
+		}
+	}
+
+	/* &D6 BroadcastControl handler for AUN stations; reports from unknown sources (station 0.0) are dropped, as repairs can't be sent back to them */
+	int protohandler(const econet::Frame *rx_data, size_t rx_length, __attribute__((__unused__)) econet::Frame *tx_data, __attribute__((__unused__)) size_t tx_length) {
+		if ((workers::current.network == 0) && (workers::current.station == 0))
+			return 0;
+		if (rx_length > 8)
+			report(workers::current.network, workers::current.station, rx_data->aun.control, rx_data->aun.data, rx_length - 8);
+		return 0;
+	}
+
+	/* Get a copy of the progress of the current or last transfer */
+	void getStatus(Status *copy) {
+		std::lock_guard<std::mutex> lock(transfer_lock);
+		*copy = status;
+	}
+}
+
@@ -0,0 +1,57 @@
+/* bcastload.h
+ * Broadcast loader: sends one file to many stations at once on ports &D6 BroadcastControl and &D7 BroadcastData
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_BCASTLOAD_HEADER
+#define ECONET_BCASTLOAD_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint16_t, uint32_t
+
+#include "econet.h"			// econet::Frame
+
+#define FILESTORE_BCASTLOAD_MAX_SIZE	4194304		// Largest file which can be broadcast
+#define FILESTORE_BCASTLOAD_BLOCK	1024		// Size of one data block
+#define FILESTORE_BCASTLOAD_MAX_NAME	80		// Maximum length of the file name in the announcement
+#define FILESTORE_BCASTLOAD_ANNOUNCE	3		// Number of times a transfer is announced before the first block is sent
+#define FILESTORE_BCASTLOAD_REQUESTS	256		// Maximum number of missing block reports waiting to be repaired
+#define FILESTORE_BCASTLOAD_WINDOW	100000		// Number of microseconds reports are collected before they are repaired together
+#define FILESTORE_BCASTLOAD_QUIET	1000000		// Number of microseconds without reports after which the end of a transfer is announced again
+#define FILESTORE_BCASTLOAD_END_ROUNDS	3		// Number of quiet end announcements after which a transfer is finished
+#define FILESTORE_BCASTLOAD_MAX_ROUNDS	50		// Maximum number of repair rounds of one transfer
+#define FILESTORE_BCASTLOAD_REBROADCAST	3		// Number of stations missing the same block above which it is broadcast again instead of sent to each of them
+
+#define BCASTLOAD_CONTROL_ANNOUNCE	0x80		// &D6: a new transfer starts: ID, length, load and exec address, block size, number of blocks and name
+#define BCASTLOAD_CONTROL_MISSING	0x81		// &D6 from a station: ID, number of ranges and the first and last block of every range of missing blocks
+#define BCASTLOAD_CONTROL_COMPLETE	0x82		// &D6 from a station: ID of the transfer which the station received completely
+#define BCASTLOAD_CONTROL_END		0x83		// &D6: ID of the transfer of which all blocks have been sent
+#define BCASTLOAD_CONTROL_DATA		0x80		// &D7: ID, block number and the data of the block
+
+namespace bcastload {
+	/* Progress of the current or last transfer */
+	typedef struct {
+		bool		active;			// A transfer is running
+		uint8_t		id;			// ID of the transfer
+		char		name[FILESTORE_BCASTLOAD_MAX_NAME + 1];
+		uint32_t	length;			// Size of the file
+		uint16_t	blocks;			// Number of blocks of the file
+		uint16_t	sent;			// Number of blocks broadcast in the first pass
+		uint32_t	reports;		// Number of missing block reports received
+		uint32_t	repaired;		// Number of blocks sent again to a single station
+		uint32_t	rebroadcast;		// Number of blocks broadcast again because many stations missed them
+		uint32_t	completed;		// Number of stations which received the whole file
+		uint32_t	rounds;			// Number of repair rounds
+		uint64_t	elapsed;		// Duration of the transfer (in microseconds)
+	} Status;
+
+	int		load(const char *filename, uint32_t loadaddr, uint32_t execaddr);
+	void		stop(void);
+	void		report(uint8_t network, uint8_t station, uint8_t control, const uint8_t *data, size_t length);
+	int		protohandler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length);
+	void		getStatus(Status *status);
+}
+
+#endif
+
@@ -0,0 +1,213 @@
+/* bridge.cpp
+ * Pipeline between the Econet and AUN sides of the bridge
+ *
+ * The bridge is split in separate stages, so slow work in one stage can
+ * never make another stage miss frames:
+ * - Econet-RX: only drains the Econet hardware (econet::pollNetworkReceive())
+ * - AUN-RX: bridged AUN frames which aren't for us; the AUN workers which
+ *   receive them take turns as its producer
+ * - Trunk-RX: only unpacks the datagrams received from another bridge over the trunk
+ * - Forwarding: validates, processes and forwards frames, and does all of the
+ *   socket and Econet transmit work
+ *
+ * Each receive stage is linked to the forwarding stage by a pipe: a ring of
+ * received frames and a ring which returns the empty frame buffers. Both are
+ * single-producer/single-consumer rings, so no locks are needed. Every pipe
+ * owns FILESTORE_BRIDGE_RING_SIZE frame buffers; when the forwarding stage
+ * falls behind and all of them are in use, new frames are dropped.
+ *
+ * When there's nothing to forward, the forwarding stage sleeps on a
+ * condition variable. A receive stage only takes the lock to wake it up when
+ * it's actually sleeping, so passing on frames stays lock-free while the
+ * bridge is busy.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <chrono>		// std::chrono::milliseconds
+#include <condition_variable>	// std::condition_variable
+#include <cstdio>		// printf()
+#include <mutex>		// std::mutex, std::unique_lock, std::lock_guard
+#include <thread>		// std::thread
+
+#include "bridge.h"		// Header file for this code
+#include "aun.h"		// aun::handleFrame()
+#include "main.h"		// bye
+#include "trunk.h"		// trunk::handleFrame()
+
+const char *bridge_pipe[] = {"Econet-RX", "AUN-RX", "Trunk-RX"};
+
+using namespace std;
+
+
+
+namespace bridge {
+	/* One receive stage and its link to the forwarding stage */
+	typedef struct {
+		Ring			received;	// Received frames, from the receive stage to the forwarding stage
+		Ring			empty;		// Empty frame buffers, from the forwarding stage back to the receive stage
+		econet::Frame		*pool;		// All frame buffers of this pipe
+		std::atomic<uint32_t>	dropped;	// Number of frames dropped because all buffers were in use
+	} Pipe;
+
+	Pipe			pipes[BRIDGE_PIPES];
+	std::thread		thread_econet_rx;
+	std::thread		thread_forwarder;
+	std::mutex		sleep_lock;		// Taken to wake up the forwarding stage
+	std::condition_variable	wakeup;			// Signalled when a frame is submitted while the forwarding stage sleeps
+	std::atomic<bool>	sleeping(false);	// The forwarding stage is waiting for frames
+
+	/* Add a descriptor to a ring; only to be called by the producer thread */
+	bool push(Ring *ring, const FrameDesc *desc) {
+		unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+
+		if (tail - ring->head.load(std::memory_order_acquire) == FILESTORE_BRIDGE_RING_SIZE)
+			return false;
+
+		ring->slots[tail & (FILESTORE_BRIDGE_RING_SIZE - 1)] = *desc;
+		ring->tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Take a descriptor from a ring; only to be called by the consumer thread */
+	bool pop(Ring *ring, FrameDesc *desc) {
+		unsigned int head = ring->head.load(std::memory_order_relaxed);
+
+		if (head == ring->tail.load(std::memory_order_acquire))
+			return false;
+
+		*desc = ring->slots[head & (FILESTORE_BRIDGE_RING_SIZE - 1)];
+		ring->head.store(head + 1, std::memory_order_release);
+		return true;
+	}
+
+	/* Check if any frames are waiting to be forwarded */
+	bool pending(void) {
+		int p;
+
+		for (p = 0; p < BRIDGE_PIPES; p++) {
+			if (pipes[p].received.head.load(std::memory_order_relaxed) != pipes[p].received.tail.load(std::memory_order_acquire))
+				return true;
+		}
+		return false;
+	}
+
+	/* Main loop of the forwarding stage */
+	void forwarder(void) {
+		FrameDesc desc;
+		bool idle;
+		int p;
+
+		while (bye == false) {
+			idle = true;
+			for (p = 0; p < BRIDGE_PIPES; p++) {
+				if (pop(&pipes[p].received, &desc) == false)
+					continue;
+
+				idle = false;
+				if (p == BRIDGE_ECONET_RX)
+					econet::handleFrame(desc.frame, desc.length);
+				else if (p == BRIDGE_TRUNK_RX)
+					trunk::handleFrame(desc.frame, desc.length);
+				else
+					aun::handleFrame(desc.frame, desc.length);
+
+				/* Give the buffer back to the receive stage; this can't fail as the ring holds all buffers of the pipe */
+				push(&pipes[p].empty, &desc);
+			}
+
+			/* Sleep until a receive stage submits a frame; set sleeping before checking the rings again, so a frame submitted in between isn't missed */
+			if (idle) {
+				std::unique_lock<std::mutex> lock(sleep_lock);
+				sleeping.store(true);
+				std::atomic_thread_fence(std::memory_order_seq_cst);
+				if (pending() == false)
+					wakeup.wait_for(lock, std::chrono::milliseconds(FILESTORE_BRIDGE_POLL));
+				sleeping.store(false);
+			}
+		}
+	}
+
+	/* Allocate the frame buffers and start the Econet-RX and forwarding stages */
+	int start(void) {
+		FrameDesc desc;
+		int p, i;
+
+		for (p = 0; p < BRIDGE_PIPES; p++) {
+			pipes[p].received.head = 0;
+			pipes[p].received.tail = 0;
+			pipes[p].empty.head = 0;
+			pipes[p].empty.tail = 0;
+			pipes[p].dropped = 0;
+			pipes[p].pool = new econet::Frame[FILESTORE_BRIDGE_RING_SIZE];
+			for (i = 0; i < FILESTORE_BRIDGE_RING_SIZE; i++) {
+				desc.frame = &pipes[p].pool[i];
+				desc.length = 0;
+				push(&pipes[p].empty, &desc);
+			}
+		}
+
+		thread_forwarder = std::thread(forwarder);
+#if (FILESTORE_ADAPTER != FILESTORE_ADAPTER_NONE)
+		thread_econet_rx = std::thread(econet::pollNetworkReceive);
+#endif
+
+		return 0;
+	}
+
+	/* Wait for the bridge stages to finish and release the frame buffers */
+	void stop(void) {
+		int p;
+
+		if (thread_econet_rx.joinable())
+			thread_econet_rx.join();
+		if (thread_forwarder.joinable())
+			thread_forwarder.join();
+
+		for (p = 0; p < BRIDGE_PIPES; p++) {
+			delete[] pipes[p].pool;
+			pipes[p].pool = NULL;
+		}
+	}
+
+	/* Get an empty frame buffer for a receive stage, or NULL if all buffers are in use */
+	econet::Frame *acquire(int pipe) {
+		FrameDesc desc;
+
+		if (pop(&pipes[pipe].empty, &desc) == false)
+			return NULL;
+		return desc.frame;
+	}
+
+	/* Hand a received frame over to the forwarding stage */
+	void submit(int pipe, econet::Frame *frame, unsigned int length) {
+		FrameDesc desc;
+
+		desc.frame = frame;
+		desc.length = length;
+		push(&pipes[pipe].received, &desc);
+
+		/* Wake up the forwarding stage if it's waiting for frames */
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (sleeping.load() == true) {
+			std::lock_guard<std::mutex> lock(sleep_lock);
+			wakeup.notify_one();
+		}
+	}
+
+	/* Count a received frame which was dropped because acquire() found no free buffer */
+	void drop(int pipe) {
+		pipes[pipe].dropped++;
+	}
+
+	/* Number of frames waiting to be forwarded */
+	unsigned int occupancy(int pipe) {
+		return pipes[pipe].received.tail - pipes[pipe].received.head;
+	}
+
+	/* Number of frames dropped because the forwarding stage couldn't keep up */
+	uint32_t dropped(int pipe) {
+		return pipes[pipe].dropped;
+	}
+}
+
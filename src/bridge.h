@@ -0,0 +1,47 @@
+/* bridge.h
+ * Pipeline between the Econet and AUN sides of the bridge
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_BRIDGE_HEADER
+#define ECONET_BRIDGE_HEADER
+
+#include <atomic>			// std::atomic
+#include <cstdint>			// uint8_t, uint32_t
+
+#include "econet.h"			// econet::Frame
+
+#define FILESTORE_BRIDGE_RING_SIZE	32		// Number of frames in each ring; must be a power of 2
+#define FILESTORE_BRIDGE_POLL		100		// Number of milliseconds the idle forwarding stage waits for frames before checking if it has to stop
+
+enum BRIDGE_PIPES {BRIDGE_ECONET_RX, BRIDGE_AUN_RX, BRIDGE_TRUNK_RX, BRIDGE_PIPES};
+extern const char *bridge_pipe[];
+
+namespace bridge {
+	/* A received frame which is waiting to be forwarded */
+	typedef struct {
+		econet::Frame	*frame;
+		unsigned int	length;
+	} FrameDesc;
+
+	/* Bounded lock-free ring with exactly one producer and one consumer thread */
+	typedef struct {
+		FrameDesc			slots[FILESTORE_BRIDGE_RING_SIZE];
+		std::atomic<unsigned int>	head;		// Number of descriptors taken by the consumer
+		std::atomic<unsigned int>	tail;		// Number of descriptors added by the producer
+	} Ring;
+
+	bool		push(Ring *ring, const FrameDesc *desc);
+	bool		pop(Ring *ring, FrameDesc *desc);
+	int		start(void);
+	void		stop(void);
+	econet::Frame	*acquire(int pipe);
+	void		submit(int pipe, econet::Frame *frame, unsigned int length);
+	void		drop(int pipe);
+	unsigned int	occupancy(int pipe);
+	uint32_t	dropped(int pipe);
+}
+
+#endif
+
@@ -0,0 +1,114 @@
+/* broadcasts.cpp
+ * Relaying of broadcast frames between the Econet and AUN networks
+ *
+ * A broadcast is relayed to every interface except the one it came in on:
+ * Econet, AUN and, if it is open, the trunk to another bridge.
+ *
+ * With more than one bridge between the same networks, a relayed broadcast
+ * can come back to us and would be relayed again. To make every broadcast
+ * cross this bridge only once, a broadcast isn't relayed when:
+ * - it is one of our own broadcasts
+ * - its source network is routed through the other interface (it has looped)
+ * - its source network is more than FILESTORE_BROADCAST_MAX_HOPS bridges away
+ * - the same broadcast was already relayed in the last FILESTORE_BROADCAST_LIFETIME
+ *   microseconds; this is checked with a small direct-mapped hash cache
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::lock_guard
+
+#include "broadcasts.h"		// Header file for this code
+#include "aun.h"		// aun::transmitFrame()
+#include "routes.h"		// routes::lookup(), ROUTE_ECONET, ROUTE_AUN, ROUTE_TRUNK
+#include "settings.h"		// settings::econet_network, settings::econet_station, settings::aun_network, settings::aun_station
+#include "trunk.h"		// trunk::active(), trunk::send()
+
+using namespace std;
+
+
+
+namespace broadcasts {
+	Entry			cache[FILESTORE_BROADCAST_CACHE_SIZE];
+	std::mutex		cache_lock;			// Protects cache[]
+	std::atomic<uint32_t>	suppressedFrames(0);
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	/* Check if a broadcast was relayed recently, and remember it if it wasn't */
+	bool seen(const econet::Frame *frame, unsigned int size) {
+		uint64_t key, t;
+		Entry *entry;
+		unsigned int i;
+
+		/* FNV-1a hash of everything except the destination: source, control byte, port and payload */
+		key = 14695981039346656037ull;
+		for (i = 2; i < size; i++) {
+			key ^= frame->rawdata[i];
+			key *= 1099511628211ull;
+		}
+		if (key == 0)
+			key = 1;
+
+		t = now();
+		entry = &cache[key & (FILESTORE_BROADCAST_CACHE_SIZE - 1)];
+
+		std::lock_guard<std::mutex> lock(cache_lock);
+		if ((entry->key == key) && (entry->expires > t))
+			return true;
+
+		entry->key = key;
+		entry->expires = t + FILESTORE_BROADCAST_LIFETIME;
+		return false;
+	}
+
+	/* Relay a broadcast which was received on interface from to the other interfaces, unless it shouldn't cross this bridge */
+	bool relay(econet::Frame *frame, unsigned int size, uint8_t from) {
+		routes::Route route;
+
+		if (size < 6)
+			return false;
+
+		/* One of our own broadcasts */
+		if (((frame->econet.src_network == settings::econet_network) && (frame->econet.src_station == settings::econet_station)) ||
+		    ((frame->econet.src_network == settings::aun_network) && (frame->econet.src_station == settings::aun_station))) {
+			suppressedFrames++;
+			return false;
+		}
+
+		/* A broadcast from a network which isn't on this side of the bridge has looped; one from too far away is dropped */
+		if (routes::lookup(frame->econet.src_network, &route) == true) {
+			if ((route.via != from) || (route.hops > FILESTORE_BROADCAST_MAX_HOPS)) {
+				suppressedFrames++;
+				return false;
+			}
+		}
+
+		if (seen(frame, size) == true) {
+			suppressedFrames++;
+			return false;
+		}
+
+		if (from != ROUTE_AUN)
+			aun::transmitFrame(frame, size);
+		if (from != ROUTE_ECONET)
+			econet::transmitFrame(frame, size);
+		if ((from != ROUTE_TRUNK) && (trunk::active() == true))
+			trunk::send(frame, size);
+		return true;
+	}
+
+	/* Number of broadcasts which weren't relayed */
+	uint32_t suppressed(void) {
+		return suppressedFrames;
+	}
+}
+
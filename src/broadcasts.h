@@ -0,0 +1,31 @@
+/* broadcasts.h
+ * Relaying of broadcast frames between the Econet and AUN networks
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_BROADCASTS_HEADER
+#define ECONET_BROADCASTS_HEADER
+
+#include <cstdint>			// uint8_t, uint32_t, uint64_t
+
+#include "econet.h"			// econet::Frame
+
+#define FILESTORE_BROADCAST_CACHE_SIZE	256		// Number of recently relayed broadcasts to remember; must be a power of 2
+#define FILESTORE_BROADCAST_LIFETIME	2000000		// Number of microseconds a relayed broadcast is remembered
+#define FILESTORE_BROADCAST_MAX_HOPS	3		// Broadcasts from networks more than this number of bridges away aren't relayed
+
+namespace broadcasts {
+	/* A recently relayed broadcast */
+	typedef struct {
+		uint64_t	key;		// Hash of source, port, control byte and payload, or 0 if unused
+		uint64_t	expires;	// When this entry can be forgotten (in microseconds)
+	} Entry;
+
+	bool		seen(const econet::Frame *frame, unsigned int size);
+	bool		relay(econet::Frame *frame, unsigned int size, uint8_t from);
+	uint32_t	suppressed(void);
+}
+
+#endif
+
@@ -5,21 +5,39 @@
  */
 
 #include <cstdio>			// NULL, printf(), FILE*, fopen(), fgets(), feof() and fclose()
-#include <cstdlib>			// strtol()
-#include <cstring>			// strlen(), strncpy()
+#include <cstdlib>			// strtol(), free()
+#include <cstring>			// strlen(), strncpy(), strdup()
+#include <climits>			// INT_MAX
+#include <strings.h>			// strcasecmp()
 #include <unistd.h>			// usleep()
 #include <termios.h>			// struct termios
 #include <ctime>			// time_t tm
+#include <mutex>			// std::mutex, std::lock_guard
 #include <readline/readline.h>		// rl_attempted_completion_over, rl_completion_matches()
 #include "cli.h"
 #include "config.h"			// DEBUG_BUILD
+#include "aun.h"			// aun::setMulticast()
+#include "bcastload.h"			// bcastload::load(), bcastload::getStatus()
+#include "bridge.h"			// bridge::occupancy(), bridge::dropped()
+#include "broadcasts.h"			// broadcasts::suppressed()
 #include "debug.h"			// debug::*
+#include "dentries.h"			// dentries::getStats()
+#include "dircache.h"			// dircache::getStats()
 #include "econet.h"			// econet::netmon and econet::Frame
+#include "fsdir.h"			// fsdir::init(), fsdir::release()
 #include "main.h"			// bye, strtoupper() and STARTUP_MESSAGE
+#include "nativefs.h"			// nativefs::importINF(), nativefs::exportINF()
 #include "netfs.h"			// netfs::*
+#include "peers.h"			// peers::snapshot()
+#include "links.h"			// links::lookup()
+#include "ratelimit.h"			// ratelimit::dropped*()
+#include "retransmit.h"			// retransmit::resent(), retransmit::failed()
+#include "routes.h"			// routes::snapshot()
 #include "settings.h"			// settings::*
 #include "stations.h"			// stations::*
+#include "trunk.h"			// trunk::start(), trunk::stop(), trunk::getStats()
 #include "users.h"			// MAX_PASSWORD_LENGTH, users::newUser()
+#include "workers.h"			// workers::dropped()
 #include "platforms/platform.h"
 #if (FILESTORE_HAS_KBHIT == 0)
 #include "platforms/kbhit.h"
@@ -29,6 +47,8 @@
 extern std::atomic<bool>	bye;
 extern FILE			*fp_volume;
 
+std::mutex			netmon_lock;	// Keeps frames dumped by different worker threads from interleaving
+
 const char *modules[]={"OS", "NetFS", "Debug", NULL};
 
 Command commands[] {
@@ -43,6 +63,7 @@ Command commands[] {
 	{debug::phi2,		"DEBUG",	"PHI2",		"<ON|OFF>"},
 #endif
 	{cli::access,		"NETFS",	"ACCESS",	"<filename> (RWL)"},
+	{cli::broadcastload,	"NETFS",	"BCASTLOAD",	"(<filename> (<load> (<exec>)))"},
 	{cli::logout,		"OS",		"BYE",		""},
 	{cli::cat,		"NETFS",	"CAT",		""},
 	{cli::cdir,		"NETFS",	"CDIR",		"<dir>"},
@@ -59,8 +80,10 @@ Command commands[] {
 	{cli::login,		"OS",		"LOGIN",	"<username> (password)"},
 	{cli::logout,		"OS",		"LOGOUT",	""},
 	{cli::info,		"NETFS",	"INFO",		"<fsp>"},
+	{cli::metaindex,	"NETFS",	"METAINDEX",	"<IMPORT|EXPORT> <directory>"},
 	{cli::mount,		"NETFS",	"MOUNT",	"<filename>"},
 	{cli::netmon,		"OS",		"NETMON",	""},
+	{cli::netstats,		"OS",		"NETSTATS",	""},
 	{cli::newuser,		"OS",		"NEWUSER",	"<username> <password>"},
 	{cli::notify,		"OS",		"NOTIFY",	"<station id> <message>"},
 	{cli::pass,		"OS",		"PASS",		"<username> <password>"},
@@ -68,6 +91,7 @@ Command commands[] {
 	{cli::priv,		"OS",		"PRIV",		"<username> (S)"},
 	{cli::remuser,		"OS",		"REMUSER",	"<username>"},
 	{cli::rename,		"NETFS",	"RENAME",	"<filename>"},
+	{cli::routes,		"OS",		"ROUTES",	""},
 	{cli::sessions,		"OS",		"SESSIONS",	""},
 	{cli::stations,		"OS",		"STATIONS",	""},
 	{cli::star_time,	"OS",		"TIME",		""},
@@ -91,21 +115,58 @@ namespace cli {
 		return(0);
 	}
 
+	int broadcastload(int argv, char **args) {
+		bcastload::Status status;
+		uint32_t loadaddr, execaddr;
+
+		if (argv == 1) {
+			bcastload::getStatus(&status);
+			if (status.id == 0) {
+				printf("No broadcast load has been started\n");
+				return(0);
+			}
+			printf("File                      %s (%u bytes, %u blocks)\n", status.name, status.length, status.blocks);
+			if (status.active == true)
+				printf("Status                    Running, %u of %u blocks sent\n", status.sent, status.blocks);
+			else
+				printf("Status                    Finished in %llu.%03llus\n", (unsigned long long) (status.elapsed / 1000000), (unsigned long long) ((status.elapsed / 1000) % 1000));
+			printf("Missing block reports     %u\n", status.reports);
+			printf("Blocks sent to a station  %u\n", status.repaired);
+			printf("Blocks broadcast again    %u\n", status.rebroadcast);
+			printf("Repair rounds             %u\n", status.rounds);
+			printf("Stations completed        %u\n", status.completed);
+			return(0);
+		} else if ((argv >= 2) && (argv <= 4)) {
+			loadaddr = (argv >= 3) ? strtoul(args[2], NULL, 16) : 0xFFFFFFFF;
+			execaddr = (argv == 4) ? strtoul(args[3], NULL, 16) : loadaddr;
+			if (bcastload::load(args[1], loadaddr, execaddr) != 0)
+				return(0x000000D6);
+			printf("Broadcasting %s\n", args[1]);
+			return(0);
+		} else {
+			return(-2);
+		}
+	}
+
 	int cat(int argv, char **args) {
-		FSDirectory dir[ECONET_MAX_DIRENTRIES];
+		FSDirectory dir;
+		FSAttributes attrib;
 		char access[FILESTORE_MAX_ATTRIBS];
-		int i, result;
+		int i;
 
 		if ((argv == 1) || (argv == 2)) {
+			fsdir::init(&dir);
 			if (argv == 1) {
-				result = netfs::catalogue(0x00, dir, "", 0, ECONET_MAX_DIRENTRIES);
+				netfs::catalogue(0x00, &dir, "", 0, INT_MAX, true);
 			} else {
-				result = netfs::catalogue(0x00, dir, args[1], 0, ECONET_MAX_DIRENTRIES);
+				netfs::catalogue(0x00, &dir, args[1], 0, INT_MAX, true);
 			}
-			for (i = 0; i < result; i++) {
-				netfs::attribtostr(&dir->fsp[i].attrib, access);
-				printf("%-10s %08X %08X %06X %s\n", dir->fsp[i].name, dir->fsp[i].loadaddr, dir->fsp[i].execaddr, dir->fsp[i].length, access); /* TODO replace %-10s by ECONET_MAX_FILENAME_LEN */
+			for (i = 0; i < dir.count; i++) {
+				netfs::unpackattrib(dir.attribs[i], &attrib);
+				netfs::attribtostr(&attrib, access);
+				printf("%-10s %08X %08X %06X %s\n", dir.names[i], dir.loadaddrs[i], dir.execaddrs[i], dir.lengths[i], access); /* TODO replace %-10s by ECONET_MAX_FILENAME_LEN */
 			}
+			fsdir::release(&dir);
 		} else {
 			return(-2);
 		}
@@ -155,6 +216,34 @@ namespace cli {
 			printf("NETWORK         %i\n", settings::econet_network);
 			printf("AUNNETWORK      %i\n", settings::aun_network);
 			printf("AUTOLEARN       %i\n", settings::autolearn);
+			printf("WORKERS         %u\n", settings::workers);
+			printf("RATEFRAMES      %u\n", settings::ratelimit_frames);
+			printf("RATEBYTES       %u\n", settings::ratelimit_bytes);
+			printf("RATEUNKNOWN     %u\n", settings::ratelimit_unknown);
+			if (settings::trunk_peer != NULL)
+				printf("TRUNK           %s\n", settings::trunk_peer);
+			else
+				printf("TRUNK           OFF\n");
+			printf("TRUNKDELAY      %uus\n", settings::trunk_delay);
+			if (settings::multicast_group != NULL)
+				printf("MULTICAST       %s %s\n", settings::multicast_group, (settings::multicast_interface != NULL) ? (const char *) settings::multicast_interface : "");
+			else
+				printf("MULTICAST       OFF\n");
+			printf("BCASTDELAY      %uus\n", settings::bcastload_delay);
+			printf("DIRCACHE        %zuK\n", settings::dircache_size / 1024);
+			if (settings::metaindex == true)
+				printf("METAINDEX       ON\n");
+			else
+				printf("METAINDEX       OFF\n");
+			if ((FILESTORE_HAS_ZLIB == 1) && (settings::trunk_compression == true))
+				printf("TRUNKCOMPRESS   ON\n");
+			else
+				printf("TRUNKCOMPRESS   OFF\n");
+			printf("TRUNKTHRESHOLD  %u\n", settings::trunk_threshold);
+			if (settings::trunk_segmentation == true)
+				printf("TRUNKSEGMENT    ON\n");
+			else
+				printf("TRUNKSEGMENT    OFF\n");
 			printf("VOLUME          %s\n", settings::volume);
 			printf("PRINTQUEUE      %s\n", settings::printqueue);
 			if (settings::clock == true)
@@ -194,6 +283,150 @@ namespace cli {
 					settings::aun_network = value;
 					printf("AUN network ID set to %i\n", value);
 				}
+			} else if (strcmp(args[1], "AUTOLEARN") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if ((value < 0) || (value > 2)) {
+					printf("Error: %s is an invalid autolearn mode\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::autolearn = value;
+					printf("Autolearn set to %i\n", value);
+				}
+			} else if (strcmp(args[1], "RATEFRAMES") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if (value < 0) {
+					printf("Error: %s is an invalid rate limit\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::ratelimit_frames = value;
+					printf("Rate limit per station set to %i frames/s\n", value);
+				}
+			} else if (strcmp(args[1], "RATEBYTES") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if (value < 0) {
+					printf("Error: %s is an invalid rate limit\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::ratelimit_bytes = value;
+					printf("Rate limit per station set to %i bytes/s\n", value);
+				}
+			} else if (strcmp(args[1], "RATEUNKNOWN") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if (value < 0) {
+					printf("Error: %s is an invalid rate limit\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::ratelimit_unknown = value;
+					printf("Rate limit per unknown station set to %i frames/s\n", value);
+				}
+			} else if (strcmp(args[1], "TRUNK") == 0) {
+				if (strcasecmp(args[2], "OFF") == 0) {
+					trunk::stop();
+					free(settings::trunk_peer);
+					settings::trunk_peer = NULL;
+					printf("Trunk closed\n");
+				} else if (trunk::start(args[2]) != 0) {
+					printf("Error: Could not open trunk to %s\n", args[2]);
+					return(0x000000FD);
+				} else {
+					free(settings::trunk_peer);
+					settings::trunk_peer = (unsigned char *)strdup(args[2]);
+				}
+			} else if (strcmp(args[1], "MULTICAST") == 0) {
+				if (strcasecmp(args[2], "OFF") == 0) {
+					aun::setMulticast(NULL, NULL);
+					free(settings::multicast_group);
+					settings::multicast_group = NULL;
+					printf("Broadcasts are now sent to every station\n");
+				} else if (aun::setMulticast(args[2], (const char *) settings::multicast_interface) != 0) {
+					printf("Error: Could not send broadcasts to %s\n", args[2]);
+					return(0x000000FD);
+				} else {
+					free(settings::multicast_group);
+					settings::multicast_group = (unsigned char *)strdup(args[2]);
+				}
+			} else if (strcmp(args[1], "MULTICASTIF") == 0) {
+				if ((settings::multicast_group != NULL) && (aun::setMulticast((const char *) settings::multicast_group, args[2]) != 0)) {
+					printf("Error: Could not send broadcasts on interface %s\n", args[2]);
+					return(0x000000FD);
+				}
+				free(settings::multicast_interface);
+				settings::multicast_interface = (unsigned char *)strdup(args[2]);
+				printf("Multicast interface set to %s\n", args[2]);
+			} else if (strcmp(args[1], "TRUNKDELAY") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if ((value < 0) || (value > 1000000)) {
+					printf("Error: %s is an invalid trunk delay\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::trunk_delay = value;
+					printf("Trunk delay set to %ius\n", value);
+				}
+			} else if (strcmp(args[1], "BCASTDELAY") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if ((value < 0) || (value > 1000000)) {
+					printf("Error: %s is an invalid broadcast load delay\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::bcastload_delay = value;
+					printf("Broadcast load delay set to %ius\n", value);
+				}
+			} else if (strcmp(args[1], "DIRCACHE") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if ((value < 0) || (value > 1048576)) {
+					printf("Error: %s is an invalid directory cache size\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::dircache_size = (size_t) value * 1024;
+					printf("Directory cache size set to %iK\n", value);
+				}
+			} else if (strcmp(args[1], "TRUNKCOMPRESS") == 0) {
+				strtoupper(args[2]);
+				if (strcmp(args[2], "ON") == 0) {
+#if (FILESTORE_HAS_ZLIB == 1)
+					settings::trunk_compression = true;
+					printf("Trunk compression is now on\n");
+#else
+					printf("Error: FileStore was built without zlib, so trunk compression isn't available\n");
+					return(0x000000FD);
+#endif
+				} else if (strcmp(args[2], "OFF") == 0) {
+					settings::trunk_compression = false;
+					printf("Trunk compression is now off\n");
+				} else {
+					return(-2);
+				}
+			} else if (strcmp(args[1], "METAINDEX") == 0) {
+				strtoupper(args[2]);
+				if (strcmp(args[2], "ON") == 0) {
+					settings::metaindex = true;
+					printf("Metadata index is now on\n");
+				} else if (strcmp(args[2], "OFF") == 0) {
+					settings::metaindex = false;
+					printf("Metadata index is now off\n");
+				} else {
+					return(-2);
+				}
+			} else if (strcmp(args[1], "TRUNKSEGMENT") == 0) {
+				strtoupper(args[2]);
+				if (strcmp(args[2], "ON") == 0) {
+					settings::trunk_segmentation = true;
+					printf("Trunk segmentation is now on\n");
+				} else if (strcmp(args[2], "OFF") == 0) {
+					settings::trunk_segmentation = false;
+					printf("Trunk segmentation is now off\n");
+				} else {
+					return(-2);
+				}
+			} else if (strcmp(args[1], "TRUNKTHRESHOLD") == 0) {
+				value = strtol(args[2], NULL, 10);
+				if ((value < 0) || (value > ECONET_MAX_FRAMESIZE)) {
+					printf("Error: %s is an invalid compression threshold\n", args[2]);
+					return(0x000000FD);
+				} else {
+					settings::trunk_threshold = value;
+					printf("Trunk compression threshold set to %i bytes\n", value);
+				}
 			} else if (strcmp(args[1], "PRINTQUEUE") == 0) {
 				if (!(fp_printer = fopen(args[2], "w"))) {
 					printf("Error: Could not open %s\n", args[2]);
@@ -384,6 +617,28 @@ namespace cli {
 		}
 	}
 
+	int metaindex(int argv, char **args) {
+		int result;
+
+		if (argv == 3) {
+			strtoupper(args[1]);
+			if (strcmp(args[1], "IMPORT") == 0) {
+				if ((result = nativefs::importINF(args[2])) == -1)
+					return(0x000000D6);
+				printf("Imported %i .INF files into the index of %s\n", result, args[2]);
+			} else if (strcmp(args[1], "EXPORT") == 0) {
+				if ((result = nativefs::exportINF(args[2])) == -1)
+					return(0x000000D6);
+				printf("Exported %i .INF files from the index of %s\n", result, args[2]);
+			} else {
+				return(-2);
+			}
+		} else {
+			return(-2);
+		}
+		return(0);
+	}
+
 	int mount(int argv, char **args) {
 		if (argv == 3) {
 			return (netfs::mount(strtol(args[1], NULL, 10), args[2]));
@@ -436,6 +691,64 @@ namespace cli {
 		return(0);
 	}
 
+	int netstats(int argv, __attribute__((__unused__))char **args) {
+		trunk::Stats trunkstats;
+		dircache::Stats dirstats;
+		dentries::Stats pathstats;
+		int n, s;
+
+		if (argv == 1) {
+			printf("Dropped frames\n");
+			printf("  Worker queue full       %u\n", workers::dropped());
+			printf("  Rate limited stations   %u\n", ratelimit::droppedKnown());
+			printf("  Unknown stations        %u\n", ratelimit::droppedUnknown());
+			printf("  Unroutable              %u\n", routes::unroutable());
+			printf("  Forged bridged frames   %u\n", routes::rejected());
+			printf("  Suppressed broadcasts   %u\n", broadcasts::suppressed());
+			printf("Forwarded frames          %u\n", routes::forwarded());
+			printf("Resent replies            %u\n", retransmit::resent());
+			printf("Unacknowledged replies    %u\n", retransmit::failed());
+			dircache::getStats(&dirstats);
+			printf("Directory cache           %u hits, %u misses, %u invalidated, %u evicted\n", dirstats.hits, dirstats.misses, dirstats.invalidations, dirstats.evictions);
+			printf("Cached directories        %u (%zu bytes)\n", dirstats.directories, dirstats.bytes);
+			dentries::getStats(&pathstats);
+			printf("Path name cache           %u hits (%u not found), %u misses, %u invalidated\n", pathstats.hits, pathstats.negatives, pathstats.misses, pathstats.invalidations);
+			printf("Cached path names         %u\n", pathstats.entries);
+			if (trunk::active() == true) {
+				trunk::getStats(&trunkstats);
+				printf("\nTrunk       Frames  Datagrams\n");
+				printf("Sent        %6u  %9u\n", trunkstats.tx_frames, trunkstats.tx_datagrams);
+				printf("Received    %6u  %9u\n", trunkstats.rx_frames, trunkstats.rx_datagrams);
+				printf("Invalid datagrams   %u\n", trunkstats.rx_invalid);
+				if (trunkstats.peer_compression == true)
+					printf("Compression         on\n");
+				else
+					printf("Compression         off (other bridge can't decompress)\n");
+				if (trunkstats.tx_bytes != 0)
+					printf("Compression ratio   %llu -> %llu bytes (%.1f%%)\n", (unsigned long long) trunkstats.tx_bytes, (unsigned long long) trunkstats.tx_compressed, (100.0 * trunkstats.tx_compressed) / trunkstats.tx_bytes);
+				printf("Not compressed      %u frames\n", trunkstats.tx_uncompressed);
+				printf("CPU time            %llums compressing, %llums decompressing\n", (unsigned long long) trunkstats.compress_time / 1000, (unsigned long long) trunkstats.decompress_time / 1000);
+				printf("Path MTU            %u\n", trunkstats.pmtu);
+				printf("Segmented frames    %u sent in %u segments, %u segments resent\n", trunkstats.tx_segmented, trunkstats.tx_segments, trunkstats.tx_resent);
+				printf("Reassembled frames  %u, %u expired, %u times asked for missing segments\n", trunkstats.rx_reassembled, trunkstats.rx_expired, trunkstats.rx_nacks);
+			}
+			printf("\nBridge pipe  Queued  Dropped\n");
+			for (n = 0; n < BRIDGE_PIPES; n++)
+				printf("%-11s  %6u  %7u\n", bridge_pipe[n], bridge::occupancy(n), bridge::dropped(n));
+			printf("\nNet:Stn  Rate limited\n");
+			for (n = 0; n < 127; n++) {
+				for (s = 0; s < 255; s++) {
+					if (ratelimit::dropped(n, s) != 0)
+						printf("%3d:%3d  %u\n", n, s, ratelimit::dropped(n, s));
+				}
+			}
+		} else {
+			return(-2);
+		}
+
+		return(0);
+	}
+
 	int newuser(int argv, char **args) {
 		char *password1, *password2;
 
@@ -554,6 +867,23 @@ namespace cli {
 		return(0);
 	}
 
+	int routes(int argv, __attribute__((__unused__))char **args) {
+		routes::Route list[256];
+		uint8_t networks[256];
+		int i, total;
+
+		if (argv == 1) {
+			printf("Net  Via     Next hop  Hops  Updated\n");
+			total = routes::snapshot(networks, list, 256);
+			for (i = 0; i < total; i++)
+				printf("%3d  %-6s  %3d:%3d   %4d  %lis ago\n", networks[i], route_interface[list[i].via], list[i].network, list[i].station, list[i].hops, (long) (time(NULL) - list[i].updated));
+		} else {
+			return(-2);
+		}
+
+		return(0);
+	}
+
 	int sessions(int argv, char **args) {
 		char flags[MAX_USER_FLAGS];
 		char buffer[BUFFER_LENGTH];
@@ -565,6 +895,7 @@ namespace cli {
 			printf("List all users. Mask = %s\n", args[1]);
 
 			printf("UsrId  Net:Stn  Username    Flags   Login time\n");
+			std::lock_guard<std::mutex> lock(users::sessions_lock);
 			for (i = 0; i < users::totalSessions; i++) {
 				users::getUserFlags(users::sessions[i].user_id, flags);
 				timeinfo = localtime (&users::sessions[i].login_time);
@@ -599,8 +930,11 @@ namespace cli {
 	}
 
 	int stations(__attribute__((__unused__))int argv, __attribute__((__unused__))char **args) {
+		peers::Peer learned[FILESTORE_PEERS_MAX];
+		links::Link link;
 		char ipstr[BUFFER_LENGTH];
-		int n, s;
+		unsigned short port;
+		int n, s, i, total;
 
 		if (argv == 1) {
 			printf("Net:Stn  Type      IP Address                  Port   Fingerprint\n");
@@ -627,6 +961,30 @@ namespace cli {
 					printf("%3d:%3d  %-8s  %-26s  %-5d  %s\n", n, s, station_type[stations::stations[n][s].type], ipstr, stations::stations[n][s].port, stations::stations[n][s].fingerprint);
 				}
 			}
+
+			/* Stations which were learned from received frames */
+			total = peers::snapshot(learned, FILESTORE_PEERS_MAX);
+			for (i = 0; i < total; i++) {
+				if (learned[i].addr.ss_family == AF_INET6) {
+					inet_ntop(AF_INET6, &((struct sockaddr_in6 *) &learned[i].addr)->sin6_addr, ipstr, sizeof(ipstr));
+					port = ntohs(((struct sockaddr_in6 *) &learned[i].addr)->sin6_port);
+				} else {
+					inet_ntop(AF_INET, &((struct sockaddr_in *) &learned[i].addr)->sin_addr, ipstr, sizeof(ipstr));
+					port = ntohs(((struct sockaddr_in *) &learned[i].addr)->sin_port);
+				}
+				printf("%3d:%3d  %-8s  %-26s  %-5d  %lis ago\n", learned[i].network, learned[i].station, "Learned", ipstr, port, (long) (time(NULL) - learned[i].lastseen));
+			}
+
+			/* Link quality of every station we've heard from */
+			printf("\nNet:Stn  SRTT(ms)  RTTVAR(ms)  RTO(ms)  Backoff  Frames  Retries  Timeouts  Block\n");
+			for (n = 0; n < 127; n++) {
+				for (s = 0; s < 255; s++) {
+					if (links::lookup(n, s, &link) == false)
+						continue;
+					printf("%3d:%3d  %8.1f  %10.1f  %7.1f  %7u  %6u  %7u  %8u  %5u\n", n, s, link.srtt / 1000.0, link.rttvar / 1000.0,
+					    links::rto(n, s) / 1000.0, link.backoff, link.frames, link.retries, link.timeouts, link.blocksize);
+				}
+			}
 		} else {
 			return(-2);
 		}
@@ -734,6 +1092,7 @@ namespace cli {
 void netmonPrintFrame(const char *interface, bool tx, econet::Frame *frame, int size) {
 	const uint8_t chars_per_line = 16;
 	int i, offset;
+	std::lock_guard<std::mutex> lock(netmon_lock);
 
 	printf("          Offs  Tr Po Ct Rt -Sequence--\n");
 
@@ -29,6 +29,7 @@ namespace cli {
 	extern unsigned int user_id;
 
 	int access(int argv, char **args);
+	int broadcastload(int argv, char **args);
 	int cat(int argv, char **args);
 	int cdir(int argv, char **args);
 	int clock(int argv, char **args);
@@ -44,8 +45,10 @@ namespace cli {
 	int info(int argv, char **args);
 	int login(int argv, char **args);
 	int logout(int argv, char **args);
+	int metaindex(int argv, char **args);
 	int mount(int argv, char **args);
 	int netmon(int argv, char **args);
+	int netstats(int argv, char **args);
 	int newuser(int argv, char **args);
 	int notify(int argv, char **args);
 	int pass(int argv, char **args);
@@ -53,6 +56,7 @@ namespace cli {
 	int priv(int argv, char **args);
 	int remuser(int argv, char **args);
 	int rename(int argv, char **args);
+	int routes(int argv, char **args);
 	int sessions(int argv, char **args);
 	int star_time(int argv, char **args);
 	int stations(int argv, char **args);
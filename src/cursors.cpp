@@ -0,0 +1,148 @@
+/* cursors.cpp
+ * Snapshots of directory catalogues for stations which read a directory in parts
+ *
+ * An Examine request only returns a few entries of a directory, so a
+ * station reads a large directory with many requests, each one starting at
+ * the entry after the last one it got. Reading the directory again for every
+ * request would cost O(n²), and the entries could move between requests when
+ * the directory changes.
+ *
+ * So the first request takes a sorted snapshot of the catalogue (only the
+ * entries which match the mask), which is kept for the station until it has
+ * read all of it. Follow-up requests are
+ * answered from the snapshot. A snapshot is dropped when the cycle number of
+ * the directory in the directory cache changes (the directory was changed),
+ * when it isn't used for FILESTORE_CURSOR_TIMEOUT, or when the station logs
+ * off. A directory which isn't in the directory cache has no cycle number, so
+ * no snapshot is kept for it.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstring>		// strcmp(), strlcpy()
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::lock_guard
+
+#include "cursors.h"		// Header file for this code
+#include "dircache.h"		// dircache::cycle(), dircache::hashPath()
+#include "fsdir.h"		// fsdir::append(), fsdir::release()
+
+using namespace std;
+
+
+
+namespace cursors {
+	Cursor		cursors[FILESTORE_CURSORS];
+	std::mutex	cursors_lock;			// Protects cursors[]
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	/* Drop a snapshot; the caller must hold cursors_lock */
+	void drop(Cursor *cursor) {
+		fsdir::release(&cursor->entries);
+		cursor->used = false;
+	}
+
+	/* Find the snapshot of a directory which a station is reading; the caller must hold cursors_lock */
+	Cursor *find(uint8_t network, uint8_t station, const char *localpath, uint32_t hash, const char *mask) {
+		int i;
+
+		for (i = 0; i < FILESTORE_CURSORS; i++) {
+			if ((cursors[i].used == true) && (cursors[i].network == network) && (cursors[i].station == station) && (cursors[i].hash == hash) && (strcmp(cursors[i].path, localpath) == 0) && (strcmp(cursors[i].mask, mask) == 0))
+				return &cursors[i];
+		}
+		return NULL;
+	}
+
+	/* Add entries from the snapshot of a directory which a station is reading to a listing; returns the number of entries added, or -1 if there's no valid snapshot */
+	int read(uint8_t network, uint8_t station, const char *localpath, const char *mask, FSDirectory *dir, int startentry, int numentries) {
+		Cursor *cursor;
+		uint64_t cycle, t;
+		int count;
+
+		cycle = dircache::cycle(localpath);
+		t = now();
+
+		std::lock_guard<std::mutex> lock(cursors_lock);
+		if ((cursor = find(network, station, localpath, dircache::hashPath(localpath), mask)) == NULL)
+			return -1;
+
+		/* The directory changed, or the station didn't continue in time: the snapshot is stale */
+		if ((cursor->cycle != cycle) || (cursor->expires < t)) {
+			drop(cursor);
+			return -1;
+		}
+
+		count = fsdir::append(dir, &cursor->entries, startentry, numentries);
+
+		/* The station has read the whole directory */
+		cursor->next = startentry + count;
+		if (cursor->next >= cursor->entries.count) {
+			drop(cursor);
+		} else {
+			cursor->expires = t + FILESTORE_CURSOR_TIMEOUT;
+		}
+		return count;
+	}
+
+	/* Keep a snapshot of a directory for a station which will read the rest of it later; takes over entries */
+	void open(uint8_t network, uint8_t station, const char *localpath, const char *mask, uint64_t cycle, FSDirectory *entries, int next) {
+		Cursor *cursor;
+		uint32_t hash;
+		uint64_t t;
+		int i;
+
+		/* Nothing left to read, or there's no way to tell when the directory changes */
+		if ((next >= entries->count) || (cycle == 0) || (strlen(localpath) >= PATH_MAX) || (strlen(mask) >= FILESTORE_WILDCARD_LEN)) {
+			fsdir::release(entries);
+			return;
+		}
+
+		hash = dircache::hashPath(localpath);
+		t = now();
+
+		std::lock_guard<std::mutex> lock(cursors_lock);
+		if ((cursor = find(network, station, localpath, hash, mask)) == NULL) {
+			/* Use a free slot or an expired one, or else the one which expires first */
+			for (i = 0; i < FILESTORE_CURSORS; i++) {
+				if ((cursors[i].used == false) || (cursors[i].expires < t))
+					break;
+				if ((cursor == NULL) || (cursors[i].expires < cursor->expires))
+					cursor = &cursors[i];
+			}
+			if (i < FILESTORE_CURSORS)
+				cursor = &cursors[i];
+		}
+		if (cursor->used == true)
+			drop(cursor);
+
+		cursor->used = true;
+		cursor->network = network;
+		cursor->station = station;
+		strlcpy(cursor->path, localpath, sizeof(cursor->path));
+		cursor->hash = hash;
+		strlcpy(cursor->mask, mask, sizeof(cursor->mask));
+		cursor->cycle = cycle;
+		cursor->entries = *entries;
+		cursor->next = next;
+		cursor->expires = t + FILESTORE_CURSOR_TIMEOUT;
+	}
+
+	/* Drop all snapshots of a station */
+	void close(uint8_t network, uint8_t station) {
+		int i;
+
+		std::lock_guard<std::mutex> lock(cursors_lock);
+		for (i = 0; i < FILESTORE_CURSORS; i++) {
+			if ((cursors[i].used == true) && (cursors[i].network == network) && (cursors[i].station == station))
+				drop(&cursors[i]);
+		}
+	}
+}
+
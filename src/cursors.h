@@ -0,0 +1,40 @@
+/* cursors.h
+ * Snapshots of directory catalogues for stations which read a directory in parts
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_CURSORS_HEADER
+#define ECONET_CURSORS_HEADER
+
+#include <cstdint>			// uint8_t, uint32_t, uint64_t
+
+#include "netfs.h"			// FSDirectory
+#include "platforms/platform.h"		// PATH_MAX
+#include "wildcard.h"			// FILESTORE_WILDCARD_LEN
+
+#define FILESTORE_CURSORS		64		// Maximum number of stations which can read a directory in parts at the same time
+#define FILESTORE_CURSOR_TIMEOUT	30000000	// Number of microseconds after which an unused snapshot is dropped
+
+namespace cursors {
+	/* Snapshot of a directory which a station is reading in parts */
+	typedef struct {
+		bool		used;
+		uint8_t		network;		// Station which reads the directory
+		uint8_t		station;
+		char		path[PATH_MAX];		// Native path of the directory
+		uint32_t	hash;			// Hash of the path, to find it quickly
+		char		mask[FILESTORE_WILDCARD_LEN];	// Mask which selected the entries
+		uint64_t	cycle;			// Cycle number of the directory when the snapshot was taken
+		FSDirectory	entries;		// Sorted catalogue of the directory
+		int		next;			// Entry which the station is expected to ask for next
+		uint64_t	expires;		// When the snapshot is dropped if it isn't used anymore (in microseconds)
+	} Cursor;
+
+	int		read(uint8_t network, uint8_t station, const char *localpath, const char *mask, FSDirectory *dir, int startentry, int numentries);
+	void		open(uint8_t network, uint8_t station, const char *localpath, const char *mask, uint64_t cycle, FSDirectory *entries, int next);
+	void		close(uint8_t network, uint8_t station);
+}
+
+#endif
+
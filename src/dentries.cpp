@@ -0,0 +1,270 @@
+/* dentries.cpp
+ * Cache of the native objects which Acorn path names resolve to
+ *
+ * Every NetFS call with a file name has to turn an Acorn path such as
+ * $.LIB.FOO into a native path, one component at a time: find the object in
+ * the directory regardless of case, and find out whether it's a directory so
+ * the path can continue. Looking up a name means reading the directory, so
+ * the result is cached per (native parent directory, upper case name). Names
+ * which don't exist are cached too, as stations often look for files which
+ * aren't there (e.g. a command in the CSD before the library).
+ *
+ * The cache is set associative: a name can only be in one of the
+ * FILESTORE_DENTRY_WAYS entries of the set its hash points to, and replaces
+ * the least recently used one. Its size is fixed.
+ *
+ * A directory is watched by the directory cache before names are looked up
+ * in it. dircache calls invalidate() when the directory changes or isn't
+ * watched anymore, which drops all names in it. A lookup which overlaps with
+ * an invalidation isn't stored, as it may have read the directory before the
+ * change.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <cctype>		// toupper()
+#include <cstdio>		// snprintf()
+#include <cstring>		// strcmp(), strlcpy(), strlen(), strrchr()
+#include <mutex>		// std::mutex, std::lock_guard
+
+#include "dentries.h"		// Header file for this code
+#include "dircache.h"		// dircache::watch(), dircache::hashPath()
+#include "nativefs.h"		// nativefs::lookup(), nativefs::directorypath(), FILESTORE_NATIVE_ROOT
+#include "users.h"		// users::getDirectory(), SESSION_URD, SESSION_CSD, SESSION_LIB
+
+using namespace std;
+
+
+
+namespace dentries {
+	Dentry			dentries[FILESTORE_DENTRY_SETS][FILESTORE_DENTRY_WAYS];
+	std::mutex		dentries_lock;		// Protects dentries[], tick and epoch
+	uint64_t		tick = 0;
+	uint64_t		epoch = 0;		// Changes with every invalidation
+	std::atomic<uint32_t>	hits(0), negatives(0), misses(0), invalidations(0);
+
+	/* Continue the FNV-1a hash of a parent directory with a name */
+	uint32_t hashName(uint32_t hash, const char *name) {
+		while (*name != '\0') {
+			hash ^= (uint8_t) *name++;
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	/* Find the native name of an object in a directory, from the cache or else from disc; returns false if it doesn't exist */
+	bool lookup(const char *parent, const char *name, char *native, bool *directory) {
+		Dentry *set, *dentry;
+		uint32_t parenthash, hash;
+		uint64_t started;
+		bool found, cacheable;
+		int i;
+
+		parenthash = dircache::hashPath(parent);
+		hash = hashName(parenthash, name);
+		set = dentries[hash % FILESTORE_DENTRY_SETS];
+
+		{
+			std::lock_guard<std::mutex> lock(dentries_lock);
+			for (i = 0; i < FILESTORE_DENTRY_WAYS; i++) {
+				dentry = &set[i];
+				if ((dentry->used == false) || (dentry->hash != hash) || (strcmp(dentry->name, name) != 0) || (strcmp(dentry->parent, parent) != 0))
+					continue;
+
+				dentry->lastused = ++tick;
+				hits++;
+				if (dentry->exists == false) {
+					negatives++;
+					return false;
+				}
+				strlcpy(native, dentry->native, NAME_MAX + 1);
+				*directory = dentry->directory;
+				return true;
+			}
+		}
+
+		/* Watch the directory before reading it, so a change while it's read isn't missed */
+		misses++;
+		cacheable = ((strlen(parent) < FILESTORE_DENTRY_PATH) && (dircache::watch(parent) == true));
+		{
+			std::lock_guard<std::mutex> lock(dentries_lock);
+			started = epoch;
+		}
+
+		*directory = false;
+		found = nativefs::lookup(parent, name, native, directory);
+		if ((cacheable == false) || ((found == true) && (strlen(native) >= FILESTORE_DENTRY_NATIVE)))
+			return found;
+
+		std::lock_guard<std::mutex> lock(dentries_lock);
+		if (epoch != started)
+			return found;
+
+		/* Use a free entry in the set, or else the least recently used one */
+		dentry = &set[0];
+		for (i = 0; i < FILESTORE_DENTRY_WAYS; i++) {
+			if (set[i].used == false) {
+				dentry = &set[i];
+				break;
+			}
+			if (set[i].lastused < dentry->lastused)
+				dentry = &set[i];
+		}
+
+		dentry->used = true;
+		dentry->exists = found;
+		dentry->directory = (found == true) ? *directory : false;
+		dentry->hash = hash;
+		dentry->parenthash = parenthash;
+		strlcpy(dentry->parent, parent, sizeof(dentry->parent));
+		strlcpy(dentry->name, name, sizeof(dentry->name));
+		strlcpy(dentry->native, (found == true) ? native : "", sizeof(dentry->native));
+		dentry->lastused = ++tick;
+		return found;
+	}
+
+	/* Get the next component of an Acorn path in upper case; returns its length, or -1 if it's too long */
+	int component(const char **fsp, char *name) {
+		int length;
+
+		length = 0;
+		while ((**fsp != '\0') && (**fsp != '\r') && (**fsp != ' ') && (**fsp != '.')) {
+			if (length == ECONET_MAX_FILENAME_LEN)
+				return -1;
+			name[length++] = toupper((unsigned char) **fsp);
+			(*fsp)++;
+		}
+		name[length] = '\0';
+		if (**fsp == '.')
+			(*fsp)++;
+		return length;
+	}
+
+	/* Resolve an Acorn path of a station to a native path; returns 0, or an Acorn error code */
+	int resolve(uint8_t network, uint8_t station, const char *fsp, char *localpath, bool *directory) {
+		char name[ECONET_MAX_FILENAME_LEN + 1];
+		char native[NAME_MAX + 1];
+		const char *next;
+		char *slash;
+		size_t length;
+		uint8_t which;
+		int dir;
+
+		/* There's only one native disc, so a disc name just means the path starts at the root */
+		which = SESSION_CSD;
+		if (*fsp == ':') {
+			while ((*fsp != '\0') && (*fsp != '\r') && (*fsp != ' ') && (*fsp != '.'))
+				fsp++;
+			if (*fsp == '.')
+				fsp++;
+			which = 0xFF;
+		}
+
+		/* The first component may select the directory the path starts from */
+		next = fsp;
+		if (component(&next, name) == 1) {
+			switch (name[0]) {
+				case '$' :
+					which = 0xFF;
+					fsp = next;
+					break;
+				case '&' :
+					which = SESSION_URD;
+					fsp = next;
+					break;
+				case '@' :
+					which = SESSION_CSD;
+					fsp = next;
+					break;
+				case '%' :
+					which = SESSION_LIB;
+					fsp = next;
+					break;
+			}
+		}
+
+		dir = (which == 0xFF) ? nativefs::rootdirectory() : users::getDirectory(network, station, which);
+		if (nativefs::directorypath(dir, localpath) == false) {
+			nativefs::closedirectory(dir);
+			return 0x000000D6;
+		}
+		nativefs::closedirectory(dir);
+
+		*directory = true;
+		while ((*fsp != '\0') && (*fsp != '\r') && (*fsp != ' ')) {
+			if (component(&fsp, name) <= 0)
+				return 0x000000CC;		// Bad file name
+
+			/* The parent directory, which never goes above the root */
+			if (strcmp(name, "^") == 0) {
+				if ((strlen(localpath) > strlen(FILESTORE_NATIVE_ROOT)) && ((slash = strrchr(localpath, '/')) != NULL))
+					*slash = '\0';
+				continue;
+			}
+
+			/* Only a directory can have objects in it */
+			if ((*directory == false) || (lookup(localpath, name, native, directory) == false))
+				return 0x000000D6;		// Not found
+
+			length = strlen(localpath);
+			if (snprintf(localpath + length, PATH_MAX - length, "/%s", native) >= (int) (PATH_MAX - length))
+				return 0x000000CC;
+		}
+		return 0;
+	}
+
+	/* Drop all names in a directory which changed */
+	void invalidate(const char *parent) {
+		uint32_t parenthash;
+		int i, j;
+
+		parenthash = dircache::hashPath(parent);
+		std::lock_guard<std::mutex> lock(dentries_lock);
+		epoch++;
+		for (i = 0; i < FILESTORE_DENTRY_SETS; i++) {
+			for (j = 0; j < FILESTORE_DENTRY_WAYS; j++) {
+				if ((dentries[i][j].used == true) && (dentries[i][j].parenthash == parenthash) && (strcmp(dentries[i][j].parent, parent) == 0)) {
+					dentries[i][j].used = false;
+					invalidations++;
+				}
+			}
+		}
+	}
+
+	/* Drop all names, e.g. when changes may have been missed */
+	void invalidateAll(void) {
+		int i, j;
+
+		std::lock_guard<std::mutex> lock(dentries_lock);
+		epoch++;
+		for (i = 0; i < FILESTORE_DENTRY_SETS; i++) {
+			for (j = 0; j < FILESTORE_DENTRY_WAYS; j++) {
+				if (dentries[i][j].used == true) {
+					dentries[i][j].used = false;
+					invalidations++;
+				}
+			}
+		}
+	}
+
+	/* Get the cache statistics */
+	void getStats(Stats *stats) {
+		int i, j;
+
+		stats->hits = hits;
+		stats->negatives = negatives;
+		stats->misses = misses;
+		stats->invalidations = invalidations;
+
+		std::lock_guard<std::mutex> lock(dentries_lock);
+		stats->entries = 0;
+		for (i = 0; i < FILESTORE_DENTRY_SETS; i++) {
+			for (j = 0; j < FILESTORE_DENTRY_WAYS; j++) {
+				if (dentries[i][j].used == true)
+					stats->entries++;
+			}
+		}
+	}
+}
+
@@ -0,0 +1,50 @@
+/* dentries.h
+ * Cache of the native objects which Acorn path names resolve to
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_DENTRIES_HEADER
+#define ECONET_DENTRIES_HEADER
+
+#include <cstdint>			// uint8_t, uint32_t, uint64_t
+
+#include "main.h"			// ECONET_MAX_FILENAME_LEN
+#include "platforms/platform.h"		// PATH_MAX
+
+#define FILESTORE_DENTRY_SETS		256		// Number of sets in the cache; a name can only be cached in the set its hash points to
+#define FILESTORE_DENTRY_WAYS		4		// Number of names in every set
+#define FILESTORE_DENTRY_PATH		256		// Maximum length of the native path of a directory whose names are cached, including the terminating NUL
+#define FILESTORE_DENTRY_NATIVE		64		// Maximum length of a cached native name, including the terminating NUL
+
+namespace dentries {
+	/* One name in a native directory, which either exists or is known not to exist */
+	typedef struct {
+		bool		used;
+		bool		exists;					// false for a negative entry: there's no object with this name
+		bool		directory;				// The object is a directory
+		uint32_t	hash;					// Hash of the parent and the name, to find it quickly
+		uint32_t	parenthash;				// Hash of the parent, to invalidate all names in it quickly
+		char		parent[FILESTORE_DENTRY_PATH];		// Native path of the directory which holds the object
+		char		name[ECONET_MAX_FILENAME_LEN + 1];	// Acorn name of the object, in upper case
+		char		native[FILESTORE_DENTRY_NATIVE];	// Native name of the object
+		uint64_t	lastused;				// When the name was used last, to find the least recently used one in its set
+	} Dentry;
+
+	/* Cache statistics */
+	typedef struct {
+		uint32_t	hits;			// Number of names found in the cache
+		uint32_t	negatives;		// Number of hits on names which don't exist
+		uint32_t	misses;			// Number of names looked up on disc
+		uint32_t	invalidations;		// Number of cached names dropped because their directory changed
+		uint32_t	entries;		// Number of names in the cache
+	} Stats;
+
+	int		resolve(uint8_t network, uint8_t station, const char *fsp, char *localpath, bool *directory);
+	void		invalidate(const char *parent);
+	void		invalidateAll(void);
+	void		getStats(Stats *stats);
+}
+
+#endif
+
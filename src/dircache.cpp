@@ -0,0 +1,362 @@
+/* dircache.cpp
+ * Cache of the catalogues of native directories, kept up to date with inotify
+ *
+ * Reading a native directory means a readdir() of the whole directory, a
+ * stat() and an .INF file for every entry. Stations ask for the same
+ * catalogues over and over again (*CAT, *EX and every Examine while walking
+ * a directory), so the parsed catalogue of every directory which was read
+ * is kept in memory.
+ *
+ * Every cached directory has an inotify watch. Any change to the directory
+ * or to one of its entries drops the catalogue, so the next request reads it
+ * from disc again. A catalogue which was being read from disc while the
+ * directory changed is never stored: begin() hands out a ticket with the
+ * generation of the directory before it is read, and store() only accepts
+ * the catalogue if the generation didn't change in the meantime. The
+ * generation of a cached catalogue is its cycle number: it changes whenever
+ * the directory changes, so a snapshot of a catalogue can tell whether it's
+ * still current.
+ *
+ * All catalogues together use at most settings::dircache_size bytes; the
+ * least recently used ones are dropped first.
+ *
+ * The path resolution cache (dentries) uses the same watches: a directory
+ * which it looked up names in is watched with watch(), and any change to it
+ * or losing its watch also drops the cached names in it. The same goes for
+ * the translated file names of a directory (nametrans).
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <cstdio>		// fprintf()
+#include <cstring>		// strcmp(), strlcpy()
+#include <mutex>		// std::mutex, std::lock_guard
+#include <poll.h>		// poll()
+#include <sys/inotify.h>	// inotify_init1(), inotify_add_watch(), inotify_rm_watch()
+#include <thread>		// std::thread
+#include <unistd.h>		// read(), close()
+
+#include "dentries.h"		// dentries::invalidate(), dentries::invalidateAll()
+#include "dircache.h"		// Header file for this code
+#include "fsdir.h"		// fsdir::init(), fsdir::release(), fsdir::append(), fsdir::bytes()
+#include "main.h"		// bye
+#include "nametrans.h"		// nametrans::invalidate(), nametrans::invalidateAll()
+#include "settings.h"		// settings::dircache_size
+
+using namespace std;
+
+
+
+namespace dircache {
+	Directory		directories[FILESTORE_DIRCACHE_SLOTS];
+	std::mutex		directories_lock;		// Protects directories[], total_bytes, tick and last_generation
+	size_t			total_bytes = 0;
+	uint64_t		tick = 0;
+	uint64_t		last_generation = 0;
+	int			inotify_fd = -1;
+	std::thread		thread_inotify;
+	std::atomic<uint32_t>	hits(0), misses(0), invalidations(0), evictions(0);
+
+	/* FNV-1a hash of a path */
+	uint32_t hashPath(const char *path) {
+		uint32_t hash = 2166136261u;
+
+		while (*path != '\0') {
+			hash ^= (uint8_t) *path++;
+			hash *= 16777619u;
+		}
+		return hash;
+	}
+
+	/* Find the slot of a directory; the caller must hold directories_lock */
+	int find(const char *localpath, uint32_t hash) {
+		int i;
+
+		for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+			if ((directories[i].used == true) && (directories[i].hash == hash) && (strcmp(directories[i].path, localpath) == 0))
+				return i;
+		}
+		return -1;
+	}
+
+	/* Drop the catalogue of a directory, but keep watching it; the caller must hold directories_lock */
+	void drop(Directory *directory) {
+		fsdir::release(&directory->catalogue);
+		directory->cached = false;
+		total_bytes -= directory->bytes;
+		directory->bytes = 0;
+		directory->generation = ++last_generation;
+	}
+
+	/* Forget a directory completely; the caller must hold directories_lock */
+	void release(Directory *directory) {
+		drop(directory);
+		dentries::invalidate(directory->path);
+		nametrans::invalidate(directory->path);
+		if ((directory->wd != -1) && (inotify_fd != -1))
+			inotify_rm_watch(inotify_fd, directory->wd);
+		directory->wd = -1;
+		directory->used = false;
+	}
+
+	/* Find the least recently used directory, optionally only those with a catalogue; the caller must hold directories_lock */
+	int leastRecentlyUsed(bool cached, int except) {
+		int i, lru;
+
+		lru = -1;
+		for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+			if ((i == except) || (directories[i].used == false) || ((cached == true) && (directories[i].cached == false)))
+				continue;
+			if ((lru == -1) || (directories[i].lastused < directories[lru].lastused))
+				lru = i;
+		}
+		return lru;
+	}
+
+	/* Handle the events of the inotify watches */
+	void run(void) {
+		char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+		const struct inotify_event *event;
+		struct pollfd pfd;
+		ssize_t length;
+		char *ptr;
+		int i;
+
+		pfd.fd = inotify_fd;
+		pfd.events = POLLIN;
+
+		while (bye == false) {
+			if (poll(&pfd, 1, FILESTORE_DIRCACHE_POLL) <= 0)
+				continue;
+			if ((length = read(inotify_fd, buffer, sizeof(buffer))) <= 0)
+				continue;
+
+			std::lock_guard<std::mutex> lock(directories_lock);
+			for (ptr = buffer; ptr < buffer + length; ptr += sizeof(struct inotify_event) + event->len) {
+				event = (const struct inotify_event *) ptr;
+
+				/* Events were lost: nothing in the cache can be trusted anymore */
+				if (event->mask & IN_Q_OVERFLOW) {
+					for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+						if ((directories[i].used == true) && (directories[i].cached == true))
+							invalidations++;
+						if (directories[i].used == true)
+							drop(&directories[i]);
+					}
+					dentries::invalidateAll();
+					nametrans::invalidateAll();
+					continue;
+				}
+
+				for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+					if ((directories[i].used == false) || (directories[i].wd != event->wd))
+						continue;
+					if (directories[i].cached == true)
+						invalidations++;
+
+					/* The directory itself is gone, and so is its watch */
+					if (event->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+						if (event->mask & IN_IGNORED)
+							directories[i].wd = -1;
+						release(&directories[i]);
+					} else {
+						drop(&directories[i]);
+						dentries::invalidate(directories[i].path);
+						nametrans::invalidate(directories[i].path);
+					}
+					break;
+				}
+			}
+		}
+	}
+
+	/* Start watching for changes to cached directories */
+	int start(void) {
+		if ((inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+			fprintf(stderr, "dircache::start: inotify_init1() failed; directory catalogues won't be cached.\n");
+			return -1;
+		}
+
+		thread_inotify = std::thread(run);
+		return 0;
+	}
+
+	/* Stop the inotify thread and empty the cache */
+	void stop(void) {
+		int i;
+
+		if (thread_inotify.joinable())
+			thread_inotify.join();
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+			if (directories[i].used == true)
+				release(&directories[i]);
+		}
+		if (inotify_fd != -1)
+			close(inotify_fd);
+		inotify_fd = -1;
+	}
+
+	/* Get a copy of the cached catalogue of a directory and its cycle number; returns false if the directory isn't cached */
+	bool snapshot(const char *localpath, FSDirectory *catalogue, uint64_t *cycle) {
+		Directory *directory;
+		int i;
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		if ((i = find(localpath, hashPath(localpath))) == -1)
+			return false;
+
+		directory = &directories[i];
+		if (directory->cached == false)
+			return false;
+
+		directory->lastused = ++tick;
+		hits++;
+
+		fsdir::init(catalogue);
+		fsdir::append(catalogue, &directory->catalogue, 0, directory->catalogue.count);
+		*cycle = directory->generation;
+		return true;
+	}
+
+	/* Get the cycle number of a cached directory, which changes whenever the directory changes; returns 0 if it isn't cached */
+	uint64_t cycle(const char *localpath) {
+		int i;
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		if (((i = find(localpath, hashPath(localpath))) == -1) || (directories[i].cached == false))
+			return 0;
+		return directories[i].generation;
+	}
+
+	/* Find the slot of a directory, and start watching it if it isn't watched yet; returns -1 if it can't be watched. The caller must hold directories_lock */
+	int attach(const char *localpath, uint32_t hash) {
+		Directory *directory;
+		int i, wd;
+
+		if ((i = find(localpath, hash)) == -1) {
+			wd = inotify_add_watch(inotify_fd, localpath, IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+			if (wd == -1)
+				return -1;
+
+			/* Adding a watch for a path which is already watched (through another name) gives the same watch descriptor */
+			for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+				if ((directories[i].used == true) && (directories[i].wd == wd))
+					return -1;
+			}
+
+			/* Find a free slot, or reuse the least recently used one */
+			for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+				if (directories[i].used == false)
+					break;
+			}
+			if (i == FILESTORE_DIRCACHE_SLOTS) {
+				i = leastRecentlyUsed(false, -1);
+				if (directories[i].cached == true)
+					evictions++;
+				release(&directories[i]);
+			}
+
+			directory = &directories[i];
+			directory->used = true;
+			strlcpy(directory->path, localpath, sizeof(directory->path));
+			directory->hash = hash;
+			directory->wd = wd;
+			directory->cached = false;
+			fsdir::init(&directory->catalogue);
+			directory->bytes = 0;
+			directory->generation = ++last_generation;
+		}
+
+		directories[i].lastused = ++tick;
+		return i;
+	}
+
+	/* Start watching a directory; returns false if changes to it can't be noticed */
+	bool watch(const char *localpath) {
+		if ((inotify_fd == -1) || (strlen(localpath) >= PATH_MAX))
+			return false;
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		return (attach(localpath, hashPath(localpath)) != -1);
+	}
+
+	/* Start watching a directory before it's read from disc */
+	Ticket begin(const char *localpath) {
+		Ticket ticket;
+		int i;
+
+		ticket.slot = -1;
+		ticket.generation = 0;
+		misses++;
+
+		if ((inotify_fd == -1) || (settings::dircache_size == 0) || (strlen(localpath) >= PATH_MAX))
+			return ticket;
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		if ((i = attach(localpath, hashPath(localpath))) == -1)
+			return ticket;
+
+		ticket.slot = i;
+		ticket.generation = directories[i].generation;
+		return ticket;
+	}
+
+	/* Store the catalogue of a directory which was read from disc; takes over the catalogue and returns its cycle number, or 0 if it wasn't stored */
+	uint64_t store(Ticket ticket, FSDirectory *catalogue) {
+		Directory *directory;
+		size_t bytes;
+		int lru;
+
+		if (ticket.slot == -1)
+			return 0;
+
+		bytes = sizeof(Directory) + fsdir::bytes(catalogue);
+		if (bytes > settings::dircache_size)
+			return 0;
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		directory = &directories[ticket.slot];
+
+		/* The directory changed, or was dropped from the cache, while it was read */
+		if ((directory->used == false) || (directory->generation != ticket.generation))
+			return 0;
+
+		/* Make room by dropping the least recently used catalogues */
+		while (total_bytes + bytes - directory->bytes > settings::dircache_size) {
+			if ((lru = leastRecentlyUsed(true, ticket.slot)) == -1)
+				return 0;
+			drop(&directories[lru]);
+			evictions++;
+		}
+
+		drop(directory);
+		directory->catalogue = *catalogue;
+		directory->cached = true;
+		directory->bytes = bytes;
+		directory->lastused = ++tick;
+		total_bytes += bytes;
+		return directory->generation;
+	}
+
+	/* Get the cache statistics */
+	void getStats(Stats *stats) {
+		int i;
+
+		stats->hits = hits;
+		stats->misses = misses;
+		stats->invalidations = invalidations;
+		stats->evictions = evictions;
+
+		std::lock_guard<std::mutex> lock(directories_lock);
+		stats->directories = 0;
+		for (i = 0; i < FILESTORE_DIRCACHE_SLOTS; i++) {
+			if (directories[i].cached == true)
+				stats->directories++;
+		}
+		stats->bytes = total_bytes;
+	}
+}
+
@@ -0,0 +1,61 @@
+/* dircache.h
+ * Cache of the catalogues of native directories, kept up to date with inotify
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_DIRCACHE_HEADER
+#define ECONET_DIRCACHE_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t, uint64_t
+
+#include "netfs.h"			// FSDirectory
+#include "platforms/platform.h"		// PATH_MAX
+
+#define FILESTORE_DIRCACHE_SLOTS	64		// Maximum number of directories in the cache
+#define FILESTORE_DIRCACHE_POLL		100		// Number of milliseconds the inotify thread waits for events before checking if it has to stop
+
+namespace dircache {
+	/* One cached directory */
+	typedef struct {
+		bool		used;
+		char		path[PATH_MAX];		// Native path of the directory
+		uint32_t	hash;			// Hash of the path, to find it quickly
+		int		wd;			// inotify watch descriptor of the directory
+		uint64_t	generation;		// Changes every time the catalogue is filled or invalidated
+		bool		cached;			// The catalogue of the directory is cached
+		FSDirectory	catalogue;		// Catalogue of the directory
+		size_t		bytes;			// Memory used by the catalogue
+		uint64_t	lastused;		// When the catalogue was used last, to find the least recently used one
+	} Directory;
+
+	/* Ticket to fill the cache with a catalogue which was read from disc */
+	typedef struct {
+		int		slot;			// Slot which will hold the catalogue, or -1 if it can't be cached
+		uint64_t	generation;		// Generation of the slot when the directory was read
+	} Ticket;
+
+	/* Cache statistics */
+	typedef struct {
+		uint32_t	hits;			// Number of catalogues read from the cache
+		uint32_t	misses;			// Number of catalogues read from disc
+		uint32_t	invalidations;		// Number of cached catalogues dropped because the directory changed
+		uint32_t	evictions;		// Number of cached catalogues dropped to stay within the memory budget
+		uint32_t	directories;		// Number of directories in the cache
+		size_t		bytes;			// Memory used by all cached catalogues
+	} Stats;
+
+	int		start(void);
+	void		stop(void);
+	bool		snapshot(const char *localpath, FSDirectory *catalogue, uint64_t *cycle);
+	uint64_t	cycle(const char *localpath);
+	bool		watch(const char *localpath);
+	Ticket		begin(const char *localpath);
+	uint64_t	store(Ticket ticket, FSDirectory *catalogue);
+	void		getStats(Stats *stats);
+	uint32_t	hashPath(const char *path);
+}
+
+#endif
+
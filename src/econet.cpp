@@ -7,6 +7,7 @@
 #include <cstdlib>		// Included for strtol()
 #include <cstring>		// Included for memcpy(), strlen()
 #include <ctime>		// Included for time(), tm
+#include <strings.h>		// strcasecmp()
 
 #include "main.h"		// Included for bye variable
 #include "errorhandler.h"	// errorMessages[]
@@ -15,54 +16,100 @@
 #include "econet.h"		// Header file for this code
 #include "aun.h"		// Included for aun::transmitFrame()
 #include "cli.h"		// Included for commands::netmonPrintFrame()
-#include "netfs.h"		// getDiscTitle()
+#include "cursors.h"		// cursors::close()
+#include "fsdir.h"		// fsdir::init(), fsdir::release()
+#include "nativefs.h"		// nativefs::info()
+#include "netfs.h"		// getDiscTitle(), netfs::resolve(), netfs::resolveNew()
+#include "routes.h"		// routes::update(), routes::forward()
+#include "bridge.h"		// bridge::acquire(), bridge::submit(), bridge::drop()
+#include "bcastload.h"		// bcastload::protohandler(), bcastload::report()
+#include "broadcasts.h"		// broadcasts::relay()
+#include "links.h"		// links::blockSize()
+#include "workers.h"		// workers::current
 
 using namespace std;
 
 
 
 namespace econet {
-	Station known_networks[256];
 	Session sessions[ECONET_MAX_SESSIONS];
+	std::mutex session_locks[ECONET_SESSION_STRIPES];	// session_locks[n] protects sessions[n * ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES] and onwards
 	ProtoHandlers protohandlers[256] = {
 		NULL
 //		[0x99] = netfs::protohandler
 	};
-	uint8_t	printer_status = 0, printer_network = 0, printer_station = 0;
-	uint8_t	port99save_replyport = 0;
+	std::atomic<uint8_t>	printer_status(0), printer_network(0), printer_station(0);
+	std::atomic<uint8_t>	port99save_replyport(0);
+	std::mutex		printer_lock;		// Protects fp_printbuffer; only one print job can be active at a time
 	FILE	*fp_printbuffer;
-	bool	netmon;
+	std::atomic<bool>	netmon;
+
+	/* Register the handlers for all supported ports; must be called before any listener thread is started */
+	void initProtoHandlers(void) {
+		econet::protohandlers[0x00] = econet::port00handler;
+		econet::protohandlers[0x90] = econet::port90handler;
+		econet::protohandlers[0x91] = econet::port91handler;
+		econet::protohandlers[0x99] = econet::port99handler;
+		econet::protohandlers[0x9F] = econet::port9Fhandler;
+		econet::protohandlers[0xB0] = econet::portB0handler;
+		econet::protohandlers[0xD0] = econet::portD0handler;
+		econet::protohandlers[0xD1] = econet::portD1handler;
+		econet::protohandlers[0xD6] = bcastload::protohandler;
+	}
 
-	/* Periodically check if we've received an Econet network package */
+	/* Econet-RX stage of the bridge: only drain the Econet hardware and hand the frames over to the forwarding stage */
 	void pollNetworkReceive(void) {
 		int rx_length;
-		econet::Frame frame;
+		econet::Frame *frame = NULL;
+		econet::Frame *overflow = new econet::Frame;
 
 		while (bye == false) {
-			rx_length = api::receiveData(&frame);
-			if ((rx_length > 0) && (econet::netmon))
-				netmonPrintFrame("eco  ", false, &frame, rx_length);
-			if (econet::validateFrame((econet::Frame *) &frame, rx_length)) {
-				if (frame.flags || ECONET_FRAME_TOLOCAL) {
-					/* Frame is addressed to a station on our local network */
-					if (frame.flags || ECONET_FRAME_TOME) {
-						/* Frame is addressed to us */
-						econet::processFrame(&frame, rx_length);
-					} else {
-						/* Frame is addressed to a station on our local network */
-						frame.rawdata[0] = 0x00; // Set destination network to local network
-						econet::transmitFrame((econet::Frame *) &frame, rx_length);
-					}
+			if (frame == NULL)
+				frame = bridge::acquire(BRIDGE_ECONET_RX);
+
+			/* All buffers are in use: keep draining the hardware, but drop the frame */
+			if (frame == NULL) {
+				if (api::receiveData(overflow) > 0)
+					bridge::drop(BRIDGE_ECONET_RX);
+				continue;
+			}
+
+			rx_length = api::receiveData(frame);
+			if (rx_length > 0) {
+				if (econet::netmon)
+					netmonPrintFrame("eco  ", false, frame, rx_length);
+				bridge::submit(BRIDGE_ECONET_RX, frame, rx_length);
+				frame = NULL;
+			}
+		}
+		delete overflow;
+	}
+
+	/* Forwarding stage of the bridge: handle one frame which was received from the Econet */
+	void handleFrame(econet::Frame *frame, int size) {
+		/* Fast path: a frame for another network is forwarded to its next hop without any further processing */
+		if ((size > 4) && (frame->econet.dst_network != 0x00) && (frame->econet.dst_network != 0xFF) && (frame->econet.dst_network != settings::econet_network)) {
+			routes::forward(frame, size, ROUTE_ECONET);
+			return;
+		}
+
+		if (econet::validateFrame(frame, size)) {
+			if (frame->flags & ECONET_FRAME_TOLOCAL) {
+				/* Frame is addressed to a station on our local network */
+				if (frame->flags & ECONET_FRAME_TOME) {
+					/* Frame is addressed to us */
+					econet::processFrame(frame, size);
 				} else {
-					/* Frame is addressed to a station on another network */
-//					if ((settings::relay_only_known_networks) && (econet::known_networks[frame.dst_network].network == 0)) {
-						/* Don't relay the frame, but reply with &3A2 Not listening */
-						econet::transmitFrame((econet::Frame *) &frame, rx_length);
-//					} else {
-						/* Relay frame to other known network(s) */
-						aun::transmitFrame((econet::Frame *) &frame, rx_length);
-//					}
+					/* Frame is addressed to a station on our local network */
+					frame->rawdata[0] = 0x00; // Set destination network to local network
+					econet::transmitFrame(frame, size);
 				}
+			} else if (frame->port == 0x9C) {
+				/* Bridge protocol broadcast: update the routing table, don't relay it */
+				econet::processFrame(frame, size);
+			} else {
+				/* Broadcast: relay it to the AUN stations, unless it has already crossed this bridge */
+				broadcasts::relay(frame, size, ROUTE_ECONET);
 			}
 		}
 	}
@@ -75,6 +122,7 @@ namespace econet {
 
 	/* Check if a frame is a valid Econet frame */
 	bool validateFrame(econet::Frame *frame, int size) {
+		frame->flags = 0;
 		if (size < 4)
 			frame->flags |= ECONET_FRAME_INVALID;
 		if (size == 4)
@@ -83,7 +131,7 @@ namespace econet {
 			frame->flags |= ECONET_FRAME_SCOUT;
 		if (size > 4)
 			frame->flags |= ECONET_FRAME_DATA;
-		if (frame->flags || ECONET_FRAME_INVALID) {
+		if (frame->flags & ECONET_FRAME_INVALID) {
 			return false;
 		} else {
 			frame->port = frame->rawdata[4];
@@ -112,6 +160,9 @@ namespace econet {
 
 	/* Processes one Econet frame */
 	void processFrame(econet::Frame *frame, int size) {
+		uint8_t src_network = frame->econet.src_network;
+		uint8_t src_station = frame->econet.src_station;
+
 		frame->rawdata[0] = frame->econet.src_network;
 		frame->rawdata[1] = frame->econet.src_station;
 		frame->rawdata[2] = settings::econet_network;
@@ -152,25 +203,20 @@ namespace econet {
 				switch (frame->control) {
 					// &80 New bridge available on the network
 					case 0x80 :
-						if (settings::econet_network == frame->econet.src_network) {
-							fprintf(stderr, "Warning! Found another Econet network with the same network number as ours! Please check the configuration at station %i:%i\n", frame->econet.src_network, frame->econet.src_station);
-						} else {
-							// Add the new Econet network to our list of known networks
-							econet::known_networks[frame->econet.src_network].network = frame->econet.src_network;
-							econet::known_networks[frame->econet.src_network].station = frame->econet.src_station;
+						if ((src_network != 0) && (settings::econet_network == src_network)) {
+							fprintf(stderr, "Warning! Found another Econet network with the same network number as ours! Please check the configuration at station %i:%i\n", src_network, src_station);
+							break;
 						}
+						routes::update(ROUTE_ECONET, src_network, src_station, frame->control, &frame->rawdata[6], (size > 6) ? size - 6 : 0);
 						break;
 
 					// &81 Reply to new bridge frame (&80)
 					case 0x81 :
-						break;
-
 					// &82 What net?
 					case 0x82 :
-						break;
-
 					// &83 Is net?
 					case 0x83 :
+						routes::update(ROUTE_ECONET, src_network, src_station, frame->control, &frame->rawdata[6], (size > 6) ? size - 6 : 0);
 						break;
 
 					default :
@@ -264,6 +310,8 @@ namespace econet {
 
 			// &D6 BroadcastControl
 			case 0xD6 :
+				if (size > 6)
+					bcastload::report((src_network == 0x00) ? settings::econet_network : src_network, src_station, frame->control, &frame->rawdata[6], size - 6);
 				break;
 
 			// &D7 BroadcastData
@@ -329,12 +377,39 @@ namespace econet {
 		aun::transmitFrame(&frame, sizeof(ECONET_BROADCAST_NEWBRIDGE));
 	}
 
+	/* Get the lock stripe which holds the sessions of a station */
+	int sessionStripe(unsigned char network, unsigned char station) {
+		return ((network * 31) + station) % ECONET_SESSION_STRIPES;
+	}
+
+	/* Ends a session with a client; the caller must hold the lock of the session's stripe */
+	bool endSessionLocked(int stripe, unsigned char network, unsigned char station, unsigned char port) {
+		int i;
+
+		i = stripe * (ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES);
+		while (i < (stripe + 1) * (ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES)) {
+			if ((sessions[i].network == network) && (sessions[i].station == station) && (sessions[i].port == port)) {
+				sessions[i].sequence = 0;
+				sessions[i].timeout = 0;
+				sessions[i].network = 0x00;
+				sessions[i].station = 0x00;
+				sessions[i].port = 0x00;
+				return true;
+			}
+			i++;
+		}
+		return false;
+	}
+
 	/* Start a session with a client */
 	bool startSession(uint32_t sequence, unsigned char network, unsigned char station, unsigned char port) {
-		int i;
+		int i, stripe;
+
+		stripe = sessionStripe(network, station);
+		std::lock_guard<std::mutex> lock(session_locks[stripe]);
 
-		i = 0;
-		while (i < ECONET_MAX_SESSIONS) {
+		i = stripe * (ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES);
+		while (i < (stripe + 1) * (ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES)) {
 			if ((sessions[i].network == 0x00) && (sessions[i].station == 0x00) && (sessions[i].port == 0x00)) {
 				sessions[i].sequence = sequence;
 				sessions[i].timeout = ((unsigned long)time(NULL) + ECONET_SESSION_TIMEOUT);
@@ -349,17 +424,20 @@ namespace econet {
 	}
 
 	/* Check if a client has an open session on a port */
-	bool hasSession(uint32_t sequence, unsigned char network, unsigned char station, unsigned char port) {
-		int i;
+	bool hasSession(__attribute__((__unused__))uint32_t sequence, unsigned char network, unsigned char station, unsigned char port) {
+		int i, stripe;
+
+		stripe = sessionStripe(network, station);
+		std::lock_guard<std::mutex> lock(session_locks[stripe]);
 
-		i = 0;
-		while (i < ECONET_MAX_SESSIONS) {
+		i = stripe * (ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES);
+		while (i < (stripe + 1) * (ECONET_MAX_SESSIONS / ECONET_SESSION_STRIPES)) {
 			if ((sessions[i].network == network) && (sessions[i].station == station) && (sessions[i].port == port)) {
 				if (sessions[i].timeout < (unsigned long)time(NULL)) {
 					return true;
 				} else {
 					/* Session has timed out */
-					endSession(sequence, network, station, port);
+					endSessionLocked(stripe, network, station, port);
 					if (ECONET_SESSION_TIMEOUT_NOTIFY) {
 //						notify station at network:station that this session has timed out
 					}
@@ -372,22 +450,13 @@ namespace econet {
 	}
 
 	/* Ends a session with a client */
-	bool endSession(uint32_t sequence, unsigned char network, unsigned char station, unsigned char port) {
-		int i;
+	bool endSession(__attribute__((__unused__))uint32_t sequence, unsigned char network, unsigned char station, unsigned char port) {
+		int stripe;
 
-		i = 0;
-		while (i < ECONET_MAX_SESSIONS) {
-			if ((sessions[i].network == network) && (sessions[i].station == station) && (sessions[i].port == port)) {
-				sessions[i].sequence = 0;
-				sessions[i].timeout = 0;
-				sessions[i].network = 0x00;
-				sessions[i].station = 0x00;
-				sessions[i].port = 0x00;
-				return true;
-			}
-			i++;
-		}
-		return false;
+		stripe = sessionStripe(network, station);
+		std::lock_guard<std::mutex> lock(session_locks[stripe]);
+
+		return endSessionLocked(stripe, network, station, port);
 	}
 
 	/* &00 Immediate */
@@ -507,15 +576,19 @@ namespace econet {
 
 	/* &99 FileServerCommand */
 	int port99handler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length) {
-		FSDirectory dir[ECONET_MAX_DIRENTRIES];
+		FSDirectory dir;
 		uint32_t loadaddr, execaddr, length, offset, size;
 		char filename[ECONET_MAX_FILENAME_LEN+1];
+		char pathname[256];
+		char localpath[PATH_MAX];
+		bool directory;
+		FSObject obj;
 		char disctitle[ECONET_MAX_DISCTITLE_LEN+1];
 		char username[MAX_USERNAME+1];
 		char access_string[9];
 		uint8_t num_drives;
 		uint8_t access_byte = 0x02;
-		uint16_t max_block_size = 0xFFFF;
+		uint16_t max_block_size = links::blockSize(workers::current.network, workers::current.station);
 		struct tm *timeinfo;
 		char **args = NULL;
 		char *cli_ptr;
@@ -537,14 +610,21 @@ while (args[argv] != NULL) {
 	printf("arg%i = %s\n", argv, args[argv]);
 	argv++;
 }
-					/* Execute command */
-					executeCommand(args);
+					/* *I AM logs the station on, anything else is a command */
+					if ((args[0] != NULL) && (strcasecmp(args[0], "I.") == 0)) {
+						retval = logon(&args[1], tx_data->aun.data, tx_length);
+					} else if ((args[0] != NULL) && (args[1] != NULL) && (strcasecmp(args[0], "I") == 0) && (strcasecmp(args[1], "AM") == 0)) {
+						retval = logon(&args[2], tx_data->aun.data, tx_length);
+					} else {
+						/* Execute command */
+						executeCommand(args);
 
-					free(args);
+						tx_data->aun.data[0x00] = 0;			// Return command
+						tx_data->aun.data[0x01] = 0 & 0x000000FF;	// Result
+						retval = 2;
+					}
 
-					tx_data->aun.data[0x00] = 0;			// Return command
-					tx_data->aun.data[0x01] = 0 & 0x000000FF;	// Result
-					retval = 2;
+					free(args);
 				}
 				break;
 
@@ -588,11 +668,16 @@ while (args[argv] != NULL) {
 			case 0x05 :
 				if (rx_length > 13) {
 					strlcpy(filename, (const char *) &rx_data->aun.data[0x05], rx_length - 0x0D);
+					strlcpy(pathname, (const char *) &rx_data->aun.data[0x05], ((rx_length - 0x0D) < sizeof(pathname)) ? rx_length - 0x0D : sizeof(pathname));
 
-//					if (netfs::save(filename) == 0) {
-						loadaddr = 0xFFFF1900;
-						execaddr = 0xFFFF8023;
-						length   = 0x00004C85;
+					if ((result = netfs::resolve(pathname, localpath, &directory)) != 0) {
+						retval = returnError(tx_data->aun.data, tx_length, result);
+					} else if ((directory == true) || (nativefs::info(localpath, &obj) == false)) {
+						retval = returnError(tx_data->aun.data, tx_length, 0x000000D6);
+					} else {
+						loadaddr = obj.loadaddr;
+						execaddr = obj.execaddr;
+						length   = obj.length;
 
 						tx_data->aun.data[0x00] = 0x00;							// Command
 						tx_data->aun.data[0x01] = 0x00;							// Error code
@@ -611,9 +696,7 @@ while (args[argv] != NULL) {
 						tx_data->aun.data[0x0E] = 0;							// File creation date: day
 						tx_data->aun.data[0x0F] = 0;							// File creation date: year (4 bits), month (4 bits)
 						strlcpy((char *)&tx_data->aun.data[0x10], filename, ECONET_MAX_FILENAME_LEN);	// Object name, padded with spaces
-//					} else {
-//						retval = returnError(tx_data->aun.data, tx_length, 0x000000D6);
-//					}
+					}
 				}
 				break;
 
@@ -622,71 +705,94 @@ while (args[argv] != NULL) {
 				if (rx_length > 16) {
 					uint8_t entrypoint  = rx_data->aun.data[0x06];
 					uint8_t numentries  = rx_data->aun.data[0x07];
-					strlcpy(filename, (const char *) &rx_data->aun.data[0x08], rx_length - 0x10);
+					uint8_t format      = rx_data->aun.data[0x05];
+					strlcpy(pathname, (const char *) &rx_data->aun.data[0x08], ((rx_length - 0x10) < sizeof(pathname)) ? rx_length - 0x10 : sizeof(pathname));
+					pathname[strcspn(pathname, "\r")] = '\0';
 
-					result = netfs::catalogue(rx_data->aun.csd, dir, filename, entrypoint, numentries);
-fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, filename);
+					if (format > 0x03) {
+						retval = returnError(tx_data->aun.data, tx_length, 0x000000CF);			// Error code &CF: Bad attribute
+						break;
+					}
 
-					loadaddr = 0xFFFF1900;
-					execaddr = 0xFFFF8023;
-					length   = 0x00004C85;
-					strcpy(filename, "abcdefghij");
-					strcpy(access_string, "MPDLWRwr");
+					/* Only the machine readable format and the character string with all information show lengths and dates */
+					fsdir::init(&dir);
+					netfs::catalogue(rx_data->aun.csd, &dir, pathname, entrypoint, numentries, format < 0x02);
 
 					tx_data->aun.data[0x00] = 0x00;					// Command
 					tx_data->aun.data[0x01] = 0x00;					// Error code
-					tx_data->aun.data[0x02] = 0x01;					// Number of objects returned
 
-					switch (rx_data->aun.data[5]) {
-						// All information, machine readable format
-						case 0x00 :
-							strlcpy((char *)&tx_data->aun.data[0x03], filename, ECONET_MAX_FILENAME_LEN);	// Object name, padded with spaces
-							tx_data->aun.data[0x0D] = (loadaddr & 0x000000FF);				// Load address LSB
-							tx_data->aun.data[0x0E] = (loadaddr & 0x0000FF00) >> 8;				// Load address
-							tx_data->aun.data[0x0F] = (loadaddr & 0x00FF0000) >> 16;			// Load address
-							tx_data->aun.data[0x10] = (loadaddr & 0xFF000000) >> 24;			// Load address MSB
-							tx_data->aun.data[0x11] = (execaddr & 0x000000FF);				// Exec address LSB
-							tx_data->aun.data[0x12] = (execaddr & 0x0000FF00) >> 8;				// Exec address
-							tx_data->aun.data[0x13] = (execaddr & 0x00FF0000) >> 16;			// Exec address
-							tx_data->aun.data[0x14] = (execaddr & 0xFF000000) >> 24;			// Exec address MSB
-							tx_data->aun.data[0x15] = access_byte;						// Access byte LWRwr (bottom 5 bits)
-							tx_data->aun.data[0x16] = 0;							// Date: day
-							tx_data->aun.data[0x17] = 0;							// Date: year (4 bits), month (4 bits)
-							tx_data->aun.data[0x18] = 0;							// System internal name
-							tx_data->aun.data[0x19] = 0;							// System internal name
-							tx_data->aun.data[0x1A] = 0;							// System internal name
-							tx_data->aun.data[0x1B] = (length   & 0x000000FF);				// Length LSB
-							tx_data->aun.data[0x1C] = (length   & 0x0000FF00) >> 8;				// Length
-							tx_data->aun.data[0x1D] = (length   & 0x00FF0000) >> 16;			// Length MSB
-							retval = 29;
-							break;
-
-						// All information, character string
-						case 0x01 :
-							sprintf((char *) &tx_data->aun.data[0x03], "%s %08X %08X %06X %s\x80", filename, loadaddr, execaddr, length, access_string);
-							retval = (strlen((char *) &tx_data->aun.data[0x03]) - 1);	// Skip training \0
-							break;
+					/* Add as many entries as fit in the reply; the text formats end with &80, so keep room for that */
+					offset = 0x03;
+					size_t end = (format & 0x01) ? sizeof(tx_data->aun.data) - 1 : sizeof(tx_data->aun.data);
+					for (i = 0; i < (size_t) dir.count; i++) {
+						loadaddr = dir.loadaddrs[i];
+						execaddr = dir.execaddrs[i];
+						length   = dir.lengths[i];
+						access_byte = netfs::accessbyte(dir.attribs[i]);
+						netfs::accesstostr(access_byte, access_string);
+
+						size = 0;
+						switch (format) {
+							// All information, machine readable format
+							case 0x00 :
+								size = 27;
+								if (offset + size > end)
+									break;
+								memset(&tx_data->aun.data[offset], ' ', ECONET_MAX_FILENAME_LEN);				// Object name, padded with spaces
+								memcpy(&tx_data->aun.data[offset], dir.names[i], strlen(dir.names[i]));
+								tx_data->aun.data[offset + 0x0A] = (loadaddr & 0x000000FF);			// Load address LSB
+								tx_data->aun.data[offset + 0x0B] = (loadaddr & 0x0000FF00) >> 8;		// Load address
+								tx_data->aun.data[offset + 0x0C] = (loadaddr & 0x00FF0000) >> 16;		// Load address
+								tx_data->aun.data[offset + 0x0D] = (loadaddr & 0xFF000000) >> 24;		// Load address MSB
+								tx_data->aun.data[offset + 0x0E] = (execaddr & 0x000000FF);			// Exec address LSB
+								tx_data->aun.data[offset + 0x0F] = (execaddr & 0x0000FF00) >> 8;		// Exec address
+								tx_data->aun.data[offset + 0x10] = (execaddr & 0x00FF0000) >> 16;		// Exec address
+								tx_data->aun.data[offset + 0x11] = (execaddr & 0xFF000000) >> 24;		// Exec address MSB
+								tx_data->aun.data[offset + 0x12] = access_byte;					// Access byte DLWRwr
+								netfs::packdate(dir.ctimes[i], &tx_data->aun.data[offset + 0x13]);		// Date: day, year (4 bits) and month (4 bits)
+								tx_data->aun.data[offset + 0x15] = 0;						// System internal name
+								tx_data->aun.data[offset + 0x16] = 0;						// System internal name
+								tx_data->aun.data[offset + 0x17] = 0;						// System internal name
+								tx_data->aun.data[offset + 0x18] = (length   & 0x000000FF);			// Length LSB
+								tx_data->aun.data[offset + 0x19] = (length   & 0x0000FF00) >> 8;		// Length
+								tx_data->aun.data[offset + 0x1A] = (length   & 0x00FF0000) >> 16;		// Length MSB
+								break;
 
-						// File title only
-						case 0x02 :
-							tx_data->aun.data[0x03] = 0x0A;							// Length of filename
-							strlcpy((char *) &tx_data->aun.data[0x04], filename, ECONET_MAX_FILENAME_LEN);	// Object name, padded with spaces
-							retval = 13;
-							break;
+							// All information, character string
+							case 0x01 :
+								size = 10 + 1 + 8 + 1 + 8 + 1 + 6 + 1 + 7 + 1;
+								if (offset + size > end)
+									break;
+								size = snprintf((char *) &tx_data->aun.data[offset], size, "%-10.10s %08X %08X %06X %-7.7s", dir.names[i], loadaddr, execaddr, length & 0x00FFFFFF, access_string) + 1;
+								break;
 
-						// File title and access, character string
-						case 0x03 :
-							tx_data->aun.data[0x03] = 0x0A;							// ???????
-							strlcpy((char *) &tx_data->aun.data[0x04], filename, ECONET_MAX_FILENAME_LEN+1);	// Object name, padded with spaces
-							strlcpy((char *) &tx_data->aun.data[0x0E], access_string, 9);				// Access string
-							tx_data->aun.data[0x16] = 0x80;							// Error code (0 = success)
-							retval = 23;
-							break;
+							// File title only
+							case 0x02 :
+								size = 1 + ECONET_MAX_FILENAME_LEN;
+								if (offset + size > end)
+									break;
+								tx_data->aun.data[offset] = ECONET_MAX_FILENAME_LEN;					// Length of filename
+								memset(&tx_data->aun.data[offset + 1], ' ', ECONET_MAX_FILENAME_LEN);			// Object name, padded with spaces
+								memcpy(&tx_data->aun.data[offset + 1], dir.names[i], strlen(dir.names[i]));
+								break;
 
-						default:
-							retval = returnError(tx_data->aun.data, tx_length, 0x000000CF);			// Error code &CF: Bad attribute
+							// File title and access, character string
+							case 0x03 :
+								size = 10 + 1 + 7 + 1;
+								if (offset + size > end)
+									break;
+								snprintf((char *) &tx_data->aun.data[offset], size, "%-10.10s %-7.7s", dir.names[i], access_string);
+								break;
+						}
+						if (offset + size > end)
 							break;
+						offset += size;
 					}
+					tx_data->aun.data[0x02] = i;					// Number of objects returned
+					if (format & 0x01)
+						tx_data->aun.data[offset++] = 0x80;			// End of the character strings
+					retval = offset;
+					fsdir::release(&dir);
 				}
 				break;
 
@@ -711,23 +817,53 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 			// &06: Open file
 			case 0x06 :
 				if (rx_length > 15) {
-					strlcpy(filename, (const char *) &rx_data->aun.data[0x07], rx_length - 0x0F);
-
-					tx_data->aun.data[0x00] = 0x00;					// Command
-					tx_data->aun.data[0x01] = 0x00;					// Error code
-					tx_data->aun.data[0x02] = 0x01;					// File handle
+					uint8_t handle;
+					const char *mode;
+
+					strlcpy(pathname, (const char *) &rx_data->aun.data[0x07], ((rx_length - 0x0F) < sizeof(pathname)) ? rx_length - 0x0F : sizeof(pathname));
+
+					/* OPENIN opens read only, OPENUP opens an existing file for update and OPENOUT creates a new file */
+					if (rx_data->aun.data[0x06] != 0x00)
+						mode = "r";
+					else if (rx_data->aun.data[0x05] != 0x00)
+						mode = "r+";
+					else
+						mode = "w+";
+
+					/* OPENOUT may create the file */
+					if (strcmp(mode, "w+") == 0)
+						result = netfs::resolveNew(pathname, localpath, &directory);
+					else
+						result = netfs::resolve(pathname, localpath, &directory);
+
+					if (result != 0) {
+						retval = returnError(tx_data->aun.data, tx_length, result);
+					} else if (directory == true) {
+						retval = returnError(tx_data->aun.data, tx_length, 0x000000D6);
+					} else if ((result = users::openFile(workers::current.network, workers::current.station, localpath, mode, &handle)) != 0) {
+						retval = returnError(tx_data->aun.data, tx_length, result);
+					} else {
+						tx_data->aun.data[0x00] = 0x00;					// Command
+						tx_data->aun.data[0x01] = 0x00;					// Error code
+						tx_data->aun.data[0x02] = handle;				// File handle
 
-					retval = 3;
+						retval = 3;
+					}
 				}
 				break;
 
 			// &07: Close file
 			case 0x07 :
 				if (rx_length == 14) {
-					tx_data->aun.data[0x00] = 0x00;					// Command
-					tx_data->aun.data[0x01] = 0x00;					// Error code
+					/* Handle 0 closes all files of the station */
+					if ((result = users::closeFile(workers::current.network, workers::current.station, rx_data->aun.data[0x05])) != 0) {
+						retval = returnError(tx_data->aun.data, tx_length, result);
+					} else {
+						tx_data->aun.data[0x00] = 0x00;					// Command
+						tx_data->aun.data[0x01] = 0x00;					// Error code
 
-					retval = 2;
+						retval = 2;
+					}
 				}
 				break;
 
@@ -766,7 +902,7 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 					tx_data->aun.data[0x01] = 0;						// Result
 					tx_data->aun.data[0x02] = 0x90;						// Data port
 					tx_data->aun.data[0x03] = (max_block_size & 0x00FF);			// Max size of data block per packet LSB
-					tx_data->aun.data[0x04] = (max_block_size & 0xFF00) << 8;		// Max size of data block per packet MSB
+					tx_data->aun.data[0x04] = (max_block_size & 0xFF00) >> 8;		// Max size of data block per packet MSB
 
 					retval = 5;
 				}
@@ -785,7 +921,7 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 					tx_data->aun.data[0x01] = 0;						// Result
 					tx_data->aun.data[0x02] = 0x90;						// Data port
 					tx_data->aun.data[0x03] = (max_block_size & 0x00FF);			// Max size of data block per packet LSB
-					tx_data->aun.data[0x04] = (max_block_size & 0xFF00) << 8;		// Max size of data block per packet MSB
+					tx_data->aun.data[0x04] = (max_block_size & 0xFF00) >> 8;		// Max size of data block per packet MSB
 
 					retval = 5;
 				}
@@ -885,6 +1021,8 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 				if (rx_length == 15) {
 					tx_data->aun.data[0] = 0x00;	// Command
 					tx_data->aun.data[1] = 0x00;	// Error code (0 = success)
+					std::lock_guard<std::mutex> lock(users::sessions_lock);
+
 					tx_data->aun.data[2] = users::totalSessions;	// Number of user sessions
 					retval = 0x03;
 					for (i = 0; i < users::totalSessions; i++) {
@@ -1158,13 +1296,15 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 			// &17: Log off
 			case 0x17 :
 				if (rx_length == 13) {
-					tx_data->aun.data[0] = 0x00;							// Command
-//					if ((users::delSession(users::getSession(0, 0, 0))) == 0) {
+					cursors::close(workers::current.network, workers::current.station);
+					/* Closes everything the station left open */
+					if ((result = users::logoff(workers::current.network, workers::current.station)) == 0) {
+						tx_data->aun.data[0] = 0x00;						// Command
 						tx_data->aun.data[1] = 0x00;						// Error code
 						retval = 2;
-//					} else {
-//						retval = returnError(tx_data->aun.data, tx_length, 0x000000AE);
-//					}
+					} else {
+						retval = returnError(tx_data->aun.data, tx_length, result);
+					}
 				}
 				break;
 
@@ -1176,6 +1316,8 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 						username[strlen(username)] = '\0';
 
 					if ((result = users::getUserID(username)) >= 0) {
+						std::lock_guard<std::mutex> lock(users::sessions_lock);
+
 						tx_data->aun.data[0x00] = 0x00;						// Command
 						tx_data->aun.data[0x01] = 0x00;						// Error code
 						users::users[result].flags.p ? tx_data->aun.data[0x02] = 0x00 : tx_data->aun.data[0x02] = 0xFF;
@@ -1279,6 +1421,8 @@ fprintf(stderr, "entry=%i numentries=%i dirname=%s\n", entrypoint, numentries, f
 			// &20: Read client user identifier
 			case 0x20 :
 				if (rx_length == 13) {
+					std::lock_guard<std::mutex> lock(users::sessions_lock);
+
 					for (i = 0; i < users::totalSessions; i++) {
 						if ((users::sessions[i].network == rx_data->econet.src_network) && (users::sessions[i].network == rx_data->econet.src_station)) {
 							tx_data->aun.data[0x00] = 0x00;					// Command
@@ -1537,6 +1681,8 @@ char pbuffer[65536];
 		if ((rx_length < 9) && (tx_length < 9))
 			return 0;
 
+		std::lock_guard<std::mutex> lock(printer_lock);
+
 		if (rx_length == 9) {
 			switch (rx_data->aun.data[0x00]) {
 				// Last bytes have been received, so finish the print job
@@ -1596,6 +1742,30 @@ printf("print done\n");
 		return retval;
 	}
 
+	/* Log the station on as the user in args[0], with the password in args[1]; a station which was logged on is logged off first */
+	int logon(char **args, uint8_t *tx_data, size_t tx_length) {
+		int user_id, session, result;
+
+		if ((args[0] == NULL) || ((user_id = users::getUserID(args[0])) == -1))
+			return (returnError(tx_data, tx_length, 0x000000BC));
+
+		users::logoff(workers::current.network, workers::current.station);
+		if ((result = users::login(user_id, (args[1] != NULL) ? args[1] : "", workers::current.network, workers::current.station)) != 0)
+			return (returnError(tx_data, tx_length, result));
+
+		std::lock_guard<std::mutex> lock(users::sessions_lock);
+		if ((session = users::findSession(workers::current.network, workers::current.station)) == -1)
+			return (returnError(tx_data, tx_length, 0x000000AE));
+
+		tx_data[0] = 0x05;						// Command: *I AM
+		tx_data[1] = 0x00;						// Error code
+		tx_data[2] = users::sessions[session].urd;			// Handle of the User Root Directory
+		tx_data[3] = users::sessions[session].csd;			// Handle of the Currently Selected Directory
+		tx_data[4] = users::sessions[session].lib;			// Handle of the library
+		tx_data[5] = users::users[user_id].bootoption;			// Boot option
+		return (6);
+	}
+
 	/* Return an error */
 	int returnError(uint8_t *tx_data, size_t tx_length, uint32_t errorNumber) {
 		int len;
@@ -9,10 +9,13 @@
 
 #include <cstddef>					// size_t
 #include <cstdint>					// uint8_t
+#include <atomic>					// std::atomic
+#include <mutex>					// std::mutex
 
 #define ECONET_MACHINETYPE		0x0314		// Econet machine type is RaspberryPi (3.14)
 #define ECONET_MAX_FRAMESIZE		32768		// Maximum size of an Econet frame is 32768 bytes (todo: need to check what the maximum allowed framesize is according to Acorn specifications)
 #define ECONET_MAX_SESSIONS		256		// Max 256 sessions for now; must rewrite the session handler someday to dynamically allocate sessions
+#define ECONET_SESSION_STRIPES		16		// Number of lock stripes for the sessions table; sessions of one station always use the same stripe
 #define ECONET_SESSION_TIMEOUT		60		// Each session will timeout after 60 seconds
 #define ECONET_SESSION_TIMEOUT_NOTIFY	1		// Notify (send a frame to) stations when a session times out
 #define ECONET_SERVERTYPE		"FILESTOR"	// Servertype when responding to &B0 FindServer
@@ -125,12 +128,13 @@ namespace econet {
 
 	typedef	int	(*ProtoHandlers)(const econet::Frame *, size_t, econet::Frame *, size_t);
 
-	extern bool	netmon;
-	extern Station	known_networks[256];
-	extern Session	sessions[ECONET_MAX_SESSIONS];
-	extern ProtoHandlers protohandlers[256];
+	extern std::atomic<bool>	netmon;
+	extern Session		sessions[ECONET_MAX_SESSIONS];
+	extern ProtoHandlers	protohandlers[256];
 
+	void	initProtoHandlers(void);
 	void	pollNetworkReceive(void);
+	void	handleFrame(econet::Frame *frame, int size);
 	void	transmitFrame(econet::Frame *frame, unsigned int size);
 	bool	validateFrame(econet::Frame *frame, int size);
 	void	processFrame(econet::Frame *frame, int size);
@@ -147,6 +151,7 @@ namespace econet {
 	int	portB0handler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length);
 	int	portD0handler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length);
 	int	portD1handler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length);
+	int	logon(char **args, uint8_t *tx_data, size_t tx_length);
 	int	returnError(uint8_t *tx_data, size_t tx_length, uint32_t errorNumber);
 }
 
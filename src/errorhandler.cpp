@@ -69,7 +69,7 @@ void errorHandler(uint32_t errorNumber) {
 	unsigned int i;
 
 	for (i = 0; i < 38; i++) {
-		if (errorMessages[i].errno == errorNumber) {
+		if (errorMessages[i].errnum == errorNumber) {
 			fprintf(stderr, (char *)settings::onError, "Warning", errorNumber, errorMessages[i].error);
 			return;
 		}
@@ -81,7 +81,7 @@ char * getErrorString(uint32_t errorNumber) {
 	unsigned int i;
 
 	for (i = 0; i < 38; i++) {
-		if (errorMessages[i].errno == errorNumber) {
+		if (errorMessages[i].errnum == errorNumber) {
 			return (char *)errorMessages[i].error;
 		}
 	}
@@ -18,7 +18,7 @@
 #define ERR_BAD_COMMAND		0x000000FE
 
 typedef struct {
-	uint32_t	errno;
+	uint32_t	errnum;
 	const char	*error;
 } Error;
 
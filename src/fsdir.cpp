@@ -0,0 +1,191 @@
+/* fsdir.cpp
+ * Growable directory listings, stored as one array per field
+ *
+ * A listing keeps every field of its entries in an array of its own (names,
+ * load addresses, lengths, packed attributes and so on) instead of an array
+ * of FSObjects. Matching a mask only reads the names, and sorting only
+ * compares them, so they're next to each other in memory instead of spread
+ * out over all other fields. The attributes are packed in a 16 bits mask
+ * (FILESTORE_ATTRIB_*) instead of nine bools.
+ *
+ * All arrays of a listing are carved out of one allocation, which doubles
+ * when the listing is full, so a directory can have any number of entries.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdlib>		// qsort()
+#include <cstring>		// memcpy(), memset(), strcmp(), strlcpy()
+
+#include "fsdir.h"		// Header file for this code
+#include "main.h"		// ECONET_MAX_DIRENTRIES, ECONET_MAX_FILENAME_LEN
+
+using namespace std;
+
+
+
+namespace fsdir {
+	/* Sort key of an entry: its name in upper case, and where it is now */
+	typedef struct {
+		char	name[ECONET_MAX_FILENAME_LEN + 1];
+		int	entry;
+	} SortKey;
+
+	/* Memory needed for the arrays of a listing of a given size */
+	size_t blockSize(int size) {
+		return size * (2 * sizeof(time_t) + 3 * sizeof(uint32_t) + sizeof(uint16_t) + (ECONET_MAX_FILENAME_LEN + 1));
+	}
+
+	/* Point the arrays of a listing into a block; the widest fields go first, so every array is aligned */
+	void carve(FSDirectory *dir, uint8_t *block, int size) {
+		dir->block = block;
+		dir->ctimes = (time_t *) block;
+		dir->mtimes = dir->ctimes + size;
+		dir->loadaddrs = (uint32_t *) (dir->mtimes + size);
+		dir->execaddrs = dir->loadaddrs + size;
+		dir->lengths = dir->execaddrs + size;
+		dir->attribs = (uint16_t *) (dir->lengths + size);
+		dir->names = (char (*)[ECONET_MAX_FILENAME_LEN + 1]) (dir->attribs + size);
+		dir->size = size;
+	}
+
+	/* Copy entries between listings, which must both have room for them */
+	void copyEntries(FSDirectory *to, int first, const FSDirectory *from, int start, int count) {
+		memcpy(&to->ctimes[first], &from->ctimes[start], count * sizeof(time_t));
+		memcpy(&to->mtimes[first], &from->mtimes[start], count * sizeof(time_t));
+		memcpy(&to->loadaddrs[first], &from->loadaddrs[start], count * sizeof(uint32_t));
+		memcpy(&to->execaddrs[first], &from->execaddrs[start], count * sizeof(uint32_t));
+		memcpy(&to->lengths[first], &from->lengths[start], count * sizeof(uint32_t));
+		memcpy(&to->attribs[first], &from->attribs[start], count * sizeof(uint16_t));
+		memcpy(&to->names[first], &from->names[start], count * (ECONET_MAX_FILENAME_LEN + 1));
+	}
+
+	/* Start an empty listing */
+	void init(FSDirectory *dir) {
+		memset(dir, 0, sizeof(FSDirectory));
+	}
+
+	/* Free the memory of a listing, and leave it empty */
+	void release(FSDirectory *dir) {
+		delete[] dir->block;
+		init(dir);
+	}
+
+	/* Make room for at least size entries */
+	void reserve(FSDirectory *dir, int size) {
+		FSDirectory grown;
+		uint8_t *block;
+
+		if (size <= dir->size)
+			return;
+
+		block = new uint8_t[blockSize(size)];
+		carve(&grown, block, size);
+		grown.count = dir->count;
+		copyEntries(&grown, 0, dir, 0, dir->count);
+		delete[] dir->block;
+		*dir = grown;
+	}
+
+	/* Add an entry at the end of a listing; returns its number */
+	int add(FSDirectory *dir, const FSObject *obj) {
+		int entry;
+
+		if (dir->count == dir->size)
+			reserve(dir, (dir->size == 0) ? ECONET_MAX_DIRENTRIES : dir->size * 2);
+
+		entry = dir->count++;
+		dir->ctimes[entry] = obj->ctime;
+		dir->mtimes[entry] = obj->mtime;
+		dir->loadaddrs[entry] = obj->loadaddr;
+		dir->execaddrs[entry] = obj->execaddr;
+		dir->lengths[entry] = obj->length;
+		dir->attribs[entry] = netfs::packattrib(&obj->attrib);
+		strlcpy(dir->names[entry], obj->name, ECONET_MAX_FILENAME_LEN + 1);
+		return entry;
+	}
+
+	/* Get all fields of an entry */
+	void get(const FSDirectory *dir, int entry, FSObject *obj) {
+		memset(obj, 0, sizeof(FSObject));
+		strlcpy(obj->name, dir->names[entry], sizeof(obj->name));
+		obj->loadaddr = dir->loadaddrs[entry];
+		obj->execaddr = dir->execaddrs[entry];
+		obj->length = dir->lengths[entry];
+		netfs::unpackattrib(dir->attribs[entry], &obj->attrib);
+		obj->ctime = dir->ctimes[entry];
+		obj->mtime = dir->mtimes[entry];
+	}
+
+	/* Add at most count entries of another listing, starting at entry start; returns the number of entries added */
+	int append(FSDirectory *to, const FSDirectory *from, int start, int count) {
+		if ((start < 0) || (start >= from->count) || (count <= 0))
+			return 0;
+		if (count > from->count - start)
+			count = from->count - start;
+
+		reserve(to, to->count + count);
+		copyEntries(to, to->count, from, start, count);
+		to->count += count;
+		return count;
+	}
+
+	/* Order of the entries: alphabetically regardless of case, and otherwise in the order they were added */
+	int compareKeys(const void *a, const void *b) {
+		int result;
+
+		if ((result = strcmp(((const SortKey *) a)->name, ((const SortKey *) b)->name)) != 0)
+			return result;
+		return ((const SortKey *) a)->entry - ((const SortKey *) b)->entry;
+	}
+
+	/* Sort a listing by name; only the names are compared, and every array is moved once */
+	void sort(FSDirectory *dir) {
+		FSDirectory sorted;
+		SortKey *keys;
+		int i, j;
+
+		if (dir->count < 2)
+			return;
+
+		keys = new SortKey[dir->count];
+		for (i = 0; i < dir->count; i++) {
+			for (j = 0; dir->names[i][j] != '\0'; j++)
+				keys[i].name[j] = ((dir->names[i][j] >= 'a') && (dir->names[i][j] <= 'z')) ? dir->names[i][j] - ('a' - 'A') : dir->names[i][j];
+			keys[i].name[j] = '\0';
+			keys[i].entry = i;
+		}
+		qsort(keys, dir->count, sizeof(SortKey), compareKeys);
+
+		carve(&sorted, new uint8_t[blockSize(dir->size)], dir->size);
+		sorted.count = dir->count;
+		for (i = 0; i < dir->count; i++)
+			copyEntries(&sorted, i, dir, keys[i].entry, 1);
+		delete[] keys;
+		delete[] dir->block;
+		*dir = sorted;
+	}
+
+	/* Only keep the entries whose names match a mask; they stay in the same order */
+	void filter(FSDirectory *dir, const wildcard::Matcher *matcher) {
+		int i, j;
+
+		if (matcher->kind == WILDCARD_ALL)
+			return;
+
+		for (i = 0, j = 0; i < dir->count; i++) {
+			if (wildcard::match(matcher, dir->names[i]) == false)
+				continue;
+			if (j != i)
+				copyEntries(dir, j, dir, i, 1);
+			j++;
+		}
+		dir->count = j;
+	}
+
+	/* Memory used by a listing */
+	size_t bytes(const FSDirectory *dir) {
+		return sizeof(FSDirectory) + blockSize(dir->size);
+	}
+}
+
@@ -0,0 +1,28 @@
+/* fsdir.h
+ * Growable directory listings, stored as one array per field
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_FSDIR_HEADER
+#define ECONET_FSDIR_HEADER
+
+#include <cstddef>			// size_t
+
+#include "netfs.h"			// FSDirectory, FSObject
+#include "wildcard.h"			// wildcard::Matcher
+
+namespace fsdir {
+	void		init(FSDirectory *dir);
+	void		release(FSDirectory *dir);
+	void		reserve(FSDirectory *dir, int size);
+	int		add(FSDirectory *dir, const FSObject *obj);
+	void		get(const FSDirectory *dir, int entry, FSObject *obj);
+	int		append(FSDirectory *to, const FSDirectory *from, int start, int count);
+	void		sort(FSDirectory *dir);
+	void		filter(FSDirectory *dir, const wildcard::Matcher *matcher);
+	size_t		bytes(const FSDirectory *dir);
+}
+
+#endif
+
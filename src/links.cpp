@@ -0,0 +1,200 @@
+/* links.cpp
+ * Per-station link quality, retransmission timeouts and the data block size advertised to each station
+ *
+ * The FileServer tells a station how large the data blocks of a file
+ * transfer may be (Save, Get bytes and Put bytes). A large block size is
+ * fastest on a clean LAN, but when a block is lost the station has to send
+ * all of it again. So every station gets its own block size:
+ * - it starts at FILESTORE_LINK_START_BLOCK
+ * - it is halved whenever the station has to retransmit a frame
+ * - it is doubled after FILESTORE_LINK_GROW_FRAMES frames without retransmissions
+ * - it never grows beyond FILESTORE_LINK_BRIDGED_BLOCK for stations on real
+ *   Econet, stations behind a bridge and stations with a slow round-trip time,
+ *   or beyond FILESTORE_LINK_MAX_BLOCK for stations on the local AUN network
+ *
+ * The round-trip time of every station is measured from the ACKs of our
+ * replies, and gives the retransmission timeout for replies which aren't
+ * ACKed (RFC 6298): a smoothed round-trip time and its variation are kept,
+ * replies which were sent more than once are never timed (Karn's rule), and
+ * the timeout is doubled on every retransmission, up to FILESTORE_LINK_MAX_RTO.
+ *
+ * A station's link is updated by the worker thread which owns the station,
+ * and by the retransmit thread, so all links are protected by links_lock.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::lock_guard
+
+#include "links.h"		// Header file for this code
+#include "aun.h"		// AUN_ACK
+#include "main.h"		// ECONET_MAX_NETWORK
+#include "routes.h"		// routes::lookup()
+#include "settings.h"		// settings::econet_network
+
+using namespace std;
+
+
+
+namespace links {
+	Link		links[ECONET_MAX_NETWORK + 1][255];
+	std::mutex	links_lock;			// Protects links[][]
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	/* Largest block size for a station, depending on the path to it */
+	uint16_t maxBlockSize(uint8_t network, const Link *link) {
+		routes::Route route;
+
+		if (link->srtt > FILESTORE_LINK_SLOW_RTT)
+			return FILESTORE_LINK_BRIDGED_BLOCK;
+		if (network == settings::econet_network)
+			return FILESTORE_LINK_BRIDGED_BLOCK;
+		if (routes::lookup(network, &route) == true)
+			return FILESTORE_LINK_BRIDGED_BLOCK;
+		return FILESTORE_LINK_MAX_BLOCK;
+	}
+
+	/* Add a round-trip time sample and compute the new retransmission timeout */
+	void sample(Link *link, uint64_t rtt) {
+		uint64_t delta, variation;
+
+		if (link->srtt == 0) {
+			link->srtt = rtt;
+			link->rttvar = rtt / 2;
+		} else {
+			delta = (link->srtt > rtt) ? (link->srtt - rtt) : (rtt - link->srtt);
+			link->rttvar = (3 * (uint64_t) link->rttvar + delta) / 4;
+			link->srtt = (7 * (uint64_t) link->srtt + rtt) / 8;
+		}
+
+		variation = 4 * (uint64_t) link->rttvar;
+		if (variation < FILESTORE_LINK_GRANULARITY)
+			variation = FILESTORE_LINK_GRANULARITY;
+		link->rto = (link->srtt + variation > FILESTORE_LINK_MAX_RTO) ? FILESTORE_LINK_MAX_RTO : link->srtt + variation;
+		if (link->rto < FILESTORE_LINK_MIN_RTO)
+			link->rto = FILESTORE_LINK_MIN_RTO;
+
+		/* A valid measurement ends the backoff */
+		link->backoff = 0;
+	}
+
+	/* Update the link of a station with a frame which was received from it */
+	void received(uint8_t network, uint8_t station, const econet::Frame *frame, size_t length) {
+		uint16_t max;
+		Link *link;
+
+		if ((network > ECONET_MAX_NETWORK) || (station > 254) || ((network == 0) && (station == 0)) || (length < 8))
+			return;
+
+		std::lock_guard<std::mutex> lock(links_lock);
+		link = &links[network][station];
+		if (link->blocksize == 0)
+			link->blocksize = FILESTORE_LINK_START_BLOCK;
+
+		/* The ACK of our last reply gives a round-trip time sample, unless the reply was sent more than once */
+		if (frame->aun.type == AUN_ACK) {
+			if ((link->tx_time != 0) && (frame->aun.sequence == link->tx_sequence)) {
+				if (link->retransmitted == false)
+					sample(link, now() - link->tx_time);
+				link->tx_time = 0;
+			}
+			return;
+		}
+
+		link->frames++;
+		max = maxBlockSize(network, link);
+
+		/* The station had to send this frame again: a block was lost, so use smaller blocks */
+		if ((frame->aun.retry != 0) || ((link->frames > 1) && (frame->aun.sequence == link->last_sequence))) {
+			link->retries++;
+			link->clean = 0;
+			link->blocksize /= 2;
+			if (link->blocksize < FILESTORE_LINK_MIN_BLOCK)
+				link->blocksize = FILESTORE_LINK_MIN_BLOCK;
+		} else if (++link->clean >= FILESTORE_LINK_GROW_FRAMES) {
+			link->clean = 0;
+			link->blocksize = (link->blocksize > max / 2) ? max : link->blocksize * 2;
+		}
+		if (link->blocksize > max)
+			link->blocksize = max;
+
+		link->last_sequence = frame->aun.sequence;
+	}
+
+	/* Remember when a reply was sent to a station, to time its ACK */
+	void sent(uint8_t network, uint8_t station, uint32_t sequence) {
+		Link *link;
+
+		if ((network > ECONET_MAX_NETWORK) || (station > 254) || ((network == 0) && (station == 0)))
+			return;
+
+		std::lock_guard<std::mutex> lock(links_lock);
+		link = &links[network][station];
+		link->tx_sequence = sequence;
+		link->tx_time = now();
+		link->retransmitted = false;
+	}
+
+	/* A reply to a station wasn't ACKed in time and is sent again: back off */
+	void timeout(uint8_t network, uint8_t station) {
+		Link *link;
+
+		if ((network > ECONET_MAX_NETWORK) || (station > 254) || ((network == 0) && (station == 0)))
+			return;
+
+		std::lock_guard<std::mutex> lock(links_lock);
+		link = &links[network][station];
+		link->retransmitted = true;
+		link->timeouts++;
+		if (link->backoff < 16)
+			link->backoff++;
+	}
+
+	/* Current retransmission timeout for replies to a station, in microseconds */
+	uint32_t rto(uint8_t network, uint8_t station) {
+		uint64_t timeout;
+		Link *link;
+
+		if ((network > ECONET_MAX_NETWORK) || (station > 254) || ((network == 0) && (station == 0)))
+			return FILESTORE_LINK_INITIAL_RTO;
+
+		std::lock_guard<std::mutex> lock(links_lock);
+		link = &links[network][station];
+		timeout = (link->rto == 0) ? FILESTORE_LINK_INITIAL_RTO : link->rto;
+		timeout <<= link->backoff;
+		return (timeout > FILESTORE_LINK_MAX_RTO) ? FILESTORE_LINK_MAX_RTO : timeout;
+	}
+
+	/* Block size to advertise to a station; network and station are 0 for unknown stations */
+	uint16_t blockSize(uint8_t network, uint8_t station) {
+		if ((network > ECONET_MAX_NETWORK) || (station > 254) || ((network == 0) && (station == 0)))
+			return FILESTORE_LINK_START_BLOCK;
+
+		std::lock_guard<std::mutex> lock(links_lock);
+		if (links[network][station].blocksize == 0)
+			return FILESTORE_LINK_START_BLOCK;
+		return links[network][station].blocksize;
+	}
+
+	/* Get a copy of the link of a station; returns false if nothing was received from it yet */
+	bool lookup(uint8_t network, uint8_t station, Link *link) {
+		if ((network > ECONET_MAX_NETWORK) || (station > 254))
+			return false;
+
+		std::lock_guard<std::mutex> lock(links_lock);
+		if (links[network][station].blocksize == 0)
+			return false;
+
+		*link = links[network][station];
+		return true;
+	}
+}
+
@@ -0,0 +1,53 @@
+/* links.h
+ * Per-station link quality, retransmission timeouts and the data block size advertised to each station
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_LINKS_HEADER
+#define ECONET_LINKS_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint16_t, uint32_t, uint64_t
+
+#include "econet.h"			// econet::Frame, ECONET_MAX_FRAMESIZE
+
+#define FILESTORE_LINK_MIN_BLOCK	256			// Smallest block size advertised to a station
+#define FILESTORE_LINK_START_BLOCK	4096			// Block size advertised to a station we don't know anything about yet
+#define FILESTORE_LINK_BRIDGED_BLOCK	1280			// Largest block size for stations on real Econet, behind a bridge or on a slow link
+#define FILESTORE_LINK_MAX_BLOCK	(ECONET_MAX_FRAMESIZE - 8)	// Largest block size for stations on the local AUN network
+#define FILESTORE_LINK_GROW_FRAMES	32			// Number of frames without retransmissions before the block size is doubled
+#define FILESTORE_LINK_SLOW_RTT		20000			// Smoothed round-trip time (in microseconds) above which a link counts as slow
+#define FILESTORE_LINK_INITIAL_RTO	1000000			// Retransmission timeout (in microseconds) before the round-trip time is measured
+#define FILESTORE_LINK_MIN_RTO		20000			// Smallest retransmission timeout (in microseconds)
+#define FILESTORE_LINK_MAX_RTO		8000000			// Largest retransmission timeout (in microseconds), also after backing off
+#define FILESTORE_LINK_GRANULARITY	1000			// Clock granularity (in microseconds) added to the retransmission timeout
+
+namespace links {
+	/* Link quality of one station */
+	typedef struct {
+		uint32_t	frames;		// Number of frames received from this station
+		uint32_t	retries;	// Number of frames the station had to send again
+		uint32_t	clean;		// Number of frames received since the last retransmission
+		uint32_t	last_sequence;	// Sequence number of the last frame received from this station
+		uint32_t	tx_sequence;	// Sequence number of the last reply sent to this station, waiting for its ACK
+		uint64_t	tx_time;	// When that reply was sent (in microseconds), or 0 if it was already ACKed
+		bool		retransmitted;	// That reply was sent more than once, so its ACK can't be timed (Karn's rule)
+		uint32_t	srtt;		// Smoothed round-trip time in microseconds, or 0 if not measured yet
+		uint32_t	rttvar;		// Round-trip time variation in microseconds
+		uint32_t	rto;		// Retransmission timeout in microseconds, before backing off
+		uint8_t		backoff;	// Number of times the retransmission timeout was doubled since the last measurement
+		uint32_t	timeouts;	// Number of replies to this station which had to be sent again
+		uint16_t	blocksize;	// Block size currently advertised to this station, or 0 if not set yet
+	} Link;
+
+	void		received(uint8_t network, uint8_t station, const econet::Frame *frame, size_t length);
+	void		sent(uint8_t network, uint8_t station, uint32_t sequence);
+	void		timeout(uint8_t network, uint8_t station);
+	uint32_t	rto(uint8_t network, uint8_t station);
+	uint16_t	blockSize(uint8_t network, uint8_t station);
+	bool		lookup(uint8_t network, uint8_t station, Link *link);
+}
+
+#endif
+
@@ -5,6 +5,7 @@
  */
 
 #include <cstdio>			// Included for NULL, printf(), FILE*, fopen(), fgets(), feof() and fclose()
+#include <cstdlib>			// Included for exit()
 #include <cstring>			// Included for memmove(), strtok(), strcmp() and strlen()
 #include <atomic>			// Included for std::atomic
 #include <thread>			// Included for std::thread
@@ -18,10 +19,17 @@
 #include "errorhandler.h"		// Error handling functions
 #include "econet.h"			// Included for pollEconet() thread
 #include "aun.h"			// Included for pollAUN() thread
+#include "bcastload.h"			// bcastload::stop()
+#include "bridge.h"			// Included for bridge::start() and bridge::stop()
 #include "cli.h"			// All * commands
+#include "dircache.h"			// dircache::start() and dircache::stop()
 #include "netfs.h"			// netfs::dismount()
 #include "users.h"			// Included for users::loadUsers()
 #include "stations.h"			// Included for users::loadStations()
+#include "retransmit.h"			// retransmit::start() and retransmit::stop()
+#include "settings.h"			// settings::workers
+#include "trunk.h"			// trunk::start() and trunk::stop()
+#include "workers.h"			// workers::start() and workers::stop()
 #include "platforms/platform.h"		// All platform- and hardware-dependant functions
 
 using namespace std;
@@ -75,8 +83,30 @@ int main(int argc, char** argv) {
 		exit(0x000000D6);
 	}
 
+	/* Start watching the directories whose catalogues are cached */
+	dircache::start();
+
+	/* Register the port handlers before any listener can receive a frame */
+	econet::initProtoHandlers();
+
+	/* Start the worker threads which process the received frames */
+	workers::start(settings::workers);
+
+	/* Start sending replies again which aren't ACKed in time */
+	retransmit::start();
+
+	/* Send broadcasts to the multicast group, if one is configured; the listeners join it too */
+	if (settings::multicast_group != NULL)
+		aun::setMulticast((const char *) settings::multicast_group, (const char *) settings::multicast_interface);
+
+	/* Start the Econet-RX and forwarding stages of the bridge */
+	bridge::start();
+
+	/* Open the trunk to another bridge, if one is configured */
+	if (settings::trunk_peer != NULL)
+		trunk::start((const char *) settings::trunk_peer);
+
 	/* Spawn new thread for polling hardware and processing network data */
-//	std::thread thread_econet_listener(econet::pollNetworkReceive);
 	std::thread thread_ipv4_aun_Listener(aun::ipv4_aun_Listener);
 #if (FILESTORE_WITHIPV6 == 1)
 	std::thread thread_ipv6_aun_Listener(aun::ipv6_aun_Listener);
@@ -166,7 +196,6 @@ int main(int argc, char** argv) {
 	printf("\n");
 
 	/* Wait for the threads to finish */
-//	thread_econet_listener.join();
 	thread_ipv4_aun_Listener.join();
 #if (FILESTORE_WITHIPV6 == 1)
 	thread_ipv6_aun_Listener.join();
@@ -178,6 +207,24 @@ int main(int argc, char** argv) {
 #endif
 #endif
 
+	/* Stop a running broadcast load before the interfaces it sends on are closed */
+	bcastload::stop();
+
+	/* Close the trunk before the bridge stage it hands its frames over to is stopped */
+	trunk::stop();
+
+	/* Stop the bridge once the AUN listeners don't hand over any frames anymore */
+	bridge::stop();
+
+	/* Stop the worker threads once the listeners don't dispatch any frames anymore */
+	workers::stop();
+
+	/* Stop the retransmit thread once the workers don't send any replies anymore */
+	retransmit::stop();
+
+	/* Empty the directory cache once no worker reads catalogues anymore */
+	dircache::stop();
+
 	/* Dismount all open disc images */
 //	netfs::dismount(NULL);
 
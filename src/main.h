@@ -19,6 +19,7 @@
 #define ECONET_MAX_DISCTITLE_LEN	16
 #define ECONET_MAX_FILENAME_LEN		10
 #define ECONET_MAX_DIRENTRIES		47
+#define ECONET_MAX_NETWORK		127
 #define FILESTORE_MAX_ATTRIBS		8
 
 #include <cstdio>			// Included for FILE*
@@ -0,0 +1,302 @@
+/* metaindex.cpp
+ * Index with the Acorn metadata of all objects in a native directory
+ *
+ * Native files don't have load and exec addresses or Acorn attributes, so
+ * they're traditionally kept in an .INF file next to every object. Listing a
+ * directory then means opening and parsing one .INF file per object. With
+ * settings::metaindex on, the metadata of all objects in a directory is kept
+ * in one binary index file instead (FILESTORE_METAINDEX_FILE):
+ * - a listing reads the whole index with one read()
+ * - changing the metadata of one object appends a new record for it, which
+ *   replaces the earlier ones; deleting it appends a deleted record
+ * - once the index has grown to twice its live records, it's compacted
+ * Objects with native names of FILESTORE_METAINDEX_NAME characters or more
+ * don't fit in a record and keep using .INF files. *METAINDEX IMPORT and
+ * EXPORT convert a directory between .INF files and the index.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <algorithm>		// std::stable_sort()
+#include <cstdio>		// fprintf(), rename()
+#include <cstdlib>		// bsearch()
+#include <cstring>		// memcmp(), memcpy(), memset(), strcmp(), strlcpy()
+#include <fcntl.h>		// open(), openat()
+#include <mutex>		// std::mutex, std::lock_guard
+#include <sys/stat.h>		// fstat()
+#include <unistd.h>		// pread(), pwrite(), close(), unlink()
+
+#include "metaindex.h"		// Header file for this code
+#include "platforms/platform.h"	// PATH_MAX, strlcpy()
+
+using namespace std;
+
+
+
+namespace metaindex {
+	std::mutex	index_lock;		// Serializes changes to the index files
+
+	/* Order of the records: by native name */
+	int compareRecords(const void *a, const void *b) {
+		return strcmp(((const Record *) a)->native, ((const Record *) b)->native);
+	}
+
+	/* Order of the records for std::stable_sort(), which keeps the records of one object in the order they were written */
+	bool lessRecords(const Record &a, const Record &b) {
+		return (strcmp(a.native, b.native) < 0);
+	}
+
+	/* Assemble the path of the index of a directory; returns false if it's too long */
+	bool indexPath(const char *dirpath, char *path) {
+		return (snprintf(path, PATH_MAX, "%s/%s", dirpath, FILESTORE_METAINDEX_FILE) < PATH_MAX);
+	}
+
+	/* Check the header of an index */
+	bool validHeader(const Header *header) {
+		return ((memcmp(header->magic, FILESTORE_METAINDEX_MAGIC, sizeof(header->magic)) == 0) && (header->version == FILESTORE_METAINDEX_VERSION) && (header->recordsize == sizeof(Record)));
+	}
+
+	/* Read all records of an open index in the order they were written; returns the number of records, or -1 if it isn't a valid index */
+	int readRecords(int fd, Record **records) {
+		struct stat st;
+		Header header;
+		uint8_t *buffer;
+		int count;
+
+		if ((fstat(fd, &st) == -1) || (st.st_size < (off_t) sizeof(Header)))
+			return -1;
+
+		buffer = new uint8_t[st.st_size];
+		if (pread(fd, buffer, st.st_size, 0) != st.st_size) {
+			delete[] buffer;
+			return -1;
+		}
+
+		memcpy(&header, buffer, sizeof(Header));
+		if (validHeader(&header) == false) {
+			delete[] buffer;
+			return -1;
+		}
+
+		count = (st.st_size - sizeof(Header)) / sizeof(Record);
+		*records = new Record[(count > 0) ? count : 1];
+		memcpy(*records, buffer + sizeof(Header), count * sizeof(Record));
+		delete[] buffer;
+		return count;
+	}
+
+	/* Sort records by native name, and keep only the last live record of every object; returns the number of records left */
+	int tidy(Record *records, int count) {
+		int i, live;
+
+		std::stable_sort(records, records + count, lessRecords);
+		live = 0;
+		for (i = 0; i < count; i++) {
+			if ((i + 1 < count) && (strcmp(records[i].native, records[i + 1].native) == 0))
+				continue;
+			if ((records[i].native[0] == '\0') || (records[i].flags & FILESTORE_METAINDEX_DELETED))
+				continue;
+			if (live != i)
+				records[live] = records[i];
+			live++;
+		}
+		return live;
+	}
+
+	/* Read the index of a directory in one go, sorted by native name; returns the number of records, or -1 if the directory has no index */
+	int load(const char *dirpath, Record **records) {
+		char path[PATH_MAX];
+		int fd, count;
+
+		if ((indexPath(dirpath, path) == false) || ((fd = ::open(path, O_RDONLY | O_CLOEXEC)) == -1))
+			return -1;
+
+		count = readRecords(fd, records);
+		::close(fd);
+		if (count > 0)
+			count = tidy(*records, count);
+		return count;
+	}
+
+	/* Read the index of a directory which is open as dirfd; returns the number of records, or -1 if the directory has no index */
+	int loadAt(int dirfd, Record **records) {
+		int fd, count;
+
+		if ((fd = openat(dirfd, FILESTORE_METAINDEX_FILE, O_RDONLY | O_CLOEXEC)) == -1)
+			return -1;
+
+		count = readRecords(fd, records);
+		::close(fd);
+		if (count > 0)
+			count = tidy(*records, count);
+		return count;
+	}
+
+	/* Find the record of an object in a sorted index */
+	const Record *find(const Record *records, int count, const char *native) {
+		Record key;
+
+		if ((count <= 0) || (strlen(native) >= FILESTORE_METAINDEX_NAME))
+			return NULL;
+
+		strlcpy(key.native, native, sizeof(key.native));
+		return (const Record *) bsearch(&key, records, count, sizeof(Record), compareRecords);
+	}
+
+	/* Copy the metadata of a record to an object */
+	void apply(const Record *record, FSObject *obj) {
+		if (record->name[0] != '\0')
+			strlcpy(obj->name, record->name, sizeof(obj->name));
+		obj->loadaddr = record->loadaddr;
+		obj->execaddr = record->execaddr;
+		netfs::unpackattrib(record->attrib, &obj->attrib);
+		if (record->ctime != 0)
+			obj->ctime = record->ctime;
+		if (record->mtime != 0)
+			obj->mtime = record->mtime;
+	}
+
+	/* Fill a record with the metadata of an object */
+	void fill(Record *record, const char *native, const FSObject *obj) {
+		memset(record, 0, sizeof(Record));
+		strlcpy(record->native, native, sizeof(record->native));
+		if (strcmp(obj->name, native) != 0)
+			strlcpy(record->name, obj->name, sizeof(record->name));
+		record->attrib = netfs::packattrib(&obj->attrib);
+		record->loadaddr = obj->loadaddr;
+		record->execaddr = obj->execaddr;
+		record->ctime = obj->ctime;
+		record->mtime = obj->mtime;
+	}
+
+	/* Write a whole index to path */
+	int writeRecords(const char *path, const Record *records, int count) {
+		Header header;
+		int fd, result;
+
+		if ((fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1)
+			return -1;
+
+		memcpy(header.magic, FILESTORE_METAINDEX_MAGIC, sizeof(header.magic));
+		header.version = FILESTORE_METAINDEX_VERSION;
+		header.recordsize = sizeof(Record);
+		result = 0;
+		if ((pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) || (pwrite(fd, records, count * sizeof(Record), sizeof(header)) != (ssize_t) (count * sizeof(Record))))
+			result = -1;
+		::close(fd);
+		return result;
+	}
+
+	/* Open the index of a directory for changes, optionally creating it; returns the number of records in it, or -1 if it can't be used */
+	int openIndex(const char *dirpath, bool create, int *fd) {
+		char path[PATH_MAX];
+		Header header;
+		struct stat st;
+
+		if ((indexPath(dirpath, path) == false) || ((*fd = ::open(path, O_RDWR | O_CLOEXEC | (create ? O_CREAT : 0), 0644)) == -1)) {
+			if (create)
+				fprintf(stderr, "metaindex::openIndex: Unable to open the index of %s\n", dirpath);
+			return -1;
+		}
+
+		if (fstat(*fd, &st) == -1) {
+			::close(*fd);
+			return -1;
+		}
+		if (st.st_size == 0) {
+			memcpy(header.magic, FILESTORE_METAINDEX_MAGIC, sizeof(header.magic));
+			header.version = FILESTORE_METAINDEX_VERSION;
+			header.recordsize = sizeof(Record);
+			if (pwrite(*fd, &header, sizeof(header), 0) != sizeof(header)) {
+				::close(*fd);
+				return -1;
+			}
+			return 0;
+		}
+
+		if ((st.st_size < (off_t) sizeof(Header)) || (pread(*fd, &header, sizeof(header), 0) != sizeof(header)) || (validHeader(&header) == false)) {
+			fprintf(stderr, "metaindex::openIndex: The index of %s is invalid\n", dirpath);
+			::close(*fd);
+			return -1;
+		}
+		return (st.st_size - sizeof(Header)) / sizeof(Record);
+	}
+
+	/* Append a record to an open index with count records, and compact the index when it has grown to twice its live records */
+	int append(const char *dirpath, int fd, int count, const Record *record) {
+		char path[PATH_MAX], newpath[PATH_MAX];
+		Record *records;
+		int live;
+
+		if (pwrite(fd, record, sizeof(Record), sizeof(Header) + (count * sizeof(Record))) != sizeof(Record))
+			return -1;
+		count++;
+
+		/* Only look at the whole index each time its size doubles, so appending stays cheap */
+		if ((count < FILESTORE_METAINDEX_COMPACT) || ((count & (count - 1)) != 0))
+			return 0;
+		if ((count = readRecords(fd, &records)) == -1)
+			return 0;
+		live = tidy(records, count);
+		if ((live * 2 <= count) && (indexPath(dirpath, path) == true) && (snprintf(newpath, sizeof(newpath), "%s.new", path) < (int) sizeof(newpath))) {
+			/* Readers see either the old or the compacted index, never a half written one */
+			if ((writeRecords(newpath, records, live) != 0) || (rename(newpath, path) != 0)) {
+				fprintf(stderr, "metaindex::append: Unable to compact the index of %s\n", dirpath);
+				unlink(newpath);
+			}
+		}
+		delete[] records;
+		return 0;
+	}
+
+	/* Record the metadata of one object, without reading the rest of the index */
+	int update(const char *dirpath, const char *native, const FSObject *obj) {
+		Record record;
+		int fd, count, result;
+
+		if (strlen(native) >= FILESTORE_METAINDEX_NAME)
+			return -1;
+
+		fill(&record, native, obj);
+		std::lock_guard<std::mutex> lock(index_lock);
+		if ((count = openIndex(dirpath, true, &fd)) == -1)
+			return -1;
+		result = append(dirpath, fd, count, &record);
+		::close(fd);
+		return result;
+	}
+
+	/* Record that an object was deleted or renamed */
+	int forget(const char *dirpath, const char *native) {
+		Record record;
+		int fd, count, result;
+
+		if (strlen(native) >= FILESTORE_METAINDEX_NAME)
+			return 0;
+
+		memset(&record, 0, sizeof(Record));
+		strlcpy(record.native, native, sizeof(record.native));
+		record.flags = FILESTORE_METAINDEX_DELETED;
+		std::lock_guard<std::mutex> lock(index_lock);
+		if ((count = openIndex(dirpath, false, &fd)) == -1)
+			return 0;
+		result = append(dirpath, fd, count, &record);
+		::close(fd);
+		return result;
+	}
+
+	/* Replace the whole index of a directory */
+	int write(const char *dirpath, const Record *records, int count) {
+		char path[PATH_MAX];
+
+		if (indexPath(dirpath, path) == false)
+			return -1;
+
+		std::lock_guard<std::mutex> lock(index_lock);
+		if (writeRecords(path, records, count) != 0) {
+			fprintf(stderr, "metaindex::write: Unable to write the index of %s\n", dirpath);
+			return -1;
+		}
+		return 0;
+	}
+}
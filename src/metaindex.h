@@ -0,0 +1,54 @@
+/* metaindex.h
+ * Index with the Acorn metadata of all objects in a native directory
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_METAINDEX_HEADER
+#define ECONET_METAINDEX_HEADER
+
+#include <cstdint>			// uint8_t, uint16_t, uint32_t, int64_t
+
+#include "main.h"			// ECONET_MAX_FILENAME_LEN
+#include "netfs.h"			// FSObject
+
+#define FILESTORE_METAINDEX_FILE	".FSIndex"	// Name of the index in every native directory
+#define FILESTORE_METAINDEX_VERSION	1
+#define FILESTORE_METAINDEX_NAME	48		// Maximum length of a native name in the index, including the terminating NUL
+#define FILESTORE_METAINDEX_COMPACT	64		// Smallest number of records at which an index is compacted
+#define FILESTORE_METAINDEX_DELETED	0x01		// Record flag: the object was deleted or renamed
+
+const uint8_t FILESTORE_METAINDEX_MAGIC[] = {'F', 'S', 'I', 'X'};
+
+namespace metaindex {
+	/* Start of the index file; all fields are in host byte order */
+	typedef struct {
+		uint8_t		magic[4];
+		uint16_t	version;
+		uint16_t	recordsize;		// Size of one record, so records can be extended later
+	} Header;
+
+	/* Metadata of one object; a record with an empty native name is free, and a later record of the same object replaces it */
+	typedef struct {
+		char		native[FILESTORE_METAINDEX_NAME];	// Native name of the object
+		char		name[ECONET_MAX_FILENAME_LEN + 1];	// Acorn name of the object, or empty if it's the native name
+		uint8_t		flags;					// FILESTORE_METAINDEX_DELETED
+		uint16_t	attrib;					// Packed attributes (FILESTORE_ATTRIB_*)
+		uint32_t	loadaddr;
+		uint32_t	execaddr;
+		int64_t		ctime;
+		int64_t		mtime;
+	} Record;
+
+	int		load(const char *dirpath, Record **records);
+	int		loadAt(int dirfd, Record **records);
+	const Record	*find(const Record *records, int count, const char *native);
+	void		apply(const Record *record, FSObject *obj);
+	int		update(const char *dirpath, const char *native, const FSObject *obj);
+	int		forget(const char *dirpath, const char *native);
+	int		write(const char *dirpath, const Record *records, int count);
+	void		fill(Record *record, const char *native, const FSObject *obj);
+}
+
+#endif
+
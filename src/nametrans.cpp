@@ -0,0 +1,423 @@
+/* nametrans.cpp
+ * Translation between native file names and Acorn file names
+ *
+ * Acorn file names have at most ECONET_MAX_FILENAME_LEN characters, and
+ * can't contain characters which have a meaning in an Acorn path (such as
+ * . $ & @ ^ % : # and *). Native names can be longer and contain any of
+ * those, so every native name gets an Acorn name which is unique in its
+ * directory (regardless of case), as on other Acorn file servers:
+ * - a . becomes a /, so DATA.TXT is shown as DATA/TXT
+ * - names starting with a . are hidden (this includes . and .., the
+ *   metadata index and other dot files)
+ * - the .INF file of an object (DATA.INF next to DATA) holds the object's
+ *   metadata, and is hidden as well
+ * - a name which was given to the object in the metadata index is used
+ *   first; then come names which translate without loss, then names in
+ *   which characters had to be replaced by _, and last names which are too
+ *   long. A name which is too long, or which collides with a name handed out
+ *   earlier, is shortened and gets a ~ and a number (LONGFILE~1).
+ * Which name collides is decided in the order of the native names, so an
+ * object keeps its Acorn name as long as no objects are added before it.
+ *
+ * The names of a directory are translated all at once, into a map with the
+ * native names in native order and the Acorn names in alphabetical order,
+ * so both ways are a binary search. The maps of the most recently used
+ * directories are kept. Like the path name cache, the map of a directory
+ * is dropped as soon as the directory cache notices a change in it. A map
+ * which was being built while its directory changed isn't kept; every
+ * directory has its own invalidation counter for that, so a change in one
+ * directory doesn't keep the maps of all others out of the cache.
+ *
+ * Code which translates all names of a directory (such as reading a whole
+ * catalogue) gets its own copy of the map with load(), so the names are only
+ * translated once even if the directory can't be cached.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdio>		// snprintf()
+#include <cstdlib>		// qsort(), bsearch()
+#include <cstring>		// memset(), strchr(), strcmp(), strlcpy(), strlen()
+#include <mutex>		// std::mutex, std::unique_lock
+#include <strings.h>		// strcasecmp()
+
+#include "dircache.h"		// dircache::watch(), dircache::hashPath()
+#include "metaindex.h"		// metaindex::load(), metaindex::find()
+#include "nametrans.h"		// Header file for this code
+#include "nativefs.h"		// nativefs::names()
+#include "settings.h"		// settings::metaindex
+
+using namespace std;
+
+
+
+namespace nametrans {
+	Map		maps[FILESTORE_NAMETRANS_DIRS];
+	std::mutex	maps_lock;		// Protects maps[], tick and epochs[]
+	uint64_t	tick = 0;
+	uint64_t	epochs[FILESTORE_NAMETRANS_EPOCHS];	// Change with every invalidation of a directory, by path hash
+
+	/* Check if a character can be used in an Acorn file name */
+	inline bool acornChar(uint8_t c) {
+		return ((c > ' ') && (c < 0x7F) && (strchr("\"#$%&*.:@^|", c) == NULL));
+	}
+
+	/* Upper case of a name, for comparing names regardless of case */
+	void fold(const char *name, char *folded) {
+		while (*name != '\0') {
+			*folded++ = ((*name >= 'a') && (*name <= 'z')) ? *name - ('a' - 'A') : *name;
+			name++;
+		}
+		*folded = '\0';
+	}
+
+	/* Translate a native name to an Acorn name, shortened if needed; returns true if nothing was lost */
+	bool translate(const char *native, char *acorn) {
+		bool lossless;
+		int i;
+
+		lossless = true;
+		for (i = 0; native[i] != '\0'; i++) {
+			if (i == ECONET_MAX_FILENAME_LEN) {
+				lossless = false;
+				break;
+			}
+			if (native[i] == '.') {
+				acorn[i] = '/';
+			} else if (acornChar(native[i]) == true) {
+				acorn[i] = native[i];
+			} else {
+				acorn[i] = '_';
+				lossless = false;
+			}
+		}
+		acorn[i] = '\0';
+		return lossless;
+	}
+
+	/* Hash of a name regardless of case */
+	uint32_t hashName(const char *name) {
+		char folded[ECONET_MAX_FILENAME_LEN + 1];
+
+		fold(name, folded);
+		return dircache::hashPath(folded);
+	}
+
+	/* Give an entry an Acorn name, unless another entry already has it; table is an open addressing hash table of entry numbers + 1 */
+	bool claim(Map *map, int *table, int size, int entry, const char *acorn) {
+		int i;
+
+		for (i = hashName(acorn) & (size - 1); table[i] != 0; i = (i + 1) & (size - 1)) {
+			if (strcasecmp(map->acorns[table[i] - 1], acorn) == 0)
+				return false;
+		}
+		strlcpy(map->acorns[entry], acorn, ECONET_MAX_FILENAME_LEN + 1);
+		table[i] = entry + 1;
+		return true;
+	}
+
+	int compareNatives(const void *a, const void *b) {
+		return strcmp(*(const char * const *) a, *(const char * const *) b);
+	}
+
+	int compareKeys(const void *a, const void *b) {
+		return strcmp(((const Key *) a)->name, ((const Key *) b)->name);
+	}
+
+	/* Check if a native name is the .INF file of an object in a sorted list of native names */
+	bool sidecar(const char * const *natives, int count, const char *native) {
+		char base[NAME_MAX + 1];
+		const char *key;
+		size_t length;
+
+		length = strlen(native);
+		if ((count == 0) || (length <= 4) || (length > NAME_MAX) || (strcmp(native + length - 4, ".INF") != 0))
+			return false;
+		memcpy(base, native, length - 4);
+		base[length - 4] = '\0';
+		key = base;
+		return (bsearch(&key, natives, count, sizeof(const char *), compareNatives) != NULL);
+	}
+
+	/* Free the memory of a map */
+	void discard(Map *map) {
+		delete[] map->pool;
+		delete[] map->natives;
+		delete[] map->acorns;
+		delete[] map->byacorn;
+		memset(map, 0, sizeof(Map));
+	}
+
+	/* Read all names in a directory, and translate them; returns false if the directory can't be read */
+	bool build(const char *localpath, Map *map) {
+		metaindex::Record *records;
+		const metaindex::Record *record;
+		char acorn[ECONET_MAX_FILENAME_LEN + 1];
+		char suffix[16];
+		const char *name;
+		bool *named;
+		int *table;
+		int i, count, numrecords, size, pass, number, length;
+
+		if ((count = nativefs::names(localpath, &map->pool)) == -1)
+			return false;
+
+		map->natives = new const char *[(count > 0) ? count : 1];
+		map->count = 0;
+		for (name = map->pool, i = 0; i < count; name += strlen(name) + 1, i++) {
+			if (name[0] != '.')
+				map->natives[map->count++] = name;
+		}
+		map->poolsize = name - map->pool;
+		qsort(map->natives, map->count, sizeof(const char *), compareNatives);
+
+		/* An object sorts before its .INF file, so the objects which are kept so far are enough to find it */
+		for (count = 0, i = 0; i < map->count; i++) {
+			if (sidecar(map->natives, count, map->natives[i]) == false)
+				map->natives[count++] = map->natives[i];
+		}
+		map->count = count;
+
+		map->acorns = new char[(count > 0) ? count : 1][ECONET_MAX_FILENAME_LEN + 1];
+		named = new bool[(count > 0) ? count : 1];
+		memset(named, 0, count * sizeof(bool));
+		for (size = 16; size < 2 * count; size *= 2)
+			;
+		table = new int[size];
+		memset(table, 0, size * sizeof(int));
+
+		records = NULL;
+		numrecords = (settings::metaindex == true) ? metaindex::load(localpath, &records) : -1;
+
+		/* Names from the index first, then lossless names, then names with replaced characters, then everything else gets a unique short name */
+		for (pass = 0; pass < 4; pass++) {
+			for (i = 0; i < count; i++) {
+				if (named[i] == true)
+					continue;
+
+				switch (pass) {
+					case 0 :
+						if (((record = metaindex::find(records, numrecords, map->natives[i])) != NULL) && (record->name[0] != '\0'))
+							named[i] = claim(map, table, size, i, record->name);
+						break;
+
+					case 1 :
+						if (translate(map->natives[i], acorn) == true)
+							named[i] = claim(map, table, size, i, acorn);
+						break;
+
+					case 2 :
+						translate(map->natives[i], acorn);
+						if (strlen(map->natives[i]) <= ECONET_MAX_FILENAME_LEN)
+							named[i] = claim(map, table, size, i, acorn);
+						break;
+
+					default :
+						translate(map->natives[i], acorn);
+						for (number = 1; named[i] == false; number++) {
+							snprintf(suffix, sizeof(suffix), "~%d", number);
+							length = ECONET_MAX_FILENAME_LEN - strlen(suffix);
+							if ((int) strlen(acorn) < length)
+								length = strlen(acorn);
+							acorn[length] = '\0';
+							strlcpy(&acorn[length], suffix, sizeof(acorn) - length);
+							named[i] = claim(map, table, size, i, acorn);
+							acorn[length] = '\0';
+						}
+						break;
+				}
+			}
+		}
+		delete[] records;
+		delete[] table;
+		delete[] named;
+
+		map->byacorn = new Key[(count > 0) ? count : 1];
+		for (i = 0; i < count; i++) {
+			fold(map->acorns[i], map->byacorn[i].name);
+			map->byacorn[i].entry = i;
+		}
+		qsort(map->byacorn, count, sizeof(Key), compareKeys);
+		return true;
+	}
+
+	/* Find the map of a directory, translating its names first if they aren't cached; returns with lock locked, or NULL if the directory can't be read */
+	Map *acquire(const char *localpath, Map *scratch, std::unique_lock<std::mutex> &lock) {
+		uint32_t hash;
+		uint64_t started;
+		bool cacheable;
+		int i, slot;
+
+		hash = dircache::hashPath(localpath);
+		lock.lock();
+		for (i = 0; i < FILESTORE_NAMETRANS_DIRS; i++) {
+			if ((maps[i].used == true) && (maps[i].hash == hash) && (strcmp(maps[i].path, localpath) == 0)) {
+				maps[i].lastused = ++tick;
+				return &maps[i];
+			}
+		}
+		lock.unlock();
+
+		/* Watch the directory before reading it, so a change while it's read isn't missed */
+		cacheable = ((strlen(localpath) < PATH_MAX) && (dircache::watch(localpath) == true));
+		lock.lock();
+		started = epochs[hash & (FILESTORE_NAMETRANS_EPOCHS - 1)];
+		lock.unlock();
+
+		if (build(localpath, scratch) == false) {
+			lock.lock();
+			return NULL;
+		}
+
+		lock.lock();
+		if ((cacheable == false) || (epochs[hash & (FILESTORE_NAMETRANS_EPOCHS - 1)] != started))
+			return scratch;
+
+		/* Use a free slot, or else the least recently used one */
+		slot = 0;
+		for (i = 0; i < FILESTORE_NAMETRANS_DIRS; i++) {
+			if (maps[i].used == false) {
+				slot = i;
+				break;
+			}
+			if (maps[i].lastused < maps[slot].lastused)
+				slot = i;
+		}
+		discard(&maps[slot]);
+		maps[slot] = *scratch;
+		memset(scratch, 0, sizeof(Map));
+		maps[slot].used = true;
+		strlcpy(maps[slot].path, localpath, sizeof(maps[slot].path));
+		maps[slot].hash = hash;
+		maps[slot].lastused = ++tick;
+		return &maps[slot];
+	}
+
+	/* Copy a map, so it can be used without holding maps_lock */
+	void copy(const Map *from, Map *to) {
+		int i, count;
+
+		*to = *from;
+		count = (from->count > 0) ? from->count : 1;
+		to->pool = new char[(from->poolsize > 0) ? from->poolsize : 1];
+		memcpy(to->pool, from->pool, from->poolsize);
+		to->natives = new const char *[count];
+		for (i = 0; i < from->count; i++)
+			to->natives[i] = to->pool + (from->natives[i] - from->pool);
+		to->acorns = new char[count][ECONET_MAX_FILENAME_LEN + 1];
+		memcpy(to->acorns, from->acorns, from->count * sizeof(*from->acorns));
+		to->byacorn = new Key[count];
+		memcpy(to->byacorn, from->byacorn, from->count * sizeof(Key));
+	}
+
+	/* Get a copy of the map of a directory, to translate many names in it; returns false if the directory can't be read */
+	bool load(const char *localpath, Map *map) {
+		std::unique_lock<std::mutex> lock(maps_lock, std::defer_lock);
+		Map scratch, *found;
+
+		memset(&scratch, 0, sizeof(Map));
+		memset(map, 0, sizeof(Map));
+		found = acquire(localpath, &scratch, lock);
+		if (found == &scratch) {
+			/* The map isn't cached: take it over */
+			*map = scratch;
+		} else if (found != NULL) {
+			copy(found, map);
+		}
+		lock.unlock();
+		return (found != NULL);
+	}
+
+	/* Get the Acorn name of an object from a map of its directory; returns false if the object is hidden */
+	bool find(const Map *map, const char *native, char *acorn) {
+		const char **found;
+
+		if (native[0] == '.')
+			return false;
+
+		if ((map->count > 0) && ((found = (const char **) bsearch(&native, map->natives, map->count, sizeof(const char *), compareNatives)) != NULL))
+			strlcpy(acorn, map->acorns[found - map->natives], ECONET_MAX_FILENAME_LEN + 1);
+		else if (sidecar(map->natives, map->count, native) == true)
+			return false;
+		else
+			translate(native, acorn);
+		return true;
+	}
+
+	/* Free a map which was got with load() */
+	void release(Map *map) {
+		discard(map);
+	}
+
+	/* Get the Acorn name of an object in a directory; returns false if the object is hidden */
+	bool toAcorn(const char *localpath, const char *native, char *acorn) {
+		std::unique_lock<std::mutex> lock(maps_lock, std::defer_lock);
+		Map scratch, *map;
+		bool shown;
+
+		if (native[0] == '.')
+			return false;
+
+		memset(&scratch, 0, sizeof(Map));
+		shown = true;
+		map = acquire(localpath, &scratch, lock);
+		if (map != NULL)
+			shown = find(map, native, acorn);
+		else
+			translate(native, acorn);
+		lock.unlock();
+
+		discard(&scratch);
+		return shown;
+	}
+
+	/* Get the native name of an object in a directory by its Acorn name, regardless of case; returns false if there's no such object */
+	bool toNative(const char *localpath, const char *acorn, char *native) {
+		std::unique_lock<std::mutex> lock(maps_lock, std::defer_lock);
+		const Key *found;
+		Map scratch, *map;
+		Key key;
+
+		if (strlen(acorn) > ECONET_MAX_FILENAME_LEN)
+			return false;
+		fold(acorn, key.name);
+
+		memset(&scratch, 0, sizeof(Map));
+		found = NULL;
+		map = acquire(localpath, &scratch, lock);
+		if ((map != NULL) && ((found = (const Key *) bsearch(&key, map->byacorn, map->count, sizeof(Key), compareKeys)) != NULL))
+			strlcpy(native, map->natives[found->entry], NAME_MAX + 1);
+		lock.unlock();
+
+		discard(&scratch);
+		return (found != NULL);
+	}
+
+	/* Drop the map of a directory which changed */
+	void invalidate(const char *localpath) {
+		uint32_t hash;
+		int i;
+
+		hash = dircache::hashPath(localpath);
+		std::lock_guard<std::mutex> lock(maps_lock);
+		epochs[hash & (FILESTORE_NAMETRANS_EPOCHS - 1)]++;
+		for (i = 0; i < FILESTORE_NAMETRANS_DIRS; i++) {
+			if ((maps[i].used == true) && (maps[i].hash == hash) && (strcmp(maps[i].path, localpath) == 0))
+				discard(&maps[i]);
+		}
+	}
+
+	/* Drop all maps, e.g. when changes may have been missed */
+	void invalidateAll(void) {
+		int i;
+
+		std::lock_guard<std::mutex> lock(maps_lock);
+		for (i = 0; i < FILESTORE_NAMETRANS_EPOCHS; i++)
+			epochs[i]++;
+		for (i = 0; i < FILESTORE_NAMETRANS_DIRS; i++) {
+			if (maps[i].used == true)
+				discard(&maps[i]);
+		}
+	}
+}
+
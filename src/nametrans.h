@@ -0,0 +1,50 @@
+/* nametrans.h
+ * Translation between native file names and Acorn file names
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_NAMETRANS_HEADER
+#define ECONET_NAMETRANS_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint32_t, uint64_t
+
+#include "main.h"			// ECONET_MAX_FILENAME_LEN
+#include "platforms/platform.h"		// PATH_MAX
+
+#define FILESTORE_NAMETRANS_DIRS	32		// Maximum number of directories whose names are kept translated
+#define FILESTORE_NAMETRANS_EPOCHS	256		// Number of invalidation counters, shared by directories with the same path hash; must be a power of 2
+
+namespace nametrans {
+	/* Sort key of an Acorn name: the name in upper case, and the entry it belongs to */
+	typedef struct {
+		char		name[ECONET_MAX_FILENAME_LEN + 1];
+		int		entry;
+	} Key;
+
+	/* Translated names of all visible objects in a native directory */
+	typedef struct {
+		bool		used;
+		char		path[PATH_MAX];				// Native path of the directory
+		uint32_t	hash;					// Hash of the path, to find it quickly
+		int		count;					// Number of objects
+		char		*pool;					// Native names of the objects, one after another
+		size_t		poolsize;				// Length of the pool
+		const char	**natives;				// Native names, in native order
+		char		(*acorns)[ECONET_MAX_FILENAME_LEN + 1];	// Acorn name of every native name
+		Key		*byacorn;				// Acorn names in upper case, in alphabetical order
+		uint64_t	lastused;				// When the map was used last, to find the least recently used one
+	} Map;
+
+	bool		load(const char *localpath, Map *map);
+	bool		find(const Map *map, const char *native, char *acorn);
+	void		release(Map *map);
+	bool		toAcorn(const char *localpath, const char *native, char *acorn);
+	bool		toNative(const char *localpath, const char *acorn, char *native);
+	void		invalidate(const char *localpath);
+	void		invalidateAll(void);
+}
+
+#endif
+
@@ -4,69 +4,157 @@
  * (c) Eelco Huininga 2017-2019
  */
 
+#include <atomic>	// std::atomic
 #include <cstdio>	// FILE*, fopen(), fclose(), fgetpos(), fsetpos(), fgetc(), fputc(), fread(), fwrite()
-#include <cstring>	// basename()
-#include <dirent.h>	// dirent, opendir, readdir
-#include <unistd.h>	// access()
-#include <sys/stat.h>	/* stat */
+#include <cstring>	// memcpy(), memset(), strchr(), strrchr()
+#include <strings.h>	// strcasecmp()
+#include <dirent.h>	// dirent, opendir, readdir, DT_DIR, DT_REG, DT_LNK, DT_UNKNOWN
+#include <fcntl.h>	// open(), openat(), O_PATH, AT_SYMLINK_NOFOLLOW
+#include <unistd.h>	// access(), close(), pread(), pwrite(), write(), lseek()
+#include <sys/stat.h>	/* stat, fstatat() */
+#include <sys/syscall.h>	// SYS_getdents64
 
 #include "config.h"	// uint8_t, uint32_t
+#include "cursors.h"	// cursors::read(), cursors::open()
+#include "dircache.h"	// dircache::snapshot(), dircache::begin(), dircache::store()
+#include "fsdir.h"	// fsdir::add(), fsdir::append(), fsdir::filter(), fsdir::sort()
 #include "main.h"	// ECONET_MAX_FILENAME_LEN
+#include "metaindex.h"	// metaindex::load(), metaindex::loadAt(), metaindex::find(), metaindex::update()
+#include "nametrans.h"	// nametrans::load(), nametrans::find(), nametrans::toAcorn(), nametrans::toNative()
 #include "nativefs.h"	/* FILESTORE_NATIVE_FILEHANDLE */
-#include "netfs.h"	// FILESTORE_MAX_FILEHANDLES, FILESTORE_EOF, FILESTORE_HANDLE, newhandle(), freehandle(), struct Attributes
+#include "netfs.h"	// FILESTORE_EOF, FILESTORE_HANDLE, struct Attributes
+#include "settings.h"	// settings::metaindex
+#include "wildcard.h"	// wildcard::compile()
 
 
 
 namespace nativefs {
-	FILESTORE_NATIVE_FILEHANDLE filehandles[FILESTORE_MAX_FILEHANDLES];
+	FILESTORE_NATIVE_FILEHANDLE *filehandles[FILESTORE_FILEHANDLE_CHUNKS];	/* File handles, allocated a chunk at a time; a chunk never moves */
+	std::atomic<int> numfilehandles(0);	/* Number of file handles in all allocated chunks */
+	int freefilehandles = -1;	/* Most recently freed file handle, or -1 */
+	std::mutex filehandles_lock;	/* Protects the allocation of file handles, and used and the paths in filehandles[], which are scanned by remove() and rename() */
+	FILESTORE_NATIVE_DIRHANDLE dirhandles[FILESTORE_MAX_DIRHANDLES];
+	std::mutex dirhandles_lock;	/* Protects dirhandles[] and root */
+	int root = -1;			/* Directory handle of FILESTORE_NATIVE_ROOT, which stays open */
+
+	/* Entry in the buffer filled by getdents64(), which glibc doesn't declare */
+	struct linux_dirent64 {
+		uint64_t	d_ino;
+		int64_t		d_off;
+		unsigned short	d_reclen;
+		unsigned char	d_type;
+		char		d_name[256];	/* NUL terminated, and usually much shorter */
+	};
+
+	/* Convert an fopen() mode to open() flags */
+	int openflags(const char *mode) {
+		bool update;
+
+		update = (strchr(mode, '+') != NULL);
+		switch (mode[0]) {
+			case 'w' :
+				return ((update == true) ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+			case 'a' :
+				return ((update == true) ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND;
+			default :
+				return (update == true) ? O_RDWR : O_RDONLY;
+		}
+	}
+
+	/* Find the data of a file handle; returns NULL if the handle was never handed out */
+	FILESTORE_NATIVE_FILEHANDLE *filehandle(FILESTORE_HANDLE handle) {
+		if ((handle < 0) || (handle >= numfilehandles))
+			return NULL;
+		return &filehandles[handle / FILESTORE_FILEHANDLE_CHUNK][handle % FILESTORE_FILEHANDLE_CHUNK];
+	}
+
+	/* Reserve a file handle: the most recently freed one, or else a new one; the caller must hold filehandles_lock */
+	FILESTORE_HANDLE newfilehandle(void) {
+		FILESTORE_HANDLE handle;
+		int chunk;
+
+		if ((handle = freefilehandles) != -1) {
+			freefilehandles = filehandle(handle)->next;
+			return handle;
+		}
+
+		/* All handles are in use: add a chunk once the last one is full */
+		handle = numfilehandles;
+		if ((handle % FILESTORE_FILEHANDLE_CHUNK) == 0) {
+			if ((chunk = handle / FILESTORE_FILEHANDLE_CHUNK) == FILESTORE_FILEHANDLE_CHUNKS)
+				return -1;
+			filehandles[chunk] = new FILESTORE_NATIVE_FILEHANDLE[FILESTORE_FILEHANDLE_CHUNK]();
+		}
+		numfilehandles = handle + 1;
+		return handle;
+	}
 
 	FILESTORE_HANDLE open(const char *filename, const char *mode) {
+		FILESTORE_NATIVE_FILEHANDLE *fh;
 		FILESTORE_HANDLE handle;
-		long int filesize;
-
-		if ((handle = netfs::newhandle()) != -1) {
-			filehandles[handle].fp = fopen(filename, mode);
-			if (filehandles[handle].fp == NULL) {
-				return FILESTORE_EOF;
-			} else {
-				/* Get filesize */
-				fseek(filehandles[handle].fp, 0, SEEK_END);
-				filesize = ftell(filehandles[handle].fp);
-				fseek(filehandles[handle].fp, 0, SEEK_SET);
-				filehandles[handle].obj->length = filesize;
-
-				/* Get extra information from .INF file */
-				readinf(filename, filehandles[handle].obj);
-
-				/* Set internal variables */
-				strlcpy((char *) filehandles[handle].obj->name, filename, ECONET_MAX_FILENAME_LEN);
-				filehandles[handle].pos = 0;
-
-				/* Return FileStore's file handle */
-				return handle;
-			}
+		struct stat64 localattribs;
+		FSObject obj;
+		int fd;
+
+		if ((fd = ::open(filename, openflags(mode) | O_CLOEXEC, 0644)) == -1)
+			return FILESTORE_EOF;
+
+		/* Get filesize and extra information from .INF file */
+		memset(&obj, 0, sizeof(obj));
+		if (fstat64(fd, &localattribs) == 0)
+			obj.length = localattribs.st_size;
+		readinf(filename, &obj);
+
+		{
+			std::lock_guard<std::mutex> lock(filehandles_lock);
+			handle = newfilehandle();
+		}
+		if (handle == -1) {
+			::close(fd);
+			fprintf(stderr, "0x000000C0 fopen Unable to open file: Maximum number of open files reached");
+			return FILESTORE_EOF;
+		}
+
+		/* Set internal variables; a file which is appended to starts at its end */
+		fh = filehandle(handle);
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		fh->fd = fd;
+		fh->obj = obj;
+		fh->pos = (mode[0] == 'a') ? obj.length : 0;
+		fh->append = (mode[0] == 'a');
+		{
+			std::lock_guard<std::mutex> lock(filehandles_lock);
+			strlcpy(fh->localobj, filename, sizeof(fh->localobj));
+			fh->used = true;
 		}
 
-		fprintf(stderr, "0x000000C0 fopen Unable to open file: Maximum number of open files reached");
-		return FILESTORE_EOF;
+		/* Return FileStore's file handle */
+		return handle;
 	}
 
 	int close(FILESTORE_HANDLE handle) {
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		int result;
+
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			if (fclose(filehandles[handle].fp) == 0) {
-				filehandles[handle].fp = NULL;
-				filehandles[handle].obj->name[0] = '\0';
-				filehandles[handle].pos = 0;
-				netfs::freehandle(handle);
-				return 0;
-			} else {
-				/* Unable to close handle */
-				return FILESTORE_EOF;
-			}
+
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+
+		result = ::close(fh->fd);
+		fh->fd = -1;
+		fh->pos = 0;
+		fh->append = false;
+		{
+			std::lock_guard<std::mutex> lock(filehandles_lock);
+			fh->used = false;
+			fh->localobj[0] = '\0';
+			fh->next = freefilehandles;
+			freefilehandles = handle;
 		}
+		return (result == 0) ? 0 : FILESTORE_EOF;
 	}
 
 	size_t load(const char *localfile, char *buffer, uint32_t bufsize) {
@@ -101,195 +189,706 @@ namespace nativefs {
 		return retval;
 	}
 
-	int catalogue(const char *localpath, FSDirectory *dir, const char *mask, const uint8_t startentry, const uint8_t numentries) {
-		DIR *localdir;
-		struct dirent *direntry;
-		struct stat64 localattribs;
+	/* Put an open directory in a free directory handle; the caller must hold dirhandles_lock */
+	int newdirectory(int fd, const char *path) {
 		int i;
 
-		i = 0;
-		if (numentries <= ECONET_MAX_DIRENTRIES) {
-			if ((localdir = opendir(localpath)) != NULL) {
-				while (((direntry = readdir(localdir)) != NULL) && (i < ECONET_MAX_DIRENTRIES)) {
-					if (i >= startentry) {
-						strlcpy((char *) dir->fsp[i].name, direntry->d_name, ECONET_MAX_FILENAME_LEN);
-						dir->fsp[i].loadaddr = 0;
-						dir->fsp[i].execaddr = 0;
-						dir->fsp[i].length = 0;
-						dir->fsp[i].attrib.R = false;
-						dir->fsp[i].attrib.W = false;
-						dir->fsp[i].attrib.L = false;
-						dir->fsp[i].attrib.D = false;
-						dir->fsp[i].attrib.E = false;
-						dir->fsp[i].attrib.r = false;
-						dir->fsp[i].attrib.w = false;
-						dir->fsp[i].attrib.e = false;
-						dir->fsp[i].attrib.P = false;
-						if (stat64(direntry->d_name, &localattribs)) {
-							dir->fsp[i].length = localattribs.st_size;
-							dir->fsp[i].ctime = localattribs.st_ctime;
-							dir->fsp[i].mtime = localattribs.st_mtime;
-							if ((S_ISDIR(localattribs.st_mode)) != 0)
-								dir->fsp[i].attrib.D = true;
-						} else
-							fprintf(stderr, "stat failed\n");
-						readinf(direntry->d_name, &dir->fsp[i]);
-						i++;
-					}
-				}
-				closedir(localdir);
+		for (i = 0; i < FILESTORE_MAX_DIRHANDLES; i++) {
+			if (dirhandles[i].refs == 0) {
+				dirhandles[i].fd = fd;
+				dirhandles[i].refs = 1;
+				strlcpy(dirhandles[i].path, path, sizeof(dirhandles[i].path));
 				return i;
 			}
 		}
 
-		return 0;
+		fprintf(stderr, "nativefs::newdirectory: Maximum number of open directories reached\n");
+		::close(fd);
+		return -1;
+	}
+
+	/* Get a directory handle of the root of the file server; the caller must close it again */
+	int rootdirectory(void) {
+		int fd;
+
+		std::lock_guard<std::mutex> lock(dirhandles_lock);
+		if (root == -1) {
+			if ((fd = ::open(FILESTORE_NATIVE_ROOT, O_PATH | O_DIRECTORY | O_CLOEXEC)) == -1) {
+				fprintf(stderr, "nativefs::rootdirectory: Unable to open %s\n", FILESTORE_NATIVE_ROOT);
+				return -1;
+			}
+			if ((root = newdirectory(fd, FILESTORE_NATIVE_ROOT)) == -1)
+				return -1;
+		}
+		dirhandles[root].refs++;
+		return root;
+	}
+
+	/* Open a directory relative to an open directory, or an absolute path if parent is -1; returns a directory handle, or -1 */
+	int opendirectory(int parent, const char *name) {
+		char path[PATH_MAX];
+		int fd;
+
+		std::lock_guard<std::mutex> lock(dirhandles_lock);
+		if (parent == -1) {
+			if (strlcpy(path, name, sizeof(path)) >= sizeof(path))
+				return -1;
+			fd = ::open(name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		} else {
+			if ((parent < 0) || (parent >= FILESTORE_MAX_DIRHANDLES) || (dirhandles[parent].refs == 0))
+				return -1;
+			if (snprintf(path, sizeof(path), "%s/%s", (strcmp(dirhandles[parent].path, "/") == 0) ? "" : dirhandles[parent].path, name) >= (int) sizeof(path))
+				return -1;
+			fd = openat(dirhandles[parent].fd, name, O_PATH | O_DIRECTORY | O_CLOEXEC);
+		}
+		if (fd == -1)
+			return -1;
+
+		return newdirectory(fd, path);
+	}
+
+	/* Add a user to a directory handle, e.g. when the CSD and LIB are the same directory */
+	void retaindirectory(int directory) {
+		std::lock_guard<std::mutex> lock(dirhandles_lock);
+		if ((directory >= 0) && (directory < FILESTORE_MAX_DIRHANDLES) && (dirhandles[directory].refs != 0))
+			dirhandles[directory].refs++;
+	}
+
+	/* Close a directory handle; the directory is closed when its last user is gone */
+	void closedirectory(int directory) {
+		std::lock_guard<std::mutex> lock(dirhandles_lock);
+		if ((directory < 0) || (directory >= FILESTORE_MAX_DIRHANDLES) || (dirhandles[directory].refs == 0))
+			return;
+		if (--dirhandles[directory].refs == 0)
+			::close(dirhandles[directory].fd);
+	}
+
+	/* Get the full native path of an open directory */
+	bool directorypath(int directory, char *path) {
+		std::lock_guard<std::mutex> lock(dirhandles_lock);
+		if ((directory < 0) || (directory >= FILESTORE_MAX_DIRHANDLES) || (dirhandles[directory].refs == 0))
+			return false;
+		strlcpy(path, dirhandles[directory].path, PATH_MAX);
+		return true;
+	}
+
+	/* Read the names of all objects in a native directory, one after another, into a new pool; returns the number of names, or -1 if the directory can't be read */
+	int names(const char *localpath, char **pool) {
+		const struct linux_dirent64 *direntry;
+		char *buffer, *grown;
+		long length, offset;
+		size_t used, size, namelength;
+		int fd, count;
+
+		if ((fd = ::open(localpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+			return -1;
+
+		count = 0;
+		used = 0;
+		size = FILESTORE_GETDENTS_BUFFER;
+		*pool = new char[size];
+		buffer = new char[FILESTORE_GETDENTS_BUFFER];
+		while ((length = syscall(SYS_getdents64, fd, buffer, FILESTORE_GETDENTS_BUFFER)) > 0) {
+			for (offset = 0; offset < length; offset += direntry->d_reclen) {
+				direntry = (const struct linux_dirent64 *) (buffer + offset);
+				if ((strcmp(direntry->d_name, ".") == 0) || (strcmp(direntry->d_name, "..") == 0))
+					continue;
+
+				namelength = strlen(direntry->d_name) + 1;
+				if (used + namelength > size) {
+					grown = new char[size * 2];
+					memcpy(grown, *pool, used);
+					delete[] *pool;
+					*pool = grown;
+					size *= 2;
+				}
+				memcpy(*pool + used, direntry->d_name, namelength);
+				used += namelength;
+				count++;
+			}
+		}
+		delete[] buffer;
+		::close(fd);
+
+		if (length == -1) {
+			fprintf(stderr, "nativefs::names: Unable to read directory %s\n", localpath);
+			delete[] *pool;
+			*pool = NULL;
+			return -1;
+		}
+		return count;
+	}
+
+	/* Find the native name of an object in a directory by its Acorn name, regardless of case; returns false if there's no such object */
+	bool lookup(const char *localpath, const char *name, char *native, bool *directory) {
+		struct stat64 localattribs;
+		char path[PATH_MAX];
+
+		if (nametrans::toNative(localpath, name, native) == false)
+			return false;
+
+		*directory = ((snprintf(path, sizeof(path), "%s/%s", localpath, native) < (int) sizeof(path)) && (stat64(path, &localattribs) == 0) && (S_ISDIR(localattribs.st_mode) != 0));
+		return true;
+	}
+
+	/* Get the length, dates and metadata of a native object; returns false if it doesn't exist */
+	bool info(const char *localpath, FSObject *obj) {
+		struct stat64 localattribs;
+		char dirpath[PATH_MAX];
+		const char *native;
+
+		if (stat64(localpath, &localattribs) != 0)
+			return false;
+
+		memset(obj, 0, sizeof(FSObject));
+		obj->length = localattribs.st_size;
+		obj->ctime = localattribs.st_ctime;
+		obj->mtime = localattribs.st_mtime;
+		if ((S_ISDIR(localattribs.st_mode)) != 0)
+			obj->attrib.D = true;
+		readinf(localpath, obj);
+
+		/* The Acorn name is the one which the object has in its directory */
+		splitPath(localpath, dirpath, &native);
+		if (nametrans::toAcorn(dirpath, native, obj->name) == false)
+			strlcpy(obj->name, native, sizeof(obj->name));
+		return true;
+	}
+
+	/* Read the whole catalogue of a native directory which is open as dirfd into an empty listing, without lengths and dates unless details is set; returns the number of entries, or -1 if the directory can't be read */
+	int scan(int dirfd, const char *localpath, FSDirectory *catalogue, bool details) {
+		const struct linux_dirent64 *direntry;
+		struct stat64 localattribs;
+		metaindex::Record *records;
+		const metaindex::Record *record;
+		nametrans::Map names;
+		FSObject entry, *obj;
+		char acorn[ECONET_MAX_FILENAME_LEN + 1];
+		char *buffer;
+		long length, offset;
+		int fd, numrecords;
+		bool directory;
+
+		if ((fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+			return -1;
+
+		/* Translate all names at once, instead of looking up the directory again for every entry */
+		nametrans::load(localpath, &names);
+
+		/* The metadata of all objects comes from the index, if the directory has one */
+		records = NULL;
+		numrecords = (settings::metaindex == true) ? metaindex::loadAt(dirfd, &records) : -1;
+
+		obj = &entry;
+		buffer = new char[FILESTORE_GETDENTS_BUFFER];
+		while ((length = syscall(SYS_getdents64, fd, buffer, FILESTORE_GETDENTS_BUFFER)) > 0) {
+			for (offset = 0; offset < length; offset += direntry->d_reclen) {
+				direntry = (const struct linux_dirent64 *) (buffer + offset);
+				memset(obj, 0, sizeof(FSObject));
+
+				/* Hidden objects (., .. and the index among them) aren't listed */
+				if (nametrans::find(&names, direntry->d_name, acorn) == false)
+					continue;
+
+				/* Directories are stat'ed as well, so they get their dates; the type from the filesystem is used if that fails. Without details, only a filesystem which doesn't give the type needs a stat */
+				directory = (direntry->d_type == DT_DIR);
+				if (((details == true) || (direntry->d_type == DT_UNKNOWN)) && (fstatat64(dirfd, direntry->d_name, &localattribs, 0) == 0)) {
+					obj->length = localattribs.st_size;
+					obj->ctime = localattribs.st_ctime;
+					obj->mtime = localattribs.st_mtime;
+					directory = ((S_ISDIR(localattribs.st_mode)) != 0);
+				}
+				obj->attrib.D = directory;
+
+				if ((record = metaindex::find(records, numrecords, direntry->d_name)) != NULL)
+					metaindex::apply(record, obj);
+				else
+					readINFAt(dirfd, direntry->d_name, obj);
+
+				/* The metadata can't turn a file into a directory or the other way around */
+				obj->attrib.D = directory;
+				strlcpy(obj->name, acorn, sizeof(obj->name));
+				fsdir::add(catalogue, obj);
+			}
+		}
+		if (length == -1)
+			fprintf(stderr, "nativefs::scan: Unable to read directory %s\n", localpath);
+		delete[] buffer;
+		::close(fd);
+		delete[] records;
+		nametrans::release(&names);
+
+		fsdir::sort(catalogue);
+		return catalogue->count;
+	}
+
+	/* Add at most numentries entries of a directory which match a mask to a listing, starting at entry startentry; returns the number of entries added */
+	int catalogue(int directory, uint8_t network, uint8_t station, FSDirectory *dir, const char *mask, int startentry, int numentries, bool details) {
+		dircache::Ticket ticket;
+		wildcard::Matcher matcher;
+		FSDirectory entries, scanned;
+		char localpath[PATH_MAX];
+		uint64_t cycle;
+		int i, dirfd;
+
+		if ((startentry < 0) || (numentries <= 0) || (directory < 0) || (directory >= FILESTORE_MAX_DIRHANDLES))
+			return 0;
+		if (mask == NULL)
+			mask = "";
+		if (wildcard::compile(mask, &matcher) == false)
+			return 0;
+
+		/* The caller holds the directory handle, so it can't be closed while the directory is read */
+		{
+			std::lock_guard<std::mutex> lock(dirhandles_lock);
+			if (dirhandles[directory].refs == 0)
+				return 0;
+			dirfd = dirhandles[directory].fd;
+			strlcpy(localpath, dirhandles[directory].path, sizeof(localpath));
+		}
+
+		/* A station which continues reading a directory gets the next entries of its snapshot */
+		if ((startentry != 0) && ((i = cursors::read(network, station, localpath, mask, dir, startentry, numentries)) != -1))
+			return i;
+
+		/* Otherwise take a new snapshot, from the directory cache or else from disc */
+		if (dircache::snapshot(localpath, &entries, &cycle) == false) {
+			/* Start watching the directory before reading it, so a change while it's read isn't missed */
+			ticket = dircache::begin(localpath);
+			fsdir::init(&scanned);
+
+			/* A catalogue which goes into the directory cache answers requests in any format, so it needs everything */
+			if (scan(dirfd, localpath, &scanned, (details == true) || (ticket.slot != -1)) == -1) {
+				fsdir::release(&scanned);
+				return 0;
+			}
+
+			/* The directory cache takes over the catalogue, so the snapshot is a copy of it */
+			fsdir::init(&entries);
+			fsdir::append(&entries, &scanned, 0, scanned.count);
+			if ((cycle = dircache::store(ticket, &scanned)) == 0)
+				fsdir::release(&scanned);
+		}
+
+		/* Only keep the entries which match the mask; the snapshot is sorted, so they stay in order */
+		fsdir::filter(&entries, &matcher);
+
+		i = fsdir::append(dir, &entries, startentry, numentries);
+
+		/* Keep the snapshot if the station has to come back for the rest of the directory */
+		cursors::open(network, station, localpath, mask, cycle, &entries, startentry + i);
+		return i;
 	}
 
 	int remove(const char *objspec) {
+		char dirpath[PATH_MAX], inffilename[PATH_MAX];
+		const char *native;
 		int i;
 
-		for (i = 0; i < FILESTORE_MAX_FILEHANDLES; i++)
-			if (strcmp((const char *) filehandles[i].obj->name, objspec) == 0)
-				return 0x000000C3;				/* Object is open: return 'Object locked' */
+		{
+			std::lock_guard<std::mutex> lock(filehandles_lock);
+			for (i = 0; i < numfilehandles; i++)
+				if ((filehandle(i)->used == true) && (strcmp(filehandle(i)->localobj, objspec) == 0))
+					return 0x000000C3;			/* Object is open: return 'Object locked' */
+		}
+
+		if (::remove(objspec) != 0)
+			return 0x000000D6;				/* Object not found */
 
-		return remove(objspec);
+		/* Clear the object's metadata */
+		if (settings::metaindex == true) {
+			splitPath(objspec, dirpath, &native);
+			metaindex::forget(dirpath, native);
+		}
+		if (snprintf(inffilename, sizeof(inffilename), "%s.INF", objspec) < (int) sizeof(inffilename))
+			::remove(inffilename);
+		return 0;
 	}
 
 	int rename(const char *oldname, const char *newname) {
+		char dirpath[PATH_MAX], inffilename[PATH_MAX];
+		const char *native;
+		struct stat64 localattribs;
+		FSObject obj;
 		FILE *fp;
 		int i;
 
-		for (i = 0; i < FILESTORE_MAX_FILEHANDLES; i++)
-			if (strcmp((const char *) filehandles[i].obj->name, oldname) == 0)
-				return 0x000000C3;				/* Object is open: return 'Object locked' */
+		{
+			std::lock_guard<std::mutex> lock(filehandles_lock);
+			for (i = 0; i < numfilehandles; i++)
+				if ((filehandle(i)->used == true) && (strcmp(filehandle(i)->localobj, oldname) == 0))
+					return 0x000000C3;			/* Object is open: return 'Object locked' */
+		}
 
 		if ((fp = fopen(newname, "r")) != NULL) {
 			fclose(fp);
 			return 0x000000C4;				/* Object already exists */
 		}
 
-		return rename(oldname, newname);
+		/* Keep the object's metadata, which moves along with it */
+		memset(&obj, 0, sizeof(obj));
+		if (stat64(oldname, &localattribs) == 0)
+			obj.length = localattribs.st_size;
+		readinf(oldname, &obj);
+
+		if (::rename(oldname, newname) != 0)
+			return 0x000000D6;				/* Object not found */
+
+		if (settings::metaindex == true) {
+			splitPath(oldname, dirpath, &native);
+			metaindex::forget(dirpath, native);
+		}
+		if (snprintf(inffilename, sizeof(inffilename), "%s.INF", oldname) < (int) sizeof(inffilename))
+			::remove(inffilename);
+		splitPath(newname, dirpath, &native);
+		strlcpy(obj.name, native, ECONET_MAX_FILENAME_LEN);
+		writeinf(newname, &obj);
+		return 0;
 	}
 
 	int getpos(FILESTORE_HANDLE handle, uint32_t &pos) {
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			pos = filehandles[handle].pos;
-			return 0;
-		}
+
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+		pos = fh->pos;
+		return 0;
 	}
 
+	/* Move the sequential pointer; the next access simply happens at the new position, so nothing has to be seeked */
 	int setpos(FILESTORE_HANDLE handle, const uint32_t &pos) {
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			filehandles[handle].pos = pos;
-			return 0;
-		}
+
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+		fh->pos = pos;
+		return 0;
 	}
 
 	int bget(FILESTORE_HANDLE handle) {
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		uint8_t character;
+
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			if (filehandles[handle].pos <= filehandles[handle].obj->length) {
-				return fgetc(filehandles[handle].fp);
-			} else {
-				return FILESTORE_EOF;
-			}
-		}
+
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+		if (pread(fh->fd, &character, 1, fh->pos) != 1)
+			return FILESTORE_EOF;
+		fh->pos++;
+		return character;
 	}
 
 	size_t read(void *ptr, uint32_t count, FILESTORE_HANDLE handle) {
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		ssize_t result = 0;
+		uint32_t done;
+
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			if (filehandles[handle].pos <= filehandles[handle].obj->length) {
-				return fread(ptr, sizeof(uint8_t), count, filehandles[handle].fp);
-			} else {
-				return FILESTORE_EOF;
-			}
+
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+
+		/* pread() may return less than asked for, e.g. when it's interrupted */
+		for (done = 0; done < count; done += result) {
+			if ((result = pread(fh->fd, (uint8_t *) ptr + done, count - done, fh->pos + done)) <= 0)
+				break;
 		}
+		if ((done == 0) && (result == -1))
+			return FILESTORE_EOF;
+		fh->pos += done;
+		return done;
+	}
+
+	/* Write at the sequential pointer, or at the end of the file for a handle which appends, where the file may
+	 * have grown since it was opened; the sequential pointer is moved to the start of what was written. The caller
+	 * must hold fh->lock */
+	ssize_t writeAt(FILESTORE_NATIVE_FILEHANDLE *fh, const void *ptr, size_t count) {
+		ssize_t result;
+		off_t end;
+
+		if (fh->append == false)
+			return pwrite(fh->fd, ptr, count, fh->pos);
+
+		if (((result = ::write(fh->fd, ptr, count)) > 0) && ((end = lseek(fh->fd, 0, SEEK_CUR)) != -1))
+			fh->pos = end - result;
+		return result;
 	}
 
 	int bput(int character, FILESTORE_HANDLE handle) {
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		uint8_t byte;
+
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			return fputc(character, filehandles[handle].fp);
-		}
+
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+
+		byte = character;
+		if (writeAt(fh, &byte, 1) != 1)
+			return FILESTORE_EOF;
+		fh->pos++;
+
+		/* Update file length if the file has grown */
+		if (fh->pos > fh->obj.length)
+			fh->obj.length = fh->pos;
+		return byte;
 	}
 
 	size_t write(const void *ptr, uint32_t count, FILESTORE_HANDLE handle) {
-		long int pos;
-		size_t result;
+		FILESTORE_NATIVE_FILEHANDLE *fh;
+		ssize_t result = 0;
+		uint32_t done;
 
-		if (filehandles[handle].fp == NULL) {
-			/* Invalid handle */
+		if ((fh = filehandle(handle)) == NULL)
 			return FILESTORE_EOF;
-		} else {
-			result = fwrite(ptr, sizeof(uint8_t), count, filehandles[handle].fp);
-			
-			/* Update file length if new file size has changed */
-			pos = ftell(filehandles[handle].fp);
-			if (pos > filehandles[handle].pos)
-				filehandles[handle].pos = pos;
 
-			/* Return fwrite() result */
-			return result;
+		std::lock_guard<std::mutex> handlelock(fh->lock);
+		if (fh->used == false)
+			return FILESTORE_EOF;				/* Invalid handle */
+
+		for (done = 0; done < count; done += result) {
+			if ((result = writeAt(fh, (const uint8_t *) ptr + done, count - done)) <= 0)
+				break;
+			fh->pos += result;
 		}
+		if ((done == 0) && (result == -1))
+			return FILESTORE_EOF;
+
+		/* Update file length if the file has grown */
+		if (fh->pos > fh->obj.length)
+			fh->obj.length = fh->pos;
+		return done;
 	}
 
-	void readinf(const char *filename, FSObject *obj) {
+	/* Split a native path in the directory and the name of the object */
+	void splitPath(const char *filename, char *dirpath, const char **native) {
+		const char *slash;
+
+		if ((slash = strrchr(filename, '/')) == NULL) {
+			strlcpy(dirpath, ".", PATH_MAX);
+			*native = filename;
+		} else {
+			strlcpy(dirpath, filename, ((slash - filename) + 1 < PATH_MAX) ? (slash - filename) + 1 : PATH_MAX);
+			if (dirpath[0] == '\0')
+				strlcpy(dirpath, "/", PATH_MAX);
+			*native = slash + 1;
+		}
+	}
+
+	/* Read the metadata of an object from its .INF file; returns false if it has none */
+	bool readINF(const char *filename, FSObject *obj) {
 		FILE *fp_inffile;
-		char inffilename[ECONET_MAX_FILENAME_LEN];
-		char inf_filename[ECONET_MAX_FILENAME_LEN];
-		char access[FILESTORE_MAX_ATTRIBS];
+		char inffilename[PATH_MAX];
+		char inf_filename[256];
+		char access[16];
 		uint32_t length;
+		bool directory;
 
 		/* Assemble filename for .INF file */
-		strlcpy(inffilename, basename(filename), sizeof(inffilename));
-		strcat(inffilename, ".INF");
+		if (snprintf(inffilename, sizeof(inffilename), "%s.INF", filename) >= (int) sizeof(inffilename))
+			return false;
 
 		/* Read contents of .INF file */
 		fp_inffile = fopen(inffilename, "r");
 		if (fp_inffile != NULL) {
-			fscanf(fp_inffile, "%s %x %x %x %s", inf_filename, &obj->loadaddr, &obj->execaddr, &length, access);
-			netfs::strtoattrib(access, &obj->attrib);
-			if (obj->length != length)
-				fprintf(stderr, "nativefs::open Actual filesize and .INF filesize for %s differ!\n", filename);
+			access[0] = '\0';
+			directory = obj->attrib.D;
+			if (fscanf(fp_inffile, "%255s %x %x %x %15s", inf_filename, &obj->loadaddr, &obj->execaddr, &length, access) >= 4) {
+				netfs::strtoattrib(access, &obj->attrib);
+				obj->attrib.D = directory;
+				if (obj->length != length)
+					fprintf(stderr, "nativefs::readINF Actual filesize and .INF filesize for %s differ!\n", filename);
+			}
 			fclose(fp_inffile);
+			return true;
 		} else {
 			obj->loadaddr = 0;
 			obj->execaddr = 0;
+			return false;
 		}
 	}
 
-	void writeinf(const char *filename, const FSObject *obj) {
+	/* Read the metadata of an object in a directory which is open as dirfd from its .INF file; returns false if it has none */
+	bool readINFAt(int dirfd, const char *native, FSObject *obj) {
 		FILE *fp_inffile;
-		char inffilename[ECONET_MAX_FILENAME_LEN];
-		char inf_filename[ECONET_MAX_FILENAME_LEN];
-		char access[FILESTORE_MAX_ATTRIBS];
+		char inffilename[PATH_MAX];
+		char inf_filename[256];
+		char access[16];
 		uint32_t length;
+		bool directory;
+		int fd;
+
+		if ((snprintf(inffilename, sizeof(inffilename), "%s.INF", native) >= (int) sizeof(inffilename)) || ((fd = openat(dirfd, inffilename, O_RDONLY | O_CLOEXEC)) == -1)) {
+			obj->loadaddr = 0;
+			obj->execaddr = 0;
+			return false;
+		}
+		if ((fp_inffile = fdopen(fd, "r")) == NULL) {
+			::close(fd);
+			return false;
+		}
+
+		access[0] = '\0';
+		directory = obj->attrib.D;
+		if (fscanf(fp_inffile, "%255s %x %x %x %15s", inf_filename, &obj->loadaddr, &obj->execaddr, &length, access) >= 4) {
+			/* The D bit comes from the native object, not from the access string */
+			netfs::strtoattrib(access, &obj->attrib);
+			obj->attrib.D = directory;
+			if ((obj->attrib.D == false) && (obj->length != length))
+				fprintf(stderr, "nativefs::readINFAt Actual filesize and .INF filesize for %s differ!\n", native);
+		}
+		fclose(fp_inffile);
+		return true;
+	}
+
+	/* Write the metadata of an object to its .INF file */
+	void writeINF(const char *filename, const FSObject *obj) {
+		FILE *fp_inffile;
+		char inffilename[PATH_MAX];
+		char access[16];
 
 		/* Assemble filename for .INF file */
-		strlcpy(inffilename, basename(filename), sizeof(inffilename));
-		strcat(inffilename, ".INF");
+		if (snprintf(inffilename, sizeof(inffilename), "%s.INF", filename) >= (int) sizeof(inffilename))
+			return;
 
 		/* Write contents of .INF file */
 		fp_inffile = fopen(inffilename, "w");
 		if (fp_inffile != NULL) {
 			netfs::attribtostr(&obj->attrib, access);
-			fprintf(fp_inffile, "%s %08x %08x %06x %s", inf_filename, obj->loadaddr, obj->execaddr, length, access);
+			fprintf(fp_inffile, "%s %08x %08x %06x %s", obj->name, obj->loadaddr, obj->execaddr, obj->length, access);
 			fclose(fp_inffile);
 		} else {
-			fprintf(stderr, "nativefs::writeinf Unable to write .INF file %s\n", inffilename);
+			fprintf(stderr, "nativefs::writeINF Unable to write .INF file %s\n", inffilename);
+		}
+	}
+
+	/* Read the metadata of an object, from the index of its directory or else from its .INF file */
+	void readinf(const char *filename, FSObject *obj) {
+		metaindex::Record *records;
+		const metaindex::Record *record;
+		char dirpath[PATH_MAX];
+		const char *native;
+		bool directory;
+		int count;
+
+		if (settings::metaindex == true) {
+			splitPath(filename, dirpath, &native);
+			if ((count = metaindex::load(dirpath, &records)) != -1) {
+				record = metaindex::find(records, count, native);
+				if (record != NULL) {
+					/* The D bit comes from the native object, not from the index */
+					directory = obj->attrib.D;
+					metaindex::apply(record, obj);
+					obj->attrib.D = directory;
+				}
+				delete[] records;
+				if (record != NULL)
+					return;
+			}
+		}
+		readINF(filename, obj);
+	}
+
+	/* Write the metadata of an object, to the index of its directory or else to its .INF file */
+	void writeinf(const char *filename, const FSObject *obj) {
+		char dirpath[PATH_MAX];
+		const char *native;
+
+		if (settings::metaindex == true) {
+			splitPath(filename, dirpath, &native);
+			if (metaindex::update(dirpath, native, obj) == 0)
+				return;
+		}
+		writeINF(filename, obj);
+	}
+
+	/* Copy the .INF files of a directory into its index; returns the number of objects in the index */
+	int importINF(const char *localpath) {
+		DIR *localdir;
+		struct dirent *direntry;
+		metaindex::Record *records, *grown;
+		struct stat64 localattribs;
+		char path[PATH_MAX];
+		FSObject obj;
+		size_t len;
+		int count, size;
+
+		if ((localdir = opendir(localpath)) == NULL)
+			return -1;
+
+		count = 0;
+		size = ECONET_MAX_DIRENTRIES;
+		records = new metaindex::Record[size];
+		while ((direntry = readdir(localdir)) != NULL) {
+			len = strlen(direntry->d_name);
+			if ((len < 5) || (strcasecmp(&direntry->d_name[len - 4], ".INF") != 0) || (len - 4 >= FILESTORE_METAINDEX_NAME))
+				continue;
+			if (snprintf(path, sizeof(path), "%s/%s", localpath, direntry->d_name) >= (int) sizeof(path))
+				continue;
+			path[strlen(path) - 4] = '\0';
+
+			memset(&obj, 0, sizeof(obj));
+			if (stat64(path, &localattribs) == 0)
+				obj.length = localattribs.st_size;
+			if (readINF(path, &obj) == false)
+				continue;
+			if (count == size) {
+				grown = new metaindex::Record[size * 2];
+				memcpy(grown, records, size * sizeof(metaindex::Record));
+				delete[] records;
+				records = grown;
+				size *= 2;
+			}
+			direntry->d_name[len - 4] = '\0';
+			strlcpy(obj.name, direntry->d_name, ECONET_MAX_FILENAME_LEN);
+			metaindex::fill(&records[count++], direntry->d_name, &obj);
 		}
+		closedir(localdir);
+
+		if (metaindex::write(localpath, records, count) != 0)
+			count = -1;
+		delete[] records;
+		return count;
+	}
+
+	/* Write an .INF file for every object in the index of a directory; returns the number of .INF files written */
+	int exportINF(const char *localpath) {
+		metaindex::Record *records;
+		char path[PATH_MAX];
+		FSObject obj;
+		struct stat64 localattribs;
+		int i, count, written;
+
+		if ((count = metaindex::load(localpath, &records)) == -1)
+			return -1;
+
+		written = 0;
+		for (i = 0; i < count; i++) {
+			if ((records[i].native[0] == '\0') || (snprintf(path, sizeof(path), "%s/%s", localpath, records[i].native) >= (int) sizeof(path)))
+				continue;
+			memset(&obj, 0, sizeof(obj));
+			strlcpy(obj.name, records[i].native, ECONET_MAX_FILENAME_LEN);
+			metaindex::apply(&records[i], &obj);
+			if (stat64(path, &localattribs) == 0)
+				obj.length = localattribs.st_size;
+			writeINF(path, &obj);
+			written++;
+		}
+		delete[] records;
+		return written;
 	}
 }
+
@@ -7,24 +7,56 @@
 #ifndef ECONET_FS_NATIVE_HEADER
 #define ECONET_FS_NATIVE_HEADER
 
-#include "netfs.h"			/* FILESTORE_MAX_FILEHANDLES, FILESTORE_HANDLE */
+#include <atomic>			/* std::atomic */
+#include <mutex>				/* std::mutex */
+
+#include "netfs.h"			/* FILESTORE_HANDLE */
 #include "platforms/platform.h"		/* PATH_MAX */
 
+#define FILESTORE_NATIVE_ROOT		"/tmp"		/* Native directory which holds the root of the file server */
+#define FILESTORE_MAX_DIRHANDLES	256		/* Maximum number of native directories which can be open at the same time */
+#define FILESTORE_GETDENTS_BUFFER	32768		/* Size of the buffer for reading directory entries in batches */
+#define FILESTORE_FILEHANDLE_CHUNK	256		/* Number of file handles which are allocated at once */
+#define FILESTORE_FILEHANDLE_CHUNKS	4096		/* Maximum number of chunks of file handles; the number of open files of the process runs out long before that */
+
+typedef struct {
+	int fd;				/* O_PATH file descriptor of the directory */
+	int refs;			/* Number of users of this handle, or 0 if it's free */
+	char path[PATH_MAX];		/* Full path to the directory on the local filesystem */
+} FILESTORE_NATIVE_DIRHANDLE;
+
 typedef struct {
+	bool used;			/* The handle is open */
 	char localobj[PATH_MAX];	/* Full path to object on local filesystem */
-	FILE *fp;			/* If object is a file, this is the filepointer to this file */
-	FSObject *obj;			/* ADFS Object information */
+	int fd;				/* File descriptor of the object; every access is a pread() or pwrite() at pos, or a write() when appending */
+	FSObject obj;			/* ADFS Object information */
 	uint32_t pos;			/* Sequential pointer */
+	bool append;			/* The file was opened for appending: writes always go to its end */
+	std::mutex lock;		/* Serializes the accesses through this handle, so pos is only ever moved by one of them at a time */
+	int next;			/* Next free handle if this one is free, or -1 */
 } FILESTORE_NATIVE_FILEHANDLE;
 
 namespace nativefs {
-	extern FILESTORE_NATIVE_FILEHANDLE filehandles[FILESTORE_MAX_FILEHANDLES];
+	extern FILESTORE_NATIVE_FILEHANDLE *filehandles[FILESTORE_FILEHANDLE_CHUNKS];
+	extern std::atomic<int> numfilehandles;
+	extern std::mutex filehandles_lock;
+	extern FILESTORE_NATIVE_DIRHANDLE dirhandles[FILESTORE_MAX_DIRHANDLES];
+	extern std::mutex dirhandles_lock;
 
+	FILESTORE_NATIVE_FILEHANDLE *filehandle(FILESTORE_HANDLE handle);
 	FILESTORE_HANDLE open(const char *filename, const char *mode);
 	int close(FILESTORE_HANDLE handle);
 	size_t load(const char *localfile, char *buffer, uint32_t bufsize);
 	size_t save(const char *localfile, char *buffer, uint32_t bufsize);
-	int catalogue(const char *localpath, FSDirectory *dir, const char *mask, const uint8_t startentry, const uint8_t numentries);
+	int rootdirectory(void);
+	int opendirectory(int parent, const char *name);
+	void retaindirectory(int directory);
+	void closedirectory(int directory);
+	bool directorypath(int directory, char *path);
+	int names(const char *localpath, char **pool);
+	bool lookup(const char *localpath, const char *name, char *native, bool *directory);
+	bool info(const char *localpath, FSObject *obj);
+	int catalogue(int directory, uint8_t network, uint8_t station, FSDirectory *dir, const char *mask, int startentry, int numentries, bool details);
 	int remove(const char *objspec);
 	int rename(const char *oldname, const char *newname);
 	int getpos(FILESTORE_HANDLE handle, uint32_t &pos);
@@ -33,8 +65,14 @@ namespace nativefs {
 	size_t read(void *ptr, uint32_t count, FILESTORE_HANDLE handle);
 	int bput(int character, FILESTORE_HANDLE handle);
 	size_t write(const void *ptr, uint32_t count, FILESTORE_HANDLE handle);
+	void splitPath(const char *filename, char *dirpath, const char **native);
+	bool readINF(const char *filename, FSObject *obj);
+	bool readINFAt(int dirfd, const char *native, FSObject *obj);
+	void writeINF(const char *filename, const FSObject *obj);
 	void readinf(const char *filename, FSObject *obj);
 	void writeinf(const char *filename, const FSObject *obj);
+	int importINF(const char *localpath);
+	int exportINF(const char *localpath);
 }
 #endif
 
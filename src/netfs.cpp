@@ -5,13 +5,18 @@
  */
 
 #include <cstdlib>			// free()
-#include <cstring>			// strchr()
+#include <cstring>			// strchr(), strcspn(), strlcpy()
+#include <ctime>			// localtime_r()
 
 #include "main.h"			// ECONET_MAX_DISCDRIVES
 #include "adfs.h"
+#include "dentries.h"			// dentries::resolve()
+#include "nametrans.h"			// nametrans::toNative()
 #include "nativefs.h"			/* natviefs::* */
 #include "netfs.h"			// FILESTORE_HANDLE
 #include "settings.h"			// settings::*
+#include "users.h"			// users::getDirectory()
+#include "workers.h"			// workers::current
 #include "platforms/platform.h"
 
 /* Temporary code to prevent -Wunused-parameter for now */
@@ -23,8 +28,6 @@ using namespace std;
 
 
 namespace netfs {
-	bool handles[FILESTORE_MAX_FILEHANDLES] = {false};
-
 	int access(const char *fsp, const char *flags) {
 		/* Temporary code to prevent -Wunused-parameter for now */
 		printf("fsp: %s\n", fsp);
@@ -32,8 +35,73 @@ namespace netfs {
 		return(0);
 	}
 
-	int catalogue(uint8_t csd, FSDirectory *dir, const char *mask, uint8_t entrypoint, uint8_t numentries) {
-		return nativefs::catalogue("/tmp/", dir, mask, entrypoint, numentries);
+	/* Add the entries of a directory to a listing: the directory which fsp refers to, or else the entries of the CSD which match fsp as a wildcard mask; lengths and dates may be left out unless details is set */
+	int catalogue(uint8_t csd, FSDirectory *dir, const char *fsp, int entrypoint, int numentries, bool details) {
+		char localpath[PATH_MAX];
+		bool isdirectory;
+		int directory, count;
+
+		if ((fsp[0] != '\0') && (resolve(fsp, localpath, &isdirectory) == 0) && (isdirectory == true)) {
+			directory = nativefs::opendirectory(-1, localpath);
+			fsp = "";
+		} else {
+			/* The station's CSD is an open directory, so its catalogue is read without resolving its path again */
+			directory = users::getDirectory(workers::current.network, workers::current.station, SESSION_CSD);
+		}
+		if (directory == -1)
+			return 0;
+		count = nativefs::catalogue(directory, workers::current.network, workers::current.station, dir, fsp, entrypoint, numentries, details);
+		nativefs::closedirectory(directory);
+		return count;
+	}
+
+	/* Find the native object which an Acorn path of the current station refers to; returns 0, or an Acorn error code */
+	int resolve(const char *fsp, char *localpath, bool *directory) {
+		return dentries::resolve(workers::current.network, workers::current.station, fsp, localpath, directory);
+	}
+
+	/* Find the native path for an Acorn path of the current station which may not exist yet, such as a file which is opened for output; returns 0, or an Acorn error code */
+	int resolveNew(const char *fsp, char *localpath, bool *directory) {
+		char parent[256], leaf[ECONET_MAX_FILENAME_LEN + 1], native[NAME_MAX + 1];
+		const char *end, *name;
+		size_t length, i;
+		int result;
+
+		if ((result = resolve(fsp, localpath, directory)) != 0x000000D6)
+			return result;
+
+		/* Split the path into the directory the object goes in, and its name */
+		end = fsp + strcspn(fsp, "\r ");
+		for (name = end; (name > fsp) && (name[-1] != '.'); name--)
+			;
+		length = end - name;
+		if ((length == 0) || (length > ECONET_MAX_FILENAME_LEN) || (strcspn(name, "$&@%^:#*") < length))
+			return 0x000000CC;		// Bad file name
+		memcpy(leaf, name, length);
+		leaf[length] = '\0';
+		length = (name > fsp) ? name - fsp - 1 : 0;
+		if (length >= sizeof(parent))
+			return 0x000000CC;
+		memcpy(parent, fsp, length);
+		parent[length] = '\0';
+
+		if ((result = resolve(parent, localpath, directory)) != 0)
+			return result;
+		if (*directory == false)
+			return 0x000000D6;
+
+		/* A name which is already in use keeps its native name, a new one is taken literally, with a / for a . */
+		if (nametrans::toNative(localpath, leaf, native) == false) {
+			for (i = 0; leaf[i] != '\0'; i++)
+				native[i] = (leaf[i] == '/') ? '.' : leaf[i];
+			native[i] = '\0';
+		}
+
+		length = strlen(localpath);
+		if (snprintf(localpath + length, PATH_MAX - length, "/%s", native) >= (int) (PATH_MAX - length))
+			return 0x000000CC;
+		*directory = false;
+		return 0;
 	}
 
 	int cdir(const char *dir) {
@@ -103,23 +171,57 @@ namespace netfs {
 		return(0);
 	}
 
-	/* Reserves a new file handle */
-	FILESTORE_HANDLE newhandle(void) {
-		int i;
+	/* Empty the handle table of a station; the caller serializes all accesses to the table (e.g. with users::sessions_lock) */
+	void inithandles(StationHandles *table) {
+		table->freelist = 0;
+		table->unused = 1;
+	}
 
-		for (i = 0; i < FILESTORE_MAX_FILEHANDLES; i++) {
-			if (netfs::handles[i] == false) {
-				netfs::handles[i] = true;
-				return i;
-			}
-		}
+	/* Reserves a new handle of a station: the most recently freed one, or else one which was never used; returns 0 if the station has no handles left */
+	uint8_t newhandle(StationHandles *table, uint8_t kind, int object) {
+		uint8_t handle;
 
-		return -1;
+		if ((handle = table->freelist) != 0)
+			table->freelist = table->handles[handle].next;
+		else if (table->unused < FILESTORE_STATION_HANDLES)
+			handle = table->unused++;
+		else
+			return 0;
+
+		table->handles[handle].kind = kind;
+		table->handles[handle].object = object;
+		return handle;
 	}
 
-	/* Frees a file handle */
-	void freehandle(FILESTORE_HANDLE handle) {
-		netfs::handles[handle] = false;
+	/* Get the object a handle of a station refers to; returns -1 if it isn't a handle of that kind */
+	int gethandle(const StationHandles *table, uint8_t handle, uint8_t kind) {
+		if ((handle == 0) || (handle >= table->unused) || (table->handles[handle].kind != kind))
+			return -1;
+		return table->handles[handle].object;
+	}
+
+	/* Frees a handle of a station; the object it refers to isn't closed */
+	void freehandle(StationHandles *table, uint8_t handle) {
+		if ((handle == 0) || (handle >= table->unused) || (table->handles[handle].kind == FILESTORE_HANDLE_FREE))
+			return;
+
+		table->handles[handle].kind = FILESTORE_HANDLE_FREE;
+		table->handles[handle].next = table->freelist;
+		table->freelist = handle;
+	}
+
+	/* Close all objects a station still has open, and empty its handle table */
+	void closehandles(StationHandles *table) {
+		int i;
+
+		for (i = 1; i < table->unused; i++) {
+			if (table->handles[i].kind == FILESTORE_HANDLE_FILE)
+				nativefs::close(table->handles[i].object);
+			else if (table->handles[i].kind == FILESTORE_HANDLE_DIRECTORY)
+				nativefs::closedirectory(table->handles[i].object);
+			table->handles[i].kind = FILESTORE_HANDLE_FREE;
+		}
+		inithandles(table);
 	}
 
 	/* Convert a string of object attributes to Acorn flags */
@@ -172,7 +274,7 @@ namespace netfs {
 
 	/* Convert Acorn object attributes to a string */
 	int attribtostr(const FSAttributes *attrib, char *string) {
-		const *strstart = *string
+		const char *strstart = string;
 
 		if (attrib->R == true)
 			*string++ = 'R';
@@ -197,6 +299,96 @@ namespace netfs {
 		return string - strstart;
 	}
 
+	/* Pack Acorn object attributes into a bitmask, to store them compactly */
+	uint16_t packattrib(const FSAttributes *attrib) {
+		uint16_t bits = 0;
+
+		if (attrib->R == true)
+			bits |= FILESTORE_ATTRIB_R;
+		if (attrib->W == true)
+			bits |= FILESTORE_ATTRIB_W;
+		if (attrib->L == true)
+			bits |= FILESTORE_ATTRIB_L;
+		if (attrib->D == true)
+			bits |= FILESTORE_ATTRIB_D;
+		if (attrib->E == true)
+			bits |= FILESTORE_ATTRIB_E;
+		if (attrib->r == true)
+			bits |= FILESTORE_ATTRIB_r;
+		if (attrib->w == true)
+			bits |= FILESTORE_ATTRIB_w;
+		if (attrib->e == true)
+			bits |= FILESTORE_ATTRIB_e;
+		if (attrib->P == true)
+			bits |= FILESTORE_ATTRIB_P;
+		return bits;
+	}
+
+	/* Convert packed attributes to the access byte of the NetFS protocol (DLWRwr) */
+	uint8_t accessbyte(uint16_t bits) {
+		uint8_t access = 0;
+
+		if (bits & FILESTORE_ATTRIB_r)
+			access |= 0x01;
+		if (bits & FILESTORE_ATTRIB_w)
+			access |= 0x02;
+		if (bits & FILESTORE_ATTRIB_R)
+			access |= 0x04;
+		if (bits & FILESTORE_ATTRIB_W)
+			access |= 0x08;
+		if (bits & FILESTORE_ATTRIB_L)
+			access |= 0x10;
+		if (bits & FILESTORE_ATTRIB_D)
+			access |= 0x20;
+		return access;
+	}
+
+	/* Convert an access byte to a string like DLWR/wr; the string needs room for 8 characters */
+	void accesstostr(uint8_t access, char *string) {
+		if (access & 0x20)
+			*string++ = 'D';
+		if (access & 0x10)
+			*string++ = 'L';
+		if (access & 0x08)
+			*string++ = 'W';
+		if (access & 0x04)
+			*string++ = 'R';
+		*string++ = '/';
+		if (access & 0x02)
+			*string++ = 'w';
+		if (access & 0x01)
+			*string++ = 'r';
+		*string = '\0';
+	}
+
+	/* Convert a time to the two byte date of the NetFS protocol: day, and year since 1981 and month */
+	void packdate(time_t time, uint8_t *date) {
+		struct tm timeinfo;
+		int year;
+
+		if ((localtime_r(&time, &timeinfo) == NULL) || (timeinfo.tm_year < 81)) {
+			date[0] = 1;
+			date[1] = 1;
+			return;
+		}
+		year = timeinfo.tm_year - 81;
+		date[0] = timeinfo.tm_mday | ((year & 0xF0) << 1);
+		date[1] = (timeinfo.tm_mon + 1) | ((year & 0x0F) << 4);
+	}
+
+	/* Unpack a bitmask of Acorn object attributes */
+	void unpackattrib(uint16_t bits, FSAttributes *attrib) {
+		attrib->R = ((bits & FILESTORE_ATTRIB_R) != 0);
+		attrib->W = ((bits & FILESTORE_ATTRIB_W) != 0);
+		attrib->L = ((bits & FILESTORE_ATTRIB_L) != 0);
+		attrib->D = ((bits & FILESTORE_ATTRIB_D) != 0);
+		attrib->E = ((bits & FILESTORE_ATTRIB_E) != 0);
+		attrib->r = ((bits & FILESTORE_ATTRIB_r) != 0);
+		attrib->w = ((bits & FILESTORE_ATTRIB_w) != 0);
+		attrib->e = ((bits & FILESTORE_ATTRIB_e) != 0);
+		attrib->P = ((bits & FILESTORE_ATTRIB_P) != 0);
+	}
+
 //private:
 	const char *getDiscTitle(int i) {
 		return discs[i]->image;
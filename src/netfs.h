@@ -9,11 +9,26 @@
 
 #include "config.h"	// int16_t
 
-#define FILESTORE_MAX_FILEHANDLES 256
 #define FILESTORE_EOF -1
+#define FILESTORE_STATION_HANDLES	256	/* Handles of one station: 1-255, as handle 0 means "no handle" in the NetFS protocol */
+#define FILESTORE_HANDLE_FREE		0	/* Kinds of objects a station's handle can refer to */
+#define FILESTORE_HANDLE_FILE		1
+#define FILESTORE_HANDLE_DIRECTORY	2
+
+#include <mutex>		/* std::mutex */
 
 #include "main.h"		/* ECONET_MAX_FILENAME_LEN */
 
+#define FILESTORE_ATTRIB_R	0x0001	/* Bits of the packed attributes, in the order of FSAttributes */
+#define FILESTORE_ATTRIB_W	0x0002
+#define FILESTORE_ATTRIB_L	0x0004
+#define FILESTORE_ATTRIB_D	0x0008
+#define FILESTORE_ATTRIB_E	0x0010
+#define FILESTORE_ATTRIB_r	0x0020
+#define FILESTORE_ATTRIB_w	0x0040
+#define FILESTORE_ATTRIB_e	0x0080
+#define FILESTORE_ATTRIB_P	0x0100
+
 typedef struct {		/* Attributes (encoded in bit 7 of Name) */
 	bool	R;		/* Read access */
 	bool	W;		/* Write access */
@@ -27,7 +42,7 @@ typedef struct {		/* Attributes (encoded in bit 7 of Name) */
 } FSAttributes;
 
 typedef struct {
-	char		name[ECONET_MAX_FILENAME_LEN];	/* Acorn filename */
+	char		name[ECONET_MAX_FILENAME_LEN + 1];	/* Acorn filename */
 	uint32_t	loadaddr;	/* Load address (4 bytes) */
 	uint32_t	execaddr;	/* Exec address (4 bytes) */
 	uint32_t	length;		/* Length (4 bytes) */
@@ -38,8 +53,17 @@ typedef struct {
 	time_t		mtime;		/* Modification date/time */
 } FSObject;
 
-typedef struct {
-	FSObject	fsp[ECONET_MAX_DIRENTRIES];	/* TODO: Replace [47] with dynamic memory allocation using malloc/realloc and double pointers */
+typedef struct {		/* Listing of a directory, with one array per field (see fsdir.cpp) */
+	int		count;		/* Number of entries */
+	int		size;		/* Number of entries there's room for */
+	uint8_t		*block;		/* Memory which holds all arrays */
+	char		(*names)[ECONET_MAX_FILENAME_LEN + 1];	/* Acorn filenames */
+	uint32_t	*loadaddrs;	/* Load addresses */
+	uint32_t	*execaddrs;	/* Exec addresses */
+	uint32_t	*lengths;	/* Lengths */
+	uint16_t	*attribs;	/* Packed attributes (FILESTORE_ATTRIB_*) */
+	time_t		*ctimes;	/* Creation dates/times */
+	time_t		*mtimes;	/* Modification dates/times */
 } FSDirectory;
 
 
@@ -48,15 +72,27 @@ typedef struct {
 //	uint32_t	ptr;
 //} FileHandles;
 
-typedef int16_t FILESTORE_HANDLE;
+typedef int32_t FILESTORE_HANDLE;
 
+typedef struct {		/* Handle of a station */
+	uint8_t		kind;		/* FILESTORE_HANDLE_* */
+	uint8_t		next;		/* Next free handle if this one is free, or 0 */
+	int		object;		/* nativefs file handle or directory handle */
+} StationHandle;
+
+typedef struct {		/* Handles of one station; they only have to be unique for that station */
+	StationHandle	handles[FILESTORE_STATION_HANDLES];
+	uint8_t		freelist;	/* Most recently freed handle, or 0 */
+	uint16_t	unused;		/* Lowest handle which was never handed out, so a new table needs no initialisation */
+} StationHandles;
 
 
-namespace netfs {
-	extern bool handles[FILESTORE_MAX_FILEHANDLES];
 
+namespace netfs {
 	int access(const char *fsp, const char *flags);
-	int catalogue(uint8_t csd, FSDirectory *dir, const char *mask, uint8_t entrypoint, uint8_t numentries);
+	int catalogue(uint8_t csd, FSDirectory *dir, const char *fsp, int entrypoint, int numentries, bool details);
+	int resolve(const char *fsp, char *localpath, bool *directory);
+	int resolveNew(const char *fsp, char *localpath, bool *directory);
 	int cdir(const char *dir);
 	int del(const char *fsp);
 	int dismount(const char *disc);
@@ -64,10 +100,18 @@ namespace netfs {
 	int info(const char *fsp);
 	int mount(const int slot, const char *image);
 	int rename(const char *oldfile, const char *newfile);
-	FILESTORE_HANDLE newhandle(void);
-	void freehandle(FILESTORE_HANDLE handle);
+	void inithandles(StationHandles *table);
+	uint8_t newhandle(StationHandles *table, uint8_t kind, int object);
+	int gethandle(const StationHandles *table, uint8_t handle, uint8_t kind);
+	void freehandle(StationHandles *table, uint8_t handle);
+	void closehandles(StationHandles *table);
 	void strtoattrib(const char *string, FSAttributes *attrib);
-	intd attribtostr(const FSAttributes *attrib, char *string);
+	int attribtostr(const FSAttributes *attrib, char *string);
+	uint16_t packattrib(const FSAttributes *attrib);
+	void unpackattrib(uint16_t bits, FSAttributes *attrib);
+	uint8_t accessbyte(uint16_t bits);
+	void accesstostr(uint8_t access, char *string);
+	void packdate(time_t time, uint8_t *date);
 
 //private:
 	const char *getDiscTitle(int i);
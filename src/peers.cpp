@@ -0,0 +1,299 @@
+/* peers.cpp
+ * Cache of AUN stations which were learned from received frames
+ *
+ * When autolearning is enabled, every valid frame from a source which is not
+ * in !Stations teaches us the IP address and port of that station. Learned
+ * stations are keyed by their full address and port, and get a station
+ * number on our AUN network: the last byte of the IP address as on a native
+ * AUN network, or else the first free one, so sources on different IP
+ * networks never end up as the same station. Learned stations are also
+ * indexed by network and station number, so transmitting to one is a single
+ * table lookup. When the cache is full, the least recently heard station is
+ * forgotten first. Stations which weren't heard of for FILESTORE_PEERS_TIMEOUT
+ * seconds are forgotten as soon as the cache is used, from the least
+ * recently heard end, so they don't get broadcasts or keep their number.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdio>			// FILE*, fopen(), fprintf(), fclose()
+#include <cstring>			// memcpy()
+#include <mutex>			// std::mutex, std::lock_guard
+#include <arpa/inet.h>			// inet_ntop()
+#include <netinet/in.h>			// struct sockaddr_in, struct sockaddr_in6
+
+#include "peers.h"			// Header file for this code
+#include "main.h"			// STATIONSFILE
+#include "settings.h"			// settings::autolearn, settings::aun_network
+#include "stations.h"			// stations::stations[][], stations::hashAddress()
+
+using namespace std;
+
+
+
+namespace peers {
+	Peer		peers[FILESTORE_PEERS_MAX];
+	uint16_t	index[127][255];		// Peer number + 1 of every learned station, or 0 if not learned
+	uint16_t	byaddress[FILESTORE_PEERS_HASH];	// Peer number + 1 of the first peer per address hash, or 0
+	int16_t		mru = -1;			// Most recently heard peer
+	int16_t		lru = -1;			// Least recently heard peer
+	int16_t		freelist = -1;			// First released peer entry
+	int		used = 0;			// Number of peer entries which have ever been used
+	std::mutex	peers_lock;			// Protects all of the above
+
+	/* The station number an AUN station would have on a native AUN network: the last byte of its IP address */
+	uint8_t preferredStation(const struct sockaddr *addr) {
+		if (addr->sa_family == AF_INET)
+			return ntohl(((const struct sockaddr_in *) addr)->sin_addr.s_addr) & 0xFF;
+		return ((const struct sockaddr_in6 *) addr)->sin6_addr.s6_addr[15];
+	}
+
+	/* Hash of the IP address and UDP port of a station */
+	uint32_t addressHash(const struct sockaddr *addr) {
+		if (addr->sa_family == AF_INET6)
+			return stations::hashAddress(&((const struct sockaddr_in6 *) addr)->sin6_addr, sizeof(struct in6_addr), ntohs(((const struct sockaddr_in6 *) addr)->sin6_port));
+		return stations::hashAddress(&((const struct sockaddr_in *) addr)->sin_addr, sizeof(struct in_addr), ntohs(((const struct sockaddr_in *) addr)->sin_port));
+	}
+
+	/* Check if two addresses have the same IP address and UDP port */
+	bool sameAddress(const struct sockaddr *a, const struct sockaddr_storage *b) {
+		if (a->sa_family != b->ss_family)
+			return false;
+		if (a->sa_family == AF_INET6)
+			return ((((const struct sockaddr_in6 *) a)->sin6_port == ((const struct sockaddr_in6 *) b)->sin6_port) &&
+			    (memcmp(&((const struct sockaddr_in6 *) a)->sin6_addr, &((const struct sockaddr_in6 *) b)->sin6_addr, sizeof(struct in6_addr)) == 0));
+		return ((((const struct sockaddr_in *) a)->sin_port == ((const struct sockaddr_in *) b)->sin_port) &&
+		    (((const struct sockaddr_in *) a)->sin_addr.s_addr == ((const struct sockaddr_in *) b)->sin_addr.s_addr));
+	}
+
+	/* Find the peer with this address; peers_lock must be held */
+	int16_t findPeer(const struct sockaddr *addr) {
+		uint16_t next;
+
+		for (next = byaddress[addressHash(addr) & (FILESTORE_PEERS_HASH - 1)]; next != 0; next = peers[next - 1].hnext) {
+			if (sameAddress(addr, &peers[next - 1].addr))
+				return next - 1;
+		}
+		return -1;
+	}
+
+	/* Check if a station number on our AUN network can be given to a learned station */
+	bool stationFree(uint8_t network, uint8_t station) {
+		return ((station >= 1) && (station <= 254) && (index[network][station] == 0) && (stations::stations[network][station].type == STATION_UNUSED));
+	}
+
+	/* Choose the station number of a newly learned station; peers_lock must be held */
+	bool chooseStation(const struct sockaddr *addr, uint8_t *network, uint8_t *station) {
+		unsigned int s;
+
+		*network = settings::aun_network;
+		if ((*network < 1) || (*network > 126))
+			return false;
+
+		*station = preferredStation(addr);
+		if (stationFree(*network, *station))
+			return true;
+
+		/* Another source already has that number: take the first free one */
+		for (s = 1; s <= 254; s++) {
+			if (stationFree(*network, s)) {
+				*station = s;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/* Size of the address of a given family */
+	socklen_t addressLength(const struct sockaddr *addr) {
+		if (addr->sa_family == AF_INET6)
+			return sizeof(struct sockaddr_in6);
+		return sizeof(struct sockaddr_in);
+	}
+
+	/* Remove a peer from the LRU list */
+	void unlinkPeer(int16_t p) {
+		if (peers[p].prev != -1)
+			peers[peers[p].prev].next = peers[p].next;
+		else
+			mru = peers[p].next;
+		if (peers[p].next != -1)
+			peers[peers[p].next].prev = peers[p].prev;
+		else
+			lru = peers[p].prev;
+	}
+
+	/* Put a peer at the front of the LRU list */
+	void linkFront(int16_t p) {
+		peers[p].prev = -1;
+		peers[p].next = mru;
+		if (mru != -1)
+			peers[mru].prev = p;
+		mru = p;
+		if (lru == -1)
+			lru = p;
+	}
+
+	/* Forget a peer */
+	void release(int16_t p) {
+		uint16_t *link;
+
+		unlinkPeer(p);
+		index[peers[p].network][peers[p].station] = 0;
+		link = &byaddress[addressHash((const struct sockaddr *) &peers[p].addr) & (FILESTORE_PEERS_HASH - 1)];
+		while (*link != 0) {
+			if (*link - 1 == p) {
+				*link = peers[p].hnext;
+				break;
+			}
+			link = &peers[*link - 1].hnext;
+		}
+		peers[p].next = freelist;
+		freelist = p;
+	}
+
+	/* Forget the stations which haven't been heard of for FILESTORE_PEERS_TIMEOUT seconds; peers_lock must be held */
+	void expire(void) {
+		time_t now;
+
+		now = time(NULL);
+		while ((lru != -1) && (now - peers[lru].lastseen > FILESTORE_PEERS_TIMEOUT))
+			release(lru);
+	}
+
+	/* Add a line for a newly learned station to the !Stations file */
+	void saveStation(uint8_t network, uint8_t station, const struct sockaddr *addr) {
+		char ip[INET6_ADDRSTRLEN];
+		unsigned short port;
+		FILE *fp_stationsfile;
+
+		if (addr->sa_family == AF_INET) {
+			inet_ntop(AF_INET, &((const struct sockaddr_in *) addr)->sin_addr, ip, sizeof(ip));
+			port = ntohs(((const struct sockaddr_in *) addr)->sin_port);
+		} else {
+			inet_ntop(AF_INET6, &((const struct sockaddr_in6 *) addr)->sin6_addr, ip, sizeof(ip));
+			port = ntohs(((const struct sockaddr_in6 *) addr)->sin6_port);
+		}
+
+		if ((fp_stationsfile = fopen(STATIONSFILE, "a")) == NULL) {
+			fprintf(stderr, "peers::saveStation: Could not open %s\n", STATIONSFILE);
+			return;
+		}
+		fprintf(fp_stationsfile, "%i %i %s %i\n", network, station, ip, port);
+		fclose(fp_stationsfile);
+	}
+
+	/* Learn (or refresh) the address of the station which sent a frame; returns false if it can't be learned */
+	bool learn(const struct sockaddr *addr, uint8_t *network, uint8_t *station) {
+		uint32_t hash;
+		int16_t p;
+		bool added = false;
+
+		if ((addr->sa_family != AF_INET) && (addr->sa_family != AF_INET6))
+			return false;
+
+		{
+			std::lock_guard<std::mutex> lock(peers_lock);
+
+			p = findPeer(addr);
+			if (p == -1) {
+				if (freelist != -1) {
+					p = freelist;
+					freelist = peers[p].next;
+				} else if (used < FILESTORE_PEERS_MAX) {
+					p = used++;
+				} else {
+					/* Cache is full: forget the least recently heard station */
+					p = lru;
+					release(p);
+					freelist = peers[p].next;
+				}
+
+				if (chooseStation(addr, network, station) == false) {
+					peers[p].next = freelist;
+					freelist = p;
+					return false;
+				}
+
+				memcpy(&peers[p].addr, addr, addressLength(addr));
+				peers[p].network = *network;
+				peers[p].station = *station;
+				index[*network][*station] = p + 1;
+				hash = addressHash(addr) & (FILESTORE_PEERS_HASH - 1);
+				peers[p].hnext = byaddress[hash];
+				byaddress[hash] = p + 1;
+				added = true;
+			} else {
+				unlinkPeer(p);
+				*network = peers[p].network;
+				*station = peers[p].station;
+			}
+			peers[p].lastseen = time(NULL);
+			linkFront(p);
+		}
+
+		if ((added == true) && (settings::autolearn == 2))
+			saveStation(*network, *station, addr);
+
+		return true;
+	}
+
+	/* Find the station number of a learned address, without learning it */
+	bool find(const struct sockaddr *addr, uint8_t *network, uint8_t *station) {
+		std::lock_guard<std::mutex> lock(peers_lock);
+		int16_t p;
+
+		if ((addr->sa_family != AF_INET) && (addr->sa_family != AF_INET6))
+			return false;
+
+		/* A station which was silent for too long has to be learned again */
+		expire();
+		p = findPeer(addr);
+		if (p == -1)
+			return false;
+
+		*network = peers[p].network;
+		*station = peers[p].station;
+		return true;
+	}
+
+	/* Look up the address of a learned station */
+	bool lookup(uint8_t network, uint8_t station, struct sockaddr_storage *addr) {
+		std::lock_guard<std::mutex> lock(peers_lock);
+		int16_t p;
+
+		if ((network > 126) || (station > 254))
+			return false;
+
+		/* Age out stations which haven't been heard of for a while */
+		expire();
+		p = index[network][station] - 1;
+		if (p == -1)
+			return false;
+
+		memcpy(addr, &peers[p].addr, sizeof(struct sockaddr_storage));
+		return true;
+	}
+
+	/* Copy the learned stations which haven't timed out, most recently heard first */
+	int snapshot(Peer *list, int max) {
+		std::lock_guard<std::mutex> lock(peers_lock);
+		int16_t p;
+		int i;
+
+		expire();
+		i = 0;
+		for (p = mru; (p != -1) && (i < max); p = peers[p].next)
+			list[i++] = peers[p];
+		return i;
+	}
+	/* Call function for every learned station which hasn't timed out, most recently heard first, with peers_lock held */
+	void visit(void (*function)(const Peer *peer, void *context), void *context) {
+		std::lock_guard<std::mutex> lock(peers_lock);
+		int16_t p;
+
+		expire();
+		for (p = mru; p != -1; p = peers[p].next)
+			function(&peers[p], context);
+	}
+}
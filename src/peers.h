@@ -0,0 +1,38 @@
+/* peers.h
+ * Cache of AUN stations which were learned from received frames
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_PEERS_HEADER
+#define ECONET_PEERS_HEADER
+
+#include <cstdint>			// uint8_t, int16_t, uint16_t
+#include <ctime>			// time_t
+#include <sys/socket.h>			// struct sockaddr, struct sockaddr_storage
+
+#define FILESTORE_PEERS_MAX		256		// Maximum number of learned stations
+#define FILESTORE_PEERS_TIMEOUT		900		// Number of seconds after which a silent learned station is forgotten
+#define FILESTORE_PEERS_HASH		512		// Size of the address to peer lookup table; must be a power of 2
+
+namespace peers {
+	/* A learned station */
+	typedef struct {
+		uint8_t			network;
+		uint8_t			station;
+		struct sockaddr_storage	addr;		// IP address and UDP port of the station
+		time_t			lastseen;	// When the last frame from this station was received
+		int16_t			prev;		// Previous (more recently used) peer, or -1
+		int16_t			next;		// Next (less recently used) peer, or -1
+		uint16_t		hnext;		// Peer number + 1 of the next peer with the same address hash, or 0
+	} Peer;
+
+	bool	learn(const struct sockaddr *addr, uint8_t *network, uint8_t *station);
+	bool	find(const struct sockaddr *addr, uint8_t *network, uint8_t *station);
+	bool	lookup(uint8_t network, uint8_t station, struct sockaddr_storage *addr);
+	int	snapshot(Peer *list, int max);
+	void	visit(void (*function)(const Peer *peer, void *context), void *context);
+}
+
+#endif
+
@@ -0,0 +1,144 @@
+/* ratelimit.cpp
+ * Per-source token bucket rate limiting of received frames
+ *
+ * Every station in !Stations has its own pair of token buckets (frames per
+ * second and bytes per second), so a flooding station only ever drops its
+ * own frames. Sources which are not in !Stations get a frame bucket from a
+ * fixed table which is indexed by a hash of their address and port, so a
+ * flooding source only starves the few sources which share its slot, and the
+ * state kept for unknown sources stays bounded. The buckets are protected by striped locks, as the
+ * IPv4, IPv6 and DTLS listeners may all receive from the same station.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::lock_guard
+#include <netinet/in.h>		// struct sockaddr_in, struct sockaddr_in6
+
+#include "ratelimit.h"		// Header file for this code
+#include "main.h"		// ECONET_MAX_NETWORK
+#include "settings.h"		// settings::ratelimit_*
+#include "stations.h"		// stations::hashAddress()
+
+using namespace std;
+
+
+
+namespace ratelimit {
+	Bucket			buckets[ECONET_MAX_NETWORK + 1][255];	// Buckets of known stations
+	std::mutex		locks[FILESTORE_RATELIMIT_LOCKS];	// Protect the buckets of the known stations
+	Bucket			unknown[FILESTORE_RATELIMIT_UNKNOWN];	// Buckets of sources which are not in !Stations, by address hash
+	std::mutex		unknown_locks[FILESTORE_RATELIMIT_LOCKS];	// Protect the buckets of the unknown sources
+	std::atomic<uint32_t>	knownDropped(0);
+	std::atomic<uint32_t>	unknownDropped(0);
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	/* Refill a bucket with tokens; a bucket holds at most one second worth of tokens */
+	void refill(uint64_t *tokens, uint64_t elapsed, unsigned int rate) {
+		uint64_t max = (uint64_t) rate * 1000000;
+
+		if (elapsed > 1000000)
+			elapsed = 1000000;
+		*tokens += elapsed * rate;
+		if (*tokens > max)
+			*tokens = max;
+	}
+
+	/* Take one frame of the given length from a bucket, or return false if there aren't enough tokens */
+	bool take(Bucket *bucket, size_t length, unsigned int framerate, unsigned int byterate) {
+		uint64_t t, elapsed;
+
+		t = now();
+		if (bucket->updated == 0) {
+			/* First frame from this source: start with full buckets */
+			bucket->frames = (uint64_t) framerate * 1000000;
+			bucket->bytes = (uint64_t) byterate * 1000000;
+		} else {
+			elapsed = t - bucket->updated;
+			refill(&bucket->frames, elapsed, framerate);
+			refill(&bucket->bytes, elapsed, byterate);
+		}
+		bucket->updated = t;
+
+		if ((framerate != 0) && (bucket->frames < 1000000))
+			return false;
+		if ((byterate != 0) && (bucket->bytes < (uint64_t) length * 1000000))
+			return false;
+
+		if (framerate != 0)
+			bucket->frames -= 1000000;
+		if (byterate != 0)
+			bucket->bytes -= (uint64_t) length * 1000000;
+		return true;
+	}
+
+	/* Check if a received frame from a station may be processed */
+	bool allow(uint8_t network, uint8_t station, size_t length) {
+		Bucket *bucket;
+
+		if ((network > ECONET_MAX_NETWORK) || (station > 254))
+			return false;
+
+		bucket = &buckets[network][station];
+		std::lock_guard<std::mutex> lock(locks[((network << 8) | station) % FILESTORE_RATELIMIT_LOCKS]);
+		if (take(bucket, length, settings::ratelimit_frames, settings::ratelimit_bytes) == false) {
+			bucket->dropped++;
+			knownDropped++;
+			return false;
+		}
+		return true;
+	}
+
+	/* Check if a received frame from a source which is not in !Stations may be processed */
+	bool allowUnknown(const struct sockaddr *addr, size_t length) {
+		Bucket *bucket;
+		uint32_t key;
+
+		if (settings::ratelimit_unknown == 0) {
+			unknownDropped++;
+			return false;
+		}
+
+		if (addr->sa_family == AF_INET6)
+			key = stations::hashAddress(&((const struct sockaddr_in6 *) addr)->sin6_addr, sizeof(struct in6_addr), ((const struct sockaddr_in6 *) addr)->sin6_port);
+		else
+			key = stations::hashAddress(&((const struct sockaddr_in *) addr)->sin_addr, sizeof(struct in_addr), ((const struct sockaddr_in *) addr)->sin_port);
+
+		bucket = &unknown[key & (FILESTORE_RATELIMIT_UNKNOWN - 1)];
+		std::lock_guard<std::mutex> lock(unknown_locks[key % FILESTORE_RATELIMIT_LOCKS]);
+		if (take(bucket, length, settings::ratelimit_unknown, 0) == false) {
+			unknownDropped++;
+			return false;
+		}
+		return true;
+	}
+
+	/* Number of frames from a station which were dropped */
+	uint32_t dropped(uint8_t network, uint8_t station) {
+		if ((network > ECONET_MAX_NETWORK) || (station > 254))
+			return 0;
+
+		std::lock_guard<std::mutex> lock(locks[((network << 8) | station) % FILESTORE_RATELIMIT_LOCKS]);
+		return buckets[network][station].dropped;
+	}
+
+	/* Number of frames from known stations which were dropped */
+	uint32_t droppedKnown(void) {
+		return knownDropped;
+	}
+
+	/* Number of frames from unknown sources which were dropped */
+	uint32_t droppedUnknown(void) {
+		return unknownDropped;
+	}
+}
+
@@ -0,0 +1,34 @@
+/* ratelimit.h
+ * Per-source token bucket rate limiting of received frames
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_RATELIMIT_HEADER
+#define ECONET_RATELIMIT_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint32_t, uint64_t
+#include <sys/socket.h>			// struct sockaddr
+
+#define FILESTORE_RATELIMIT_LOCKS	64		// Number of locks which protect the buckets of the known stations
+#define FILESTORE_RATELIMIT_UNKNOWN	1024		// Number of buckets for sources which are not in !Stations; must be a power of 2
+
+namespace ratelimit {
+	/* Token buckets of one source */
+	typedef struct {
+		uint64_t	frames;		// Available frame tokens, in millionths of a frame
+		uint64_t	bytes;		// Available byte tokens, in millionths of a byte
+		uint64_t	updated;	// Time the buckets were last refilled (in microseconds)
+		uint32_t	dropped;	// Number of frames dropped from this source
+	} Bucket;
+
+	bool		allow(uint8_t network, uint8_t station, size_t length);
+	bool		allowUnknown(const struct sockaddr *addr, size_t length);
+	uint32_t	dropped(uint8_t network, uint8_t station);
+	uint32_t	droppedKnown(void);
+	uint32_t	droppedUnknown(void);
+}
+
+#endif
+
@@ -0,0 +1,166 @@
+/* retransmit.cpp
+ * Retransmission of replies which weren't ACKed by the station
+ *
+ * Every reply to a known station is kept until the station ACKs it. When
+ * the ACK doesn't arrive within the retransmission timeout of that station
+ * (links::rto()), the reply is sent again with the AUN retry flag set and
+ * the timeout is doubled. After FILESTORE_RETRANSMIT_TRIES retransmissions
+ * we give up. Only the last reply to every station is kept: a new reply
+ * means that the station has received the previous one.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <cstdio>		// fprintf()
+#include <cstring>		// memcpy()
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::lock_guard
+#include <thread>		// std::thread
+#include <unistd.h>		// usleep()
+
+#include "retransmit.h"		// Header file for this code
+#include "links.h"		// links::rto(), links::timeout()
+#include "main.h"		// bye
+
+using namespace std;
+
+
+
+namespace retransmit {
+	Reply			replies[FILESTORE_RETRANSMIT_SLOTS];
+	std::mutex		replies_lock;			// Protects replies[]
+	std::thread		thread_retransmit;
+	std::atomic<uint32_t>	resentFrames(0);
+	std::atomic<uint32_t>	failedFrames(0);
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	/* Main loop of the retransmit thread: send replies again when their timer expires */
+	void run(void) {
+		Reply *reply;
+		uint64_t t;
+		int i;
+
+		while (bye == false) {
+			usleep(FILESTORE_RETRANSMIT_TICK);
+
+			t = now();
+			std::lock_guard<std::mutex> lock(replies_lock);
+			for (i = 0; i < FILESTORE_RETRANSMIT_SLOTS; i++) {
+				reply = &replies[i];
+				if ((reply->used == false) || (reply->deadline > t))
+					continue;
+
+				if (reply->tries >= FILESTORE_RETRANSMIT_TRIES) {
+					reply->used = false;
+					failedFrames++;
+					continue;
+				}
+
+				reply->frame->aun.retry = 1;
+				if (sendto(reply->sock, (char *) reply->frame, reply->length, 0, (struct sockaddr *) &reply->addr, reply->addrlen) == -1)
+					fprintf(stderr, "retransmit::run: sendto() failed.\n");
+				else
+					resentFrames++;
+				reply->tries++;
+
+				links::timeout(reply->network, reply->station);
+				reply->deadline = t + links::rto(reply->network, reply->station);
+			}
+		}
+	}
+
+	/* Start the retransmit thread */
+	int start(void) {
+		thread_retransmit = std::thread(run);
+		return 0;
+	}
+
+	/* Wait for the retransmit thread to finish and release the copies of the replies */
+	void stop(void) {
+		int i;
+
+		if (thread_retransmit.joinable())
+			thread_retransmit.join();
+
+		std::lock_guard<std::mutex> lock(replies_lock);
+		for (i = 0; i < FILESTORE_RETRANSMIT_SLOTS; i++) {
+			delete replies[i].frame;
+			replies[i].frame = NULL;
+			replies[i].used = false;
+		}
+	}
+
+	/* Keep a reply which was sent to a station until it's ACKed */
+	void add(const Job *job, const econet::Frame *frame, size_t length) {
+		Reply *reply, *unused;
+		int i;
+
+		if (((job->network == 0) && (job->station == 0)) || (length < 8) || (length > sizeof(frame->rawdata)))
+			return;
+
+		std::lock_guard<std::mutex> lock(replies_lock);
+		reply = NULL;
+		unused = NULL;
+		for (i = 0; i < FILESTORE_RETRANSMIT_SLOTS; i++) {
+			if ((replies[i].used == true) && (replies[i].network == job->network) && (replies[i].station == job->station)) {
+				reply = &replies[i];
+				break;
+			}
+			if ((replies[i].used == false) && (unused == NULL))
+				unused = &replies[i];
+		}
+		if (reply == NULL)
+			reply = unused;
+		if (reply == NULL) {
+			/* Too many replies waiting: this one can't be sent again */
+			failedFrames++;
+			return;
+		}
+
+		if (reply->frame == NULL)
+			reply->frame = new econet::Frame;
+		memcpy(reply->frame->rawdata, frame->rawdata, length);
+		reply->used = true;
+		reply->network = job->network;
+		reply->station = job->station;
+		reply->sock = job->sock;
+		reply->addr = job->addr;
+		reply->addrlen = job->addrlen;
+		reply->sequence = frame->aun.sequence;
+		reply->tries = 0;
+		reply->length = length;
+		reply->deadline = now() + links::rto(job->network, job->station);
+	}
+
+	/* A station ACKed a reply: stop its timer */
+	void acked(uint8_t network, uint8_t station, uint32_t sequence) {
+		int i;
+
+		std::lock_guard<std::mutex> lock(replies_lock);
+		for (i = 0; i < FILESTORE_RETRANSMIT_SLOTS; i++) {
+			if ((replies[i].used == true) && (replies[i].network == network) && (replies[i].station == station) && (replies[i].sequence == sequence)) {
+				replies[i].used = false;
+				break;
+			}
+		}
+	}
+
+	/* Number of replies which were sent again */
+	uint32_t resent(void) {
+		return resentFrames;
+	}
+
+	/* Number of replies which were never ACKed, or couldn't be kept */
+	uint32_t failed(void) {
+		return failedFrames;
+	}
+}
+
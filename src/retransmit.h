@@ -0,0 +1,46 @@
+/* retransmit.h
+ * Retransmission of replies which weren't ACKed by the station
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_RETRANSMIT_HEADER
+#define ECONET_RETRANSMIT_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint32_t, uint64_t
+#include <sys/socket.h>			// struct sockaddr_storage, socklen_t
+
+#include "econet.h"			// econet::Frame
+#include "workers.h"			// Job
+
+#define FILESTORE_RETRANSMIT_SLOTS	64		// Maximum number of replies waiting for an ACK
+#define FILESTORE_RETRANSMIT_TRIES	5		// Number of times a reply is sent again before giving up
+#define FILESTORE_RETRANSMIT_TICK	5000		// Number of microseconds between checks for expired timers
+
+namespace retransmit {
+	/* A reply which is waiting for its ACK */
+	typedef struct {
+		bool			used;
+		uint8_t			network;	// Station the reply was sent to
+		uint8_t			station;
+		int			sock;		// Socket the reply was sent on
+		struct sockaddr_storage	addr;		// Address of the station
+		socklen_t		addrlen;
+		uint32_t		sequence;	// Sequence number of the reply
+		uint64_t		deadline;	// When the reply must be sent again (in microseconds)
+		unsigned int		tries;		// Number of times the reply was sent again
+		size_t			length;		// Size of the reply
+		econet::Frame		*frame;		// Copy of the reply; allocated once and reused
+	} Reply;
+
+	int		start(void);
+	void		stop(void);
+	void		add(const Job *job, const econet::Frame *frame, size_t length);
+	void		acked(uint8_t network, uint8_t station, uint32_t sequence);
+	uint32_t	resent(void);
+	uint32_t	failed(void);
+}
+
+#endif
+
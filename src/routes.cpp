@@ -0,0 +1,249 @@
+/* routes.cpp
+ * Bridge routing table between the Econet and AUN networks
+ *
+ * The routing table is fed by the bridge protocol on port &9C (NewBridge,
+ * BridgeReply, WhatNet and IsNet). Every bridge message tells us that the
+ * sending station's network is directly reachable on the interface it came
+ * in on; NewBridge and BridgeReply also list the networks which can be
+ * reached through the sending bridge. Every bridge which passes such a list
+ * on adds the network it came from to the end, so the last network in the
+ * list is one bridge away, the one before it two bridges, and so on.
+ *
+ * A sender on network 0 is on the local network of the interface the message
+ * came in on, so the networks it announces are reachable through a station
+ * on that local network.
+ *
+ * A route is forgotten when it wasn't announced again, and no traffic from
+ * its network came in through it, for FILESTORE_ROUTES_TIMEOUT seconds.
+ *
+ * Frames for another network are forwarded by forward(), which is called
+ * straight from the receive loop: it doesn't go through processFrame() and
+ * sends the frame to the next hop only. A next hop on AUN can't be told the
+ * Econet destination in a plain AUN frame, so the frame is sent straight to
+ * the destination station if we know its address, or else as a bridged frame
+ * which keeps the Econet addresses.
+ *
+ * A bridged frame carries the Econet source address it was sent from, which
+ * nothing checks, so it's only accepted from the bridge which is the next hop
+ * to its source network. Anyone else could forge Econet stations with it.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <mutex>		// std::mutex, std::lock_guard
+
+#include "routes.h"		// Header file for this code
+#include "aun.h"		// aun::transmitTo(), aun::transmitBridged(), aun::transmitFrame()
+#include "broadcasts.h"		// broadcasts::relay()
+#include "settings.h"		// settings::econet_network, settings::aun_network, settings::relay_only_known_networks
+#include "trunk.h"		// trunk::send()
+
+const char *route_interface[] = {"", "Econet", "AUN", "Trunk"};
+
+using namespace std;
+
+
+
+namespace routes {
+	Route			routes[256];
+	std::mutex		routes_lock;			// Protects routes[]
+	std::atomic<uint32_t>	forwardedFrames(0);
+	std::atomic<uint32_t>	unroutableFrames(0);
+	std::atomic<uint32_t>	rejectedFrames(0);
+
+	/* Check if there's a route to a network, and forget it if it's too old; the caller must hold routes_lock */
+	bool current(uint8_t network) {
+		if (routes[network].via == ROUTE_NONE)
+			return false;
+
+		if (time(NULL) - routes[network].updated > FILESTORE_ROUTES_TIMEOUT) {
+			routes[network].via = ROUTE_NONE;
+			return false;
+		}
+		return true;
+	}
+
+	/* The network number of the local network on an interface, or 0 if it's unknown */
+	uint8_t localNetwork(uint8_t via) {
+		if (via == ROUTE_ECONET)
+			return settings::econet_network;
+		if (via == ROUTE_AUN)
+			return settings::aun_network;
+		return 0;
+	}
+
+	/* Add or replace a route, unless we already know a shorter route through another bridge */
+	void addRoute(uint8_t destination, uint8_t via, uint8_t network, uint8_t station, uint8_t hops) {
+		Route *route;
+
+		/* Never route our own networks, the local network or broadcasts */
+		if ((destination == 0) || (destination == 0xFF))
+			return;
+		if ((destination == settings::econet_network) || (destination == settings::aun_network))
+			return;
+
+		route = &routes[destination];
+		if ((current(destination) == true) && (route->hops < hops) && ((route->network != network) || (route->station != station)))
+			return;
+
+		route->via = via;
+		route->network = network;
+		route->station = station;
+		route->hops = hops;
+		route->updated = time(NULL);
+	}
+
+	/* Process a bridge protocol message (port &9C) which was received from network:station on interface via */
+	void update(uint8_t via, uint8_t network, uint8_t station, uint8_t control, const uint8_t *data, size_t length) {
+		size_t i;
+
+		std::lock_guard<std::mutex> lock(routes_lock);
+
+		/* A sender on network 0 is on the local network of the interface */
+		if (network == 0)
+			network = localNetwork(via);
+
+		/* The network of the sender is directly attached to the interface the message came in on */
+		addRoute(network, via, network, station, 0);
+
+		switch (control | 0x80) {
+			// &80 New bridge available on the network
+			case 0x80 :
+			// &81 Reply to new bridge frame (&80)
+			case 0x81 :
+				/* Every data byte is a network which can be reached through the sending bridge, the nearest one last */
+				for (i = 0; i < length; i++)
+					addRoute(data[i], via, network, station, (length - i < 0xFF) ? length - i : 0xFF);
+				break;
+
+			// &82 What net?
+			case 0x82 :
+			// &83 Is net?
+			case 0x83 :
+				break;
+
+			default :
+				break;
+		}
+	}
+
+	/* Look up the route to a network */
+	bool lookup(uint8_t network, Route *route) {
+		std::lock_guard<std::mutex> lock(routes_lock);
+
+		if (current(network) == false)
+			return false;
+
+		*route = routes[network];
+		return true;
+	}
+
+	/* Check if network:station on interface via may hand us frames from the source network: only the next hop to that network may */
+	bool trusted(uint8_t source, uint8_t via, uint8_t network, uint8_t station) {
+		std::lock_guard<std::mutex> lock(routes_lock);
+
+		/* Unknown senders are never a bridge */
+		if ((network != 0) || (station != 0)) {
+			if (network == 0)
+				network = localNetwork(via);
+			if ((current(source) == true) && (routes[source].via == via) && (routes[source].network == network) && (routes[source].station == station))
+				return true;
+		}
+
+		rejectedFrames++;
+		return false;
+	}
+
+	/* Keep the route to a network alive while traffic from it comes in through the same interface */
+	void heard(uint8_t network, uint8_t via) {
+		std::lock_guard<std::mutex> lock(routes_lock);
+
+		if ((current(network) == true) && (routes[network].via == via))
+			routes[network].updated = time(NULL);
+	}
+
+	/* Forward a frame which was received on interface from to the next hop towards its destination network */
+	bool forward(econet::Frame *frame, unsigned int size, uint8_t from) {
+		Route route;
+
+		/* Broadcasts are relayed to the other network at most once */
+		if ((frame->econet.dst_network == 0xFF) && (frame->econet.dst_station == 0xFF))
+			return broadcasts::relay(frame, size, from);
+
+		heard(frame->econet.src_network, from);
+
+		if (lookup(frame->econet.dst_network, &route) == true) {
+			/* Don't send a frame back onto the network it came from */
+			if (route.via == from) {
+				unroutableFrames++;
+				return false;
+			}
+
+			if (route.via == ROUTE_AUN) {
+				/* Send it to the destination station itself if we know it, or else to the next hop with the Econet addresses kept */
+				if ((aun::transmitTo(frame->econet.dst_network, frame->econet.dst_station, frame, size) != 0) &&
+				    (aun::transmitBridged(route.network, route.station, frame, size) != 0)) {
+					unroutableFrames++;
+					return false;
+				}
+			} else if (route.via == ROUTE_TRUNK) {
+				if (trunk::send(frame, size) == false) {
+					unroutableFrames++;
+					return false;
+				}
+			} else {
+				econet::transmitFrame(frame, size);
+			}
+			forwardedFrames++;
+			return true;
+		}
+
+		/* No route: drop the frame, or relay it to the other side if we're allowed to */
+		if (settings::relay_only_known_networks == true) {
+			unroutableFrames++;
+			return false;
+		}
+		if (from == ROUTE_ECONET) {
+			if (aun::transmitFrame(frame, size) != 0) {
+				unroutableFrames++;
+				return false;
+			}
+		} else {
+			econet::transmitFrame(frame, size);
+		}
+		forwardedFrames++;
+		return true;
+	}
+
+	/* Copy all known routes */
+	int snapshot(uint8_t *networks, Route *list, int max) {
+		std::lock_guard<std::mutex> lock(routes_lock);
+		int n, i;
+
+		i = 0;
+		for (n = 0; (n < 256) && (i < max); n++) {
+			if (current(n) == true) {
+				networks[i] = n;
+				list[i++] = routes[n];
+			}
+		}
+		return i;
+	}
+
+	/* Number of frames which were forwarded to another network */
+	uint32_t forwarded(void) {
+		return forwardedFrames;
+	}
+
+	/* Number of frames which couldn't be forwarded */
+	uint32_t unroutable(void) {
+		return unroutableFrames;
+	}
+
+	/* Number of bridged frames which didn't come from the bridge to their source network */
+	uint32_t rejected(void) {
+		return rejectedFrames;
+	}
+}
+
@@ -0,0 +1,42 @@
+/* routes.h
+ * Bridge routing table between the Econet and AUN networks
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_ROUTES_HEADER
+#define ECONET_ROUTES_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint32_t
+#include <ctime>			// time_t
+
+#include "econet.h"			// econet::Frame
+
+#define FILESTORE_ROUTES_TIMEOUT	1800		// Number of seconds after which a route which wasn't announced or used is forgotten
+
+enum ROUTE_INTERFACES {ROUTE_NONE, ROUTE_ECONET, ROUTE_AUN, ROUTE_TRUNK};
+extern const char *route_interface[];
+
+namespace routes {
+	/* How to reach a network */
+	typedef struct {
+		uint8_t		via;		// Interface on which the network can be reached, or ROUTE_NONE if unknown
+		uint8_t		network;	// Next hop: the bridge (or station) which forwards frames to this network
+		uint8_t		station;
+		uint8_t		hops;		// Number of bridges between us and the network (0 = directly attached)
+		time_t		updated;	// When this route was last announced, or traffic from the network came in through it
+	} Route;
+
+	void		update(uint8_t via, uint8_t network, uint8_t station, uint8_t control, const uint8_t *data, size_t length);
+	bool		lookup(uint8_t network, Route *route);
+	bool		forward(econet::Frame *frame, unsigned int size, uint8_t from);
+	bool		trusted(uint8_t source, uint8_t via, uint8_t network, uint8_t station);
+	int		snapshot(uint8_t *networks, Route *list, int max);
+	uint32_t	forwarded(void);
+	uint32_t	unroutable(void);
+	uint32_t	rejected(void);
+}
+
+#endif
+
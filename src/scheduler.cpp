@@ -0,0 +1,231 @@
+/* scheduler.cpp
+ * Per-station fair queueing of received frames
+ *
+ * Every worker keeps one flow per station with queued frames, and every
+ * flow is a FIFO, so the frames of one station are always processed in the
+ * order in which they arrived. Stations are classified by the next frame
+ * they have waiting: immediate operations and small metadata requests put
+ * the station in the priority class, everything which results in a bulk
+ * data transfer puts it in the bulk class. The priority class is served
+ * first, but after FILESTORE_SCHEDULER_BULK_FLOOR priority frames in a row
+ * a waiting bulk frame gets its turn, so bulk transfers can't be starved.
+ * Within a class the flows are served with deficit round-robin, so a
+ * station which is loading a large file can't hold up the *CAT of another
+ * station.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include "scheduler.h"		// Header file for this code
+#include "aun.h"		// AUN_IMMEDIATE
+
+using namespace std;
+
+
+
+namespace scheduler {
+	/* Reset a scheduler to an empty state */
+	void init(Queue *q) {
+		unsigned int i;
+
+		for (i = 0; i < FILESTORE_WORKER_QUEUE_SIZE; i++)
+			q->next[i] = i + 1;
+		q->next[FILESTORE_WORKER_QUEUE_SIZE - 1] = -1;
+		q->freelist = 0;
+		q->count = 0;
+
+		for (i = 0; i < FILESTORE_SCHEDULER_FLOWS; i++)
+			q->flows[i].used = false;
+		for (i = 0; i < SCHEDULER_CLASSES; i++) {
+			q->activehead[i] = 0;
+			q->activecount[i] = 0;
+		}
+		q->priorityrun = 0;
+	}
+
+	/* Put a flow at the end of the round-robin list of the class of its first frame */
+	void activate(Queue *q, unsigned int f) {
+		Flow *flow = &q->flows[f];
+
+		flow->cls = q->cls[flow->head];
+		flow->deficit = 0;
+		q->activelist[flow->cls][(q->activehead[flow->cls] + q->activecount[flow->cls]) % FILESTORE_SCHEDULER_FLOWS] = f;
+		q->activecount[flow->cls]++;
+	}
+
+	/* Add a received frame to the flow of its station */
+	int enqueue(Queue *q, const Job *job) {
+		Flow *flow;
+		uint32_t key;
+		unsigned int cost, f, freeflow;
+		int16_t i;
+
+		if (q->freelist == -1)
+			return SCHEDULER_FULL;
+
+		/* Find the flow of this station, or an unused one */
+		key = flowKey(job);
+		freeflow = FILESTORE_SCHEDULER_FLOWS;
+		for (f = 0; f < FILESTORE_SCHEDULER_FLOWS; f++) {
+			if (q->flows[f].used == false) {
+				if (freeflow == FILESTORE_SCHEDULER_FLOWS)
+					freeflow = f;
+			} else if (q->flows[f].key == key) {
+				break;
+			}
+		}
+		if (f == FILESTORE_SCHEDULER_FLOWS) {
+			if (freeflow == FILESTORE_SCHEDULER_FLOWS)
+				return SCHEDULER_FULL;
+
+			f = freeflow;
+			flow = &q->flows[f];
+			flow->key = key;
+			flow->used = true;
+			flow->pending = 0;
+			flow->head = -1;
+			flow->tail = -1;
+		}
+		flow = &q->flows[f];
+
+		if (flow->pending >= FILESTORE_SCHEDULER_STATION_LIMIT)
+			return SCHEDULER_STATION_FULL;
+
+		/* Store the frame and append it to the flow */
+		i = q->freelist;
+		q->freelist = q->next[i];
+		q->jobs[i] = *job;
+		q->cls[i] = classify(job, &cost);
+		q->cost[i] = cost;
+		q->next[i] = -1;
+		if (flow->tail == -1)
+			flow->head = i;
+		else
+			q->next[flow->tail] = i;
+		flow->tail = i;
+		flow->pending++;
+		q->count++;
+
+		/* A flow which had nothing queued joins the round-robin list of the class of this frame */
+		if (flow->pending == 1)
+			activate(q, f);
+
+		return SCHEDULER_QUEUED;
+	}
+
+	/* Take the next frame to be processed from the scheduler */
+	bool dequeue(Queue *q, Job *job) {
+		Flow *flow;
+		unsigned int c, f;
+		int16_t i;
+
+		/* Priority first, unless bulk frames have waited for too many priority frames already */
+		if (q->activecount[SCHEDULER_BULK] == 0)
+			q->priorityrun = 0;
+		if ((q->activecount[SCHEDULER_PRIORITY] > 0) && (q->priorityrun < FILESTORE_SCHEDULER_BULK_FLOOR))
+			c = SCHEDULER_PRIORITY;
+		else if (q->activecount[SCHEDULER_BULK] > 0)
+			c = SCHEDULER_BULK;
+		else if (q->activecount[SCHEDULER_PRIORITY] > 0)
+			c = SCHEDULER_PRIORITY;
+		else
+			return false;
+
+		while (true) {
+			f = q->activelist[c][q->activehead[c]];
+			flow = &q->flows[f];
+			i = flow->head;
+
+			/* Not enough credit left: give this flow a new quantum and move on to the next flow */
+			if (q->cost[i] > flow->deficit) {
+				flow->deficit += FILESTORE_SCHEDULER_QUANTUM;
+				q->activelist[c][(q->activehead[c] + q->activecount[c]) % FILESTORE_SCHEDULER_FLOWS] = f;
+				q->activehead[c] = (q->activehead[c] + 1) % FILESTORE_SCHEDULER_FLOWS;
+				continue;
+			}
+
+			flow->deficit -= q->cost[i];
+			flow->head = q->next[i];
+			if (flow->head == -1)
+				flow->tail = -1;
+			*job = q->jobs[i];
+			q->next[i] = q->freelist;
+			q->freelist = i;
+			q->count--;
+			flow->pending--;
+
+			/* An idle flow leaves the round-robin list and loses its credit; so does a flow whose next frame is of the other class */
+			if ((flow->head == -1) || (q->cls[flow->head] != c)) {
+				q->activehead[c] = (q->activehead[c] + 1) % FILESTORE_SCHEDULER_FLOWS;
+				q->activecount[c]--;
+				if (flow->head == -1)
+					flow->used = false;
+				else
+					activate(q, f);
+			}
+
+			if (c == SCHEDULER_PRIORITY)
+				q->priorityrun++;
+			else
+				q->priorityrun = 0;
+
+			return true;
+		}
+	}
+
+	/* Decide whether a frame is an interactive request or part of a bulk transfer, and what processing it costs */
+	int classify(const Job *job, unsigned int *cost) {
+		const econet::Frame *frame = job->frame;
+
+		*cost = (job->length > 0) ? job->length : 1;
+
+		if (job->length < 8)
+			return SCHEDULER_PRIORITY;
+
+		if ((frame->aun.type == AUN_IMMEDIATE) || (frame->aun.port == 0x00))
+			return SCHEDULER_PRIORITY;
+
+		switch (frame->aun.port) {
+			// &99 FileServerCommand
+			case 0x99 :
+				if (job->length >= 10) {
+					switch (frame->aun.function) {
+						case 0x01 :	// Save
+						case 0x02 :	// Load
+						case 0x05 :	// Load as command
+						case 0x0A :	// Get multiple bytes
+						case 0x0B :	// Put multiple bytes
+						case 0x1D :	// Create file of specified size
+							*cost = FILESTORE_SCHEDULER_BULK_COST;
+							return SCHEDULER_BULK;
+
+						default :
+							break;
+					}
+				}
+				break;
+
+			// &91 FileServerData
+			case 0x91 :
+			// &D1 PrintServerData
+			case 0xD1 :
+				return SCHEDULER_BULK;
+
+			default :
+				break;
+		}
+
+		if (job->length <= FILESTORE_SCHEDULER_SMALL_FRAME)
+			return SCHEDULER_PRIORITY;
+		return SCHEDULER_BULK;
+	}
+
+	/* Key of the flow a frame belongs to: the station number if known, otherwise its source address */
+	uint32_t flowKey(const Job *job) {
+		if ((job->network != 0) || (job->station != 0))
+			return (job->network << 8) | job->station;
+
+		return workers::addressHash(job) | 0x80000000;
+	}
+}
+
@@ -0,0 +1,59 @@
+/* scheduler.h
+ * Per-station fair queueing of received frames
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_SCHEDULER_HEADER
+#define ECONET_SCHEDULER_HEADER
+
+#include <cstdint>			// uint8_t, int16_t, uint32_t
+
+#include "workers.h"			// Job, FILESTORE_WORKER_QUEUE_SIZE
+
+#define FILESTORE_SCHEDULER_FLOWS		64		// Maximum number of stations with queued frames per worker
+#define FILESTORE_SCHEDULER_STATION_LIMIT	32		// Maximum number of queued frames per station
+#define FILESTORE_SCHEDULER_QUANTUM		1500		// Number of bytes a station may have processed per round
+#define FILESTORE_SCHEDULER_SMALL_FRAME		128		// Maximum size of a metadata request which is given priority
+#define FILESTORE_SCHEDULER_BULK_COST		8192		// Cost of a request which results in a bulk data transfer
+#define FILESTORE_SCHEDULER_BULK_FLOOR		8		// Number of priority frames in a row after which a waiting bulk frame gets its turn
+
+enum SCHEDULER_CLASSES {SCHEDULER_PRIORITY, SCHEDULER_BULK, SCHEDULER_CLASSES};
+enum SCHEDULER_RESULTS {SCHEDULER_QUEUED, SCHEDULER_FULL, SCHEDULER_STATION_FULL};
+
+namespace scheduler {
+	/* All queued frames of one station, in the order in which they were received */
+	typedef struct {
+		uint32_t	key;					// Station this flow belongs to (see flowKey())
+		bool		used;					// Is set when this flow has queued frames
+		unsigned int	pending;				// Number of queued frames
+		int16_t		head;					// First queued frame, or -1
+		int16_t		tail;					// Last queued frame, or -1
+		int		deficit;				// Deficit counter
+		int		cls;					// Class of the first queued frame, which is the class whose active list this flow is on
+	} Flow;
+
+	/* The scheduler of one worker; the caller must serialise access to it */
+	typedef struct {
+		Job		jobs[FILESTORE_WORKER_QUEUE_SIZE];	// Storage for all queued frames
+		int16_t		next[FILESTORE_WORKER_QUEUE_SIZE];	// Next frame in the same flow, or next free entry
+		uint16_t	cost[FILESTORE_WORKER_QUEUE_SIZE];	// Cost of processing each queued frame
+		uint8_t		cls[FILESTORE_WORKER_QUEUE_SIZE];	// Class of each queued frame
+		int16_t		freelist;				// First unused entry in jobs[], or -1
+		unsigned int	count;					// Number of queued frames
+		unsigned int	priorityrun;				// Number of priority frames served in a row while bulk frames were waiting
+		Flow		flows[FILESTORE_SCHEDULER_FLOWS];
+		uint8_t		activelist[SCHEDULER_CLASSES][FILESTORE_SCHEDULER_FLOWS];	// Round-robin list of flows per class
+		unsigned int	activehead[SCHEDULER_CLASSES];
+		unsigned int	activecount[SCHEDULER_CLASSES];
+	} Queue;
+
+	void		init(Queue *q);
+	int		enqueue(Queue *q, const Job *job);
+	bool		dequeue(Queue *q, Job *job);
+	int		classify(const Job *job, unsigned int *cost);
+	uint32_t	flowKey(const Job *job);
+}
+
+#endif
+
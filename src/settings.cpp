@@ -21,7 +21,23 @@ namespace settings {
 	unsigned char	aun_network;
 	unsigned short	aun_port			= 32768;
 	unsigned short	dtls_port			= 33859;
+	unsigned int	workers				= 4;					// Number of worker threads which process received frames
+	unsigned int	ratelimit_frames		= 500;					// Maximum number of frames per second accepted from each station (0=unlimited)
+	unsigned int	ratelimit_bytes			= 2097152;				// Maximum number of bytes per second accepted from each station (0=unlimited)
+	unsigned int	ratelimit_unknown		= 10;					// Maximum number of frames per second accepted from each source not in !Stations (0=drop all)
 	unsigned char	autolearn			= 0;					// Autolearning for !Stations file is OFF (1=SESSION: only for this session, do not update !Stations / 2=FULL: add new stations to !Stations file)
+	unsigned char	*trunk_peer			= NULL;					// IP address of the bridge at the other end of the trunk (NULL=no trunk)
+	unsigned short	trunk_port			= 32769;
+	unsigned int	trunk_delay			= 2000;					// Maximum number of microseconds a frame is held back to coalesce it with others on the trunk (0=never)
+	bool		trunk_compression		= true;					// Compress frames on the trunk if the other bridge can decompress them
+	unsigned int	trunk_threshold			= 64;					// Frames smaller than this number of bytes aren't compressed
+	bool		trunk_segmentation		= true;					// Split frames which don't fit in one datagram in segments sized to the path MTU
+	unsigned char	*multicast_group		= NULL;					// Multicast group to send broadcasts to (NULL=send them to every station)
+	unsigned char	*multicast_interface		= NULL;					// Network interface for the multicast group (NULL=default)
+	unsigned char	multicast_ttl			= 1;					// Number of routers a multicast broadcast may cross
+	unsigned int	bcastload_delay			= 500;					// Number of microseconds between the data blocks of a broadcast load (0=no pacing)
+	size_t		dircache_size			= 4194304;				// Maximum number of bytes used to cache directory catalogues (0=don't cache)
+	bool		metaindex			= false;					// Keep the metadata of the objects in a directory in one index file instead of an .INF file per object
 	bool		relay_only_known_networks	= false;
 	unsigned char	*volume				= NULL;
 	unsigned char	*printqueue			= (unsigned char *)"/usr/bin/lpr";
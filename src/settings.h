@@ -7,6 +7,8 @@
 #ifndef ECONET_CONFIGURATION_HEADER
 #define ECONET_CONFIGURATION_HEADER
 
+#include <cstddef>					// size_t
+
 #include "users.h"					// MAX_USER_FLAGS
 
 namespace settings {
@@ -18,7 +20,23 @@ namespace settings {
 	extern unsigned char	aun_network;
 	extern unsigned short	aun_port;
 	extern unsigned short	dtls_port;
+	extern unsigned int	workers;
+	extern unsigned int	ratelimit_frames;
+	extern unsigned int	ratelimit_bytes;
+	extern unsigned int	ratelimit_unknown;
 	extern unsigned char	autolearn;
+	extern unsigned char	*trunk_peer;
+	extern unsigned short	trunk_port;
+	extern unsigned int	trunk_delay;
+	extern bool		trunk_compression;
+	extern unsigned int	trunk_threshold;
+	extern bool		trunk_segmentation;
+	extern unsigned char	*multicast_group;
+	extern unsigned char	*multicast_interface;
+	extern unsigned char	multicast_ttl;
+	extern unsigned int	bcastload_delay;
+	extern size_t		dircache_size;
+	extern bool		metaindex;
 	extern bool		relay_only_known_networks;
 	extern unsigned char	*volume;
 	extern unsigned char	*printqueue;
@@ -6,6 +6,7 @@
 
 #include <cstdio>			// Included for EOF, printf(), FILE*, fopen(), fgets(), feof() and fclose()
 #include <cstring>			// Included for memcpy(), strlen()
+#include <strings.h>			// Included for strcasecmp()
 #include <arpa/inet.h>			// Included for in_addr
 
 #include "stations.h"			// 
@@ -19,17 +20,92 @@ using namespace std;
 
 namespace stations {
 //	Station *stations;
-	Station stations[127][255] = {STATION_UNUSED, INADDR_ANY, in6addr_any, 0, ""};
+	Station stations[127][255] = {STATION_UNUSED, INADDR_ANY, in6addr_any, 0, "", false};
 	int totalStations = 0;
+	uint16_t index[FILESTORE_STATIONS_INDEX_SIZE];	// Open addressing hash table of ((network << 8) | station) + 1, or 0 if unused
+
+	/* FNV-1a hash of an IP address and UDP port */
+	uint32_t hashAddress(const void *ip, size_t iplen, unsigned short port) {
+		const uint8_t *p = (const uint8_t *) ip;
+		uint32_t hash;
+		size_t i;
+
+		hash = 2166136261u;
+		for (i = 0; i < iplen; i++) {
+			hash ^= p[i];
+			hash *= 16777619u;
+		}
+		hash ^= (port & 0xFF);
+		hash *= 16777619u;
+		hash ^= (port >> 8);
+		hash *= 16777619u;
+
+		return hash;
+	}
+
+	/* Add a station to the IP address to station lookup table */
+	void addIndex(unsigned char n, unsigned char s) {
+		uint32_t i;
+
+		if (stations[n][s].type == STATION_IPV4)
+			i = hashAddress(&stations[n][s].ipv4, sizeof(in_addr), stations[n][s].port);
+		else
+			i = hashAddress(&stations[n][s].ipv6, sizeof(in6_addr), stations[n][s].port);
+
+		while (index[i & (FILESTORE_STATIONS_INDEX_SIZE - 1)] != 0)
+			i++;
+		index[i & (FILESTORE_STATIONS_INDEX_SIZE - 1)] = ((n << 8) | s) + 1;
+	}
+
+	/* Find the network and station number of the station with this IP address and port */
+	bool findStation(const struct sockaddr *addr, uint8_t *network, uint8_t *station) {
+		const struct sockaddr_in *addr4 = (const struct sockaddr_in *) addr;
+		const struct sockaddr_in6 *addr6 = (const struct sockaddr_in6 *) addr;
+		unsigned short port;
+		unsigned char n, s;
+		uint32_t i;
+
+		if (addr->sa_family == AF_INET) {
+			port = ntohs(addr4->sin_port);
+			i = hashAddress(&addr4->sin_addr, sizeof(in_addr), port);
+		} else if (addr->sa_family == AF_INET6) {
+			port = ntohs(addr6->sin6_port);
+			i = hashAddress(&addr6->sin6_addr, sizeof(in6_addr), port);
+		} else {
+			return false;
+		}
+
+		while (index[i & (FILESTORE_STATIONS_INDEX_SIZE - 1)] != 0) {
+			n = (index[i & (FILESTORE_STATIONS_INDEX_SIZE - 1)] - 1) >> 8;
+			s = (index[i & (FILESTORE_STATIONS_INDEX_SIZE - 1)] - 1) & 0xFF;
+			if (stations[n][s].port == port) {
+				if ((addr->sa_family == AF_INET) && (stations[n][s].type == STATION_IPV4) && (stations[n][s].ipv4.s_addr == addr4->sin_addr.s_addr)) {
+					*network = n;
+					*station = s;
+					return true;
+				}
+				if ((addr->sa_family == AF_INET6) && (stations[n][s].type == STATION_IPV6) && (memcmp(&stations[n][s].ipv6, &addr6->sin6_addr, sizeof(in6_addr)) == 0)) {
+					*network = n;
+					*station = s;
+					return true;
+				}
+			}
+			i++;
+		}
+
+		return false;
+	}
 
 	/* Load !Stations file */
 	int loadStations(void) {
 		int result;
 		unsigned char n, s;
 		unsigned short p;
+		bool unicast;
 		char buffer[256];
 		char ip[INET6_ADDRSTRLEN];
 		char hash[FILESTORE_STATIONS_HASH_LENGTH];
+		char flag[16];
 		FILE *fp_stationsfile;
 
 		printf("- Loading %s: ", STATIONSFILE);
@@ -43,7 +119,17 @@ namespace stations {
 				if (fgets(buffer, sizeof(buffer), fp_stationsfile) != NULL) {
 					if (buffer[0] != '#') {
 						/* TODO: there's no size checking when fscanf-ing the values into users[]. If a string in the !Users file is larger than the size of the variables in users[], a buffer overvlow will happen */
-						result = sscanf(buffer, "%hhu %hhu %s %hu %128s", &n, &s, ip, &p, hash);
+						result = sscanf(buffer, "%hhu %hhu %s %hu %128s %15s", &n, &s, ip, &p, hash, flag);
+
+						/* The UNICAST keyword can be given instead of or after the fingerprint */
+						unicast = false;
+						if (result == 6) {
+							unicast = (strcasecmp(flag, "UNICAST") == 0);
+							result = 5;
+						} else if ((result == 5) && (strcasecmp(hash, "UNICAST") == 0)) {
+							unicast = true;
+							result = 4;
+						}
 						if ((result == 4) || (result == 5)) {
 							if (n > 127) {
 								fprintf(stderr, "Invalid econet network value: %i\n", n);
@@ -83,6 +169,8 @@ namespace stations {
 								strcpy(stations[n][s].fingerprint, hash);
 							}
 							stations[n][s].port = p;
+							stations[n][s].unicast = unicast;
+							addIndex(n, s);
 //							printf("%i:%i IPv4=%08X IPv6=%X port=%i hash=%s\n", n, s, stations[n][s].ipv4, stations[n][s].ipv6, stations[n][s].port, hash);
 							stations::totalStations++;
 						}
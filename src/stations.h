@@ -8,8 +8,11 @@
 #define ECONET_STATIONS_HEADER
 
 #define FILESTORE_STATIONS_HASH_LENGTH (SHA512_DIGEST_LENGTH * 2) + 1
+#define FILESTORE_STATIONS_INDEX_SIZE	65536		// Size of the IP address to station lookup table; must be a power of 2 and larger than 127*255
 
+#include <cstdint>			// Included for uint8_t
 #include <netinet/in.h>			// Included for struct in_addr
+#include <sys/socket.h>			// Included for struct sockaddr
 #include <openssl/sha.h>		// Included for SHA256_DIGEST_LENGTH
 
 enum STATION_TYPES {STATION_UNUSED, STATION_CONSOLE, STATION_ECONET, STATION_IPV4, STATION_IPV6};
@@ -22,12 +25,15 @@ typedef struct {
 	in6_addr	ipv6;						// IPv6 address, or 0 if this station doesn't have an IPv6 address
 	unsigned short	port;						// UDP port, or 0 if this station doesn't have an IP address
 	char		fingerprint[FILESTORE_STATIONS_HASH_LENGTH];	// Fingerprint of the certificate used by this station, or empty when no DTLS is used
+	bool		unicast;					// Station can't receive broadcasts sent to the multicast group
 } Station;
 
 namespace stations {
 	extern Station stations[127][255];
 
 	int loadStations(void);
+	uint32_t hashAddress(const void *ip, size_t iplen, unsigned short port);
+	bool findStation(const struct sockaddr *addr, uint8_t *network, uint8_t *station);
 }
 
 #endif
@@ -0,0 +1,119 @@
+/* bridge_test.cpp
+ * Tests for the rings and pipes between the stages of the bridge
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <chrono>			// std::chrono::steady_clock
+#include <thread>			// std::thread
+#include <unistd.h>			// usleep()
+
+#include "../bridge.h"			// bridge::*
+#include "../main.h"			// bye
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_FRAMES		1000000		// Number of descriptors passed from the producer to the consumer thread
+
+using namespace std;
+
+
+
+bridge::Ring	ring;
+
+/* A ring holds FILESTORE_BRIDGE_RING_SIZE descriptors, and hands them out in order */
+void testRing(void) {
+	bridge::FrameDesc desc;
+	unsigned int i, round;
+
+	CHECK(bridge::pop(&ring, &desc) == false);
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < FILESTORE_BRIDGE_RING_SIZE; i++) {
+			desc.length = round * 100 + i;
+			CHECK(bridge::push(&ring, &desc) == true);
+		}
+		CHECK(bridge::push(&ring, &desc) == false);
+		for (i = 0; i < FILESTORE_BRIDGE_RING_SIZE; i++)
+			CHECK((bridge::pop(&ring, &desc) == true) && (desc.length == round * 100 + i));
+		CHECK(bridge::pop(&ring, &desc) == false);
+	}
+}
+
+/* The producer side of a ring, in its own thread */
+void producer(void) {
+	bridge::FrameDesc desc;
+	unsigned int i;
+
+	desc.frame = NULL;
+	for (i = 0; i < TEST_FRAMES; i++) {
+		desc.length = i;
+		while (bridge::push(&ring, &desc) == false)
+			std::this_thread::yield();
+	}
+}
+
+/* Nothing is lost, duplicated or reordered when a producer and a consumer thread share a ring */
+void testThreads(void) {
+	std::thread thread_producer;
+	bridge::FrameDesc desc;
+	unsigned int i, misordered;
+
+	thread_producer = std::thread(producer);
+	misordered = 0;
+	for (i = 0; i < TEST_FRAMES; i++) {
+		while (bridge::pop(&ring, &desc) == false)
+			std::this_thread::yield();
+		if (desc.length != i)
+			misordered++;
+	}
+	thread_producer.join();
+	CHECK(misordered == 0);
+	CHECK(bridge::pop(&ring, &desc) == false);
+}
+
+/* Running out of buffers isn't a dropped frame; only drop() counts one */
+void testPipe(void) {
+	econet::Frame *frames[FILESTORE_BRIDGE_RING_SIZE];
+	std::chrono::steady_clock::time_point submitted;
+	econet::Frame *frame;
+	int i;
+
+	for (i = 0; i < FILESTORE_BRIDGE_RING_SIZE; i++) {
+		frames[i] = bridge::acquire(BRIDGE_AUN_RX);
+		CHECK(frames[i] != NULL);
+	}
+	for (i = 0; i < 100; i++)
+		CHECK(bridge::acquire(BRIDGE_AUN_RX) == NULL);
+	CHECK(bridge::dropped(BRIDGE_AUN_RX) == 0);
+	bridge::drop(BRIDGE_AUN_RX);
+	CHECK(bridge::dropped(BRIDGE_AUN_RX) == 1);
+
+	/* The idle forwarding stage wakes up as soon as a frame is submitted; an empty frame is ignored and its buffer comes back */
+	usleep(20000);
+	submitted = std::chrono::steady_clock::now();
+	bridge::submit(BRIDGE_AUN_RX, frames[0], 0);
+	while ((frame = bridge::acquire(BRIDGE_AUN_RX)) == NULL)
+		std::this_thread::yield();
+	CHECK(frame == frames[0]);
+	CHECK(std::chrono::steady_clock::now() - submitted < std::chrono::milliseconds(FILESTORE_BRIDGE_POLL / 2));
+
+	for (i = 0; i < FILESTORE_BRIDGE_RING_SIZE; i++)
+		bridge::submit(BRIDGE_AUN_RX, frames[i], 0);
+	for (i = 0; i < FILESTORE_BRIDGE_RING_SIZE; i++) {
+		while (bridge::acquire(BRIDGE_AUN_RX) == NULL)
+			std::this_thread::yield();
+	}
+	CHECK(bridge::occupancy(BRIDGE_AUN_RX) == 0);
+	CHECK(bridge::dropped(BRIDGE_AUN_RX) == 1);
+}
+
+int main(void) {
+	testRing();
+	testThreads();
+
+	CHECK(bridge::start() == 0);
+	testPipe();
+	bye = true;
+	bridge::stop();
+
+	return TEST_RESULT("bridge_test");
+}
@@ -0,0 +1,157 @@
+/* dentries_test.cpp
+ * Tests for resolving Acorn path names to native paths, and caching them
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdlib>			// mkdtemp()
+#include <cstring>			// strcmp()
+#include <fcntl.h>			// open()
+#include <sys/stat.h>			// mkdir()
+#include <unistd.h>			// access(), close(), unlink(), rmdir(), usleep()
+
+#include "../dentries.h"		// dentries::*
+#include "../dircache.h"		// dircache::start(), dircache::stop()
+#include "../main.h"			// bye
+#include "../nativefs.h"		// FILESTORE_NATIVE_ROOT
+#include "../netfs.h"			// netfs::resolve(), netfs::resolveNew()
+#include "../users.h"			// users::newSession(), users::delSession(), users::openFile(), users::closeFile()
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+char		testdir[] = FILESTORE_NATIVE_ROOT "/DTXXXXXX";
+const char	*testname;			// Acorn name of the test directory in the root
+
+/* Resolve an Acorn path which starts in the test directory */
+int resolve(const char *path, char *localpath, bool *directory) {
+	char fsp[256];
+
+	snprintf(fsp, sizeof(fsp), "$.%s%s", testname, path);
+	return dentries::resolve(0, 0, fsp, localpath, directory);
+}
+
+/* Check that a resolved native path is the expected one in the test directory */
+bool isPath(const char *localpath, const char *expected) {
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s%s", testdir, expected);
+	return (strcmp(localpath, path) == 0);
+}
+
+/* Paths resolve regardless of case, through directories only */
+void testResolve(void) {
+	char localpath[PATH_MAX];
+	bool directory;
+
+	CHECK(resolve(".SUB.FILE", localpath, &directory) == 0);
+	CHECK(isPath(localpath, "/Sub/File") && (directory == false));
+	CHECK(resolve(".sub", localpath, &directory) == 0);
+	CHECK(isPath(localpath, "/Sub") && (directory == true));
+	CHECK(resolve(".SUB.^.Sub.file", localpath, &directory) == 0);
+	CHECK(isPath(localpath, "/Sub/File"));
+
+	CHECK(resolve(".SUB.FILE.MORE", localpath, &directory) == 0x000000D6);
+	CHECK(resolve(".NOTHERE", localpath, &directory) == 0x000000D6);
+	CHECK(resolve(".WAYTOOLONGNAME", localpath, &directory) == 0x000000CC);
+
+	/* The parent of the root is the root */
+	CHECK(dentries::resolve(0, 0, "$.^", localpath, &directory) == 0);
+	CHECK((strcmp(localpath, FILESTORE_NATIVE_ROOT) == 0) && (directory == true));
+}
+
+/* Names are looked up on disc once, also names which don't exist, until their directory changes */
+void testCache(void) {
+	dentries::Stats before, after;
+	char localpath[PATH_MAX], path[PATH_MAX];
+	bool directory;
+	int fd, i;
+
+	CHECK(resolve(".SUB.FILE", localpath, &directory) == 0);
+	CHECK(resolve(".SUB.NEWFILE", localpath, &directory) == 0x000000D6);
+	dentries::getStats(&before);
+	CHECK(resolve(".SUB.FILE", localpath, &directory) == 0);
+	CHECK(resolve(".SUB.NEWFILE", localpath, &directory) == 0x000000D6);
+	dentries::getStats(&after);
+	CHECK(after.misses == before.misses);
+	CHECK((after.hits >= before.hits + 4) && (after.negatives == before.negatives + 1));
+
+	/* A new file is found as soon as its directory changed */
+	snprintf(path, sizeof(path), "%s/Sub/NewFile", testdir);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	CHECK(fd != -1);
+	close(fd);
+	for (i = 0; (i < 200) && (resolve(".SUB.NEWFILE", localpath, &directory) != 0); i++)
+		usleep(10000);
+	CHECK(isPath(localpath, "/Sub/NewFile"));
+	dentries::getStats(&after);
+	CHECK(after.invalidations > before.invalidations);
+
+	unlink(path);
+	for (i = 0; (i < 200) && (resolve(".SUB.NEWFILE", localpath, &directory) == 0); i++)
+		usleep(10000);
+	CHECK(i < 200);
+}
+
+/* A file which doesn't exist yet is found a place in its directory, so it can be opened for output */
+void testCreate(void) {
+	char fsp[256], localpath[PATH_MAX];
+	bool directory;
+	uint8_t handle;
+	int session;
+
+	snprintf(fsp, sizeof(fsp), "$.%s.SUB.NEWOUT/TXT\r", testname);
+	CHECK(netfs::resolve(fsp, localpath, &directory) == 0x000000D6);
+	CHECK(netfs::resolveNew(fsp, localpath, &directory) == 0);
+	CHECK(isPath(localpath, "/Sub/NEWOUT.TXT") && (directory == false));
+
+	session = users::newSession(0, 0, 0);
+	CHECK(session >= 0);
+	CHECK(users::openFile(0, 0, localpath, "w+", &handle) == 0);
+	CHECK(access(localpath, F_OK) == 0);
+	CHECK(users::closeFile(0, 0, handle) == 0);
+	CHECK(users::delSession(session) == 0);
+	unlink(localpath);
+
+	/* A name which is in use keeps its native name */
+	snprintf(fsp, sizeof(fsp), "$.%s.sub.file", testname);
+	CHECK(netfs::resolveNew(fsp, localpath, &directory) == 0);
+	CHECK(isPath(localpath, "/Sub/File"));
+
+	/* The directory has to exist */
+	snprintf(fsp, sizeof(fsp), "$.%s.NOTHERE.NEWOUT", testname);
+	CHECK(netfs::resolveNew(fsp, localpath, &directory) == 0x000000D6);
+	snprintf(fsp, sizeof(fsp), "$.%s.SUB.FILE.NEWOUT", testname);
+	CHECK(netfs::resolveNew(fsp, localpath, &directory) == 0x000000D6);
+	snprintf(fsp, sizeof(fsp), "$.%s.SUB.NEW*", testname);
+	CHECK(netfs::resolveNew(fsp, localpath, &directory) == 0x000000CC);
+}
+
+int main(void) {
+	char path[PATH_MAX];
+	int fd;
+
+	CHECK(mkdtemp(testdir) != NULL);
+	testname = testdir + strlen(FILESTORE_NATIVE_ROOT) + 1;
+	snprintf(path, sizeof(path), "%s/Sub", testdir);
+	CHECK(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/Sub/File", testdir);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	CHECK(fd != -1);
+	close(fd);
+
+	CHECK(dircache::start() == 0);
+	testResolve();
+	testCache();
+	testCreate();
+	bye = true;
+	dircache::stop();
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/Sub", testdir);
+	rmdir(path);
+	rmdir(testdir);
+	return TEST_RESULT("dentries_test");
+}
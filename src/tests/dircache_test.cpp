@@ -0,0 +1,152 @@
+/* dircache_test.cpp
+ * Tests for the cache of the catalogues of native directories
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdlib>			// mkdtemp()
+#include <cstring>			// memset(), strcmp(), strlcpy()
+#include <fcntl.h>			// open()
+#include <sys/stat.h>			// mkdir()
+#include <unistd.h>			// close(), unlink(), rmdir(), usleep()
+
+#include "../dircache.h"		// dircache::*
+#include "../fsdir.h"			// fsdir::init(), fsdir::add(), fsdir::get(), fsdir::release(), fsdir::bytes()
+#include "../main.h"			// bye
+#include "../settings.h"		// settings::dircache_size
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+char		testdir[] = "/tmp/dircache_testXXXXXX";
+char		dir_a[PATH_MAX], dir_b[PATH_MAX];
+
+/* Make a catalogue with one object in it */
+void catalogue(FSDirectory *dir, const char *name) {
+	FSObject obj;
+
+	memset(&obj, 0, sizeof(obj));
+	strlcpy(obj.name, name, sizeof(obj.name));
+	obj.loadaddr = 0x1900;
+	fsdir::init(dir);
+	fsdir::add(dir, &obj);
+}
+
+/* Read a directory "from disc" and store its catalogue; returns its cycle number */
+uint64_t fill(const char *localpath, const char *name) {
+	dircache::Ticket ticket;
+	FSDirectory dir;
+	uint64_t cycle;
+
+	ticket = dircache::begin(localpath);
+	catalogue(&dir, name);
+	if ((cycle = dircache::store(ticket, &dir)) == 0)
+		fsdir::release(&dir);
+	return cycle;
+}
+
+/* Create a file in a directory, and wait until the cache notices */
+void change(const char *localpath, const char *native) {
+	char path[PATH_MAX];
+	int fd, i;
+
+	snprintf(path, sizeof(path), "%s/%s", localpath, native);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	CHECK(fd != -1);
+	close(fd);
+	for (i = 0; (i < 200) && (dircache::cycle(localpath) != 0); i++)
+		usleep(10000);
+	CHECK(i < 200);
+}
+
+/* A stored catalogue is handed out until its directory changes */
+void testCache(void) {
+	FSDirectory dir;
+	FSObject obj;
+	uint64_t cycle, snapped;
+
+	CHECK(dircache::snapshot(dir_a, &dir, &snapped) == false);
+	cycle = fill(dir_a, "FIRST");
+	CHECK(cycle != 0);
+	CHECK(dircache::cycle(dir_a) == cycle);
+
+	CHECK(dircache::snapshot(dir_a, &dir, &snapped) == true);
+	CHECK((snapped == cycle) && (dir.count == 1));
+	fsdir::get(&dir, 0, &obj);
+	CHECK((strcmp(obj.name, "FIRST") == 0) && (obj.loadaddr == 0x1900));
+	fsdir::release(&dir);
+
+	change(dir_a, "NEWFILE");
+	CHECK(dircache::snapshot(dir_a, &dir, &snapped) == false);
+
+	/* The next catalogue gets another cycle number */
+	CHECK((fill(dir_a, "SECOND") != 0) && (dircache::cycle(dir_a) != cycle));
+}
+
+/* A catalogue which was read while its directory changed is never stored */
+void testStale(void) {
+	dircache::Ticket ticket;
+	FSDirectory dir;
+
+	ticket = dircache::begin(dir_a);
+	CHECK(ticket.slot != -1);
+	change(dir_a, "OTHERFILE");
+	catalogue(&dir, "STALE");
+	CHECK(dircache::store(ticket, &dir) == 0);
+	fsdir::release(&dir);
+	CHECK(dircache::cycle(dir_a) == 0);
+}
+
+/* The least recently used catalogue is dropped to stay within settings::dircache_size */
+void testBudget(void) {
+	dircache::Stats before, after;
+	FSDirectory dir;
+	uint64_t snapped;
+
+	catalogue(&dir, "SIZE");
+	settings::dircache_size = 2 * (sizeof(dircache::Directory) + fsdir::bytes(&dir)) - 1;
+	fsdir::release(&dir);
+
+	dircache::getStats(&before);
+	CHECK(fill(dir_a, "A") != 0);
+	CHECK(fill(dir_b, "B") != 0);
+	CHECK(dircache::cycle(dir_a) == 0);
+	CHECK(dircache::snapshot(dir_b, &dir, &snapped) == true);
+	fsdir::release(&dir);
+	dircache::getStats(&after);
+	CHECK((after.evictions > before.evictions) && (after.directories == 1));
+
+	/* Without a budget, nothing is cached */
+	settings::dircache_size = 0;
+	CHECK(dircache::begin(dir_a).slot == -1);
+}
+
+int main(void) {
+	dircache::Stats stats;
+	char path[PATH_MAX];
+
+	CHECK(mkdtemp(testdir) != NULL);
+	snprintf(dir_a, sizeof(dir_a), "%s/A", testdir);
+	snprintf(dir_b, sizeof(dir_b), "%s/B", testdir);
+	CHECK((mkdir(dir_a, 0755) == 0) && (mkdir(dir_b, 0755) == 0));
+
+	CHECK(dircache::start() == 0);
+	testCache();
+	testStale();
+	dircache::getStats(&stats);
+	CHECK(stats.invalidations >= 1);
+	testBudget();
+	bye = true;
+	dircache::stop();
+
+	snprintf(path, sizeof(path), "%s/A/NEWFILE", testdir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/A/OTHERFILE", testdir);
+	unlink(path);
+	rmdir(dir_a);
+	rmdir(dir_b);
+	rmdir(testdir);
+	return TEST_RESULT("dircache_test");
+}
@@ -0,0 +1,131 @@
+/* handles_test.cpp
+ * Tests for the handle tables of the stations and the files they open through users::
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>			// std::atomic
+#include <cstdlib>			// mkstemp()
+#include <thread>			// std::thread
+#include <unistd.h>			// close(), unlink()
+
+#include "../netfs.h"			// netfs::*handle*(), StationHandles
+#include "../users.h"			// users::newSession(), users::logoff(), users::openFile(), users::closeFile(), users::getFile()
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_STATIONS		8		// Number of stations which open and close files at the same time
+#define TEST_ROUNDS		200		// Number of times each station opens and closes its files
+#define TEST_FILES		4		// Number of files each station has open at the same time
+
+using namespace std;
+
+
+
+char			testfile[] = "/tmp/handles_testXXXXXX";
+std::atomic<int>	failures(0);
+
+/* A new table hands out every handle once, and reuses freed handles most recently freed first */
+void testTable(void) {
+	static StationHandles table;
+	int i;
+
+	netfs::inithandles(&table);
+	for (i = 1; i < FILESTORE_STATION_HANDLES; i++)
+		CHECK(netfs::newhandle(&table, FILESTORE_HANDLE_FILE, 1000 + i) == i);
+	CHECK(netfs::newhandle(&table, FILESTORE_HANDLE_FILE, 0) == 0);
+
+	CHECK(netfs::gethandle(&table, 7, FILESTORE_HANDLE_FILE) == 1007);
+	CHECK(netfs::gethandle(&table, 7, FILESTORE_HANDLE_DIRECTORY) == -1);
+	CHECK(netfs::gethandle(&table, 0, FILESTORE_HANDLE_FILE) == -1);
+
+	netfs::freehandle(&table, 7);
+	netfs::freehandle(&table, 9);
+	netfs::freehandle(&table, 9);
+	CHECK(netfs::gethandle(&table, 9, FILESTORE_HANDLE_FILE) == -1);
+	CHECK(netfs::newhandle(&table, FILESTORE_HANDLE_DIRECTORY, 2) == 9);
+	CHECK(netfs::newhandle(&table, FILESTORE_HANDLE_DIRECTORY, 3) == 7);
+	CHECK(netfs::newhandle(&table, FILESTORE_HANDLE_DIRECTORY, 4) == 0);
+	CHECK(netfs::gethandle(&table, 9, FILESTORE_HANDLE_DIRECTORY) == 2);
+}
+
+/* One station opening and closing files through its own handle table */
+void station(int s) {
+	uint8_t handles[TEST_FILES];
+	FILESTORE_HANDLE files[TEST_FILES];
+	int round, f, g;
+
+	for (round = 0; round < TEST_ROUNDS; round++) {
+		for (f = 0; f < TEST_FILES; f++) {
+			if (users::openFile(1, s, testfile, "r", &handles[f]) != 0) {
+				failures++;
+				return;
+			}
+			files[f] = users::getFile(1, s, handles[f]);
+			if (files[f] == FILESTORE_EOF)
+				failures++;
+
+			/* Another station can't use this handle */
+			if (users::getFile(2, s, handles[f]) != FILESTORE_EOF)
+				failures++;
+		}
+
+		/* The station's handles and the open files behind them are all different */
+		for (f = 0; f < TEST_FILES; f++) {
+			for (g = f + 1; g < TEST_FILES; g++) {
+				if ((handles[f] == handles[g]) || (files[f] == files[g]))
+					failures++;
+			}
+		}
+
+		/* Close half of the files one by one, and the rest with handle 0 */
+		for (f = 0; f < TEST_FILES / 2; f++) {
+			if (users::closeFile(1, s, handles[f]) != 0)
+				failures++;
+			if (users::closeFile(1, s, handles[f]) != 0x000000DE)
+				failures++;
+		}
+		if (users::closeFile(1, s, 0) != 0)
+			failures++;
+		for (f = 0; f < TEST_FILES; f++) {
+			if (users::getFile(1, s, handles[f]) != FILESTORE_EOF)
+				failures++;
+		}
+	}
+}
+
+int main(void) {
+	std::thread stations[TEST_STATIONS];
+	uint8_t handle;
+	int fd, session[TEST_STATIONS], i;
+
+	testTable();
+
+	fd = mkstemp(testfile);
+	CHECK(fd != -1);
+	close(fd);
+
+	/* A station which isn't logged on can't open files */
+	CHECK(users::openFile(1, 1, testfile, "r", &handle) == 0x000000BF);
+
+	for (i = 0; i < TEST_STATIONS; i++) {
+		session[i] = users::newSession(0, 1, i + 1);
+		CHECK(session[i] >= 0);
+	}
+	for (i = 0; i < TEST_STATIONS; i++)
+		stations[i] = std::thread(station, i + 1);
+	for (i = 0; i < TEST_STATIONS; i++)
+		stations[i].join();
+	CHECK(failures == 0);
+
+	/* Logging off closes the files a station left open */
+	CHECK(users::openFile(1, 1, testfile, "r", &handle) == 0);
+	CHECK(users::logoff(1, 1) == 0);
+	CHECK(users::getFile(1, 1, handle) == FILESTORE_EOF);
+	CHECK(users::logoff(1, 1) == 0x000000AE);
+	CHECK(users::openFile(1, 1, testfile, "r", &handle) == 0x000000BF);
+	for (i = 1; i < TEST_STATIONS; i++)
+		CHECK(users::delSession(session[i]) == 0);
+
+	unlink(testfile);
+	return TEST_RESULT("handles_test");
+}
@@ -0,0 +1,118 @@
+/* links_test.cpp
+ * Tests for the per-station retransmission timeouts and block sizes
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstring>			// memset()
+#include <unistd.h>			// usleep()
+
+#include "../aun.h"			// AUN_ACK, AUN_UNICAST
+#include "../links.h"			// links::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_NETWORK		5		// Network of the test stations
+#define TEST_RTT		30000		// Round-trip time (in microseconds) of the test stations
+
+using namespace std;
+
+
+
+/* Receive a frame of some type from a station */
+void receive(uint8_t network, uint8_t station, uint8_t type, uint32_t sequence, uint8_t retry) {
+	econet::Frame frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.aun.type = type;
+	frame.aun.sequence = sequence;
+	frame.aun.retry = retry;
+	links::received(network, station, &frame, 8);
+}
+
+/* Send a reply to a station, which ACKs it after TEST_RTT */
+void roundTrip(uint8_t station, uint32_t sequence) {
+	links::sent(TEST_NETWORK, station, sequence);
+	usleep(TEST_RTT);
+	receive(TEST_NETWORK, station, AUN_ACK, sequence, 0);
+}
+
+/* The retransmission timeout follows the measured round-trip time, and backs off on timeouts */
+void testTimeout(void) {
+	links::Link link;
+	uint32_t rto, srtt;
+	int i;
+
+	CHECK(links::rto(TEST_NETWORK, 1) == FILESTORE_LINK_INITIAL_RTO);
+	CHECK(links::rto(0, 0) == FILESTORE_LINK_INITIAL_RTO);
+
+	/* The first sample sets the timeout to three times the round-trip time */
+	roundTrip(1, 100);
+	CHECK(links::lookup(TEST_NETWORK, 1, &link) == true);
+	CHECK((link.srtt >= TEST_RTT) && (link.srtt < 10 * TEST_RTT));
+	CHECK(link.rttvar == link.srtt / 2);
+	rto = links::rto(TEST_NETWORK, 1);
+	CHECK(rto == link.srtt + 4 * link.rttvar);
+
+	/* Every timeout doubles it, up to FILESTORE_LINK_MAX_RTO */
+	links::timeout(TEST_NETWORK, 1);
+	CHECK(links::rto(TEST_NETWORK, 1) == 2 * rto);
+	links::timeout(TEST_NETWORK, 1);
+	CHECK(links::rto(TEST_NETWORK, 1) == 4 * rto);
+	for (i = 0; i < 20; i++)
+		links::timeout(TEST_NETWORK, 1);
+	CHECK(links::rto(TEST_NETWORK, 1) == FILESTORE_LINK_MAX_RTO);
+
+	/* The ACK of a reply which was sent again isn't timed (Karn's rule) */
+	CHECK(links::lookup(TEST_NETWORK, 1, &link) == true);
+	srtt = link.srtt;
+	links::sent(TEST_NETWORK, 1, 101);
+	links::timeout(TEST_NETWORK, 1);
+	usleep(2 * TEST_RTT);
+	receive(TEST_NETWORK, 1, AUN_ACK, 101, 0);
+	CHECK(links::lookup(TEST_NETWORK, 1, &link) == true);
+	CHECK((link.srtt == srtt) && (link.tx_time == 0));
+	CHECK(links::rto(TEST_NETWORK, 1) == FILESTORE_LINK_MAX_RTO);
+
+	/* An ACK for another reply isn't timed either */
+	links::sent(TEST_NETWORK, 1, 102);
+	receive(TEST_NETWORK, 1, AUN_ACK, 999, 0);
+	CHECK((links::lookup(TEST_NETWORK, 1, &link) == true) && (link.tx_time != 0));
+
+	/* A valid sample ends the backoff */
+	roundTrip(1, 103);
+	rto = links::rto(TEST_NETWORK, 1);
+	CHECK((rto >= FILESTORE_LINK_MIN_RTO) && (rto < FILESTORE_LINK_MAX_RTO));
+}
+
+/* The block size shrinks when a station retransmits, and grows again on a clean link */
+void testBlockSize(void) {
+	uint32_t sequence;
+	int i;
+
+	CHECK(links::blockSize(TEST_NETWORK, 2) == FILESTORE_LINK_START_BLOCK);
+	receive(TEST_NETWORK, 2, AUN_UNICAST, 1, 0);
+	receive(TEST_NETWORK, 2, AUN_UNICAST, 2, 1);
+	CHECK(links::blockSize(TEST_NETWORK, 2) == FILESTORE_LINK_START_BLOCK / 2);
+	receive(TEST_NETWORK, 2, AUN_UNICAST, 2, 0);
+	CHECK(links::blockSize(TEST_NETWORK, 2) == FILESTORE_LINK_START_BLOCK / 4);
+
+	for (sequence = 3; sequence < 3 + FILESTORE_LINK_GROW_FRAMES; sequence++)
+		receive(TEST_NETWORK, 2, AUN_UNICAST, sequence, 0);
+	CHECK(links::blockSize(TEST_NETWORK, 2) == FILESTORE_LINK_START_BLOCK / 2);
+
+	for (i = 0; i < 20; i++)
+		receive(TEST_NETWORK, 2, AUN_UNICAST, sequence, 1);
+	CHECK(links::blockSize(TEST_NETWORK, 2) == FILESTORE_LINK_MIN_BLOCK);
+
+	/* Stations on network 127 have a link too */
+	receive(127, 3, AUN_UNICAST, 1, 0);
+	receive(127, 3, AUN_UNICAST, 2, 1);
+	CHECK(links::blockSize(127, 3) == FILESTORE_LINK_START_BLOCK / 2);
+}
+
+int main(void) {
+	testTimeout();
+	testBlockSize();
+
+	return TEST_RESULT("links_test");
+}
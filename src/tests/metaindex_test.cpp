@@ -0,0 +1,103 @@
+/* metaindex_test.cpp
+ * Tests for the index with the Acorn metadata of the objects in a directory
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdlib>			// mkdtemp()
+#include <cstring>			// memset(), strcmp()
+#include <sys/stat.h>			// stat()
+#include <unistd.h>			// unlink(), rmdir()
+
+#include "../metaindex.h"		// metaindex::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+char		testdir[] = "/tmp/metaindex_testXXXXXX";
+
+/* Size of the index in the test directory */
+off_t indexSize(void) {
+	char path[PATH_MAX];
+	struct stat st;
+
+	snprintf(path, sizeof(path), "%s/%s", testdir, FILESTORE_METAINDEX_FILE);
+	if (stat(path, &st) == -1)
+		return -1;
+	return st.st_size;
+}
+
+/* Record some metadata of an object */
+void record(const char *native, uint32_t loadaddr) {
+	FSObject obj;
+
+	memset(&obj, 0, sizeof(obj));
+	strlcpy(obj.name, native, sizeof(obj.name));
+	obj.loadaddr = loadaddr;
+	obj.attrib.R = true;
+	CHECK(metaindex::update(testdir, native, &obj) == 0);
+}
+
+/* Look up the load address of an object; returns 0 if it has no record */
+uint32_t lookup(const char *native) {
+	metaindex::Record *records;
+	const metaindex::Record *found;
+	uint32_t loadaddr;
+	int count;
+
+	if ((count = metaindex::load(testdir, &records)) == -1)
+		return 0;
+	found = metaindex::find(records, count, native);
+	loadaddr = (found != NULL) ? found->loadaddr : 0;
+	delete[] records;
+	return loadaddr;
+}
+
+/* The last record of an object counts, and a forgotten object has none */
+void testUpdate(void) {
+	CHECK(metaindex::forget(testdir, "NOTHERE") == 0);
+	CHECK(indexSize() == -1);
+
+	record("ONE", 0x1000);
+	record("TWO", 0x2000);
+	CHECK((lookup("ONE") == 0x1000) && (lookup("TWO") == 0x2000));
+
+	record("ONE", 0x1100);
+	CHECK((lookup("ONE") == 0x1100) && (lookup("TWO") == 0x2000));
+
+	CHECK(metaindex::forget(testdir, "ONE") == 0);
+	CHECK((lookup("ONE") == 0) && (lookup("TWO") == 0x2000));
+
+	record("ONE", 0x1200);
+	CHECK(lookup("ONE") == 0x1200);
+}
+
+/* Changing one object over and over again doesn't make the index grow without bounds */
+void testCompact(void) {
+	off_t limit;
+	int i;
+
+	limit = sizeof(metaindex::Header) + (FILESTORE_METAINDEX_COMPACT * sizeof(metaindex::Record));
+	for (i = 0; i < 10 * FILESTORE_METAINDEX_COMPACT; i++) {
+		record("THREE", 0x3000 + i);
+		CHECK(indexSize() <= limit);
+	}
+	CHECK(lookup("THREE") == (uint32_t) (0x3000 + i - 1));
+	CHECK((lookup("ONE") == 0x1200) && (lookup("TWO") == 0x2000));
+}
+
+int main(void) {
+	char path[PATH_MAX];
+
+	CHECK(mkdtemp(testdir) != NULL);
+
+	testUpdate();
+	testCompact();
+
+	snprintf(path, sizeof(path), "%s/%s", testdir, FILESTORE_METAINDEX_FILE);
+	unlink(path);
+	rmdir(testdir);
+	return TEST_RESULT("metaindex_test");
+}
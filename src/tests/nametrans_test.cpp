@@ -0,0 +1,136 @@
+/* nametrans_test.cpp
+ * Tests for the translation between native file names and Acorn file names
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdlib>			// mkdtemp()
+#include <cstring>			// strcmp()
+#include <fcntl.h>			// open()
+#include <unistd.h>			// close(), unlink(), rmdir(), usleep()
+
+#include "../dircache.h"		// dircache::start(), dircache::stop()
+#include "../main.h"			// bye
+#include "../nametrans.h"		// nametrans::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+char		testdir[] = "/tmp/nametrans_testXXXXXX";
+const char	*natives[] = {"DATA.TXT", "DATA", "data", "LongFileName1", "LongFileName2", "a:b", ".hidden", "DATA.INF", "ORPHAN.INF", NULL};
+
+/* Create an empty file in the test directory */
+void create(const char *native) {
+	char path[PATH_MAX];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", testdir, native);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	CHECK(fd != -1);
+	close(fd);
+}
+
+/* Remove a file from the test directory */
+void destroy(const char *native) {
+	char path[PATH_MAX];
+
+	snprintf(path, sizeof(path), "%s/%s", testdir, native);
+	unlink(path);
+}
+
+/* Every native name gets a unique Acorn name, which translates back to it */
+void testNames(void) {
+	char acorn[ECONET_MAX_FILENAME_LEN + 1], native[NAME_MAX + 1];
+
+	CHECK((nametrans::toAcorn(testdir, "DATA.TXT", acorn) == true) && (strcmp(acorn, "DATA/TXT") == 0));
+	CHECK((nametrans::toAcorn(testdir, "a:b", acorn) == true) && (strcmp(acorn, "a_b") == 0));
+	CHECK(nametrans::toAcorn(testdir, ".hidden", acorn) == false);
+
+	/* The .INF file of an object is hidden, and doesn't take a name from anything else; one without its object isn't */
+	CHECK(nametrans::toAcorn(testdir, "DATA.INF", acorn) == false);
+	CHECK(nametrans::toNative(testdir, "DATA/INF", native) == false);
+	CHECK((nametrans::toAcorn(testdir, "ORPHAN.INF", acorn) == true) && (strcmp(acorn, "ORPHAN/INF") == 0));
+
+	/* Names which only differ in case collide; the first native name keeps its name */
+	CHECK((nametrans::toAcorn(testdir, "DATA", acorn) == true) && (strcmp(acorn, "DATA") == 0));
+	CHECK((nametrans::toAcorn(testdir, "data", acorn) == true) && (strcmp(acorn, "data~1") == 0));
+
+	/* Names which are too long are shortened and numbered */
+	CHECK((nametrans::toAcorn(testdir, "LongFileName1", acorn) == true) && (strcmp(acorn, "LongFile~1") == 0));
+	CHECK((nametrans::toAcorn(testdir, "LongFileName2", acorn) == true) && (strcmp(acorn, "LongFile~2") == 0));
+
+	/* Acorn names are found regardless of case */
+	CHECK((nametrans::toNative(testdir, "data/txt", native) == true) && (strcmp(native, "DATA.TXT") == 0));
+	CHECK((nametrans::toNative(testdir, "DATA~1", native) == true) && (strcmp(native, "data") == 0));
+	CHECK((nametrans::toNative(testdir, "longfile~2", native) == true) && (strcmp(native, "LongFileName2") == 0));
+	CHECK(nametrans::toNative(testdir, "NOTHERE", native) == false);
+	CHECK(nametrans::toNative(testdir, "WAYTOOLONGNAME", native) == false);
+}
+
+/* A map got with load() gives the same names as looking them up one by one */
+void testLoad(void) {
+	nametrans::Map map;
+	char acorn[ECONET_MAX_FILENAME_LEN + 1], expected[ECONET_MAX_FILENAME_LEN + 1];
+	bool shown;
+	int i;
+
+	CHECK(nametrans::load(testdir, &map) == true);
+	CHECK(map.count == 7);
+	for (i = 0; natives[i] != NULL; i++) {
+		shown = nametrans::find(&map, natives[i], acorn);
+		CHECK(shown == nametrans::toAcorn(testdir, natives[i], expected));
+		if (shown == true)
+			CHECK(strcmp(acorn, expected) == 0);
+	}
+	CHECK(nametrans::find(&map, "DATA.INF", acorn) == false);
+	nametrans::release(&map);
+
+	CHECK(nametrans::load("/nonexistent/nametrans_test", &map) == false);
+	CHECK((nametrans::find(&map, "X.Y", acorn) == true) && (strcmp(acorn, "X/Y") == 0));
+	nametrans::release(&map);
+}
+
+/* A cached map is dropped as soon as its directory changes */
+void testChanges(void) {
+	char native[NAME_MAX + 1];
+	int i;
+
+	CHECK(nametrans::toNative(testdir, "NEWFILE", native) == false);
+	create("NewFile");
+	for (i = 0; (i < 200) && (nametrans::toNative(testdir, "NEWFILE", native) == false); i++)
+		usleep(10000);
+	CHECK(strcmp(native, "NewFile") == 0);
+
+	destroy("NewFile");
+	for (i = 0; (i < 200) && (nametrans::toNative(testdir, "NEWFILE", native) == true); i++)
+		usleep(10000);
+	CHECK(i < 200);
+}
+
+int main(void) {
+	int i;
+
+	CHECK(mkdtemp(testdir) != NULL);
+	for (i = 0; natives[i] != NULL; i++)
+		create(natives[i]);
+
+	/* Without the directory cache, nothing is cached */
+	testNames();
+	testLoad();
+	testChanges();
+
+	/* With the directory cache, maps are cached until their directory changes */
+	CHECK(dircache::start() == 0);
+	testNames();
+	testLoad();
+	testChanges();
+	bye = true;
+	dircache::stop();
+
+	for (i = 0; natives[i] != NULL; i++)
+		destroy(natives[i]);
+	rmdir(testdir);
+	return TEST_RESULT("nametrans_test");
+}
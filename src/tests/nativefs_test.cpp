@@ -0,0 +1,150 @@
+/* nativefs_test.cpp
+ * Tests for reading the metadata of native objects
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdio>			// FILE*, fopen(), fprintf(), fclose()
+#include <cstdlib>			// mkdtemp()
+#include <cstring>			// memset(), memcmp(), strcmp()
+#include <fcntl.h>			// open()
+#include <sys/stat.h>			// mkdir()
+#include <unistd.h>			// close(), unlink(), rmdir(), pread()
+
+#include "../fsdir.h"			// fsdir::init(), fsdir::get(), fsdir::release()
+#include "../nativefs.h"		// nativefs::info(), nativefs::readINFAt(), nativefs::open(), nativefs::write(), nativefs::catalogue()
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+char		testdir[] = "/tmp/nativefs_testXXXXXX";
+
+/* Write an .INF file for an object in the test directory */
+void writeINF(const char *native, const char *contents) {
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s.INF", testdir, native);
+	fp = fopen(path, "w");
+	CHECK(fp != NULL);
+	if (fp != NULL) {
+		fprintf(fp, "%s\n", contents);
+		fclose(fp);
+	}
+}
+
+/* The D bit comes from the native object, whatever the access string in its .INF file says */
+void testAttributes(void) {
+	FSObject obj;
+	char path[PATH_MAX];
+	int dirfd;
+
+	dirfd = open(testdir, O_RDONLY | O_DIRECTORY);
+	CHECK(dirfd != -1);
+
+	memset(&obj, 0, sizeof(obj));
+	obj.attrib.D = true;
+	CHECK(nativefs::readINFAt(dirfd, "SUBDIR", &obj) == true);
+	CHECK((obj.attrib.D == true) && (obj.attrib.W == true) && (obj.attrib.R == true));
+	CHECK(obj.loadaddr == 0x1900);
+
+	memset(&obj, 0, sizeof(obj));
+	CHECK(nativefs::readINFAt(dirfd, "FILE", &obj) == true);
+	CHECK((obj.attrib.D == false) && (obj.attrib.L == true));
+	close(dirfd);
+
+	/* A directory gets its dates, and keeps its D bit */
+	snprintf(path, sizeof(path), "%s/SUBDIR", testdir);
+	CHECK(nativefs::info(path, &obj) == true);
+	CHECK((obj.attrib.D == true) && (obj.attrib.W == true));
+	CHECK((obj.mtime != 0) && (obj.ctime != 0));
+
+	snprintf(path, sizeof(path), "%s/FILE", testdir);
+	CHECK(nativefs::info(path, &obj) == true);
+	CHECK((obj.attrib.D == false) && (obj.length == 5));
+}
+
+/* The .INF files of the objects aren't listed, and lengths and dates are only read when they're asked for */
+void testListing(void) {
+	FSDirectory dir;
+	FSObject obj;
+	int directory;
+
+	directory = nativefs::opendirectory(-1, testdir);
+	CHECK(directory != -1);
+	fsdir::init(&dir);
+	CHECK(nativefs::catalogue(directory, 0, 0, &dir, "", 0, 255, true) == 2);
+	fsdir::get(&dir, 0, &obj);
+	CHECK((strcmp(obj.name, "FILE") == 0) && (obj.length == 5) && (obj.mtime != 0));
+	fsdir::get(&dir, 1, &obj);
+	CHECK((strcmp(obj.name, "SUBDIR") == 0) && (obj.attrib.D == true));
+	fsdir::release(&dir);
+
+	/* Without the directory cache, the catalogue is only used for this listing */
+	fsdir::init(&dir);
+	CHECK(nativefs::catalogue(directory, 0, 0, &dir, "", 0, 255, false) == 2);
+	fsdir::get(&dir, 0, &obj);
+	CHECK((strcmp(obj.name, "FILE") == 0) && (obj.length == 0) && (obj.mtime == 0));
+	fsdir::get(&dir, 1, &obj);
+	CHECK((strcmp(obj.name, "SUBDIR") == 0) && (obj.attrib.D == true));
+	fsdir::release(&dir);
+	nativefs::closedirectory(directory);
+}
+
+/* A handle which appends writes at the end of the file, also when the file grew after it was opened */
+void testAppend(void) {
+	FILESTORE_HANDLE handle;
+	char path[PATH_MAX], contents[16];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/LOG", testdir);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	CHECK((fd != -1) && (write(fd, "AB", 2) == 2));
+
+	handle = nativefs::open(path, "a");
+	CHECK(handle != FILESTORE_EOF);
+	CHECK(write(fd, "CD", 2) == 2);
+	CHECK(nativefs::write("EF", 2, handle) == 2);
+	CHECK(write(fd, "GH", 2) == 2);
+	CHECK(nativefs::bput('I', handle) == 'I');
+	nativefs::close(handle);
+	close(fd);
+
+	fd = open(path, O_RDONLY);
+	CHECK((fd != -1) && (pread(fd, contents, sizeof(contents), 0) == 9) && (memcmp(contents, "ABCDEFGHI", 9) == 0));
+	close(fd);
+	unlink(path);
+}
+
+int main(void) {
+	char path[PATH_MAX];
+	int fd;
+
+	CHECK(mkdtemp(testdir) != NULL);
+	snprintf(path, sizeof(path), "%s/SUBDIR", testdir);
+	CHECK(mkdir(path, 0755) == 0);
+	snprintf(path, sizeof(path), "%s/FILE", testdir);
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	CHECK((fd != -1) && (write(fd, "HELLO", 5) == 5));
+	close(fd);
+
+	/* Access strings without D, and a file which claims to be a directory */
+	writeINF("SUBDIR", "SUBDIR 00001900 00008023 00000000 WR");
+	writeINF("FILE", "FILE 00000000 00000000 00000005 DLR");
+
+	testAttributes();
+	testListing();
+	testAppend();
+
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/FILE.INF", testdir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/SUBDIR.INF", testdir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/SUBDIR", testdir);
+	rmdir(path);
+	rmdir(testdir);
+	return TEST_RESULT("nativefs_test");
+}
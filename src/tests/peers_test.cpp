@@ -0,0 +1,154 @@
+/* peers_test.cpp
+ * Tests for the cache of learned AUN stations
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>			// std::atomic
+#include <cstring>			// memset()
+#include <thread>			// std::thread
+#include <arpa/inet.h>			// inet_pton(), htons()
+#include <netinet/in.h>			// struct sockaddr_in, struct sockaddr_in6
+
+#include "../peers.h"			// peers::learn(), peers::find(), peers::lookup(), peers::snapshot(), peers::visit()
+#include "../settings.h"		// settings::aun_network, settings::autolearn
+#include "../stations.h"		// stations::stations[][]
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_NETWORK		5		// Our AUN network
+#define TEST_THREADS		4		// Number of listener threads which learn stations at the same time
+
+using namespace std;
+
+
+
+std::atomic<int>	failures(0);
+
+/* Make an IPv4 address and port */
+struct sockaddr *address4(struct sockaddr_in *addr, const char *ip, unsigned short port) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	inet_pton(AF_INET, ip, &addr->sin_addr);
+	return (struct sockaddr *) addr;
+}
+
+/* Make an IPv6 address and port */
+struct sockaddr *address6(struct sockaddr_in6 *addr, const char *ip, unsigned short port) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sin6_family = AF_INET6;
+	addr->sin6_port = htons(port);
+	inet_pton(AF_INET6, ip, &addr->sin6_addr);
+	return (struct sockaddr *) addr;
+}
+
+/* Sources on different IP networks with the same last byte get their own station numbers */
+void testCollisions(void) {
+	struct sockaddr_in a, b, c;
+	struct sockaddr_in6 d;
+	struct sockaddr_storage found;
+	uint8_t network, station, network2, station2;
+
+	CHECK(peers::find(address4(&a, "10.0.0.42", 32768), &network, &station) == false);
+
+	CHECK(peers::learn(address4(&a, "10.0.0.42", 32768), &network, &station) == true);
+	CHECK((network == TEST_NETWORK) && (station == 42));
+
+	CHECK(peers::learn(address4(&b, "192.168.1.42", 32768), &network2, &station2) == true);
+	CHECK(network2 == TEST_NETWORK);
+	CHECK((station2 != 42) && (station2 >= 1) && (station2 <= 254));
+
+	/* The same address on another port is another station too */
+	CHECK(peers::learn(address4(&c, "10.0.0.42", 1000), &network, &station) == true);
+	CHECK((station != 42) && (station != station2));
+
+	CHECK(peers::learn(address6(&d, "fe80::2a", 32768), &network, &station) == true);
+	CHECK((station != 42) && (station != station2));
+
+	/* Learning a known address again keeps its station number */
+	CHECK(peers::learn(address4(&b, "192.168.1.42", 32768), &network, &station) == true);
+	CHECK((network == TEST_NETWORK) && (station == station2));
+	CHECK(peers::find((struct sockaddr *) &a, &network, &station) == true);
+	CHECK(station == 42);
+
+	/* Transmitting to a learned station uses its own address */
+	CHECK(peers::lookup(TEST_NETWORK, station2, &found) == true);
+	CHECK(((struct sockaddr_in *) &found)->sin_addr.s_addr == b.sin_addr.s_addr);
+	CHECK(peers::lookup(TEST_NETWORK, 42, &found) == true);
+	CHECK(((struct sockaddr_in *) &found)->sin_addr.s_addr == a.sin_addr.s_addr);
+}
+
+/* Station numbers in !Stations are never given to learned stations */
+void testStations(void) {
+	struct sockaddr_in a;
+	uint8_t network, station;
+
+	stations::stations[TEST_NETWORK][77].type = STATION_IPV4;
+	CHECK(peers::learn(address4(&a, "10.0.0.77", 32768), &network, &station) == true);
+	CHECK((network == TEST_NETWORK) && (station != 77));
+	stations::stations[TEST_NETWORK][77].type = STATION_UNUSED;
+}
+
+/* Several listener threads learning and finding stations at the same time */
+void listener(int t) {
+	struct sockaddr_in a;
+	uint8_t network, station, network2, station2;
+	char ip[INET_ADDRSTRLEN];
+	int i;
+
+	for (i = 0; i < 32; i++) {
+		snprintf(ip, sizeof(ip), "172.16.%i.%i", t, i + 1);
+		if (peers::learn(address4(&a, ip, 32768), &network, &station) == false) {
+			failures++;
+			continue;
+		}
+		if ((peers::find((struct sockaddr *) &a, &network2, &station2) == false) || (network2 != network) || (station2 != station))
+			failures++;
+	}
+}
+
+/* Count the stations visited by peers::visit() */
+void countPeer(const peers::Peer *peer, void *context) {
+	(void) peer;
+	(*(int *) context)++;
+}
+
+/* Every learned station has a different station number */
+void testUnique(void) {
+	static peers::Peer list[FILESTORE_PEERS_MAX];
+	bool seen[255];
+	int total, visited, i;
+
+	memset(seen, 0, sizeof(seen));
+	total = peers::snapshot(list, FILESTORE_PEERS_MAX);
+	for (i = 0; i < total; i++) {
+		CHECK(list[i].network == TEST_NETWORK);
+		CHECK(seen[list[i].station] == false);
+		seen[list[i].station] = true;
+	}
+
+	/* Visiting them finds the same stations */
+	visited = 0;
+	peers::visit(countPeer, &visited);
+	CHECK((visited == total) && (total > 0));
+}
+
+int main(void) {
+	std::thread listeners[TEST_THREADS];
+	int i;
+
+	settings::aun_network = TEST_NETWORK;
+	settings::autolearn = 1;
+
+	testCollisions();
+	testStations();
+
+	for (i = 0; i < TEST_THREADS; i++)
+		listeners[i] = std::thread(listener, i);
+	for (i = 0; i < TEST_THREADS; i++)
+		listeners[i].join();
+	CHECK(failures == 0);
+	testUnique();
+
+	return TEST_RESULT("peers_test");
+}
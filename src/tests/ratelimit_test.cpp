@@ -0,0 +1,117 @@
+/* ratelimit_test.cpp
+ * Tests for the token bucket rate limiting of received frames
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>			// std::atomic
+#include <cstring>			// memset()
+#include <thread>			// std::thread
+#include <arpa/inet.h>			// inet_pton(), htons()
+#include <netinet/in.h>			// struct sockaddr_in
+
+#include "../main.h"			// ECONET_MAX_NETWORK
+#include "../ratelimit.h"		// ratelimit::*
+#include "../settings.h"		// settings::ratelimit_*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_THREADS		4		// Number of listener threads which receive from the same station
+#define TEST_FRAMES		1000		// Number of frames each listener thread receives
+
+using namespace std;
+
+
+
+std::atomic<int>	allowed(0);
+
+/* Make an IPv4 address and port */
+struct sockaddr *address4(struct sockaddr_in *addr, const char *ip, unsigned short port) {
+	memset(addr, 0, sizeof(*addr));
+	addr->sin_family = AF_INET;
+	addr->sin_port = htons(port);
+	inet_pton(AF_INET, ip, &addr->sin_addr);
+	return (struct sockaddr *) addr;
+}
+
+/* A station gets a burst of one second worth of frames and bytes, and nothing more */
+void testKnown(void) {
+	int i, n;
+
+	settings::ratelimit_frames = 50;
+	settings::ratelimit_bytes = 0;
+	n = 0;
+	for (i = 0; i < 200; i++)
+		n += (ratelimit::allow(1, 10, 100) == true);
+	CHECK(n == 50);
+	CHECK(ratelimit::dropped(1, 10) == 150);
+
+	/* Other stations aren't affected by it */
+	CHECK(ratelimit::allow(1, 11, 100) == true);
+	CHECK(ratelimit::dropped(1, 11) == 0);
+
+	/* The byte limit is checked as well */
+	settings::ratelimit_frames = 0;
+	settings::ratelimit_bytes = 1000;
+	CHECK(ratelimit::allow(1, 12, 600) == true);
+	CHECK(ratelimit::allow(1, 12, 600) == false);
+	CHECK(ratelimit::allow(1, 12, 400) == true);
+
+	/* Stations on network 127 have a bucket too, stations beyond it are refused */
+	CHECK(ratelimit::allow(ECONET_MAX_NETWORK, 1, 600) == true);
+	CHECK(ratelimit::allow(ECONET_MAX_NETWORK, 1, 600) == false);
+	CHECK(ratelimit::dropped(ECONET_MAX_NETWORK, 1) == 1);
+	CHECK(ratelimit::allow(ECONET_MAX_NETWORK + 1, 1, 10) == false);
+	CHECK(ratelimit::dropped(ECONET_MAX_NETWORK + 1, 1) == 0);
+}
+
+/* A flooding unknown source doesn't starve the other unknown sources */
+void testUnknown(void) {
+	struct sockaddr_in flood, other;
+	int i, n;
+
+	settings::ratelimit_unknown = 10;
+	address4(&flood, "10.0.0.1", 32768);
+	n = 0;
+	for (i = 0; i < 100; i++)
+		n += (ratelimit::allowUnknown((struct sockaddr *) &flood, 100) == true);
+	CHECK(n == 10);
+
+	address4(&other, "10.0.1.1", 32768);
+	CHECK(ratelimit::allowUnknown((struct sockaddr *) &other, 100) == true);
+	address4(&other, "10.0.0.1", 32769);
+	CHECK(ratelimit::allowUnknown((struct sockaddr *) &other, 100) == true);
+
+	settings::ratelimit_unknown = 0;
+	CHECK(ratelimit::allowUnknown((struct sockaddr *) &other, 100) == false);
+}
+
+/* The IPv4, IPv6 and DTLS listeners receiving frames from one station at the same time */
+void listener(void) {
+	int i;
+
+	for (i = 0; i < TEST_FRAMES; i++) {
+		if (ratelimit::allow(2, 20, 10) == true)
+			allowed++;
+	}
+}
+
+int main(void) {
+	std::thread listeners[TEST_THREADS];
+	int i;
+
+	testKnown();
+	testUnknown();
+
+	/* No frames get lost or counted twice when the listeners share a bucket */
+	settings::ratelimit_frames = 1000;
+	settings::ratelimit_bytes = 0;
+	for (i = 0; i < TEST_THREADS; i++)
+		listeners[i] = std::thread(listener);
+	for (i = 0; i < TEST_THREADS; i++)
+		listeners[i].join();
+	CHECK(allowed >= 1000);
+	CHECK(allowed < 1100);
+	CHECK(allowed + ratelimit::dropped(2, 20) == TEST_THREADS * TEST_FRAMES);
+
+	return TEST_RESULT("ratelimit_test");
+}
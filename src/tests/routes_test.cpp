@@ -0,0 +1,184 @@
+/* routes_test.cpp
+ * Tests for the bridge routing table and forwarding frames to the next hop
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstring>			// memset(), memcmp()
+#include <arpa/inet.h>			// htonl(), ntohs()
+#include <netinet/in.h>			// struct sockaddr_in
+#include <sys/socket.h>			// socket(), bind(), recv()
+#include <unistd.h>			// close()
+
+#include "../aun.h"			// aun::rxHandler(), AUN_BRIDGED, AUN_HEADER_LENGTH
+#include "../bridge.h"			// bridge::dropped(), BRIDGE_AUN_RX
+#include "../broadcasts.h"		// broadcasts::relay(), broadcasts::suppressed(), FILESTORE_BROADCAST_MAX_HOPS
+#include "../routes.h"			// routes::*
+#include "../settings.h"		// settings::econet_network, settings::aun_network
+#include "../stations.h"		// stations::stations[][]
+#include "../workers.h"		// workers::current
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_AUN_NETWORK	5		// Our AUN network
+#define TEST_BRIDGE		200		// Station number of the bridge on our AUN network
+#define TEST_REMOTE		20		// Network behind the bridge
+
+using namespace std;
+
+
+
+/* Routes are learned from bridge messages, also from senders on network 0 */
+void testUpdate(void) {
+	routes::Route route;
+	uint8_t networks[] = {TEST_REMOTE, 21};
+	uint8_t local[] = {30};
+
+	routes::update(ROUTE_AUN, TEST_AUN_NETWORK, TEST_BRIDGE, 0x81, networks, sizeof(networks));
+	CHECK(routes::lookup(TEST_REMOTE, &route) == true);
+	CHECK((route.via == ROUTE_AUN) && (route.network == TEST_AUN_NETWORK) && (route.station == TEST_BRIDGE) && (route.hops == 2));
+	CHECK((routes::lookup(21, &route) == true) && (route.hops == 1));
+
+	/* Our own networks are never routed */
+	CHECK(routes::lookup(TEST_AUN_NETWORK, &route) == false);
+
+	/* A bridge on the local Econet which sends from network 0 */
+	routes::update(ROUTE_ECONET, 0, 254, 0x80, local, sizeof(local));
+	CHECK(routes::lookup(30, &route) == true);
+	CHECK((route.via == ROUTE_ECONET) && (route.network == settings::econet_network) && (route.station == 254));
+	CHECK(routes::lookup(0, &route) == false);
+
+	CHECK(routes::lookup(40, &route) == false);
+}
+
+/* A frame for a network behind an AUN bridge reaches the bridge with its Econet addresses */
+void testForward(void) {
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	econet::Frame frame;
+	uint8_t received[64];
+	struct timeval timeout;
+	ssize_t length;
+	int sock;
+
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	CHECK(sock != -1);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addrlen = sizeof(addr);
+	CHECK(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	CHECK(getsockname(sock, (struct sockaddr *) &addr, &addrlen) == 0);
+	timeout.tv_sec = 2;
+	timeout.tv_usec = 0;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	stations::stations[TEST_AUN_NETWORK][TEST_BRIDGE].type = STATION_IPV4;
+	stations::stations[TEST_AUN_NETWORK][TEST_BRIDGE].ipv4 = addr.sin_addr;
+	stations::stations[TEST_AUN_NETWORK][TEST_BRIDGE].port = ntohs(addr.sin_port);
+
+	memset(&frame, 0, sizeof(frame));
+	frame.econet.dst_network = TEST_REMOTE;
+	frame.econet.dst_station = 7;
+	frame.econet.src_network = 1;
+	frame.econet.src_station = 9;
+	frame.rawdata[4] = 0x80;
+	frame.rawdata[5] = 0x99;
+	memcpy(&frame.rawdata[6], "PAYLOAD", 7);
+
+	CHECK(routes::forward(&frame, 13, ROUTE_ECONET) == true);
+	length = recv(sock, received, sizeof(received), 0);
+	CHECK(length == AUN_HEADER_LENGTH + 4 + 7);
+	CHECK((received[0] == AUN_BRIDGED) && (received[1] == 0x99) && (received[2] == 0x00));
+	CHECK(memcmp(&received[AUN_HEADER_LENGTH], frame.rawdata, 4) == 0);
+	CHECK(memcmp(&received[AUN_HEADER_LENGTH + 4], "PAYLOAD", 7) == 0);
+
+	/* Frames aren't sent back to the interface they came from */
+	CHECK(routes::forward(&frame, 13, ROUTE_AUN) == false);
+	CHECK(routes::unroutable() == 1);
+	CHECK(routes::forwarded() == 1);
+
+	stations::stations[TEST_AUN_NETWORK][TEST_BRIDGE].type = STATION_UNUSED;
+	close(sock);
+}
+
+/* Bridged frames are only taken from the bridge to their source network */
+void testTrusted(void) {
+	econet::Frame rx_data, tx_data;
+	bool sendAck;
+
+	CHECK(routes::trusted(TEST_REMOTE, ROUTE_AUN, TEST_AUN_NETWORK, TEST_BRIDGE) == true);
+	CHECK(routes::trusted(TEST_REMOTE, ROUTE_AUN, 0, TEST_BRIDGE) == true);
+	CHECK(routes::trusted(TEST_REMOTE, ROUTE_AUN, TEST_AUN_NETWORK, TEST_BRIDGE + 1) == false);
+	CHECK(routes::trusted(TEST_REMOTE, ROUTE_TRUNK, TEST_AUN_NETWORK, TEST_BRIDGE) == false);
+	CHECK(routes::trusted(40, ROUTE_AUN, TEST_AUN_NETWORK, TEST_BRIDGE) == false);
+	CHECK(routes::trusted(0, ROUTE_AUN, TEST_AUN_NETWORK, TEST_BRIDGE) == false);
+	CHECK(routes::rejected() == 4);
+
+	/* A bridged frame from an unknown source claiming to come from behind the bridge is dropped */
+	memset(&rx_data, 0, sizeof(rx_data));
+	rx_data.aun.type = AUN_BRIDGED;
+	rx_data.aun.port = 0x99;
+	rx_data.aun.data[0] = 21;
+	rx_data.aun.data[1] = 7;
+	rx_data.aun.data[2] = TEST_REMOTE;
+	rx_data.aun.data[3] = 9;
+	memcpy(&rx_data.aun.data[4], "PAYLOAD", 7);
+	workers::current.network = 0;
+	workers::current.station = 0;
+	CHECK(aun::rxHandler(&rx_data, AUN_HEADER_LENGTH + 4 + 7, &tx_data, sizeof(tx_data), &sendAck) == 0);
+	CHECK(routes::rejected() == 5);
+	CHECK(rx_data.aun.data[2] == TEST_REMOTE);
+
+	/* And so is one from another station on the bridge's network */
+	workers::current.network = TEST_AUN_NETWORK;
+	workers::current.station = 100;
+	CHECK(aun::rxHandler(&rx_data, AUN_HEADER_LENGTH + 4 + 7, &tx_data, sizeof(tx_data), &sendAck) == 0);
+	CHECK(routes::rejected() == 6);
+	CHECK(routes::forwarded() == 1);
+
+	/* From the bridge it's passed on to the forwarding stage, which isn't running here, so it's dropped there */
+	workers::current.station = TEST_BRIDGE;
+	CHECK(aun::rxHandler(&rx_data, AUN_HEADER_LENGTH + 4 + 7, &tx_data, sizeof(tx_data), &sendAck) == 0);
+	CHECK(routes::rejected() == 6);
+	CHECK(bridge::dropped(BRIDGE_AUN_RX) == 1);
+}
+
+/* Every bridge which passed an announcement on added its network to the end, and broadcasts from too far away aren't relayed */
+void testHops(void) {
+	routes::Route route;
+	econet::Frame frame;
+	uint8_t networks[] = {50, 51, 52, 53, 54};
+	uint32_t suppressed;
+
+	routes::update(ROUTE_AUN, TEST_AUN_NETWORK, TEST_BRIDGE, 0x80, networks, sizeof(networks));
+	CHECK((routes::lookup(54, &route) == true) && (route.hops == 1));
+	CHECK((routes::lookup(52, &route) == true) && (route.hops == 3));
+	CHECK((routes::lookup(50, &route) == true) && (route.hops == 5));
+
+	memset(&frame, 0, sizeof(frame));
+	frame.econet.dst_network = 0xFF;
+	frame.econet.dst_station = 0xFF;
+	frame.econet.src_station = 9;
+	frame.rawdata[4] = 0x80;
+	frame.rawdata[5] = 0x99;
+	suppressed = broadcasts::suppressed();
+
+	frame.econet.src_network = 50;
+	CHECK(broadcasts::relay(&frame, 6, ROUTE_AUN) == false);
+	CHECK(broadcasts::suppressed() == suppressed + 1);
+
+	frame.econet.src_network = 50 + FILESTORE_BROADCAST_MAX_HOPS - 1;
+	CHECK(broadcasts::relay(&frame, 6, ROUTE_AUN) == true);
+	CHECK(broadcasts::suppressed() == suppressed + 1);
+}
+
+int main(void) {
+	settings::aun_network = TEST_AUN_NETWORK;
+
+	testUpdate();
+	testForward();
+	testTrusted();
+	testHops();
+
+	return TEST_RESULT("routes_test");
+}
@@ -0,0 +1,135 @@
+/* scheduler_test.cpp
+ * Tests for the per-station fair queueing of received frames
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstring>			// memset()
+
+#include "../aun.h"			// AUN_UNICAST, AUN_IMMEDIATE
+#include "../scheduler.h"		// scheduler::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+econet::Frame	frames[FILESTORE_WORKER_QUEUE_SIZE];
+unsigned int	used = 0;
+scheduler::Queue	queue;
+
+/* Queue a frame of a station; a bulk frame is a Load request, a priority frame a small command. The sequence number identifies the frame */
+int add(uint8_t station, bool bulk, uint32_t sequence) {
+	econet::Frame *frame = &frames[used++ % FILESTORE_WORKER_QUEUE_SIZE];
+	Job job;
+
+	memset(frame, 0, sizeof(*frame));
+	frame->aun.type = AUN_UNICAST;
+	frame->aun.port = 0x99;
+	frame->aun.sequence = sequence;
+	frame->aun.function = (bulk == true) ? 0x02 : 0x03;
+
+	memset(&job, 0, sizeof(job));
+	job.frame = frame;
+	job.length = 16;
+	job.network = 1;
+	job.station = station;
+	return scheduler::enqueue(&queue, &job);
+}
+
+/* Sequence number of the next frame the scheduler hands out, or 0 if it is empty */
+uint32_t next(void) {
+	Job job;
+
+	if (scheduler::dequeue(&queue, &job) == false)
+		return 0;
+	return job.frame->aun.sequence;
+}
+
+/* The frames of one station come out in the order they went in, whatever their class */
+void testOrder(void) {
+	uint32_t i;
+
+	scheduler::init(&queue);
+	add(1, false, 1);
+	add(1, true, 2);
+	add(1, false, 3);
+	add(1, true, 4);
+	add(1, true, 5);
+	add(1, false, 6);
+	for (i = 1; i <= 6; i++)
+		CHECK(next() == i);
+	CHECK(next() == 0);
+	CHECK(queue.count == 0);
+}
+
+/* A station with a small request doesn't have to wait for another station's bulk transfers */
+void testPriority(void) {
+	uint32_t i;
+
+	scheduler::init(&queue);
+	for (i = 1; i <= 10; i++)
+		add(1, true, i);
+	add(2, false, 100);
+	CHECK(next() == 100);
+	for (i = 1; i <= 10; i++)
+		CHECK(next() == i);
+}
+
+/* Bulk frames still get their turn while priority frames keep coming */
+void testFloor(void) {
+	unsigned int i, served;
+	uint32_t sequence;
+
+	scheduler::init(&queue);
+	add(1, true, 1000);
+	for (i = 0; i < 4 * FILESTORE_SCHEDULER_BULK_FLOOR; i++)
+		CHECK(add(2 + (i % 4), false, i + 1) == SCHEDULER_QUEUED);
+
+	for (served = 0; (sequence = next()) != 0; served++) {
+		if (sequence == 1000)
+			break;
+	}
+	CHECK(sequence == 1000);
+	CHECK(served == FILESTORE_SCHEDULER_BULK_FLOOR);
+}
+
+/* Stations with bulk transfers take turns */
+void testRoundRobin(void) {
+	scheduler::init(&queue);
+	add(1, true, 1);
+	add(1, true, 2);
+	add(1, true, 3);
+	add(2, true, 11);
+	add(2, true, 12);
+	add(2, true, 13);
+
+	CHECK(next() == 1);
+	CHECK(next() == 11);
+	CHECK(next() == 2);
+	CHECK(next() == 12);
+	CHECK(next() == 3);
+	CHECK(next() == 13);
+	CHECK(next() == 0);
+}
+
+/* A station can't fill the whole queue */
+void testLimits(void) {
+	unsigned int i;
+
+	scheduler::init(&queue);
+	for (i = 0; i < FILESTORE_SCHEDULER_STATION_LIMIT; i++)
+		CHECK(add(1, false, i + 1) == SCHEDULER_QUEUED);
+	CHECK(add(1, false, 999) == SCHEDULER_STATION_FULL);
+	CHECK(add(2, false, 1) == SCHEDULER_QUEUED);
+}
+
+int main(void) {
+	testOrder();
+	testPriority();
+	testFloor();
+	testRoundRobin();
+	testLimits();
+
+	return TEST_RESULT("scheduler_test");
+}
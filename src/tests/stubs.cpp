@@ -0,0 +1,29 @@
+/* stubs.cpp
+ * Globals of main.cpp which the other modules use, so the test programs can be linked without main()
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>			// std::atomic
+#include <cstdio>			// FILE
+
+#include "../main.h"			// Disc, ECONET_MAX_DISCDRIVES
+#include "test.h"			// test_failures
+
+using namespace std;
+
+
+
+std::atomic<bool>	bye(false);
+FILE			*fp_volume;
+Disc			*discs[ECONET_MAX_DISCDRIVES];
+int			test_failures = 0;
+
+char **tokenizeCommandLine(char *commandline) {
+	(void) commandline;
+	return NULL;
+}
+
+void executeCommand(char **tokens) {
+	(void) tokens;
+}
@@ -0,0 +1,28 @@
+/* test.h
+ * Helpers shared by the test programs
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_TEST_HEADER
+#define ECONET_TEST_HEADER
+
+#include <cstdio>			// fprintf()
+
+extern int	test_failures;		// Number of failed checks in this test program
+
+/* Report a failed check, but carry on with the rest of the test */
+#define CHECK(expr) \
+	do { \
+		if (!(expr)) { \
+			fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr); \
+			test_failures++; \
+		} \
+	} while (0)
+
+/* Print the result of a test program and return its exit code */
+#define TEST_RESULT(name) \
+	(printf("%s: %s\n", name, (test_failures == 0) ? "passed" : "FAILED"), (test_failures == 0) ? 0 : 1)
+
+#endif
+
@@ -0,0 +1,149 @@
+/* trunk_test.cpp
+ * Tests for reassembling segmented trunk frames and asking for the missing segments
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstring>			// memset()
+#include <arpa/inet.h>			// inet_pton(), ntohs()
+#include <netinet/in.h>			// struct sockaddr_in
+#include <sys/socket.h>			// socket(), bind(), sendto(), recv()
+#include <unistd.h>			// close(), usleep()
+
+#include "../settings.h"		// settings::trunk_port
+#include "../trunk.h"			// trunk::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_PEER		"127.0.0.2"	// Address of the other end of the trunk, played by this test
+#define TEST_SEGSIZE		10		// Size of the segments this test sends
+
+using namespace std;
+
+
+
+int			sock;			// Socket of the other end of the trunk
+struct sockaddr_in	trunkaddr;		// Address of the trunk
+
+/* Send one segment of a record of count segments */
+void sendSegment(uint32_t id, unsigned int index, unsigned int count) {
+	uint8_t datagram[FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_SEGMENT_SIZE + TEST_SEGSIZE];
+
+	datagram[0] = FILESTORE_TRUNK_MAGIC[0];
+	datagram[1] = FILESTORE_TRUNK_MAGIC[1];
+	datagram[2] = FILESTORE_TRUNK_VERSION;
+	datagram[3] = TRUNK_FLAG_SEGMENT;
+	datagram[4] = (id & 0x000000FF);
+	datagram[5] = (id & 0x0000FF00) >> 8;
+	datagram[6] = (id & 0x00FF0000) >> 16;
+	datagram[7] = (id & 0xFF000000) >> 24;
+	datagram[8] = index;
+	datagram[9] = count;
+	datagram[10] = TEST_SEGSIZE;
+	datagram[11] = 0;
+
+	/* The record is one frame of all the segments */
+	memset(&datagram[12], index, TEST_SEGSIZE);
+	if (index == 0) {
+		datagram[12] = ((count * TEST_SEGSIZE) - FILESTORE_TRUNK_RECORD_SIZE) & 0xFF;
+		datagram[13] = ((count * TEST_SEGSIZE) - FILESTORE_TRUNK_RECORD_SIZE) >> 8;
+		datagram[14] = 0;
+	}
+	CHECK(sendto(sock, datagram, sizeof(datagram), 0, (struct sockaddr *) &trunkaddr, sizeof(trunkaddr)) == sizeof(datagram));
+}
+
+/* Wait for the next NACK for a record; returns the bitmap of missing segments, or 0 if none came */
+uint64_t receiveNack(uint32_t id) {
+	uint8_t datagram[2048];
+	uint64_t missing;
+	ssize_t length;
+	int i;
+
+	while ((length = recv(sock, datagram, sizeof(datagram), 0)) > 0) {
+		if ((length != FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_NACK_SIZE) || ((datagram[3] & TRUNK_FLAG_NACK) == 0))
+			continue;
+		if ((datagram[4] | (datagram[5] << 8) | (datagram[6] << 16) | ((uint32_t) datagram[7] << 24)) != id)
+			continue;
+		missing = 0;
+		for (i = 7; i >= 0; i--)
+			missing = (missing << 8) | datagram[8 + i];
+		return missing;
+	}
+	return 0;
+}
+
+/* Only the missing segments are asked for, and the record is complete once they arrive */
+void testNack(void) {
+	trunk::Stats stats;
+	unsigned int i;
+
+	/* Segments 1 and 3 of 5 get lost */
+	sendSegment(100, 0, 5);
+	sendSegment(100, 2, 5);
+	sendSegment(100, 4, 5);
+	CHECK(receiveNack(100) == ((1ull << 1) | (1ull << 3)));
+	sendSegment(100, 3, 5);
+	CHECK(receiveNack(100) == (1ull << 1));
+	sendSegment(100, 1, 5);
+	usleep(50000);
+	trunk::getStats(&stats);
+	CHECK(stats.rx_reassembled == 1);
+
+	/* The last of FILESTORE_TRUNK_MAX_SEGMENTS segments is the top bit of the bitmap */
+	for (i = 0; i < FILESTORE_TRUNK_MAX_SEGMENTS - 1; i++)
+		sendSegment(101, i, FILESTORE_TRUNK_MAX_SEGMENTS);
+	CHECK(receiveNack(101) == (1ull << 63));
+	sendSegment(101, FILESTORE_TRUNK_MAX_SEGMENTS - 1, FILESTORE_TRUNK_MAX_SEGMENTS);
+	usleep(50000);
+	trunk::getStats(&stats);
+	CHECK(stats.rx_reassembled == 2);
+}
+
+/* A record is asked for FILESTORE_TRUNK_NACK_RETRIES times, and then dropped */
+void testExpire(void) {
+	trunk::Stats stats;
+	int nacks;
+
+	sendSegment(102, 0, 2);
+	for (nacks = 0; receiveNack(102) == 2; nacks++)
+		;
+	CHECK(nacks == FILESTORE_TRUNK_NACK_RETRIES);
+	usleep(FILESTORE_TRUNK_REASSEMBLY_TIMEOUT);
+	trunk::getStats(&stats);
+	CHECK(stats.rx_expired == 1);
+}
+
+int main(void) {
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	struct timeval timeout;
+	int reuse;
+
+	/* Play the other end of the trunk on TEST_PEER, on the same port as the trunk */
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	CHECK(sock != -1);
+	reuse = 1;
+	setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	inet_pton(AF_INET, TEST_PEER, &addr.sin_addr);
+	addrlen = sizeof(addr);
+	CHECK(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	CHECK(getsockname(sock, (struct sockaddr *) &addr, &addrlen) == 0);
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 500000;
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	settings::trunk_port = ntohs(addr.sin_port);
+	memset(&trunkaddr, 0, sizeof(trunkaddr));
+	trunkaddr.sin_family = AF_INET;
+	trunkaddr.sin_port = addr.sin_port;
+	inet_pton(AF_INET, "127.0.0.1", &trunkaddr.sin_addr);
+
+	CHECK(trunk::start(TEST_PEER) == 0);
+	testNack();
+	testExpire();
+	trunk::stop();
+
+	close(sock);
+	return TEST_RESULT("trunk_test");
+}
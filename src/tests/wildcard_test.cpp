@@ -0,0 +1,97 @@
+/* wildcard_test.cpp
+ * Tests for matching Acorn names against masks with # and * wildcards
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cctype>			// toupper()
+#include <cstring>			// memset(), strcmp(), strlcpy()
+
+#include "../fsdir.h"			// fsdir::init(), fsdir::add(), fsdir::filter(), fsdir::release()
+#include "../wildcard.h"		// wildcard::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+using namespace std;
+
+
+
+const char	*masks[] = {"*", "**", "FRED", "fred", "F#ED", "F*", "*D", "*R*", "F*D", "F*R*D", "#*#", "##", "A*A", "*ED*ED", "F#*#D", "*#R", "$.FRED", NULL};
+const char	*names[] = {"FRED", "fred", "FREDRED", "FRD", "F", "D", "ED", "AA", "A", "ABA", "EDED", "BREAD", "FFRED", "FRED2", "Fr#d", NULL};
+
+/* Straightforward backtracking matcher, to compare the compiled one with */
+bool reference(const char *mask, const char *name) {
+	if (*mask == '\0')
+		return (*name == '\0');
+	if (*mask == '*')
+		return (reference(mask + 1, name) == true) || ((*name != '\0') && (reference(mask, name + 1) == true));
+	if (*name == '\0')
+		return false;
+	if ((*mask != '#') && (toupper((unsigned char) *mask) != toupper((unsigned char) *name)))
+		return false;
+	return reference(mask + 1, name + 1);
+}
+
+/* Every mask matches the same names as the backtracking matcher; an empty mask matches everything, see testCompile() */
+void testMatch(void) {
+	wildcard::Matcher matcher;
+	int i, j;
+
+	for (i = 0; masks[i] != NULL; i++) {
+		CHECK(wildcard::compile(masks[i], &matcher) == true);
+		for (j = 0; names[j] != NULL; j++)
+			CHECK(wildcard::match(&matcher, names[j]) == reference(masks[i], names[j]));
+	}
+}
+
+/* Masks are compiled to the cheapest kind of matching */
+void testCompile(void) {
+	wildcard::Matcher matcher;
+	char mask[FILESTORE_WILDCARD_LEN + 1];
+
+	CHECK((wildcard::compile("", &matcher) == true) && (matcher.kind == WILDCARD_ALL) && (wildcard::match(&matcher, "FRED") == true));
+	CHECK((wildcard::compile("***", &matcher) == true) && (matcher.kind == WILDCARD_ALL));
+	CHECK((wildcard::compile("FRED", &matcher) == true) && (matcher.kind == WILDCARD_LITERAL));
+	CHECK((wildcard::compile("F#ED", &matcher) == true) && (matcher.kind == WILDCARD_PATTERN));
+
+	/* A mask ends at a CR, as in a NetFS command line */
+	CHECK((wildcard::compile("FRED\rJUNK", &matcher) == true) && (matcher.kind == WILDCARD_LITERAL) && (wildcard::match(&matcher, "FRED") == true));
+
+	/* Masks which are too long or have too many *'s are refused */
+	memset(mask, 'A', FILESTORE_WILDCARD_LEN);
+	mask[FILESTORE_WILDCARD_LEN] = '\0';
+	CHECK(wildcard::compile(mask, &matcher) == false);
+	CHECK(wildcard::compile("A*B*C*D*E*F*G*H*I*J*K*L*M*N*O*P*Q", &matcher) == false);
+}
+
+/* Filtering a catalogue keeps the matching entries, in order */
+void testFilter(void) {
+	wildcard::Matcher matcher;
+	FSDirectory dir;
+	FSObject obj;
+	int i;
+
+	fsdir::init(&dir);
+	memset(&obj, 0, sizeof(obj));
+	for (i = 0; names[i] != NULL; i++) {
+		strlcpy(obj.name, names[i], sizeof(obj.name));
+		obj.loadaddr = i;
+		fsdir::add(&dir, &obj);
+	}
+
+	CHECK(wildcard::compile("F*D", &matcher) == true);
+	fsdir::filter(&dir, &matcher);
+	CHECK(dir.count == 6);
+	CHECK((strcmp(dir.names[0], "FRED") == 0) && (dir.loadaddrs[0] == 0));
+	CHECK((strcmp(dir.names[2], "FREDRED") == 0) && (dir.loadaddrs[2] == 2));
+	CHECK((strcmp(dir.names[4], "FFRED") == 0) && (dir.loadaddrs[4] == 12));
+	CHECK((strcmp(dir.names[5], "Fr#d") == 0) && (dir.loadaddrs[5] == 14));
+	fsdir::release(&dir);
+}
+
+int main(void) {
+	testMatch();
+	testCompile();
+	testFilter();
+
+	return TEST_RESULT("wildcard_test");
+}
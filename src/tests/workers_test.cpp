@@ -0,0 +1,259 @@
+/* workers_test.cpp
+ * Stress test for the worker threads: run with ./configure --enable-tsan to check for data races.
+ * It also times the workers with 1, 2, 4 and as many threads as there are CPUs, and reports frames/s.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>			// std::atomic
+#include <chrono>			// std::chrono::steady_clock
+#include <cstdio>			// printf()
+#include <cstring>			// memset()
+#include <thread>			// std::thread, std::this_thread, std::thread::hardware_concurrency()
+#include <unistd.h>			// close(), usleep()
+#include <arpa/inet.h>			// htonl()
+#include <netinet/in.h>			// struct sockaddr_in
+
+#include "../aun.h"			// AUN_UNICAST
+#include "../econet.h"			// econet::Frame, econet::protohandlers[]
+#include "../workers.h"			// workers::*
+#include "test.h"			// CHECK(), TEST_RESULT()
+
+#define TEST_PORT		0xA0		// Port which records the order in which frames are processed
+#define TEST_ECHO_PORT		0xA1		// Port which replies with the received data
+#define TEST_PRODUCERS		4		// Number of threads which dispatch frames, like the listener threads
+#define TEST_STATIONS		64		// Number of stations per producer
+#define TEST_FRAMES		200		// Number of frames per station
+#define TEST_CALLS		2000		// Number of frames handed over with workers::call()
+#define TEST_TIMED_PORT		0xA2		// Port which only counts frames, for the timed runs
+#define TEST_TIMED_FRAMES	20000		// Number of frames per producer in each timed run
+#define TEST_TIMED_SLOWDOWN	3		// More workers may be at most this many times slower than one worker, also with more workers than CPUs
+
+using namespace std;
+
+
+
+/* Per-station state; only the worker which owns a station may touch its entry */
+typedef struct {
+	uint32_t	last_sequence;
+	std::thread::id	owner;
+	bool		seen;
+} StationState;
+
+StationState		state[256][256];
+std::atomic<uint32_t>	processed(0);
+std::atomic<uint32_t>	misordered(0);
+std::atomic<uint32_t>	wrongworker(0);
+std::atomic<uint32_t>	counted(0);
+
+int recordHandler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length) {
+	StationState *s = &state[workers::current.network][workers::current.station];
+
+	(void) rx_length;
+	(void) tx_data;
+	(void) tx_length;
+
+	if (s->seen == false) {
+		s->seen = true;
+		s->owner = std::this_thread::get_id();
+	} else {
+		if (s->owner != std::this_thread::get_id())
+			wrongworker++;
+		if (rx_data->aun.sequence != s->last_sequence + 1)
+			misordered++;
+	}
+	s->last_sequence = rx_data->aun.sequence;
+	processed++;
+	return 0;
+}
+
+int echoHandler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length) {
+	(void) tx_length;
+
+	memcpy(tx_data->aun.data, rx_data->aun.data, rx_length - 8);
+	return rx_length - 8;
+}
+
+int countHandler(const econet::Frame *rx_data, size_t rx_length, econet::Frame *tx_data, size_t tx_length) {
+	(void) rx_data;
+	(void) rx_length;
+	(void) tx_data;
+	(void) tx_length;
+
+	counted++;
+	return 0;
+}
+
+/* Dispatch all frames of the stations owned by one producer, interleaving the stations */
+void producer(int id, int sock, const struct sockaddr_in *addr) {
+	econet::Frame *frame;
+	Job job;
+	int f, s;
+
+	for (f = 0; f < TEST_FRAMES; f++) {
+		for (s = 0; s < TEST_STATIONS; s++) {
+			frame = new econet::Frame;
+			memset(frame, 0, sizeof(econet::Frame));
+			frame->aun.type = AUN_UNICAST;
+			frame->aun.port = TEST_PORT;
+			frame->aun.sequence = f + 1;
+
+			memcpy(&job.addr, addr, sizeof(*addr));
+			job.addrlen = sizeof(*addr);
+			job.network = id + 1;
+			job.station = s + 1;
+			job.frame = frame;
+			job.length = (f % 3 == 0) ? 8 + 200 : 8 + 4;		// Mix bulk and priority frames of the same station
+			job.sock = sock;
+			job.reply = NULL;
+
+			/* A full queue refuses the frame; offer it again so each station's sequence stays complete */
+			while (workers::dispatch(&job) == false)
+				std::this_thread::yield();
+		}
+	}
+}
+
+/* Hand frames over with workers::call(), like the DTLS listeners do */
+void caller(int *failures) {
+	econet::Frame rx_data, tx_data;
+	Job job;
+	Reply reply;
+	int i;
+
+	for (i = 0; i < TEST_CALLS; i++) {
+		memset(&rx_data, 0, sizeof(rx_data));
+		rx_data.aun.type = AUN_UNICAST;
+		rx_data.aun.port = TEST_ECHO_PORT;
+		rx_data.aun.data[0] = i & 0xFF;
+
+		memset(&job.addr, 0, sizeof(job.addr));
+		job.addrlen = 0;
+		job.network = 0;
+		job.station = 0;
+		job.frame = &rx_data;
+		job.length = 8 + 1;
+		job.sock = -1;
+		reply.tx_data = &tx_data;
+
+		while (workers::call(&job, &reply) == false)
+			std::this_thread::yield();
+		if ((reply.sendAck == false) || (reply.tx_length != 8 + 1) || (tx_data.aun.data[0] != (i & 0xFF)))
+			(*failures)++;
+	}
+}
+
+/* Dispatch frames for the timed runs, round-robin over the stations of one producer */
+void timedProducer(int id, int sock, const struct sockaddr_in *addr) {
+	econet::Frame *frame;
+	Job job;
+	int f;
+
+	for (f = 0; f < TEST_TIMED_FRAMES; f++) {
+		frame = new econet::Frame;
+		memset(frame, 0, sizeof(econet::Frame));
+		frame->aun.type = AUN_UNICAST;
+		frame->aun.port = TEST_TIMED_PORT;
+
+		memcpy(&job.addr, addr, sizeof(*addr));
+		job.addrlen = sizeof(*addr);
+		job.network = id + 1;
+		job.station = (f % TEST_STATIONS) + 1;
+		job.frame = frame;
+		job.length = 8 + 4;
+		job.sock = sock;
+		job.reply = NULL;
+
+		while (workers::dispatch(&job) == false)
+			std::this_thread::yield();
+	}
+}
+
+/* Time TEST_PRODUCERS * TEST_TIMED_FRAMES frames through numworkers workers; returns frames/s */
+double timedRun(unsigned int numworkers, int sock, const struct sockaddr_in *addr) {
+	std::thread producers[TEST_PRODUCERS];
+	std::chrono::steady_clock::time_point begin;
+	std::chrono::duration<double> elapsed;
+	double rate;
+	int i, waited;
+
+	counted = 0;
+	workers::start(numworkers);
+	begin = std::chrono::steady_clock::now();
+	for (i = 0; i < TEST_PRODUCERS; i++)
+		producers[i] = std::thread(timedProducer, i, sock, addr);
+	for (i = 0; i < TEST_PRODUCERS; i++)
+		producers[i].join();
+	for (waited = 0; (counted < TEST_PRODUCERS * TEST_TIMED_FRAMES) && (waited < 100000); waited++)
+		usleep(100);
+	elapsed = std::chrono::steady_clock::now() - begin;
+	workers::stop();
+
+	CHECK(counted == TEST_PRODUCERS * TEST_TIMED_FRAMES);
+	rate = (double) counted / elapsed.count();
+	printf("%2u workers: %10.0f frames/s\n", numworkers, rate);
+	return rate;
+}
+
+/* Adding workers must never make the workers much slower than a single one */
+void testScaling(int sock, const struct sockaddr_in *addr) {
+	unsigned int counts[] = {1, 2, 4, 0};
+	double rate[4];
+	int runs, i;
+
+	/* The last run uses a worker per CPU, unless that's one of the runs already */
+	counts[3] = std::thread::hardware_concurrency();
+	if (counts[3] > FILESTORE_MAX_WORKERS)
+		counts[3] = FILESTORE_MAX_WORKERS;
+	runs = ((counts[3] == 0) || (counts[3] == 1) || (counts[3] == 2) || (counts[3] == 4)) ? 3 : 4;
+
+	for (i = 0; i < runs; i++)
+		rate[i] = timedRun(counts[i], sock, addr);
+	for (i = 1; i < runs; i++)
+		CHECK(rate[i] * TEST_TIMED_SLOWDOWN >= rate[0]);
+}
+
+int main(void) {
+	std::thread producers[TEST_PRODUCERS], callthread;
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	int sock, i, callfailures, waited;
+
+	/* ACKs are sent to a socket of our own, which nobody reads */
+	sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	CHECK(sock >= 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addrlen = sizeof(addr);
+	CHECK(bind(sock, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+	CHECK(getsockname(sock, (struct sockaddr *) &addr, &addrlen) == 0);
+
+	econet::protohandlers[TEST_PORT] = recordHandler;
+	econet::protohandlers[TEST_ECHO_PORT] = echoHandler;
+	workers::start(4);
+
+	callfailures = 0;
+	for (i = 0; i < TEST_PRODUCERS; i++)
+		producers[i] = std::thread(producer, i, sock, &addr);
+	callthread = std::thread(caller, &callfailures);
+	for (i = 0; i < TEST_PRODUCERS; i++)
+		producers[i].join();
+	callthread.join();
+
+	/* Give the workers up to 10 seconds to process the queued frames */
+	for (waited = 0; (processed < TEST_PRODUCERS * TEST_STATIONS * TEST_FRAMES) && (waited < 1000); waited++)
+		usleep(10000);
+	workers::stop();
+
+	CHECK(processed == TEST_PRODUCERS * TEST_STATIONS * TEST_FRAMES);
+	CHECK(misordered == 0);
+	CHECK(wrongworker == 0);
+	CHECK(callfailures == 0);
+
+	econet::protohandlers[TEST_TIMED_PORT] = countHandler;
+	testScaling(sock, &addr);
+
+	close(sock);
+	return TEST_RESULT("workers_test");
+}
@@ -0,0 +1,900 @@
+/* trunk.cpp
+ * Bridge-to-bridge trunk which carries the frames of many stations over one UDP association
+ *
+ * Two FileStore bridges can be linked by a trunk, for example over a WAN. All
+ * frames which have to cross the trunk, from any station, share one
+ * persistent UDP association between the two bridges. Small frames are
+ * coalesced: a frame is held for at most settings::trunk_delay microseconds
+ * (or until the datagram is full), so frames sent in quick succession cross
+ * the trunk as one datagram.
+ *
+ * A trunk datagram starts with a 4 byte header (magic "ET", version and
+ * flags), followed by one or more records. Every record is a 2 byte frame
+ * length (little-endian) and a flags byte, followed by a complete Econet
+ * frame, including its destination and source addresses.
+ *
+ * Frames of at least settings::trunk_threshold bytes are compressed with
+ * zlib, but only if the other bridge has told us it can decompress them
+ * (TRUNK_FLAG_COMPRESSION in the header of every datagram it sends) and only
+ * if the compressed frame is actually smaller. A compressed record starts
+ * with the 2 byte length of the original frame.
+ *
+ * A record which doesn't fit in one datagram isn't left to IP fragmentation,
+ * where one lost fragment loses the whole frame. Instead it is split into
+ * segments which are sized to the path MTU, and every segment is sent in a
+ * datagram of its own (TRUNK_FLAG_SEGMENT). The receiving end reassembles
+ * the record in one of FILESTORE_TRUNK_REASSEMBLY buffers; when segments stop
+ * arriving before the record is complete, it sends a bitmap of the missing
+ * segments (TRUNK_FLAG_NACK) and only those are sent again.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <atomic>		// std::atomic
+#include <chrono>		// std::chrono::microseconds
+#include <condition_variable>	// std::condition_variable
+#include <cerrno>		// errno, EMSGSIZE
+#include <cstdio>		// printf(), fprintf()
+#include <cstring>		// memcpy(), memcmp()
+#include <ctime>		// clock_gettime()
+#include <mutex>		// std::mutex, std::unique_lock
+#include <thread>		// std::thread
+#include <unistd.h>		// close()
+#include <arpa/inet.h>		// inet_pton()
+#include <netinet/in.h>		// IP_MTU, IP_MTU_DISCOVER, IPV6_MTU, IPV6_MTU_DISCOVER
+#include <sys/socket.h>		// socket(), bind(), connect(), sendto(), recvfrom(), getsockopt()
+#include <sys/uio.h>		// struct iovec
+
+#include "trunk.h"		// Header file for this code
+#include "aun.h"		// aun::transmitTo()
+#include "bridge.h"		// bridge::acquire(), bridge::submit(), bridge::drop()
+#include "broadcasts.h"		// broadcasts::relay()
+#include "routes.h"		// routes::update(), routes::forward()
+#include "settings.h"		// settings::trunk_port, settings::trunk_delay, settings::trunk_compression, settings::trunk_threshold, settings::trunk_segmentation
+#include "config.h"		// FILESTORE_HAS_ZLIB
+#if (FILESTORE_HAS_ZLIB == 1)
+#include <zlib.h>		// compress2(), uncompress()
+#endif
+
+using namespace std;
+
+
+
+namespace trunk {
+	/* A recently segmented record, kept to resend lost segments */
+	typedef struct {
+		uint32_t	id;			// Frame ID, or 0 if unused
+		uint8_t		count;			// Number of segments
+		uint16_t	segsize;		// Size of every segment except the last one
+		size_t		length;			// Length of the record
+		uint8_t		data[FILESTORE_TRUNK_RECORD_SIZE + ECONET_MAX_FRAMESIZE];
+	} Outgoing;
+
+	/* A record which is being reassembled */
+	typedef struct {
+		bool		active;
+		uint32_t	id;			// Frame ID
+		uint8_t		count;			// Number of segments
+		uint16_t	segsize;		// Size of every segment except the last one
+		uint64_t	received;		// Bitmap of the segments which arrived
+		size_t		length;			// Length of the record, or 0 if the last segment hasn't arrived yet
+		uint64_t	started;		// When the first segment arrived (in microseconds)
+		uint64_t	lastseen;		// When the last segment arrived, or the missing ones were asked for
+		unsigned int	nacks;			// Number of times the missing segments were asked for
+		uint8_t		data[FILESTORE_TRUNK_RECORD_SIZE + ECONET_MAX_FRAMESIZE];
+	} Reassembly;
+
+	int				sock = -1;		// Socket of the trunk association
+	struct sockaddr_storage		peer;			// Address of the bridge at the other end of the trunk
+	socklen_t			peerlen;
+	std::atomic<bool>		running(false);
+	std::thread			thread_rx;
+	std::thread			thread_tx;
+
+	std::mutex			tx_lock;		// Protects txbuf, txlen and deadline
+	std::condition_variable		tx_ready;		// Signalled when the first frame is added to an empty datagram
+	uint8_t				txbuf[FILESTORE_TRUNK_MAX_DATAGRAM];
+	size_t				txlen = 0;		// Number of bytes in txbuf, or 0 if no frames are waiting
+	uint64_t			deadline;		// When the waiting frames must be sent (in microseconds)
+
+	std::atomic<bool>		peer_compression(false);	// The other end of the trunk can decompress frames
+	std::atomic<unsigned int>	pmtu(FILESTORE_TRUNK_MIN_MTU);	// Path MTU to the other end of the trunk
+
+	std::mutex			segments_lock;		// Protects outgoing[] and next_id
+	Outgoing			outgoing[FILESTORE_TRUNK_RETRANSMIT];
+	uint32_t			next_id = 1;
+	Reassembly			incoming[FILESTORE_TRUNK_REASSEMBLY];	// Only used by the receiver thread
+	uint32_t			completed[FILESTORE_TRUNK_REASSEMBLY];	// IDs of the last reassembled frames, to ignore late segments
+	unsigned int			completed_next = 0;
+
+	std::atomic<uint32_t>		tx_frames(0), tx_datagrams(0), rx_frames(0), rx_datagrams(0), rx_invalid(0), tx_uncompressed(0);
+	std::atomic<uint64_t>		tx_bytes(0), tx_compressed(0), compress_time(0), decompress_time(0);
+	std::atomic<uint32_t>		tx_segmented(0), tx_segments(0), tx_resent(0), rx_reassembled(0), rx_expired(0), rx_nacks(0);
+
+	/* Current time in microseconds */
+	uint64_t now(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+	/* CPU time used by the calling thread in microseconds */
+	uint64_t cpuTime(void) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+	}
+
+#if (FILESTORE_HAS_ZLIB == 1)
+	/* Compress a frame into packed; returns the length of the compressed record data, or 0 if it isn't worth it */
+	size_t compressFrame(const econet::Frame *frame, unsigned int size, uint8_t *packed, size_t packedsize) {
+		uLongf length;
+		uint64_t t;
+		int result;
+
+		if ((size <= 3) || (size > packedsize)) {
+			tx_uncompressed++;
+			return 0;
+		}
+
+		/* Only room for a compressed frame which is smaller than the original; zlib gives up when it doesn't fit */
+		length = size - 3;
+		t = cpuTime();
+		result = compress2(&packed[2], &length, frame->rawdata, size, Z_BEST_SPEED);
+		compress_time += cpuTime() - t;
+
+		if ((result != Z_OK) || (length + 2 >= size)) {
+			tx_uncompressed++;
+			return 0;
+		}
+
+		packed[0] = (size & 0x00FF);
+		packed[1] = (size & 0xFF00) >> 8;
+		tx_bytes += size;
+		tx_compressed += length + 2;
+		return length + 2;
+	}
+
+	/* Decompress the data of a compressed record into frame; returns the length of the frame, or 0 if the record is invalid */
+	unsigned int decompressFrame(const uint8_t *packed, size_t length, econet::Frame *frame) {
+		uLongf size = sizeof(frame->rawdata);
+		uint64_t t;
+		int result;
+
+		if (length < 2)
+			return 0;
+
+		t = cpuTime();
+		result = uncompress(frame->rawdata, &size, &packed[2], length - 2);
+		decompress_time += cpuTime() - t;
+
+		if ((result != Z_OK) || (size != (uLongf) (packed[0] | (packed[1] << 8))))
+			return 0;
+		return size;
+	}
+#else
+	/* Built without zlib: frames are never compressed */
+	size_t compressFrame(const econet::Frame *frame, unsigned int size, uint8_t *packed, size_t packedsize) {
+		(void) frame;
+		(void) size;
+		(void) packed;
+		(void) packedsize;
+		tx_uncompressed++;
+		return 0;
+	}
+
+	/* Built without zlib: compressed records can't be read */
+	unsigned int decompressFrame(const uint8_t *packed, size_t length, econet::Frame *frame) {
+		(void) packed;
+		(void) length;
+		(void) frame;
+		return 0;
+	}
+#endif
+
+	/* Write the header of a trunk datagram */
+	void writeHeader(uint8_t *header) {
+		header[0] = FILESTORE_TRUNK_MAGIC[0];
+		header[1] = FILESTORE_TRUNK_MAGIC[1];
+		header[2] = FILESTORE_TRUNK_VERSION;
+		header[3] = ((FILESTORE_HAS_ZLIB == 1) && (settings::trunk_compression == true)) ? TRUNK_FLAG_COMPRESSION : 0;
+	}
+
+	/* Ask the kernel for the current path MTU to the other end of the trunk */
+	void updateMTU(void) {
+		socklen_t len = sizeof(int);
+		int value, result;
+
+		if (peer.ss_family == AF_INET6)
+			result = getsockopt(sock, IPPROTO_IPV6, IPV6_MTU, &value, &len);
+		else
+			result = getsockopt(sock, IPPROTO_IP, IP_MTU, &value, &len);
+
+		if ((result == 0) && (value >= FILESTORE_TRUNK_MIN_MTU))
+			pmtu = value;
+	}
+
+	/* Maximum size of a trunk datagram which doesn't have to be fragmented */
+	size_t maxPayload(void) {
+		return pmtu - ((peer.ss_family == AF_INET6) ? 40 : 20) - 8;
+	}
+
+	/* Maximum size of a datagram with coalesced frames */
+	size_t maxDatagram(void) {
+		size_t payload = maxPayload();
+
+		return (payload < FILESTORE_TRUNK_MAX_DATAGRAM) ? payload : FILESTORE_TRUNK_MAX_DATAGRAM;
+	}
+
+	/* Bitmap of the first count segments */
+	uint64_t segmentMask(unsigned int count) {
+		return (count >= 64) ? ~0ull : ((1ull << count) - 1);
+	}
+
+	/* Send segment i of a segmented record; returns 0 or the errno of sendmsg() */
+	int sendSegment(const Outgoing *out, unsigned int i) {
+		uint8_t header[FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_SEGMENT_SIZE];
+		struct iovec iov[2];
+		struct msghdr msg;
+		size_t offset;
+
+		offset = i * out->segsize;
+		writeHeader(header);
+		header[3] |= TRUNK_FLAG_SEGMENT;
+		header[4] = (out->id & 0x000000FF);
+		header[5] = (out->id & 0x0000FF00) >> 8;
+		header[6] = (out->id & 0x00FF0000) >> 16;
+		header[7] = (out->id & 0xFF000000) >> 24;
+		header[8] = i;
+		header[9] = out->count;
+		header[10] = (out->segsize & 0x00FF);
+		header[11] = (out->segsize & 0xFF00) >> 8;
+		iov[0].iov_base	= header;
+		iov[0].iov_len	= sizeof(header);
+		iov[1].iov_base	= (void *) &out->data[offset];
+		iov[1].iov_len	= ((out->length - offset) < out->segsize) ? (out->length - offset) : out->segsize;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name	= &peer;
+		msg.msg_namelen	= peerlen;
+		msg.msg_iov	= iov;
+		msg.msg_iovlen	= 2;
+		if (sendmsg(sock, &msg, 0) == -1) {
+			if (errno != EMSGSIZE)
+				fprintf(stderr, "trunk::sendSegment: sendmsg() failed.\n");
+			return errno;
+		}
+		tx_segments++;
+		return 0;
+	}
+
+	/* Send a record which doesn't fit in one datagram in segments sized to the path MTU */
+	bool sendSegmented(const uint8_t *data, size_t length, uint8_t flags) {
+		std::lock_guard<std::mutex> lock(segments_lock);
+		unsigned int attempt, i;
+		Outgoing *out;
+
+		/* The trunk was closed after the frame was queued */
+		if (sock == -1)
+			return false;
+
+		for (attempt = 0; attempt < 2; attempt++) {
+			/* A new ID for every attempt, so segments of different sizes never get mixed up */
+			out = &outgoing[next_id % FILESTORE_TRUNK_RETRANSMIT];
+			out->id = next_id++;
+			if (next_id == 0)
+				next_id = 1;
+			out->data[0] = (length & 0x00FF);
+			out->data[1] = (length & 0xFF00) >> 8;
+			out->data[2] = flags;
+			memcpy(&out->data[FILESTORE_TRUNK_RECORD_SIZE], data, length);
+			out->length = FILESTORE_TRUNK_RECORD_SIZE + length;
+			out->segsize = maxPayload() - FILESTORE_TRUNK_HEADER_SIZE - FILESTORE_TRUNK_SEGMENT_SIZE;
+			out->count = (out->length + out->segsize - 1) / out->segsize;
+			if (out->count > FILESTORE_TRUNK_MAX_SEGMENTS) {
+				fprintf(stderr, "trunk::sendSegmented: frame of %zu bytes needs too many segments.\n", length);
+				out->id = 0;
+				return false;
+			}
+
+			for (i = 0; i < out->count; i++) {
+				if (sendSegment(out, i) == EMSGSIZE)
+					break;
+			}
+			if (i == out->count) {
+				tx_segmented++;
+				return true;
+			}
+
+			/* The path MTU went down while we were sending: resize the segments and try again */
+			updateMTU();
+		}
+		return false;
+	}
+
+	/* Send the segments the other end of the trunk asked for again */
+	void resend(uint32_t id, uint64_t missing) {
+		std::lock_guard<std::mutex> lock(segments_lock);
+		Outgoing *out = &outgoing[id % FILESTORE_TRUNK_RETRANSMIT];
+		unsigned int i;
+
+		if (out->id != id)
+			return;
+
+		for (i = 0; i < out->count; i++) {
+			if (missing & (1ull << i)) {
+				if (sendSegment(out, i) == 0)
+					tx_resent++;
+			}
+		}
+	}
+
+	/* Send one datagram with coalesced frames; returns 0 or the errno of sendto() */
+	int sendDatagram(const uint8_t *datagram, size_t length) {
+		if (sendto(sock, datagram, length, 0, (struct sockaddr *) &peer, peerlen) == -1) {
+			if (errno != EMSGSIZE)
+				fprintf(stderr, "trunk::flush: sendto() failed.\n");
+			return errno;
+		}
+		tx_datagrams++;
+		return 0;
+	}
+
+	/* Send the waiting frames; tx_lock must be held */
+	void flushLocked(void) {
+		uint8_t datagram[FILESTORE_TRUNK_MAX_DATAGRAM];
+		size_t offset, record, length;
+
+		if (txlen <= FILESTORE_TRUNK_HEADER_SIZE)
+			return;
+
+		if (sendDatagram(txbuf, txlen) != EMSGSIZE) {
+			txlen = 0;
+			return;
+		}
+
+		/* The path MTU went down after the frames were coalesced: pack them again in datagrams which fit */
+		updateMTU();
+		memcpy(datagram, txbuf, FILESTORE_TRUNK_HEADER_SIZE);
+		length = FILESTORE_TRUNK_HEADER_SIZE;
+		offset = FILESTORE_TRUNK_HEADER_SIZE;
+		while (offset + FILESTORE_TRUNK_RECORD_SIZE <= txlen) {
+			record = FILESTORE_TRUNK_RECORD_SIZE + (txbuf[offset] | (txbuf[offset + 1] << 8));
+
+			if ((length + record > maxDatagram()) && (length > FILESTORE_TRUNK_HEADER_SIZE)) {
+				sendDatagram(datagram, length);
+				length = FILESTORE_TRUNK_HEADER_SIZE;
+			}
+
+			/* A record which doesn't even fit on its own anymore is sent in segments */
+			if ((FILESTORE_TRUNK_HEADER_SIZE + record > maxDatagram()) && (settings::trunk_segmentation == true)) {
+				sendSegmented(&txbuf[offset + FILESTORE_TRUNK_RECORD_SIZE], record - FILESTORE_TRUNK_RECORD_SIZE, txbuf[offset + 2]);
+			} else {
+				memcpy(&datagram[length], &txbuf[offset], record);
+				length += record;
+			}
+			offset += record;
+		}
+		if (length > FILESTORE_TRUNK_HEADER_SIZE)
+			sendDatagram(datagram, length);
+		txlen = 0;
+	}
+
+	/* Send the waiting frames now */
+	void flush(void) {
+		std::lock_guard<std::mutex> lock(tx_lock);
+
+		flushLocked();
+	}
+
+	/* Queue a frame for the other end of the trunk */
+	bool send(const econet::Frame *frame, unsigned int size) {
+		static thread_local uint8_t packed[ECONET_MAX_FRAMESIZE];	// Too large for the stack of every station's worker
+		uint8_t header[FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_RECORD_SIZE];
+		const uint8_t *data;
+		struct iovec iov[2];
+		struct msghdr msg;
+		size_t length;
+		uint8_t flags;
+
+		if ((running == false) || (size == 0) || (size > ECONET_MAX_FRAMESIZE))
+			return false;
+
+		/* Compress the frame before taking the lock, so other stations don't have to wait for it */
+		data = frame->rawdata;
+		length = size;
+		flags = 0;
+		if ((FILESTORE_HAS_ZLIB == 1) && (settings::trunk_compression == true) && (peer_compression == true) && (size >= settings::trunk_threshold)) {
+			if ((length = compressFrame(frame, size, packed, sizeof(packed))) != 0) {
+				data = packed;
+				flags = TRUNK_RECORD_COMPRESSED;
+			} else {
+				length = size;
+			}
+		}
+
+		std::unique_lock<std::mutex> lock(tx_lock);
+
+		/* stop() closes the socket while holding tx_lock, so check again now we have it */
+		if (running == false)
+			return false;
+
+		/* A frame which doesn't fit in a datagram on its own is sent right away */
+		if (FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_RECORD_SIZE + length > maxDatagram()) {
+			flushLocked();
+
+			if (settings::trunk_segmentation == true) {
+				lock.unlock();
+				if (sendSegmented(data, length, flags) == false)
+					return false;
+				tx_frames++;
+				return true;
+			}
+
+			/* Without segmentation it is sent as one datagram, which IP may fragment */
+			writeHeader(header);
+			header[FILESTORE_TRUNK_HEADER_SIZE] = (length & 0x00FF);
+			header[FILESTORE_TRUNK_HEADER_SIZE + 1] = (length & 0xFF00) >> 8;
+			header[FILESTORE_TRUNK_HEADER_SIZE + 2] = flags;
+			iov[0].iov_base	= header;
+			iov[0].iov_len	= sizeof(header);
+			iov[1].iov_base	= (void *) data;
+			iov[1].iov_len	= length;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_name	= &peer;
+			msg.msg_namelen	= peerlen;
+			msg.msg_iov	= iov;
+			msg.msg_iovlen	= 2;
+			if (sendmsg(sock, &msg, 0) == -1) {
+				fprintf(stderr, "trunk::send: sendmsg() failed.\n");
+				return false;
+			}
+			tx_frames++;
+			tx_datagrams++;
+			return true;
+		}
+
+		/* Send the waiting frames first if this one doesn't fit anymore */
+		if (txlen + FILESTORE_TRUNK_RECORD_SIZE + length > maxDatagram())
+			flushLocked();
+
+		/* First frame of a new datagram: start the latency budget */
+		if (txlen == 0) {
+			writeHeader(txbuf);
+			txlen = FILESTORE_TRUNK_HEADER_SIZE;
+			deadline = now() + settings::trunk_delay;
+			tx_ready.notify_one();
+		}
+
+		txbuf[txlen++] = (length & 0x00FF);
+		txbuf[txlen++] = (length & 0xFF00) >> 8;
+		txbuf[txlen++] = flags;
+		memcpy(&txbuf[txlen], data, length);
+		txlen += length;
+		tx_frames++;
+
+		if (settings::trunk_delay == 0)
+			flushLocked();
+
+		return true;
+	}
+
+	/* Send coalesced frames when their latency budget has been used up */
+	void transmitter(void) {
+		std::unique_lock<std::mutex> lock(tx_lock);
+		uint64_t t;
+
+		while (running == true) {
+			if (txlen == 0) {
+				tx_ready.wait(lock);
+				continue;
+			}
+
+			t = now();
+			if (t >= deadline)
+				flushLocked();
+			else
+				tx_ready.wait_for(lock, std::chrono::microseconds(deadline - t));
+		}
+		flushLocked();
+	}
+
+	/* Unpack the records of a datagram or reassembled segments and hand their frames over to the forwarding stage of the bridge */
+	void unpack(const uint8_t *data, size_t length) {
+		econet::Frame *frame;
+		size_t offset, size;
+		unsigned int framesize;
+		uint8_t flags;
+
+		offset = 0;
+		while (offset + FILESTORE_TRUNK_RECORD_SIZE <= length) {
+			size = data[offset] | (data[offset + 1] << 8);
+			flags = data[offset + 2];
+			offset += FILESTORE_TRUNK_RECORD_SIZE;
+			if ((size == 0) || (offset + size > length) || (size > sizeof(econet::Frame))) {
+				rx_invalid++;
+				break;
+			}
+
+			if ((frame = bridge::acquire(BRIDGE_TRUNK_RX)) != NULL) {
+				if (flags & TRUNK_RECORD_COMPRESSED) {
+					/* An invalid record still hands the buffer back; the forwarding stage ignores empty frames */
+					if ((framesize = decompressFrame(&data[offset], size, frame)) == 0)
+						rx_invalid++;
+				} else {
+					memcpy(frame->rawdata, &data[offset], size);
+					framesize = size;
+				}
+				bridge::submit(BRIDGE_TRUNK_RX, frame, framesize);
+				rx_frames++;
+			} else {
+				bridge::drop(BRIDGE_TRUNK_RX);
+			}
+			offset += size;
+		}
+	}
+
+	/* Ask the other end of the trunk for the segments of a record which didn't arrive */
+	void sendNack(const Reassembly *slot) {
+		uint8_t nack[FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_NACK_SIZE];
+		uint64_t missing;
+		int i;
+
+		missing = segmentMask(slot->count) & ~slot->received;
+		writeHeader(nack);
+		nack[3] |= TRUNK_FLAG_NACK;
+		nack[4] = (slot->id & 0x000000FF);
+		nack[5] = (slot->id & 0x0000FF00) >> 8;
+		nack[6] = (slot->id & 0x00FF0000) >> 16;
+		nack[7] = (slot->id & 0xFF000000) >> 24;
+		for (i = 0; i < 8; i++)
+			nack[8 + i] = (missing >> (i * 8)) & 0xFF;
+
+		if (sendto(sock, nack, sizeof(nack), 0, (struct sockaddr *) &peer, peerlen) == -1)
+			fprintf(stderr, "trunk::sendNack: sendto() failed.\n");
+		else
+			rx_nacks++;
+	}
+
+	/* Add a received segment to its record, and unpack the record once it is complete */
+	void receiveSegment(const uint8_t *datagram, size_t length) {
+		Reassembly *slot, *oldest;
+		unsigned int index, count, segsize, i;
+		size_t size, offset;
+		uint32_t id;
+		uint64_t t;
+
+		if (length < FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_SEGMENT_SIZE) {
+			rx_invalid++;
+			return;
+		}
+
+		id = datagram[4] | (datagram[5] << 8) | (datagram[6] << 16) | ((uint32_t) datagram[7] << 24);
+		index = datagram[8];
+		count = datagram[9];
+		segsize = datagram[10] | (datagram[11] << 8);
+		size = length - FILESTORE_TRUNK_HEADER_SIZE - FILESTORE_TRUNK_SEGMENT_SIZE;
+		offset = index * segsize;
+		if ((count == 0) || (count > FILESTORE_TRUNK_MAX_SEGMENTS) || (index >= count) || (size == 0) || (size > segsize) ||
+		    ((index < count - 1) && (size != segsize)) || (offset + size > sizeof(slot->data))) {
+			rx_invalid++;
+			return;
+		}
+
+		/* A segment which was sent again after the record was already complete */
+		for (i = 0; i < FILESTORE_TRUNK_REASSEMBLY; i++) {
+			if (completed[i] == id)
+				return;
+		}
+
+		/* Find the record this segment belongs to, or start a new one in a free (or the oldest) buffer */
+		t = now();
+		slot = NULL;
+		oldest = &incoming[0];
+		for (i = 0; i < FILESTORE_TRUNK_REASSEMBLY; i++) {
+			if ((incoming[i].active == true) && (incoming[i].id == id)) {
+				slot = &incoming[i];
+				break;
+			}
+			if ((oldest->active == true) && ((incoming[i].active == false) || (incoming[i].started < oldest->started)))
+				oldest = &incoming[i];
+		}
+		if (slot == NULL) {
+			slot = oldest;
+			if (slot->active == true)
+				rx_expired++;
+			slot->active = true;
+			slot->id = id;
+			slot->count = count;
+			slot->segsize = segsize;
+			slot->received = 0;
+			slot->length = 0;
+			slot->started = t;
+			slot->nacks = 0;
+		} else if ((slot->count != count) || (slot->segsize != segsize)) {
+			rx_invalid++;
+			return;
+		}
+
+		memcpy(&slot->data[offset], &datagram[FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_SEGMENT_SIZE], size);
+		slot->received |= (1ull << index);
+		slot->lastseen = t;
+		if (index == count - 1)
+			slot->length = offset + size;
+
+		if (slot->received == segmentMask(count)) {
+			slot->active = false;
+			completed[completed_next++ % FILESTORE_TRUNK_REASSEMBLY] = id;
+			rx_reassembled++;
+			unpack(slot->data, slot->length);
+		}
+	}
+
+	/* Ask for missing segments of records which stopped arriving, and drop records which take too long */
+	void checkReassembly(void) {
+		uint64_t t = now();
+		int i;
+
+		for (i = 0; i < FILESTORE_TRUNK_REASSEMBLY; i++) {
+			if (incoming[i].active == false)
+				continue;
+
+			if (t - incoming[i].started > FILESTORE_TRUNK_REASSEMBLY_TIMEOUT) {
+				incoming[i].active = false;
+				rx_expired++;
+			} else if ((t - incoming[i].lastseen >= FILESTORE_TRUNK_NACK_DELAY) && (incoming[i].nacks < FILESTORE_TRUNK_NACK_RETRIES)) {
+				sendNack(&incoming[i]);
+				incoming[i].nacks++;
+				incoming[i].lastseen = t;
+			}
+		}
+	}
+
+	/* Check if a datagram was sent by the configured other end of the trunk; only the address and port count, not the padding */
+	bool fromPeer(const struct sockaddr_storage *from, socklen_t fromlen) {
+		const struct sockaddr_in *from4 = (const struct sockaddr_in *) from, *peer4 = (const struct sockaddr_in *) &peer;
+		const struct sockaddr_in6 *from6 = (const struct sockaddr_in6 *) from, *peer6 = (const struct sockaddr_in6 *) &peer;
+
+		if ((fromlen < peerlen) || (from->ss_family != peer.ss_family))
+			return false;
+
+		if (peer.ss_family == AF_INET6)
+			return ((from6->sin6_port == peer6->sin6_port) && (memcmp(&from6->sin6_addr, &peer6->sin6_addr, sizeof(struct in6_addr)) == 0));
+		return ((from4->sin_port == peer4->sin_port) && (from4->sin_addr.s_addr == peer4->sin_addr.s_addr));
+	}
+
+	/* Receive trunk datagrams and unpack them */
+	void receiver(void) {
+		uint8_t rxbuf[65536];
+		struct sockaddr_storage from;
+		socklen_t fromlen;
+		ssize_t rx_length;
+		uint64_t missing, probed;
+		uint32_t id;
+		int i;
+
+		probed = now();
+		while (running == true) {
+			checkReassembly();
+
+			/* The kernel forgets a lowered path MTU after a while, so check now and then whether larger datagrams fit again */
+			if (now() - probed >= FILESTORE_TRUNK_PMTU_INTERVAL) {
+				updateMTU();
+				probed = now();
+			}
+
+			fromlen = sizeof(from);
+			if ((rx_length = recvfrom(sock, rxbuf, sizeof(rxbuf), 0, (struct sockaddr *) &from, &fromlen)) <= 0)
+				continue;
+
+			/* Only accept datagrams from the other end of the trunk */
+			if ((fromPeer(&from, fromlen) == false) || (rx_length < FILESTORE_TRUNK_HEADER_SIZE) ||
+			    (memcmp(rxbuf, FILESTORE_TRUNK_MAGIC, sizeof(FILESTORE_TRUNK_MAGIC)) != 0) || (rxbuf[2] != FILESTORE_TRUNK_VERSION)) {
+				rx_invalid++;
+				continue;
+			}
+			rx_datagrams++;
+			peer_compression = ((rxbuf[3] & TRUNK_FLAG_COMPRESSION) != 0);
+
+			if (rxbuf[3] & TRUNK_FLAG_SEGMENT) {
+				receiveSegment(rxbuf, rx_length);
+			} else if (rxbuf[3] & TRUNK_FLAG_NACK) {
+				if (rx_length < FILESTORE_TRUNK_HEADER_SIZE + FILESTORE_TRUNK_NACK_SIZE) {
+					rx_invalid++;
+					continue;
+				}
+				id = rxbuf[4] | (rxbuf[5] << 8) | (rxbuf[6] << 16) | ((uint32_t) rxbuf[7] << 24);
+				missing = 0;
+				for (i = 7; i >= 0; i--)
+					missing = (missing << 8) | rxbuf[8 + i];
+				resend(id, missing);
+			} else {
+				unpack(&rxbuf[FILESTORE_TRUNK_HEADER_SIZE], rx_length - FILESTORE_TRUNK_HEADER_SIZE);
+			}
+		}
+	}
+
+	/* Tell the other end of the trunk which networks can be reached through us */
+	void announce(void) {
+		econet::Frame frame;
+
+		frame.rawdata[0] = 0xFF;				// Destination: broadcast
+		frame.rawdata[1] = 0xFF;
+		frame.rawdata[2] = settings::econet_network;		// Source
+		frame.rawdata[3] = settings::econet_station;
+		frame.rawdata[4] = 0x80;				// Control: new bridge
+		frame.rawdata[5] = 0x9C;				// Port: bridge
+		frame.rawdata[6] = settings::econet_network;		// Networks reachable through us
+		frame.rawdata[7] = settings::aun_network;
+		send(&frame, 8);
+		flush();
+	}
+
+	/* Open the trunk to the bridge at address */
+	int start(const char *address) {
+		struct sockaddr_in *peer4 = (struct sockaddr_in *) &peer;
+		struct sockaddr_in6 *peer6 = (struct sockaddr_in6 *) &peer;
+		struct sockaddr_storage addr_me;
+		struct timeval timeout;
+		int reuseconn, pmtudisc;
+
+		stop();
+
+		memset(&peer, 0, sizeof(peer));
+		memset(&addr_me, 0, sizeof(addr_me));
+		if (inet_pton(AF_INET, address, &peer4->sin_addr) == 1) {
+			peer4->sin_family = AF_INET;
+			peer4->sin_port = htons(settings::trunk_port);
+			peerlen = sizeof(struct sockaddr_in);
+			((struct sockaddr_in *) &addr_me)->sin_family = AF_INET;
+			((struct sockaddr_in *) &addr_me)->sin_port = htons(settings::trunk_port);
+			((struct sockaddr_in *) &addr_me)->sin_addr.s_addr = htonl(INADDR_ANY);
+		} else if (inet_pton(AF_INET6, address, &peer6->sin6_addr) == 1) {
+			peer6->sin6_family = AF_INET6;
+			peer6->sin6_port = htons(settings::trunk_port);
+			peerlen = sizeof(struct sockaddr_in6);
+			((struct sockaddr_in6 *) &addr_me)->sin6_family = AF_INET6;
+			((struct sockaddr_in6 *) &addr_me)->sin6_port = htons(settings::trunk_port);
+			((struct sockaddr_in6 *) &addr_me)->sin6_addr = in6addr_any;
+		} else {
+			fprintf(stderr, "trunk::start: invalid IP address %s\n", address);
+			return(-2);
+		}
+
+		if ((sock = socket(peer.ss_family, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+			fprintf(stderr, "trunk::start: socket() failed.\n");
+			return(-1);
+		}
+
+		reuseconn = 1;
+		if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char *)&reuseconn, sizeof(reuseconn)) == -1) {
+			fprintf(stderr, "trunk::start: setsockopt(SO_REUSEADDR).\n");
+			close(sock);
+			return(-1);
+		}
+
+		/* Set timeout on socket to prevent recvfrom from blocking execution */
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100000;
+		if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+			fprintf(stderr, "trunk::start: Error setting timeout on socket.\n");
+			close(sock);
+			return(-1);
+		}
+
+		if (bind(sock, (struct sockaddr *) &addr_me, peerlen) == -1) {
+			fprintf(stderr, "trunk::start: Error on bind.\n");
+			close(sock);
+			return(-1);
+		}
+
+		/* With segmentation, never let IP fragment our datagrams, so the kernel keeps track of the path MTU (that needs a connected
+		 * socket); without it, a frame which doesn't fit in one datagram is left to IP fragmentation, so don't set DF then
+		 */
+		if (peer.ss_family == AF_INET6)
+			pmtudisc = (settings::trunk_segmentation == true) ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_DONT;
+		else
+			pmtudisc = (settings::trunk_segmentation == true) ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+		if (((peer.ss_family == AF_INET6) && (setsockopt(sock, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) == -1)) ||
+		    ((peer.ss_family == AF_INET) && (setsockopt(sock, IPPROTO_IP, IP_MTU_DISCOVER, &pmtudisc, sizeof(pmtudisc)) == -1)))
+			fprintf(stderr, "trunk::start: Path MTU discovery isn't available.\n");
+		if (connect(sock, (struct sockaddr *) &peer, peerlen) == -1) {
+			fprintf(stderr, "trunk::start: Error on connect.\n");
+			close(sock);
+			return(-1);
+		}
+		pmtu = FILESTORE_TRUNK_MIN_MTU;
+		updateMTU();
+
+		memset(incoming, 0, sizeof(incoming));
+		memset(completed, 0, sizeof(completed));
+		txlen = 0;
+		peer_compression = false;
+		running = true;
+		thread_rx = std::thread(receiver);
+		thread_tx = std::thread(transmitter);
+
+		printf("- Trunk to %s:%i opened\n", address, settings::trunk_port);
+		announce();
+		return(0);
+	}
+
+	/* Close the trunk */
+	void stop(void) {
+		if (running == false)
+			return;
+
+		{
+			std::lock_guard<std::mutex> lock(tx_lock);
+			running = false;
+			tx_ready.notify_one();
+		}
+		thread_tx.join();
+		thread_rx.join();
+
+		/* Workers may still be sending: only close the socket when none of them is using it */
+		std::lock_guard<std::mutex> txlock(tx_lock);
+		std::lock_guard<std::mutex> segmentslock(segments_lock);
+		close(sock);
+		sock = -1;
+	}
+
+	/* Is the trunk open? */
+	bool active(void) {
+		return running;
+	}
+
+	/* Forwarding stage of the bridge: handle one frame which was received over the trunk */
+	void handleFrame(econet::Frame *frame, int size) {
+		if (size < 6)
+			return;
+
+		/* Frames for our own station go to the local FileStore, just like frames from the Econet and AUN sides */
+		if ((econet::validateFrame(frame, size) == true) && ((frame->flags & ECONET_FRAME_TOME) ||
+		    ((frame->econet.dst_network == settings::aun_network) && (frame->econet.dst_station == settings::aun_station)))) {
+			econet::processFrame(frame, size);
+			return;
+		}
+
+		if ((frame->econet.dst_network == 0xFF) && (frame->econet.dst_station == 0xFF)) {
+			if (frame->rawdata[5] == 0x9C) {
+				/* Bridge protocol broadcast from the other bridge: update the routing table */
+				routes::update(ROUTE_TRUNK, frame->econet.src_network, frame->econet.src_station, frame->rawdata[4], &frame->rawdata[6], size - 6);
+			} else {
+				broadcasts::relay(frame, size, ROUTE_TRUNK);
+			}
+			return;
+		}
+
+		if ((frame->econet.dst_network == 0x00) || (frame->econet.dst_network == settings::econet_network))
+			econet::transmitFrame(frame, size);
+		else if (frame->econet.dst_network == settings::aun_network)
+			aun::transmitTo(frame->econet.dst_network, frame->econet.dst_station, frame, size);
+		else
+			routes::forward(frame, size, ROUTE_TRUNK);
+	}
+
+	/* Copy the trunk statistics */
+	void getStats(Stats *stats) {
+		stats->tx_frames	= tx_frames;
+		stats->tx_datagrams	= tx_datagrams;
+		stats->rx_frames	= rx_frames;
+		stats->rx_datagrams	= rx_datagrams;
+		stats->rx_invalid	= rx_invalid;
+		stats->tx_bytes		= tx_bytes;
+		stats->tx_compressed	= tx_compressed;
+		stats->tx_uncompressed	= tx_uncompressed;
+		stats->compress_time	= compress_time;
+		stats->decompress_time	= decompress_time;
+		stats->peer_compression	= peer_compression;
+		stats->tx_segmented	= tx_segmented;
+		stats->tx_segments	= tx_segments;
+		stats->tx_resent	= tx_resent;
+		stats->rx_reassembled	= rx_reassembled;
+		stats->rx_expired	= rx_expired;
+		stats->rx_nacks		= rx_nacks;
+		stats->pmtu		= pmtu;
+	}
+}
+
@@ -0,0 +1,71 @@
+/* trunk.h
+ * Bridge-to-bridge trunk which carries the frames of many stations over one UDP association
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_TRUNK_HEADER
+#define ECONET_TRUNK_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint32_t
+
+#include "econet.h"			// econet::Frame
+
+#define FILESTORE_TRUNK_MAX_DATAGRAM	1400		// Maximum size of a trunk datagram with coalesced frames
+#define FILESTORE_TRUNK_HEADER_SIZE	4		// Magic (2 bytes), version and flags
+#define FILESTORE_TRUNK_RECORD_SIZE	3		// Length of the frame (2 bytes) and record flags
+#define FILESTORE_TRUNK_SEGMENT_SIZE	8		// Frame ID (4 bytes), segment number, number of segments and segment size (2 bytes)
+#define FILESTORE_TRUNK_NACK_SIZE	12		// Frame ID (4 bytes) and bitmap of missing segments (8 bytes)
+#define FILESTORE_TRUNK_VERSION		2
+
+#define FILESTORE_TRUNK_MIN_MTU		576		// Smallest path MTU which is used to size segments
+#define FILESTORE_TRUNK_MAX_SEGMENTS	64		// Maximum number of segments of one frame
+#define FILESTORE_TRUNK_RETRANSMIT	4		// Number of recently segmented frames kept to resend lost segments
+#define FILESTORE_TRUNK_REASSEMBLY	4		// Number of frames which can be reassembled at the same time
+#define FILESTORE_TRUNK_NACK_DELAY	50000		// Number of microseconds without new segments before asking for the missing ones
+#define FILESTORE_TRUNK_NACK_RETRIES	3		// Number of times to ask for the missing segments of a frame
+#define FILESTORE_TRUNK_REASSEMBLY_TIMEOUT 1000000	// Number of microseconds after which an incomplete frame is dropped
+#define FILESTORE_TRUNK_PMTU_INTERVAL	30000000	// Number of microseconds between checks whether the path MTU went up again
+
+#define TRUNK_FLAG_COMPRESSION		0x01		// Header flag: the sender can decompress frames
+#define TRUNK_FLAG_SEGMENT		0x02		// Header flag: the datagram holds one segment of a frame
+#define TRUNK_FLAG_NACK			0x04		// Header flag: the datagram asks for missing segments
+#define TRUNK_RECORD_COMPRESSED		0x01		// Record flag: the frame is compressed with zlib
+
+const uint8_t FILESTORE_TRUNK_MAGIC[] = {'E', 'T'};
+
+namespace trunk {
+	/* Trunk statistics */
+	typedef struct {
+		uint32_t	tx_frames;		// Number of frames sent over the trunk
+		uint32_t	tx_datagrams;		// Number of datagrams the sent frames were packed into
+		uint32_t	rx_frames;		// Number of frames received over the trunk
+		uint32_t	rx_datagrams;		// Number of datagrams the received frames were packed into
+		uint32_t	rx_invalid;		// Number of received datagrams which weren't valid trunk datagrams
+		uint64_t	tx_bytes;		// Number of bytes of the compressed frames before compression
+		uint64_t	tx_compressed;		// Number of bytes of the compressed frames after compression
+		uint32_t	tx_uncompressed;	// Number of frames which were too small, or didn't compress
+		uint64_t	compress_time;		// CPU time spent compressing frames (in microseconds)
+		uint64_t	decompress_time;	// CPU time spent decompressing frames (in microseconds)
+		bool		peer_compression;	// The other end of the trunk can decompress frames
+		uint32_t	tx_segmented;		// Number of frames which were sent in segments
+		uint32_t	tx_segments;		// Number of segments sent
+		uint32_t	tx_resent;		// Number of segments sent again because the other end missed them
+		uint32_t	rx_reassembled;		// Number of frames which were reassembled from segments
+		uint32_t	rx_expired;		// Number of frames dropped because not all segments arrived in time
+		uint32_t	rx_nacks;		// Number of times the other end was asked for missing segments
+		unsigned int	pmtu;			// Path MTU to the other end of the trunk
+	} Stats;
+
+	int		start(const char *address);
+	void		stop(void);
+	bool		active(void);
+	bool		send(const econet::Frame *frame, unsigned int size);
+	void		flush(void);
+	void		handleFrame(econet::Frame *frame, int size);
+	void		getStats(Stats *stats);
+}
+
+#endif
+
@@ -11,6 +11,8 @@
 #include <openssl/kdf.h>		// EVP_PKEY_CTX_set1_pbe_pass, EVP_PKEY_CTX_set1_scrypt_salt, EVP_PKEY_CTX_set_scrypt_N, EVP_PKEY_CTX_set_scrypt_r, EVP_PKEY_CTX_set_scrypt_p
 
 #include "users.h"			// 
+#include "nativefs.h"			// nativefs::rootdirectory(), nativefs::retaindirectory(), nativefs::open(), nativefs::close()
+#include "netfs.h"			// netfs::inithandles(), netfs::newhandle(), netfs::gethandle(), netfs::freehandle(), netfs::closehandles()
 #include "settings.h"			// settings::defaultflags
 #include "stations.h"			// Included for stations::stations[][]
 #include "main.h"			// Included for main.h
@@ -23,6 +25,7 @@ namespace users {
 //	User *user;
 	User users[MAX_USERS] = {"", "", "", {false, false, false, false, false, false}, -1, 0, 0, 0, 0, 0};
 	Session sessions[MAX_SESSIONS];
+	std::mutex sessions_lock;		// Protects sessions[] and totalSessions
 	unsigned int totalUsers = 0;
 	unsigned int totalSessions = 0;
 
@@ -152,6 +155,24 @@ namespace users {
 		return(0x000000AE);
 	}
 
+	/*********************************************************************/
+	/* Log a station off, whichever user it is logged on as              */
+	/* Returns: 0		Logoff successfull                           */
+	/*	    &AE		The station wasn't logged on                 */
+	/*********************************************************************/
+	int logoff(unsigned char network, unsigned char station) {
+		int session_id;
+
+		{
+			std::lock_guard<std::mutex> lock(sessions_lock);
+			session_id = findSession(network, station);
+		}
+		if ((session_id == -1) || (users::delSession(session_id) != 0))
+			return(0x000000AE);
+
+		return(0);
+	}
+
 	/*********************************************************************/
 	/* Creates a new user                                                */
 	/* Returns: true	New user created successfull                 */
@@ -291,10 +312,12 @@ namespace users {
 	}
 
 	int getSession(unsigned int user_id, unsigned char network, unsigned char station) {
+		std::lock_guard<std::mutex> lock(sessions_lock);
 		unsigned int i;
 
-		for (i = 0; i < totalSessions; i++) {
-			if ((users::sessions[i].network == network) && (users::sessions[i].station == station) && (users::sessions[i].user_id == user_id)) {
+		/* Stations log off in any order, so the sessions in use aren't the first totalSessions ones */
+		for (i = 0; i < MAX_SESSIONS; i++) {
+			if ((users::sessions[i].login_time != 0) && (users::sessions[i].network == network) && (users::sessions[i].station == station) && (users::sessions[i].user_id == user_id)) {
 				return (i);
 			}
 		}
@@ -303,7 +326,9 @@ namespace users {
 	}
 
 	int newSession(unsigned int user_id, unsigned char network, unsigned char station) {
+		std::lock_guard<std::mutex> lock(sessions_lock);
 		unsigned int i;
+		int root;
 
 		/* Scan for the first free session_id which is available */
 		for (i = 0; i < MAX_SESSIONS; i++) {
@@ -312,19 +337,41 @@ namespace users {
 				users::sessions[i].station = station;
 				users::sessions[i].user_id = user_id;
 				users::sessions[i].login_time = time(NULL);
+
+				/* The URD, CSD and library all start at the root, so paths are resolved relative to an open directory; every handle holds its own reference */
+				netfs::inithandles(&users::sessions[i].handles);
+				if ((root = nativefs::rootdirectory()) == -1) {
+					users::sessions[i].network = 0;
+					users::sessions[i].station = 0;
+					users::sessions[i].user_id = 0;
+					users::sessions[i].login_time = 0;
+					return (-1);
+				}
+				nativefs::retaindirectory(root);
+				nativefs::retaindirectory(root);
+				users::sessions[i].urd = netfs::newhandle(&users::sessions[i].handles, FILESTORE_HANDLE_DIRECTORY, root);
+				users::sessions[i].csd = netfs::newhandle(&users::sessions[i].handles, FILESTORE_HANDLE_DIRECTORY, root);
+				users::sessions[i].lib = netfs::newhandle(&users::sessions[i].handles, FILESTORE_HANDLE_DIRECTORY, root);
 				totalSessions++;
 				return (i);
 			}
 		}
 
-		return (1);
+		return (-1);
 	}
 	int delSession(unsigned int session_id) {
+		std::lock_guard<std::mutex> lock(sessions_lock);
+
 		if (users::sessions[session_id].login_time != 0) {
 			users::sessions[session_id].network = 0;
 			users::sessions[session_id].station = 0;
 			users::sessions[session_id].user_id = 0;
 			users::sessions[session_id].login_time = 0;
+			/* Close everything the station left open */
+			netfs::closehandles(&users::sessions[session_id].handles);
+			users::sessions[session_id].urd = 0;
+			users::sessions[session_id].csd = 0;
+			users::sessions[session_id].lib = 0;
 			totalSessions--;
 			return (0);
 		}
@@ -332,6 +379,100 @@ namespace users {
 		return (1);
 	}
 
+	/* Get a directory handle of the URD, CSD or library of a station; returns the root if the station isn't logged on, and the caller must close the handle */
+	int getDirectory(unsigned char network, unsigned char station, uint8_t which) {
+		unsigned int i;
+		int directory;
+
+		{
+			std::lock_guard<std::mutex> lock(sessions_lock);
+			for (i = 0; i < MAX_SESSIONS; i++) {
+				if ((users::sessions[i].login_time != 0) && (users::sessions[i].network == network) && (users::sessions[i].station == station)) {
+					if (which == SESSION_URD)
+						directory = netfs::gethandle(&users::sessions[i].handles, users::sessions[i].urd, FILESTORE_HANDLE_DIRECTORY);
+					else if (which == SESSION_LIB)
+						directory = netfs::gethandle(&users::sessions[i].handles, users::sessions[i].lib, FILESTORE_HANDLE_DIRECTORY);
+					else
+						directory = netfs::gethandle(&users::sessions[i].handles, users::sessions[i].csd, FILESTORE_HANDLE_DIRECTORY);
+					if (directory != -1) {
+						nativefs::retaindirectory(directory);
+						return (directory);
+					}
+				}
+			}
+		}
+
+		return (nativefs::rootdirectory());
+	}
+
+	/* Find the session of a station; the caller must hold sessions_lock */
+	int findSession(unsigned char network, unsigned char station) {
+		unsigned int i;
+
+		for (i = 0; i < MAX_SESSIONS; i++) {
+			if ((users::sessions[i].login_time != 0) && (users::sessions[i].network == network) && (users::sessions[i].station == station))
+				return (i);
+		}
+
+		return (-1);
+	}
+
+	/* Open a file for a station and give it a handle from the station's own table; returns 0 or an error number */
+	int openFile(unsigned char network, unsigned char station, const char *localpath, const char *mode, uint8_t *handle) {
+		FILESTORE_HANDLE file;
+		int i;
+
+		if ((file = nativefs::open(localpath, mode)) == FILESTORE_EOF)
+			return (0x000000D6);							// Not found
+
+		{
+			std::lock_guard<std::mutex> lock(sessions_lock);
+			if ((i = findSession(network, station)) != -1) {
+				if ((*handle = netfs::newhandle(&users::sessions[i].handles, FILESTORE_HANDLE_FILE, file)) != 0)
+					return (0);
+			}
+		}
+
+		nativefs::close(file);
+		return ((i == -1) ? 0x000000BF : 0x000000C0);					// Who are you? or Too many files open
+	}
+
+	/* Close a file of a station, or all its files if handle is 0; returns 0 or an error number */
+	int closeFile(unsigned char network, unsigned char station, uint8_t handle) {
+		std::lock_guard<std::mutex> lock(sessions_lock);
+		FILESTORE_HANDLE file;
+		int i, h;
+
+		if ((i = findSession(network, station)) == -1)
+			return (0x000000BF);							// Who are you?
+
+		if (handle == 0) {
+			for (h = 1; h < FILESTORE_STATION_HANDLES; h++) {
+				if ((file = netfs::gethandle(&users::sessions[i].handles, h, FILESTORE_HANDLE_FILE)) != -1) {
+					netfs::freehandle(&users::sessions[i].handles, h);
+					nativefs::close(file);
+				}
+			}
+			return (0);
+		}
+
+		if ((file = netfs::gethandle(&users::sessions[i].handles, handle, FILESTORE_HANDLE_FILE)) == -1)
+			return (0x000000DE);							// Channel
+		netfs::freehandle(&users::sessions[i].handles, handle);
+		nativefs::close(file);
+		return (0);
+	}
+
+	/* Get the nativefs file handle behind a file handle of a station; returns FILESTORE_EOF if it isn't one of its open files */
+	FILESTORE_HANDLE getFile(unsigned char network, unsigned char station, uint8_t handle) {
+		std::lock_guard<std::mutex> lock(sessions_lock);
+		int i;
+
+		if ((i = findSession(network, station)) == -1)
+			return (FILESTORE_EOF);
+		return (netfs::gethandle(&users::sessions[i].handles, handle, FILESTORE_HANDLE_FILE));
+	}
+
 	int getUserFlags(unsigned int user_id, char *flags) {
 		int i;
 
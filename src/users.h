@@ -15,10 +15,16 @@
 #define MAX_PASSWORD_LENGTH 256
 #define FILESTORE_USERS_HASH_LENGTH (SHA512_DIGEST_LENGTH * 2) + 1
 #define FILESTORE_USERS_SALT_LENGTH (SHA512_DIGEST_LENGTH + 1)
+#define SESSION_URD	0		// Directories of a session, for getDirectory()
+#define SESSION_CSD	1
+#define SESSION_LIB	2
 
 #include <ctime>			// time_t
+#include <mutex>			// std::mutex
 #include <openssl/sha.h>		// Included for SHA256_DIGEST_LENGTH
 
+#include "netfs.h"			// StationHandles, FILESTORE_HANDLE
+
 
 typedef struct {
 	char		username[MAX_USERNAME];
@@ -45,11 +51,16 @@ typedef struct {
 	uint8_t		station;
 	uint32_t	user_id;
 	time_t		login_time;
+	StationHandles	handles;			// Handles of the station's open files and directories
+	uint8_t		urd;				// Handle of the User Root Directory
+	uint8_t		csd;				// Handle of the Currently Selected Directory
+	uint8_t		lib;				// Handle of the Currently Selected Library
 } Session;
 
 namespace users {
 	extern User	users[MAX_USERS];
 	extern Session	sessions[MAX_SESSIONS];
+	extern std::mutex	sessions_lock;
 	extern uint32_t	totalUsers;
 	extern uint32_t	totalSessions;
 
@@ -57,12 +68,18 @@ namespace users {
 	int loadUsers(void);
 	int login(unsigned int user_id, const char *pwhash, unsigned char network, unsigned char station);
 	int logout(unsigned int user_id, unsigned char network, unsigned char station);
+	int logoff(unsigned char network, unsigned char station);
 	int newUser(const char *username, const char *password);
 	int changePassword(unsigned int user_id, const char *curpw, const char *newpw);
 	int getUserID(const char *username);
 	int getSession(unsigned int user_id, unsigned char network, unsigned char station);
 	int newSession(unsigned int user_id, unsigned char network, unsigned char station);
 	int delSession(unsigned int session_id);
+	int getDirectory(unsigned char network, unsigned char station, uint8_t which);
+	int findSession(unsigned char network, unsigned char station);
+	int openFile(unsigned char network, unsigned char station, const char *localpath, const char *mode, uint8_t *handle);
+	int closeFile(unsigned char network, unsigned char station, uint8_t handle);
+	FILESTORE_HANDLE getFile(unsigned char network, unsigned char station, uint8_t handle);
 	int getUserFlags(unsigned int user_id, char *flags);
 	int getBootOption(uint8_t bootoption, char *bootstr);
 }
@@ -0,0 +1,152 @@
+/* wildcard.cpp
+ * Matching of Acorn names against masks with # and * wildcards
+ *
+ * In an Acorn mask, # matches any one character and * matches any number of
+ * characters (including none), regardless of case. A mask is compiled once
+ * per request, and then matched against every entry of a directory:
+ * - an empty mask, or one with only *'s, matches everything without looking
+ *   at the names
+ * - a mask without wildcards is compared in one pass over the name
+ * - otherwise the mask is split at its *'s into parts, which can only
+ *   contain #'s. The first part has to match at the start of the name and
+ *   the last one at the end; every part in between is matched at the first
+ *   place it fits after the previous one. Taking the first place is always
+ *   right, as the * after it can absorb anything, so matching never has to
+ *   backtrack.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstring>		// strlen()
+
+#include "wildcard.h"		// Header file for this code
+
+using namespace std;
+
+
+
+namespace wildcard {
+	/* Upper case of a character; only ASCII letters have one on an Acorn */
+	inline uint8_t fold(uint8_t c) {
+		return ((c >= 'a') && (c <= 'z')) ? c - ('a' - 'A') : c;
+	}
+
+	/* Check if a part of the mask matches a name at a position */
+	inline bool matchAt(const Matcher *matcher, int segment, const char *name) {
+		const char *part;
+		int i;
+
+		part = &matcher->pattern[matcher->start[segment]];
+		for (i = 0; i < matcher->seglength[segment]; i++) {
+			if ((part[i] != '#') && (part[i] != (char) fold(name[i])))
+				return false;
+		}
+		return true;
+	}
+
+	/* Compile a mask; returns false if it's too long or too complicated */
+	bool compile(const char *mask, Matcher *matcher) {
+		int length;
+		bool star;
+
+		matcher->kind = WILDCARD_LITERAL;
+		matcher->length = 0;
+		matcher->minlength = 0;
+		matcher->anchorstart = true;
+		matcher->anchorend = true;
+		matcher->segments = 0;
+
+		length = 0;
+		star = false;
+		for (; (*mask != '\0') && (*mask != '\r'); mask++) {
+			if (*mask == '*') {
+				if (length == 0)
+					matcher->anchorstart = false;
+				matcher->kind = WILDCARD_PATTERN;
+				star = true;
+				continue;
+			}
+			if (length == FILESTORE_WILDCARD_LEN - 1)
+				return false;
+
+			/* A new part starts after every (run of) *'s */
+			if ((star == true) || (matcher->segments == 0)) {
+				if (matcher->segments == FILESTORE_WILDCARD_SEGMENTS)
+					return false;
+				matcher->start[matcher->segments] = length;
+				matcher->seglength[matcher->segments] = 0;
+				matcher->segments++;
+				star = false;
+			}
+			if (*mask == '#')
+				matcher->kind = WILDCARD_PATTERN;
+			matcher->pattern[length++] = fold(*mask);
+			matcher->seglength[matcher->segments - 1]++;
+		}
+		matcher->pattern[length] = '\0';
+		matcher->length = length;
+		matcher->minlength = length;
+		matcher->anchorend = (star == false);
+
+		if (length == 0)
+			matcher->kind = WILDCARD_ALL;
+		return true;
+	}
+
+	/* Check if a name matches a compiled mask */
+	bool match(const Matcher *matcher, const char *name) {
+		uint8_t difference;
+		int length, pos, last, segment, i;
+
+		if (matcher->kind == WILDCARD_ALL)
+			return true;
+
+		length = strlen(name);
+		if (length < matcher->minlength)
+			return false;
+
+		/* No wildcards: the whole name is compared without stopping at the first difference, which the compiler can vectorise */
+		if (matcher->kind == WILDCARD_LITERAL) {
+			if (length != matcher->length)
+				return false;
+			difference = 0;
+			for (i = 0; i < length; i++)
+				difference |= fold(name[i]) ^ (uint8_t) matcher->pattern[i];
+			return (difference == 0);
+		}
+
+		/* Only #'s: the name has exactly the length of the mask */
+		if ((matcher->anchorstart == true) && (matcher->anchorend == true) && (matcher->segments == 1))
+			return ((length == matcher->length) && (matchAt(matcher, 0, name) == true));
+
+		pos = 0;
+		segment = 0;
+		last = matcher->segments;
+		if (matcher->anchorstart == true) {
+			if (matchAt(matcher, 0, name) == false)
+				return false;
+			pos = matcher->seglength[0];
+			segment = 1;
+		}
+		if (matcher->anchorend == true)
+			last--;
+
+		/* Every part between two *'s goes at the first place it fits */
+		for (; segment < last; segment++) {
+			while ((pos + matcher->seglength[segment] <= length) && (matchAt(matcher, segment, &name[pos]) == false))
+				pos++;
+			if (pos + matcher->seglength[segment] > length)
+				return false;
+			pos += matcher->seglength[segment];
+		}
+
+		/* The last part has to fit at the end, after all other parts */
+		if (matcher->anchorend == true) {
+			if (length - matcher->seglength[last] < pos)
+				return false;
+			return matchAt(matcher, last, &name[length - matcher->seglength[last]]);
+		}
+		return true;
+	}
+}
+
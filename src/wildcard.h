@@ -0,0 +1,38 @@
+/* wildcard.h
+ * Matching of Acorn names against masks with # and * wildcards
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_WILDCARD_HEADER
+#define ECONET_WILDCARD_HEADER
+
+#include <cstdint>			// uint8_t
+
+#define FILESTORE_WILDCARD_LEN		64		// Maximum length of a mask, including the terminating NUL
+#define FILESTORE_WILDCARD_SEGMENTS	16		// Maximum number of parts between the *'s of a mask
+
+#define WILDCARD_ALL			0		// The mask matches every name
+#define WILDCARD_LITERAL		1		// The mask has no wildcards
+#define WILDCARD_PATTERN		2		// The mask has # and/or * wildcards
+
+namespace wildcard {
+	/* A mask, compiled once for matching many names */
+	typedef struct {
+		uint8_t		kind;					// WILDCARD_ALL, WILDCARD_LITERAL or WILDCARD_PATTERN
+		char		pattern[FILESTORE_WILDCARD_LEN];	// The mask in upper case, without the *'s
+		uint8_t		length;					// Length of pattern
+		uint8_t		minlength;				// Length of the shortest name which can match
+		bool		anchorstart;				// The mask doesn't start with a *
+		bool		anchorend;				// The mask doesn't end with a *
+		uint8_t		segments;				// Number of parts between the *'s
+		uint8_t		start[FILESTORE_WILDCARD_SEGMENTS];	// Start of every part in pattern
+		uint8_t		seglength[FILESTORE_WILDCARD_SEGMENTS];	// Length of every part
+	} Matcher;
+
+	bool		compile(const char *mask, Matcher *matcher);
+	bool		match(const Matcher *matcher, const char *name);
+}
+
+#endif
+
@@ -0,0 +1,266 @@
+/* workers.cpp
+ * Worker threads which process received frames, sharded by station
+ *
+ * Concurrency model:
+ * - The listener threads only receive datagrams. Every received frame is
+ *   handed to exactly one worker, chosen by shard(), and all frames from
+ *   one station always end up at the same worker. Everything which is
+ *   only about one station (its sequence numbers, its file transfers etc.)
+ *   is therefore only ever touched by the worker which owns that station.
+ * - State which is shared between stations (econet::sessions, users::sessions
+ *   with the handle tables of the stations, and nativefs::filehandles) is
+ *   protected by its own (striped) mutex in the module which owns it.
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#include <cstdio>		// fprintf()
+#include <atomic>		// std::atomic
+#include <condition_variable>	// std::condition_variable
+#include <mutex>		// std::mutex, std::unique_lock
+#include <thread>		// std::thread
+#include <netinet/in.h>		// struct sockaddr_in, struct sockaddr_in6
+
+#include "workers.h"		// Header file for this code
+#include "aun.h"		// aun::rxHandler(), aun::prepareAckPackage(), AUN_ACK
+#include "cli.h"		// netmonPrintFrame()
+#include "econet.h"		// econet::Frame, econet::netmon
+#include "links.h"		// links::received(), links::sent()
+#include "retransmit.h"		// retransmit::add(), retransmit::acked()
+#include "routes.h"		// routes::update()
+#include "scheduler.h"		// scheduler::*
+
+using namespace std;
+
+
+
+namespace workers {
+	typedef struct {
+		std::mutex			lock;		// Protects the queue
+		std::condition_variable		ready;		// Signalled when a job is added to the queue
+		scheduler::Queue		queue;		// Jobs waiting to be processed, queued per station
+	} Worker;
+
+	unsigned int		totalWorkers = 0;
+	Worker			worker[FILESTORE_MAX_WORKERS];
+	std::thread		threads[FILESTORE_MAX_WORKERS];
+	std::atomic<bool>	stopping(false);
+	std::atomic<uint32_t>	droppedFrames(0);
+	std::mutex		replies_lock;	// Protects Reply::done
+	std::condition_variable	replied;	// Signalled when a worker has finished a call()
+	thread_local econet::Station	current;
+
+	/* Process one received frame and send the ACK and reply back to the sender */
+	void process(Job *job, econet::Frame *tx_data, econet::Frame *ack) {
+		int tx_length;
+		bool sendAck;
+
+		/* Bridge protocol messages from AUN stations feed the routing table */
+		if ((job->length >= 8) && (job->frame->aun.port == 0x9C) && ((job->network != 0) || (job->station != 0)))
+			routes::update(ROUTE_AUN, job->network, job->station, job->frame->aun.control, job->frame->aun.data, job->length - 8);
+
+		/* Keep track of the link quality, and let the protocol handlers know which station they're serving */
+		links::received(job->network, job->station, job->frame, job->length);
+		if ((job->length >= 8) && (job->frame->aun.type == AUN_ACK))
+			retransmit::acked(job->network, job->station, job->frame->aun.sequence);
+		current.network = job->network;
+		current.station = job->station;
+
+		/* The caller of call() sends the ACK and reply itself, and keeps the frame */
+		if (job->reply != NULL) {
+			job->reply->tx_length = aun::rxHandler(job->frame, job->length, job->reply->tx_data, sizeof(econet::Frame), &job->reply->sendAck);
+			{
+				std::lock_guard<std::mutex> lock(replies_lock);
+				job->reply->done = true;
+			}
+			replied.notify_all();
+			job->frame = NULL;
+			return;
+		}
+
+		tx_length = aun::rxHandler(job->frame, job->length, tx_data, sizeof(econet::Frame), &sendAck);
+		if (sendAck) {
+			if ((aun::prepareAckPackage(job->frame, job->length, ack, sizeof(econet::Frame))) > 0) {
+				if (sendto(job->sock, (char *) ack, 8, 0, (struct sockaddr *) &job->addr, job->addrlen) == -1) {
+					fprintf(stderr, "workers::process: sendto() ACK failed.\n");
+				}
+			} else {
+				fprintf(stderr, "workers::process: prepareAckPackage() failed.\n");
+			}
+		}
+		if (tx_length > 0) {
+			if (econet::netmon == true) {
+				netmonPrintFrame("eth", true, tx_data, tx_length);
+			}
+			if (sendto(job->sock, (char *) tx_data, tx_length, 0, (struct sockaddr *) &job->addr, job->addrlen) == -1) {
+				fprintf(stderr, "workers::process: sendto() data failed.\n");
+			} else {
+				links::sent(job->network, job->station, tx_data->aun.sequence);
+				retransmit::add(job, tx_data, tx_length);
+			}
+		}
+
+		delete job->frame;
+		job->frame = NULL;
+	}
+
+	/* Main loop of a worker thread */
+	void run(unsigned int id) {
+		Worker *w = &worker[id];
+		econet::Frame *tx_data = new econet::Frame;
+		econet::Frame *ack = new econet::Frame;
+		Job job;
+
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(w->lock);
+
+				while ((w->queue.count == 0) && (stopping == false))
+					w->ready.wait(lock);
+
+				/* Only stop when all queued frames have been processed */
+				if (scheduler::dequeue(&w->queue, &job) == false)
+					break;
+			}
+			process(&job, tx_data, ack);
+		}
+
+		delete tx_data;
+		delete ack;
+	}
+
+	/* Start the worker threads */
+	int start(unsigned int numworkers) {
+		unsigned int i;
+
+		if (numworkers < 1)
+			numworkers = 1;
+		if (numworkers > FILESTORE_MAX_WORKERS)
+			numworkers = FILESTORE_MAX_WORKERS;
+
+		stopping = false;
+		for (i = 0; i < numworkers; i++) {
+			scheduler::init(&worker[i].queue);
+			threads[i] = std::thread(run, i);
+		}
+		totalWorkers = numworkers;
+
+		printf("- Started %u worker threads\n", totalWorkers);
+		return 0;
+	}
+
+	/* Stop all worker threads after they've finished their queued frames */
+	void stop(void) {
+		unsigned int i;
+
+		stopping = true;
+		for (i = 0; i < totalWorkers; i++) {
+			std::lock_guard<std::mutex> lock(worker[i].lock);
+			worker[i].ready.notify_one();
+		}
+		for (i = 0; i < totalWorkers; i++)
+			threads[i].join();
+		totalWorkers = 0;
+	}
+
+	/* FNV-1a hash of the source address (and port) of a frame */
+	uint32_t addressHash(const Job *job) {
+		const uint8_t *p, *port;
+		size_t i, len;
+		uint32_t hash;
+
+		port = NULL;
+		switch (job->addr.ss_family) {
+			case AF_INET :
+				p = (const uint8_t *) &((const struct sockaddr_in *) &job->addr)->sin_port;
+				len = sizeof(in_port_t) + sizeof(struct in_addr);
+				break;
+
+			case AF_INET6 :
+				/* sin6_flowinfo sits between the port and the address, so hash the port separately */
+				p = (const uint8_t *) &((const struct sockaddr_in6 *) &job->addr)->sin6_addr;
+				len = sizeof(struct in6_addr);
+				port = (const uint8_t *) &((const struct sockaddr_in6 *) &job->addr)->sin6_port;
+				break;
+
+			default :
+				return 0;
+		}
+
+		hash = 2166136261u;
+		if (port != NULL) {
+			for (i = 0; i < sizeof(in_port_t); i++) {
+				hash ^= port[i];
+				hash *= 16777619u;
+			}
+		}
+		for (i = 0; i < len; i++) {
+			hash ^= p[i];
+			hash *= 16777619u;
+		}
+
+		return hash;
+	}
+
+	/* Select the worker which owns the station that sent this frame */
+	unsigned int shard(const Job *job) {
+		if (totalWorkers == 0)
+			return 0;
+
+		/* Known station: shard by network and station number */
+		if ((job->network != 0) || (job->station != 0))
+			return ((job->network << 8) | job->station) % totalWorkers;
+
+		/* Unknown station: shard by the source address and port */
+		return addressHash(job) % totalWorkers;
+	}
+
+	/* Hand a received frame over to the worker which owns the sending station */
+	bool dispatch(const Job *job) {
+		Worker *w;
+
+		if (totalWorkers == 0) {
+			droppedFrames++;
+			return false;
+		}
+
+		w = &worker[shard(job)];
+		{
+			std::lock_guard<std::mutex> lock(w->lock);
+
+			/* A station which already has too much outstanding work is refused, the others are still served */
+			if (scheduler::enqueue(&w->queue, job) != SCHEDULER_QUEUED) {
+				droppedFrames++;
+				return false;
+			}
+		}
+		w->ready.notify_one();
+
+		return true;
+	}
+
+	/* Let the worker which owns the sending station process a frame, and wait for its reply.
+	 * This is for listeners which have to send the reply themselves, like the DTLS listeners.
+	 */
+	bool call(Job *job, Reply *reply) {
+		reply->tx_length = 0;
+		reply->sendAck = false;
+		reply->done = false;
+		job->reply = reply;
+
+		if (dispatch(job) == false)
+			return false;
+
+		std::unique_lock<std::mutex> lock(replies_lock);
+		while (reply->done == false)
+			replied.wait(lock);
+
+		return true;
+	}
+
+	/* Number of frames which were dropped because a worker queue or a station's share of it was full */
+	uint32_t dropped(void) {
+		return droppedFrames;
+	}
+}
+
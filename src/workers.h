@@ -0,0 +1,53 @@
+/* workers.h
+ * Worker threads which process received frames, sharded by station
+ *
+ * (c) Eelco Huininga 2017-2019
+ */
+
+#ifndef ECONET_WORKERS_HEADER
+#define ECONET_WORKERS_HEADER
+
+#include <cstddef>			// size_t
+#include <cstdint>			// uint8_t, uint32_t
+#include <sys/socket.h>			// struct sockaddr_storage, socklen_t
+
+#include "econet.h"			// econet::Frame
+
+#define FILESTORE_MAX_WORKERS		16		// Maximum number of worker threads
+#define FILESTORE_WORKER_QUEUE_SIZE	256		// Maximum number of frames waiting in each worker's queue
+
+/* Result of a frame which was handed over with workers::call() */
+typedef struct {
+	econet::Frame		*tx_data;	// Buffer for the reply
+	int			tx_length;	// Size of the reply, or 0 if there's no reply
+	bool			sendAck;	// True if the received frame has to be acknowledged
+	bool			done;		// Set by the worker when it has processed the frame
+} Reply;
+
+/* A received frame which is waiting to be processed by a worker */
+typedef struct {
+	econet::Frame		*frame;		// Received frame; the worker owns (and frees) it after a successful dispatch()
+	size_t			length;		// Size of the received frame
+	int			sock;		// Socket on which the frame was received; ACKs and replies are sent on this socket
+	struct sockaddr_storage	addr;		// Address of the sending station
+	socklen_t		addrlen;	// Size of addr
+	uint8_t			network;	// Econet network number of the sending station, or 0 if unknown
+	uint8_t			station;	// Econet station number of the sending station, or 0 if unknown
+	Reply			*reply;		// Where to store the reply for call(), or NULL if the worker sends it on sock
+} Job;
+
+namespace workers {
+	extern unsigned int	totalWorkers;
+	extern thread_local econet::Station	current;	// Station whose frame this worker thread is processing
+
+	int		start(unsigned int numworkers);
+	void		stop(void);
+	uint32_t	addressHash(const Job *job);
+	unsigned int	shard(const Job *job);
+	bool		dispatch(const Job *job);
+	bool		call(Job *job, Reply *reply);
+	uint32_t	dropped(void);
+}
+
+#endif
+